@@ -0,0 +1,225 @@
+#include "trafficmask.h"
+#include "signature_engine.h"
+#include "payload_mix.h"
+#include <iostream>
+#include <iomanip>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <algorithm>
+
+using namespace TrafficMask;
+using namespace TrafficMask::Bench;
+
+// Проверка отсутствия обращений к аллокатору на горячем пути.
+// Глобальные operator new/delete подменяются счетчиком; после прогрева
+// смесь пакетов демонстрации прогоняется через ProcessPacket и ProcessBatch,
+// и любое выделение памяти в установившемся режиме считается ошибкой.
+
+namespace {
+
+std::atomic<size_t> g_allocations{0};
+std::atomic<bool> g_counting{false};
+
+// Освобождение вынесено из operator delete, чтобы компилятор не сопоставлял
+// free с operator new при встраивании
+#if defined(_MSC_VER)
+__declspec(noinline)
+#else
+__attribute__((noinline))
+#endif
+void ReleaseMemory(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+} // namespace
+
+void* operator new(std::size_t size) {
+    if (g_counting.load(std::memory_order_relaxed)) {
+        g_allocations.fetch_add(1, std::memory_order_relaxed);
+    }
+    
+    void* ptr = std::malloc(size ? size : 1);
+    if (!ptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void* operator new[](std::size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* ptr) noexcept {
+    ReleaseMemory(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+    ReleaseMemory(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+    ReleaseMemory(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t) noexcept {
+    ReleaseMemory(ptr);
+}
+
+namespace {
+
+constexpr size_t kConnections = 16;
+constexpr size_t kWarmupRounds = 8;
+constexpr size_t kMeasuredRounds = 32;
+constexpr size_t kBatchSize = 32;
+
+// Процессор без regex, который переписывает payload на месте через
+// PacketBuffer::Replace: проверяет, что пул буферов пакетов не выделяет память
+class InPlaceReplaceMasker : public BaseSignatureProcessor {
+public:
+    InPlaceReplaceMasker() : BaseSignatureProcessor("in_place_replace_masker") {
+        AddKeyword("Host:");
+    }
+    
+    bool ProcessPacket(Packet& packet) override {
+        if (!IsActive() || !CheckSignature(packet)) {
+            return false;
+        }
+        
+        size_t pos = PacketView(packet.data).Find("Host: ");
+        if (pos == PacketView::npos) {
+            return false;
+        }
+        
+        packet.data.Replace(pos, 6, "Host: www.");
+        return true;
+    }
+};
+
+struct Scenario {
+    const char* name;
+    std::function<std::shared_ptr<ISignatureProcessor>()> make;  // пусто - только ядро
+};
+
+std::vector<Packet> BuildPackets(TrafficMaskEngine& engine, const std::vector<ByteArray>& mix) {
+    std::vector<Packet> packets;
+    packets.reserve(kConnections * mix.size());
+    
+    for (size_t conn = 0; conn < kConnections; ++conn) {
+        FlowId flow_id = engine.InternConnection("alloc_conn_" + std::to_string(conn));
+        for (const auto& payload : mix) {
+            packets.emplace_back(payload, 0, flow_id, true);
+        }
+    }
+    
+    return packets;
+}
+
+void RunRound(TrafficMaskEngine& engine, std::vector<Packet>& packets,
+              const std::vector<Packet>& templates, size_t round, bool batched) {
+    // Восстановление payload из шаблона - только счетчик ссылок буфера
+    for (size_t i = 0; i < packets.size(); ++i) {
+        packets[i].data = templates[i].data;
+        packets[i].timestamp = round;
+    }
+    
+    if (batched) {
+        for (size_t offset = 0; offset < packets.size(); offset += kBatchSize) {
+            size_t count = std::min(kBatchSize, packets.size() - offset);
+            engine.ProcessBatch(packets.data() + offset, count);
+        }
+    } else {
+        for (auto& packet : packets) {
+            engine.ProcessPacket(packet);
+        }
+    }
+}
+
+// Возвращает число выделений памяти в установившемся режиме
+size_t Measure(const std::string& config_path, const Scenario& scenario, bool batched) {
+    TrafficMaskEngine engine;
+    if (!engine.Initialize(config_path)) {
+        std::cerr << "Failed to initialize engine" << std::endl;
+        std::exit(1);
+    }
+    
+    if (scenario.make) {
+        engine.RegisterSignatureProcessor(scenario.make());
+    }
+    
+    std::vector<Packet> templates = BuildPackets(engine, BuildPayloadMix());
+    std::vector<Packet> packets = templates;
+    
+    size_t round = 0;
+    for (; round < kWarmupRounds; ++round) {
+        RunRound(engine, packets, templates, round, batched);
+    }
+    
+    g_allocations.store(0, std::memory_order_relaxed);
+    g_counting.store(true, std::memory_order_relaxed);
+    for (; round < kWarmupRounds + kMeasuredRounds; ++round) {
+        RunRound(engine, packets, templates, round, batched);
+    }
+    g_counting.store(false, std::memory_order_relaxed);
+    
+    size_t allocations = g_allocations.load(std::memory_order_relaxed);
+    engine.Shutdown();
+    return allocations;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    std::string config_path = argc > 1 ? argv[1] : "configs/config.yaml";
+    
+    const std::vector<Scenario> scenarios = {
+        {"core (no processors)", nullptr},
+        {"in_place_replace_masker", [] { return std::make_shared<InPlaceReplaceMasker>(); }},
+        {"tls_fingerprint_masker", [] { return std::make_shared<TlsFingerprintMasker>(); }},
+        {"http_header_masker", [] { return std::make_shared<HttpHeaderMasker>(); }},
+        {"dns_query_masker", [] { return std::make_shared<DnsQueryMasker>(); }},
+        {"sni_masker", [] { return std::make_shared<SniMasker>(); }},
+        {"ip_sidr_masker", [] { return std::make_shared<IpSidrMasker>(); }},
+        {"vk_tunnel_masker", [] { return std::make_shared<VkTunnelMasker>(); }},
+        {"encrypted_traffic_masker", [] { return std::make_shared<EncryptedTrafficMasker>(); }},
+        {"whitelist_based_masker", [] { return std::make_shared<WhitelistBasedMasker>(); }},
+        {"vless_masker", [] { return std::make_shared<VlessMasker>(); }}
+    };
+    
+    struct Result {
+        const Scenario* scenario;
+        const char* mode;
+        size_t allocations;
+    };
+    std::vector<Result> results;
+    
+    for (const auto& scenario : scenarios) {
+        results.push_back({&scenario, "single", Measure(config_path, scenario, false)});
+        results.push_back({&scenario, "batch", Measure(config_path, scenario, true)});
+    }
+    
+    size_t packets = kConnections * BuildPayloadMix().size() * kMeasuredRounds;
+    bool failed = false;
+    
+    std::cout << "\n=== Hot path allocations (" << packets << " packets per run) ===" << std::endl;
+    std::cout << std::left << std::setw(28) << "processor" << std::setw(8) << "mode"
+              << std::right << std::setw(12) << "allocs" << std::setw(12) << "per packet"
+              << "  status" << std::endl;
+    
+    for (const auto& result : results) {
+        const char* status = "ok";
+        if (result.allocations != 0) {
+            status = "FAIL";
+            failed = true;
+        }
+        
+        std::cout << std::left << std::setw(28) << result.scenario->name << std::setw(8) << result.mode
+                  << std::right << std::setw(12) << result.allocations
+                  << std::setw(12) << std::fixed << std::setprecision(2)
+                  << static_cast<double>(result.allocations) / packets
+                  << "  " << status << std::endl;
+    }
+    
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,131 @@
+#include "trafficmask.h"
+#include "signature_engine.h"
+#include "payload_mix.h"
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <string>
+#include <algorithm>
+
+using namespace TrafficMask;
+using namespace TrafficMask::Bench;
+
+// Бенчмарк пакетного API: смесь пакетов демонстрации (main.cpp)
+// прогоняется через ProcessPacket по одному пакету и через ProcessBatch
+// пачками разного размера - без процессоров (только путь движка: шард,
+// поток, классификация, вердикт) и с набором процессоров демонстрации.
+// Конфигурации чередуются по раундам, и для каждой берется лучший раунд:
+// так дрейф частоты и соседние процессы меньше искажают сравнение.
+
+namespace {
+
+constexpr size_t kConnections = 64;
+constexpr size_t kRounds = 200;
+const std::vector<size_t> kBatchSizes = {0, 8, 32, 128};  // 0 - по одному пакету
+
+// Пакеты идут в том же порядке, что и в демонстрации:
+// для каждого соединения - вся смесь типов
+std::vector<Packet> BuildPackets(TrafficMaskEngine& engine, const std::vector<ByteArray>& mix) {
+    std::vector<Packet> packets;
+    packets.reserve(kConnections * mix.size());
+    
+    for (size_t conn = 0; conn < kConnections; ++conn) {
+        FlowId flow_id = engine.InternConnection("conn_" + std::to_string(conn));
+        for (const auto& payload : mix) {
+            packets.emplace_back(payload, 0, flow_id, true);
+        }
+    }
+    
+    return packets;
+}
+
+// Маскировщики изменяют payload, поэтому перед каждым раундом он
+// восстанавливается из шаблона (вне замера)
+void ResetPackets(std::vector<Packet>& packets, const std::vector<Packet>& templates, size_t timestamp) {
+    for (size_t i = 0; i < packets.size(); ++i) {
+        packets[i].data = templates[i].data;
+        packets[i].timestamp = timestamp;
+    }
+}
+
+// Время одного прохода всех пакетов в секундах
+double RunRound(TrafficMaskEngine& engine, std::vector<Packet>& packets, size_t batch_size) {
+    auto start = std::chrono::steady_clock::now();
+    if (batch_size == 0) {
+        for (auto& packet : packets) {
+            engine.ProcessPacket(packet);
+        }
+    } else {
+        for (size_t offset = 0; offset < packets.size(); offset += batch_size) {
+            size_t count = std::min(batch_size, packets.size() - offset);
+            engine.ProcessBatch(packets.data() + offset, count);
+        }
+    }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Лучшая пропускная способность каждой конфигурации kBatchSizes, пакетов в секунду
+std::vector<double> Measure(TrafficMaskEngine& engine, const std::vector<Packet>& templates) {
+    std::vector<Packet> packets = templates;
+    std::vector<double> best(kBatchSizes.size(), 0.0);
+    
+    for (size_t round = 0; round < kRounds; ++round) {
+        for (size_t c = 0; c < kBatchSizes.size(); ++c) {
+            ResetPackets(packets, templates, round);
+            double seconds = RunRound(engine, packets, kBatchSizes[c]);
+            best[c] = std::max(best[c], static_cast<double>(packets.size()) / seconds);
+        }
+    }
+    
+    return best;
+}
+
+void PrintScenario(const std::string& name, TrafficMaskEngine& engine) {
+    std::vector<Packet> templates = BuildPackets(engine, BuildPayloadMix());
+    std::vector<double> pps = Measure(engine, templates);
+    
+    std::cout << "\n=== Batch API: " << name << " (" << templates.size()
+              << " packets per round, best of " << kRounds << " rounds) ===" << std::endl;
+    std::cout << std::setw(10) << "batch" << std::setw(14) << "Mpps"
+              << std::setw(10) << "speedup" << std::endl;
+    for (size_t c = 0; c < kBatchSizes.size(); ++c) {
+        std::cout << std::setw(10) << (kBatchSizes[c] == 0 ? std::string("single") : std::to_string(kBatchSizes[c]))
+                  << std::setw(14) << std::fixed << std::setprecision(3) << pps[c] / 1e6
+                  << std::setw(9) << std::setprecision(2) << pps[c] / pps[0] << "x" << std::endl;
+    }
+    
+    // Соединения живут все раунды, поэтому после окна детекта часть
+    // пакетов обходит процессоры по вердикту потока
+    std::cout << "Masked: " << engine.GetMaskedPackets()
+              << ", bypassed: " << engine.GetBypassedPackets()
+              << " of " << engine.GetProcessedPackets() << " packets" << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    std::string config_path = argc > 1 ? argv[1] : "configs/config.yaml";
+    
+    TrafficMaskEngine bare_engine;
+    TrafficMaskEngine engine;
+    if (!bare_engine.Initialize(config_path) || !engine.Initialize(config_path)) {
+        std::cerr << "Failed to initialize engine" << std::endl;
+        return 1;
+    }
+    
+    // Тот же набор процессоров, что и в демонстрации
+    engine.RegisterSignatureProcessor(std::make_shared<HttpHeaderMasker>());
+    engine.RegisterSignatureProcessor(std::make_shared<TlsFingerprintMasker>());
+    engine.RegisterSignatureProcessor(std::make_shared<DnsQueryMasker>());
+    engine.RegisterSignatureProcessor(std::make_shared<SniMasker>());
+    engine.RegisterSignatureProcessor(std::make_shared<IpSidrMasker>());
+    engine.RegisterSignatureProcessor(std::make_shared<EncryptedTrafficMasker>());
+    engine.RegisterSignatureProcessor(std::make_shared<VlessMasker>());
+    
+    PrintScenario("engine path, no processors", bare_engine);
+    PrintScenario("demo processors", engine);
+    
+    bare_engine.Shutdown();
+    engine.Shutdown();
+    return 0;
+}
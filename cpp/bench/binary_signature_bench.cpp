@@ -0,0 +1,104 @@
+#include "trafficmask.h"
+#include "regex_set.h"
+#include "binary_signature.h"
+#include "payload_mix.h"
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <string>
+#include <vector>
+
+using namespace TrafficMask;
+using namespace TrafficMask::Bench;
+
+// Микробенчмарк бинарных сигнатур заголовков: прежние шаблоны regex
+// маскировщиков (поиск по всему payload одним проходом RegexSet) против
+// BinarySignatureSet с проверкой по смещениям. Совпадения не обязаны
+// совпадать: regex находил байты в любом месте, сигнатура - только
+// в заголовке, поэтому печатается число совпадений обоих.
+
+namespace {
+
+constexpr size_t kMtuPayloads = 16;
+constexpr double kTargetSeconds = 0.5;
+
+struct SignatureCase {
+    const char* name;
+    std::vector<std::string> regexes;     // прежние шаблоны процессора
+    std::vector<std::string> signatures;  // их замена
+};
+
+const std::vector<SignatureCase> kCases = {
+    {"tls_hello", {"\\x16\\x03\\x01.*\\x00\\x00.*\\x03\\x03"}, {"16 03 00-03 +2 01 +3 03 00-03"}},
+    {"tls_data", {"\\x17\\x03\\x03", "\\x17\\x03\\x01", "\\x17\\x03\\x02", "\\x17\\x03\\x04"}, {"17 03 01-04 +2"}},
+    {"dns", {"\\x00\\x01.*\\x00\\x01"}, {"+2 00&F8 ?? 00 01-04 00 00 +4 01-3F"}},
+    {"ipv4", {"\\x45.*\\x00.*\\x00.*\\x00.*\\x00.*\\x00.*\\x00.*\\x00"}, {"45-4F ?? total16 +16"}},
+    {"ipv4_udp", {"\\x45\\x00"}, {"45 ?? total16 +5 11 +18"}},
+    {"vless", {"\\x00\\x00\\x00\\x00", "\\x01\\x00\\x00\\x00"}, {"00 01-03 +18"}},
+};
+
+// Время одного прохода по payloads в наносекундах на пакет; hits - число совпадений
+template<typename Check>
+double Measure(const std::vector<ByteArray>& payloads, Check check, size_t& hits) {
+    size_t rounds = 0;
+    hits = 0;
+    std::chrono::duration<double> elapsed(0);
+    auto start = std::chrono::steady_clock::now();
+    while (elapsed.count() < kTargetSeconds) {
+        for (const auto& payload : payloads) {
+            hits += check(*Opaque(&payload)) ? 1 : 0;
+        }
+        ++rounds;
+        elapsed = std::chrono::steady_clock::now() - start;
+    }
+    hits /= rounds;
+    return elapsed.count() * 1e9 / static_cast<double>(rounds * payloads.size());
+}
+
+void Compare(const SignatureCase& test, const char* data_name, const std::vector<ByteArray>& payloads) {
+    RegexSet regex_set;
+    for (const auto& pattern : test.regexes) {
+        regex_set.Add(pattern, true);
+    }
+    regex_set.Build();
+    
+    BinarySignatureSet signatures;
+    for (const auto& signature : test.signatures) {
+        signatures.Add(signature);
+    }
+    
+    size_t regex_hits = 0;
+    size_t binary_hits = 0;
+    double regex_ns = Measure(payloads, [&](const ByteArray& payload) {
+        return regex_set.Search(payload.data(), payload.size()) != RegexSet::kNoMatch;
+    }, regex_hits);
+    double binary_ns = Measure(payloads, [&](const ByteArray& payload) {
+        return signatures.Matches(payload.data(), payload.size());
+    }, binary_hits);
+    
+    std::cout << std::setw(12) << test.name << std::setw(12) << data_name
+              << std::setw(12) << std::fixed << std::setprecision(1) << regex_ns
+              << std::setw(12) << binary_ns
+              << std::setw(10) << std::setprecision(1) << regex_ns / binary_ns << "x"
+              << std::setw(8) << regex_hits << "/" << payloads.size()
+              << std::setw(8) << binary_hits << "/" << payloads.size() << std::endl;
+}
+
+} // namespace
+
+int main() {
+    std::vector<ByteArray> demo = BuildPayloadMix();
+    std::vector<ByteArray> mtu = BuildMtuPayloads(kMtuPayloads);
+    
+    std::cout << "\n=== Header signatures: RegexSet vs BinarySignatureSet (ns per packet) ===" << std::endl;
+    std::cout << std::setw(12) << "signature" << std::setw(12) << "payloads"
+              << std::setw(12) << "RegexSet" << std::setw(12) << "binary"
+              << std::setw(11) << "speedup" << std::setw(11) << "regex hits" << std::setw(11) << "bin hits" << std::endl;
+    
+    for (const auto& test : kCases) {
+        Compare(test, "demo", demo);
+        Compare(test, "mtu 1500", mtu);
+    }
+    
+    return 0;
+}
@@ -0,0 +1,91 @@
+#include "checksum.h"
+#include "payload_mix.h"
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+using namespace TrafficMask;
+using namespace TrafficMask::Bench;
+
+// Микробенчмарк суммы Интернета по payload: скалярный цикл по 16-битным
+// словам против векторных ядер SSE2 и AVX2 (64 байта за итерацию) на
+// размерах минимального кадра, MTU Ethernet и максимального сегмента.
+// Свернутые суммы всех ядер должны совпадать.
+
+namespace {
+
+constexpr double kTargetSeconds = 0.5;
+
+// Время одной суммы в наносекундах; folded - свернутая сумма
+template<typename Kernel>
+double Measure(const std::vector<uint8_t>& data, Kernel kernel, uint16_t& folded) {
+    size_t rounds = 0;
+    uint64_t sink = 0;
+    std::chrono::duration<double> elapsed(0);
+    auto start = std::chrono::steady_clock::now();
+    while (elapsed.count() < kTargetSeconds) {
+        for (int i = 0; i < 256; ++i) {
+            const std::vector<uint8_t>& input = *Opaque(&data);
+            sink += kernel(input.data(), input.size());
+        }
+        rounds += 256;
+        elapsed = std::chrono::steady_clock::now() - start;
+    }
+    folded = InternetChecksum::Fold(kernel(data.data(), data.size()));
+    if (sink == 0) {
+        std::cout << "";
+    }
+    return elapsed.count() * 1e9 / static_cast<double>(rounds);
+}
+
+void Compare(size_t size) {
+    std::vector<uint8_t> data(size);
+    uint32_t state = 0x9E3779B9u;
+    for (uint8_t& byte : data) {
+        state = state * 1664525u + 1013904223u;
+        byte = static_cast<uint8_t>(state >> 24);
+    }
+    
+    uint16_t scalar_sum = 0;
+    double scalar_ns = Measure(data, InternetChecksum::SumScalar, scalar_sum);
+    std::cout << std::setw(8) << size << std::setw(12) << std::fixed << std::setprecision(1) << scalar_ns;
+
+#if defined(TRAFFICMASK_BYTE_SEARCH_X86)
+    uint16_t sse2_sum = 0;
+    double sse2_ns = Measure(data, InternetChecksum::SumSse2, sse2_sum);
+    std::cout << std::setw(12) << sse2_ns;
+    
+    double best_ns = sse2_ns;
+    bool equal = sse2_sum == scalar_sum;
+    if (ByteSearch::HasAvx2()) {
+        uint16_t avx2_sum = 0;
+        double avx2_ns = Measure(data, InternetChecksum::SumAvx2, avx2_sum);
+        std::cout << std::setw(12) << avx2_ns;
+        best_ns = avx2_ns;
+        equal = equal && avx2_sum == scalar_sum;
+    } else {
+        std::cout << std::setw(12) << "-";
+    }
+    std::cout << std::setw(9) << std::setprecision(2) << scalar_ns / best_ns << "x"
+              << std::setw(10) << std::setprecision(1) << static_cast<double>(size) / best_ns
+              << std::setw(8) << (equal ? "ok" : "MISMATCH");
+#endif
+    std::cout << std::endl;
+}
+
+} // namespace
+
+int main() {
+    std::cout << "\n=== Internet checksum: scalar vs SSE2 vs AVX2 (ns per sum) ===" << std::endl;
+    std::cout << std::setw(8) << "bytes" << std::setw(12) << "scalar" << std::setw(12) << "sse2"
+              << std::setw(12) << "avx2" << std::setw(10) << "speedup" << std::setw(10) << "GB/s"
+              << std::setw(8) << "sum" << std::endl;
+    
+    for (size_t size : {size_t(64), size_t(1500), size_t(65536)}) {
+        Compare(size);
+    }
+    
+    return 0;
+}
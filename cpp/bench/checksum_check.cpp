@@ -0,0 +1,227 @@
+#include "trafficmask.h"
+#include "signature_engine.h"
+#include "reality_masker.h"
+#include "enhanced_vk_tunnel.h"
+#include "payload_mix.h"
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <string>
+#include <functional>
+#include <algorithm>
+#include <iterator>
+
+using namespace TrafficMask;
+using namespace TrafficMask::Bench;
+
+// Проверка checksum TCP после маскировки. Каждый payload смеси
+// демонстрации кладется в пакет IPv4/TCP с верным checksum; после
+// процессора checksum обновляется так, как это делает владелец заголовка:
+// Packet::payload_checksum применяется к старому значению, длина сегмента
+// в псевдозаголовке заменяется новой. Результат сравнивается с checksum,
+// пересчитанным по новому пакету целиком. К смеси добавлен ClientHello
+// с именем сервера для SniMasker. Процессоры проверяются вне
+// движка (ProcessPacket процессора), через ProcessPacket и ProcessBatch
+// движка; любое расхождение - ошибка (код возврата != 0).
+// IpSidrMasker не проверяется: его буфер - пакет IPv4 целиком, и checksum
+// в нем самом обновляет RewriteIpv4Bytes.
+
+namespace {
+
+constexpr size_t kIpHeaderSize = 20;
+constexpr size_t kTcpHeaderSize = 20;
+constexpr size_t kTcpChecksumOffset = kIpHeaderSize + 16;
+constexpr size_t kConnections = 4;
+
+// Пакет IPv4/TCP с payload и checksum TCP, посчитанным целиком
+PacketBuffer BuildIpv4Segment(const PacketBuffer& payload) {
+    ByteArray packet(kIpHeaderSize + kTcpHeaderSize, 0);
+    packet[0] = 0x45;
+    InternetChecksum::WriteU16(packet.data(), 2, static_cast<uint16_t>(packet.size() + payload.size()));
+    packet[8] = 64;
+    packet[9] = 6;
+    const uint8_t addresses[] = {192, 168, 1, 100, 93, 184, 216, 34};
+    std::copy(std::begin(addresses), std::end(addresses), packet.begin() + 12);
+    InternetChecksum::WriteU16(packet.data(), kIpHeaderSize, 49152);
+    InternetChecksum::WriteU16(packet.data(), kIpHeaderSize + 2, 443);
+    packet[kIpHeaderSize + 12] = 0x50;
+    packet[kIpHeaderSize + 13] = 0x18;
+    packet.insert(packet.end(), payload.data(), payload.data() + payload.size());
+    
+    PacketBuffer segment(packet);
+    RecomputeIpv4L4Checksum(segment);
+    return segment;
+}
+
+// TLS ClientHello с именем сервера host и расширением после server_name:
+// в смеси демонстрации нет ClientHello, который разбирает SniMasker
+ByteArray BuildClientHello(const std::string& host) {
+    ByteArray server_name = {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+    InternetChecksum::WriteU16(server_name.data(), 2, static_cast<uint16_t>(host.size() + 5));
+    InternetChecksum::WriteU16(server_name.data(), 4, static_cast<uint16_t>(host.size() + 3));
+    InternetChecksum::WriteU16(server_name.data(), 7, static_cast<uint16_t>(host.size()));
+    server_name.insert(server_name.end(), host.begin(), host.end());
+    const uint8_t alpn[] = {0x00, 0x10, 0x00, 0x05, 0x00, 0x03, 0x02, 0x68, 0x32};
+    
+    ByteArray hello = {0x03, 0x03};
+    for (uint8_t i = 0; i < 32; ++i) {
+        hello.push_back(static_cast<uint8_t>(0x40 + i * 5));
+    }
+    const uint8_t suites[] = {0x00, 0x00, 0x02, 0x13, 0x01, 0x01, 0x00};
+    hello.insert(hello.end(), std::begin(suites), std::end(suites));
+    size_t extensions = server_name.size() + sizeof(alpn);
+    hello.push_back(static_cast<uint8_t>(extensions >> 8));
+    hello.push_back(static_cast<uint8_t>(extensions));
+    hello.insert(hello.end(), server_name.begin(), server_name.end());
+    hello.insert(hello.end(), std::begin(alpn), std::end(alpn));
+    
+    ByteArray record = {0x16, 0x03, 0x01, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00};
+    InternetChecksum::WriteU16(record.data(), 3, static_cast<uint16_t>(hello.size() + 4));
+    InternetChecksum::WriteU16(record.data(), 7, static_cast<uint16_t>(hello.size()));
+    record.insert(record.end(), hello.begin(), hello.end());
+    return record;
+}
+
+uint16_t TcpChecksum(const PacketBuffer& segment) {
+    return InternetChecksum::ReadU16(segment.data(), kTcpChecksumOffset);
+}
+
+struct Counts {
+    size_t rewritten = 0;  // payload изменился
+    size_t resized = 0;    // изменилась длина payload
+    size_t mismatches = 0;
+};
+
+// Сравнивает checksum, обновленный по payload_checksum и длине, с пересчетом
+void Verify(const PacketBuffer& original, const Packet& packet, Counts& counts) {
+    bool same = original.size() == packet.data.size() &&
+                std::equal(original.data(), original.data() + original.size(), packet.data.data());
+    if (same && packet.payload_checksum.Empty()) {
+        return;
+    }
+    ++counts.rewritten;
+    
+    ChecksumDelta delta = packet.payload_checksum;
+    if (original.size() != packet.data.size()) {
+        ++counts.resized;
+        delta.ReplaceSum(static_cast<uint16_t>(kTcpHeaderSize + original.size()),
+                         static_cast<uint16_t>(kTcpHeaderSize + packet.data.size()));
+    }
+    uint16_t updated = delta.Apply(TcpChecksum(BuildIpv4Segment(original)));
+    uint16_t recomputed = TcpChecksum(BuildIpv4Segment(packet.data));
+    if (updated != recomputed) {
+        ++counts.mismatches;
+    }
+}
+
+struct Scenario {
+    const char* name;
+    std::function<std::shared_ptr<ISignatureProcessor>()> make;
+};
+
+enum class Mode {
+    DIRECT,
+    SINGLE,
+    BATCH
+};
+
+Counts Run(const std::string& config_path, const Scenario& scenario, Mode mode) {
+    std::vector<ByteArray> mix = BuildPayloadMix();
+    mix.push_back(BuildClientHello("www.example.org"));
+    std::shared_ptr<ISignatureProcessor> processor = scenario.make();
+    Counts counts;
+    
+    if (mode == Mode::DIRECT) {
+        for (size_t conn = 0; conn < kConnections; ++conn) {
+            for (const auto& payload : mix) {
+                Packet packet(payload, 0, ConnectionId("checksum_conn_" + std::to_string(conn)), true);
+                PacketBuffer original = packet.data;
+                processor->ProcessPacket(packet);
+                Verify(original, packet, counts);
+            }
+        }
+        return counts;
+    }
+    
+    TrafficMaskEngine engine;
+    if (!engine.Initialize(config_path)) {
+        std::cerr << "Failed to initialize engine" << std::endl;
+        std::exit(1);
+    }
+    engine.RegisterSignatureProcessor(processor);
+    
+    // Каждый payload - в своем соединении: вердикт потока после окна
+    // детекта не уводит поздние пакеты смеси в обход процессоров
+    std::vector<Packet> packets;
+    for (size_t conn = 0; conn < kConnections; ++conn) {
+        for (size_t i = 0; i < mix.size(); ++i) {
+            FlowId flow_id = engine.InternConnection("checksum_conn_" + std::to_string(conn) + "_" + std::to_string(i));
+            packets.emplace_back(mix[i], 0, flow_id, true);
+        }
+    }
+    std::vector<PacketBuffer> originals;
+    for (const auto& packet : packets) {
+        originals.push_back(packet.data);
+    }
+    
+    if (mode == Mode::BATCH) {
+        engine.ProcessBatch(packets);
+    } else {
+        for (auto& packet : packets) {
+            engine.ProcessPacket(packet);
+        }
+    }
+    for (size_t i = 0; i < packets.size(); ++i) {
+        Verify(originals[i], packets[i], counts);
+    }
+    
+    engine.Shutdown();
+    return counts;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    std::string config_path = argc > 1 ? argv[1] : "configs/config.yaml";
+    
+    const std::vector<Scenario> scenarios = {
+        {"tls_fingerprint_masker", [] { return std::make_shared<TlsFingerprintMasker>(); }},
+        {"http_header_masker", [] { return std::make_shared<HttpHeaderMasker>(); }},
+        {"dns_query_masker", [] { return std::make_shared<DnsQueryMasker>(); }},
+        {"sni_masker", [] { return std::make_shared<SniMasker>(); }},
+        {"vk_tunnel_masker", [] { return std::make_shared<VkTunnelMasker>(); }},
+        {"encrypted_traffic_masker", [] { return std::make_shared<EncryptedTrafficMasker>(); }},
+        {"whitelist_based_masker", [] { return std::make_shared<WhitelistBasedMasker>(); }},
+        {"vless_masker", [] { return std::make_shared<VlessMasker>(); }},
+        {"reality_masker", [] { return std::make_shared<RealityMasker>(); }},
+        {"xtls_masker", [] { return std::make_shared<XtlsMasker>(); }},
+        {"enhanced_vk_tunnel_masker", [] { return std::make_shared<EnhancedVkTunnelMasker>(); }}
+    };
+    
+    const std::pair<Mode, const char*> modes[] = {
+        {Mode::DIRECT, "direct"},
+        {Mode::SINGLE, "single"},
+        {Mode::BATCH, "batch"}
+    };
+    
+    bool failed = false;
+    
+    std::cout << "\n=== TCP checksum: delta update vs recompute ===" << std::endl;
+    std::cout << std::left << std::setw(28) << "processor" << std::setw(8) << "mode"
+              << std::right << std::setw(11) << "rewritten" << std::setw(9) << "resized"
+              << std::setw(12) << "mismatches" << "  status" << std::endl;
+    
+    for (const auto& scenario : scenarios) {
+        for (const auto& [mode, mode_name] : modes) {
+            Counts counts = Run(config_path, scenario, mode);
+            const char* status = counts.mismatches == 0 ? "ok" : "FAIL";
+            failed = failed || counts.mismatches != 0;
+            
+            std::cout << std::left << std::setw(28) << scenario.name << std::setw(8) << mode_name
+                      << std::right << std::setw(11) << counts.rewritten << std::setw(9) << counts.resized
+                      << std::setw(12) << counts.mismatches << "  " << status << std::endl;
+        }
+    }
+    
+    return failed ? 1 : 0;
+}
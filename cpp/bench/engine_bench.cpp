@@ -0,0 +1,120 @@
+#include "trafficmask.h"
+#include <iostream>
+#include <iomanip>
+#include <thread>
+#include <chrono>
+#include <string>
+
+using namespace TrafficMask;
+
+// Бенчмарк масштабирования TrafficMaskEngine по числу потоков.
+// Каждый поток гонит пакеты своих соединений через общий движок;
+// при шардировании пропускная способность должна расти с числом потоков.
+
+namespace {
+
+constexpr size_t kFlowsPerThread = 64;
+constexpr size_t kPacketsPerThread = 200000;
+constexpr size_t kPayloadSize = 512;
+
+// Синтетический процессор: полный проход по payload и XOR-маскировка начала,
+// по стоимости сопоставим с keyword-сканом реальных маскировщиков
+class SyntheticMasker : public ISignatureProcessor {
+public:
+    bool ProcessPacket(Packet& packet) override {
+        uint32_t acc = 0;
+        for (uint8_t byte : packet.data) {
+            acc = acc * 31 + byte;
+        }
+        
+        for (size_t i = 0; i < packet.data.size() && i < 50; i += 4) {
+            packet.data[i] ^= 0xAA;
+        }
+        
+        return (acc & 1) != 0;
+    }
+    
+    SignatureId GetSignatureId() const override { return "synthetic_masker"; }
+    bool IsActive() const override { return true; }
+};
+
+std::vector<Packet> BuildThreadPackets(TrafficMaskEngine& engine, size_t thread_index) {
+    std::vector<Packet> packets;
+    packets.reserve(kFlowsPerThread);
+    
+    for (size_t flow = 0; flow < kFlowsPerThread; ++flow) {
+        ByteArray payload(kPayloadSize);
+        for (size_t i = 0; i < payload.size(); ++i) {
+            payload[i] = static_cast<uint8_t>(i * 7 + flow);
+        }
+        
+        // Соединение интернируется один раз, пакеты несут только FlowId
+        FlowId flow_id = engine.InternConnection("bench_t" + std::to_string(thread_index) +
+                                                 "_f" + std::to_string(flow));
+        packets.emplace_back(payload, 0, flow_id, (flow & 1) != 0);
+    }
+    
+    return packets;
+}
+
+double RunWithThreads(TrafficMaskEngine& engine, size_t thread_count) {
+    std::vector<std::vector<Packet>> thread_packets;
+    for (size_t t = 0; t < thread_count; ++t) {
+        thread_packets.push_back(BuildThreadPackets(engine, t));
+    }
+    
+    auto start = std::chrono::steady_clock::now();
+    
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < thread_count; ++t) {
+        threads.emplace_back([&engine, &packets = thread_packets[t]]() {
+            for (size_t i = 0; i < kPacketsPerThread; ++i) {
+                engine.ProcessPacket(packets[i % packets.size()]);
+            }
+        });
+    }
+    
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return static_cast<double>(thread_count * kPacketsPerThread) / elapsed.count();
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    std::string config_path = argc > 1 ? argv[1] : "configs/config.yaml";
+    size_t max_threads = argc > 2 ? std::stoul(argv[2]) : std::thread::hardware_concurrency();
+    if (max_threads == 0) {
+        max_threads = 4;
+    }
+    
+    TrafficMaskEngine engine;
+    if (!engine.Initialize(config_path)) {
+        std::cerr << "Failed to initialize engine" << std::endl;
+        return 1;
+    }
+    engine.RegisterSignatureProcessor(std::make_shared<SyntheticMasker>());
+    
+    std::cout << "\n=== Engine scaling benchmark (" << engine.GetShardCount()
+              << " shards, " << kPayloadSize << " B payload) ===" << std::endl;
+    std::cout << std::setw(8) << "threads" << std::setw(14) << "Mpps"
+              << std::setw(10) << "speedup" << std::endl;
+    
+    double baseline = 0.0;
+    for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+        double pps = RunWithThreads(engine, threads);
+        if (threads == 1) {
+            baseline = pps;
+        }
+        
+        std::cout << std::setw(8) << threads
+                  << std::setw(14) << std::fixed << std::setprecision(3) << pps / 1e6
+                  << std::setw(9) << std::setprecision(2) << pps / baseline << "x" << std::endl;
+    }
+    
+    engine.Shutdown();
+    return 0;
+}
@@ -0,0 +1,121 @@
+#include "trafficmask.h"
+#include "keyword_matcher.h"
+#include "payload_mix.h"
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <set>
+#include <string>
+#include <string_view>
+
+using namespace TrafficMask;
+using namespace TrafficMask::Bench;
+
+// Микробенчмарк поиска ключевых слов: прежний цикл string_view::find по
+// std::set против одного прохода KeywordMatcher (набор процессора из
+// четырех слов он проверяет через NeedleSet, объединение - автоматом).
+// Наборы слов - как у маскировщиков (одного процессора и объединение
+// всех), данные - пакеты демонстрации (main.cpp) и payload'ы размером с
+// MTU без совпадений, где цикл find просматривает пакет целиком для
+// каждого слова.
+
+namespace {
+
+constexpr size_t kMtuPayloads = 64;
+constexpr size_t kTargetBytes = size_t(256) * 1024 * 1024;
+
+// Ключевые слова TlsFingerprintMasker
+const std::vector<std::string> kProcessorKeywords = {"TLS", "SSL", "cipher", "handshake"};
+
+// Ключевые слова всех маскировщиков из cpp/signature
+const std::vector<std::string> kAllKeywords = {
+    "IP", "SNI", "SSL", "TCP", "TLS", "UDP", "address", "apimail", "apivk", "apiyandex",
+    "cipher", "direct", "dns", "encrypted", "handshake", "http", "packet", "proxy", "query",
+    "reality", "rprx", "server_name", "socks", "stream", "vision", "vk-cdn", "vk-tunnel",
+    "vk_apps", "vkontakte", "vless", "websocket", "ws://", "wss://", "xtls"
+};
+
+bool FindLoop(const std::set<std::string>& keywords, const ByteArray& payload) {
+    std::string_view content(reinterpret_cast<const char*>(payload.data()), payload.size());
+    for (const auto& keyword : keywords) {
+        if (content.find(keyword) != std::string_view::npos) {
+            return true;
+        }
+    }
+    return false;
+}
+
+template<typename Search>
+double Measure(const std::vector<ByteArray>& payloads, Search search, size_t& hits) {
+    size_t bytes_per_round = 0;
+    for (const auto& payload : payloads) {
+        bytes_per_round += payload.size();
+    }
+    size_t rounds = kTargetBytes / bytes_per_round + 1;
+    
+    hits = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t round = 0; round < rounds; ++round) {
+        for (const auto& payload : payloads) {
+            hits += search(*Opaque(&payload)) ? 1 : 0;
+        }
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    hits /= rounds;
+    
+    return elapsed.count() * 1e9 / static_cast<double>(rounds * payloads.size());
+}
+
+// Возвращает false, если результаты поиска разошлись
+bool Compare(const char* name, const std::vector<std::string>& words, const std::vector<ByteArray>& payloads) {
+    std::set<std::string> keywords(words.begin(), words.end());
+    KeywordMatcher matcher;
+    for (const auto& word : words) {
+        matcher.Add(word);
+    }
+    matcher.Build();
+    
+    size_t find_hits = 0;
+    size_t matcher_hits = 0;
+    double find_ns = Measure(payloads, [&](const ByteArray& payload) {
+        return FindLoop(keywords, payload);
+    }, find_hits);
+    double matcher_ns = Measure(payloads, [&](const ByteArray& payload) {
+        return matcher.Contains(payload.data(), payload.size());
+    }, matcher_hits);
+    
+    std::cout << std::setw(22) << name << std::setw(6) << words.size()
+              << std::setw(12) << std::fixed << std::setprecision(1) << find_ns
+              << std::setw(12) << matcher_ns
+              << std::setw(9) << std::setprecision(2) << find_ns / matcher_ns << "x"
+              << std::setw(8) << matcher_hits << "/" << payloads.size() << std::endl;
+    
+    bool same = find_hits == matcher_hits;
+    for (const auto& payload : payloads) {
+        same = same && FindLoop(keywords, payload) == matcher.Contains(payload.data(), payload.size());
+    }
+    if (!same) {
+        std::cerr << "Mismatch between find loop and KeywordMatcher: " << name << std::endl;
+    }
+    return same;
+}
+
+} // namespace
+
+int main() {
+    std::vector<ByteArray> demo = BuildPayloadMix();
+    std::vector<ByteArray> mtu = BuildMtuPayloads(kMtuPayloads);
+    
+    std::cout << "\n=== Keyword search: find loop vs KeywordMatcher (ns per packet) ===" << std::endl;
+    std::cout << std::setw(22) << "payloads" << std::setw(6) << "words"
+              << std::setw(12) << "find" << std::setw(12) << "matcher"
+              << std::setw(10) << "speedup" << std::setw(10) << "hits" << std::endl;
+    
+    bool ok = true;
+    ok = Compare("demo, processor", kProcessorKeywords, demo) && ok;
+    ok = Compare("demo, all", kAllKeywords, demo) && ok;
+    ok = Compare("mtu 1500, processor", kProcessorKeywords, mtu) && ok;
+    ok = Compare("mtu 1500, all", kAllKeywords, mtu) && ok;
+    
+    return ok ? 0 : 1;
+}
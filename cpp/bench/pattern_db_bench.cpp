@@ -0,0 +1,291 @@
+#include "trafficmask.h"
+#include "signature_engine.h"
+#include "reality_masker.h"
+#include "payload_mix.h"
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace TrafficMask;
+using namespace TrafficMask::Bench;
+
+// Микробенчмарк общей базы шаблонов: каждый процессор проверяет payload
+// своим CheckSignature (проход на процессор) против одного сканирования
+// PatternDatabase и проверки битового результата всеми процессорами.
+// Процессоры - маскировщики из signature_engine.h и reality_masker.h,
+// у которых пересекаются ключевые слова и шаблоны. Второй замер - поток
+// соединения, разрезанный на сегменты: отдельное сканирование сегментов
+// (теряет шаблоны на стыках), пересканирование накопленного буфера
+// соединения (квадратично) и потоковое сканирование с PatternStream.
+
+namespace {
+
+constexpr size_t kMtuPayloads = 16;
+constexpr double kTargetSeconds = 0.5;
+constexpr size_t kStreamBytes = 64 * 1024;
+
+// Открывает защищенный CheckSignature для сравнения
+template<typename Masker>
+class Exposed : public Masker {
+public:
+    using Masker::CheckSignature;
+};
+
+struct Processor {
+    std::string name;
+    PatternSet patterns;
+    std::function<bool(const PacketBuffer&)> check;         // собственный проход по payload
+    std::function<bool(const Packet&)> check_shared;         // по результату общей базы в контексте
+};
+
+template<typename Masker>
+Processor MakeProcessor() {
+    auto masker = std::make_shared<Exposed<Masker>>();
+    return {masker->GetSignatureId(), masker->GetPatterns(),
+            [masker](const PacketBuffer& data) { return masker->CheckSignature(data); },
+            [masker](const Packet& packet) { return masker->CheckSignature(packet); }};
+}
+
+std::vector<Processor> BuildProcessors() {
+    std::vector<Processor> processors;
+    processors.push_back(MakeProcessor<HttpHeaderMasker>());
+    processors.push_back(MakeProcessor<TlsFingerprintMasker>());
+    processors.push_back(MakeProcessor<DnsQueryMasker>());
+    processors.push_back(MakeProcessor<SniMasker>());
+    processors.push_back(MakeProcessor<IpSidrMasker>());
+    processors.push_back(MakeProcessor<VkTunnelMasker>());
+    processors.push_back(MakeProcessor<EncryptedTrafficMasker>());
+    processors.push_back(MakeProcessor<WhitelistBasedMasker>());
+    processors.push_back(MakeProcessor<VlessMasker>());
+    processors.push_back(MakeProcessor<RealityMasker>());
+    processors.push_back(MakeProcessor<XtlsMasker>());
+    return processors;
+}
+
+// Время одного прохода по payloads в наносекундах на пакет;
+// hits - число срабатываний процессоров за проход
+template<typename Payload, typename Check>
+double Measure(const std::vector<Payload>& payloads, Check check, size_t& hits) {
+    size_t rounds = 0;
+    hits = 0;
+    std::chrono::duration<double> elapsed(0);
+    auto start = std::chrono::steady_clock::now();
+    while (elapsed.count() < kTargetSeconds) {
+        for (const auto& payload : payloads) {
+            hits += check(*Opaque(&payload));
+        }
+        ++rounds;
+        elapsed = std::chrono::steady_clock::now() - start;
+    }
+    hits /= rounds;
+    return elapsed.count() * 1e9 / static_cast<double>(rounds * payloads.size());
+}
+
+// Возвращает false, если результаты разошлись
+bool Compare(const char* name, const std::vector<Processor>& processors,
+             const PatternDatabase& database, const std::vector<ByteArray>& input) {
+    std::vector<PacketBuffer> payloads(input.begin(), input.end());
+    std::vector<uint64_t> words(database.GetWordCount());
+    
+    // Пакеты с контекстом, как их видят процессоры в движке: бинарные
+    // сигнатуры проверяются по заголовку, остальное - по битам общей базы
+    PacketContext context;
+    std::vector<Packet> packets;
+    for (const auto& payload : payloads) {
+        packets.emplace_back(payload, 0, FlowId(1), false);
+        packets.back().context = &context;
+    }
+    
+    size_t own_hits = 0;
+    size_t shared_hits = 0;
+    double own_ns = Measure(payloads, [&](const PacketBuffer& payload) {
+        size_t count = 0;
+        for (const auto& processor : processors) {
+            count += processor.check(payload);
+        }
+        return count;
+    }, own_hits);
+    double shared_ns = Measure(packets, [&](const Packet& packet) {
+        database.Scan(packet.data.data(), packet.data.size(), words.data());
+        context.patterns = {words.data(), words.size()};
+        size_t count = 0;
+        for (const auto& processor : processors) {
+            count += processor.check_shared(packet);
+        }
+        return count;
+    }, shared_hits);
+    
+    std::cout << std::setw(12) << name << std::setw(14) << std::fixed << std::setprecision(1) << own_ns
+              << std::setw(12) << shared_ns
+              << std::setw(10) << std::setprecision(2) << own_ns / shared_ns << "x"
+              << std::setw(8) << shared_hits << std::endl;
+    
+    bool same = own_hits == shared_hits;
+    for (const auto& packet : packets) {
+        database.Scan(packet.data.data(), packet.data.size(), words.data());
+        context.patterns = {words.data(), words.size()};
+        for (const auto& processor : processors) {
+            if (processor.check(packet.data) != processor.check_shared(packet)) {
+                std::cerr << "Mismatch for " << processor.name << " on " << name << " payloads" << std::endl;
+                same = false;
+            }
+        }
+    }
+    return same;
+}
+
+// Поток соединения из тех же payload'ов, повторенных до kStreamBytes
+ByteArray BuildStream() {
+    std::vector<ByteArray> parts = BuildPayloadMix();
+    std::vector<ByteArray> mtu = BuildMtuPayloads(kMtuPayloads);
+    parts.insert(parts.end(), mtu.begin(), mtu.end());
+    
+    ByteArray stream;
+    while (stream.size() < kStreamBytes) {
+        for (const auto& part : parts) {
+            stream.insert(stream.end(), part.begin(), part.end());
+        }
+    }
+    stream.resize(kStreamBytes);
+    return stream;
+}
+
+// Время обработки потока в микросекундах; found - шаблоны, найденные хотя бы в одном сегменте
+template<typename ScanStream>
+double MeasureStream(ScanStream scan_stream, std::vector<uint64_t>& found) {
+    size_t rounds = 0;
+    std::chrono::duration<double> elapsed(0);
+    auto start = std::chrono::steady_clock::now();
+    while (elapsed.count() < kTargetSeconds) {
+        std::fill(found.begin(), found.end(), 0);
+        scan_stream(found);
+        ++rounds;
+        elapsed = std::chrono::steady_clock::now() - start;
+    }
+    return elapsed.count() * 1e6 / static_cast<double>(rounds);
+}
+
+size_t CountPatterns(const std::vector<uint64_t>& words) {
+    size_t count = 0;
+    for (uint64_t word : words) {
+        for (; word != 0; word &= word - 1) {
+            ++count;
+        }
+    }
+    return count;
+}
+
+// Возвращает false, если потоковое сканирование нашло не те шаблоны,
+// что сканирование потока целиком
+bool CompareStreaming(const PatternDatabase& database, const ByteArray& stream, size_t segment) {
+    std::vector<ByteArray> segments;
+    for (size_t pos = 0; pos < stream.size(); pos += segment) {
+        segments.emplace_back(stream.begin() + pos, stream.begin() + std::min(stream.size(), pos + segment));
+    }
+    
+    size_t word_count = database.GetWordCount();
+    std::vector<uint64_t> words(word_count);
+    std::vector<uint64_t> whole(word_count);
+    database.Scan(stream.data(), stream.size(), whole.data());
+    
+    auto merge = [&words](std::vector<uint64_t>& found) {
+        for (size_t i = 0; i < found.size(); ++i) {
+            found[i] |= words[i];
+        }
+    };
+    
+    std::vector<uint64_t> separate_found(word_count);
+    std::vector<uint64_t> rescan_found(word_count);
+    std::vector<uint64_t> stream_found(word_count);
+    double separate_us = MeasureStream([&](std::vector<uint64_t>& found) {
+        for (const auto& data : segments) {
+            const ByteArray& payload = *Opaque(&data);
+            database.Scan(payload.data(), payload.size(), words.data());
+            merge(found);
+        }
+    }, separate_found);
+    ByteArray buffer;
+    double rescan_us = MeasureStream([&](std::vector<uint64_t>& found) {
+        buffer.clear();
+        for (const auto& data : segments) {
+            const ByteArray& payload = *Opaque(&data);
+            buffer.insert(buffer.end(), payload.begin(), payload.end());
+            database.Scan(buffer.data(), buffer.size(), words.data());
+            merge(found);
+        }
+    }, rescan_found);
+    double stream_us = MeasureStream([&](std::vector<uint64_t>& found) {
+        PatternStream state;
+        for (const auto& data : segments) {
+            const ByteArray& payload = *Opaque(&data);
+            database.Scan(payload.data(), payload.size(), words.data(), state, 1);
+            merge(found);
+        }
+    }, stream_found);
+    
+    // Срабатывания по сегментам: потоковое сканирование дополнительно
+    // находит шаблоны, разрезанные между сегментами
+    size_t separate_hits = 0;
+    size_t stream_hits = 0;
+    PatternStream state;
+    for (const auto& payload : segments) {
+        database.Scan(payload.data(), payload.size(), words.data());
+        separate_hits += CountPatterns(words);
+        database.Scan(payload.data(), payload.size(), words.data(), state, 1);
+        stream_hits += CountPatterns(words);
+    }
+    
+    std::cout << std::setw(8) << segment << std::setw(12) << std::fixed << std::setprecision(1) << separate_us
+              << std::setw(12) << rescan_us << std::setw(12) << stream_us
+              << std::setw(10) << separate_hits << std::setw(8) << stream_hits << std::endl;
+    
+    if (stream_found != whole || rescan_found != whole) {
+        std::cerr << "Streaming mismatch for " << segment << "-byte segments" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+int main() {
+    std::vector<Processor> processors = BuildProcessors();
+    
+    PatternSet all;
+    size_t registered = 0;
+    for (const auto& processor : processors) {
+        processor.patterns.ForEach([&registered](PatternId) { ++registered; });
+        all.Merge(processor.patterns);
+    }
+    PatternDatabase database(all);
+    
+    std::cout << "\n=== Signature check: scan per processor vs shared PatternDatabase (ns per packet) ===" << std::endl;
+    std::cout << processors.size() << " processors, " << registered << " patterns and keywords, "
+              << database.Size() << " after deduplication" << std::endl;
+    std::cout << std::setw(12) << "payloads" << std::setw(14) << "per processor"
+              << std::setw(12) << "shared" << std::setw(11) << "speedup" << std::setw(8) << "hits" << std::endl;
+    
+    bool ok = true;
+    ok = Compare("demo", processors, database, BuildPayloadMix()) && ok;
+    ok = Compare("mtu 1500", processors, database, BuildMtuPayloads(kMtuPayloads)) && ok;
+    
+    ByteArray stream = BuildStream();
+    std::cout << "\n=== " << stream.size() / 1024 << " KB connection in segments: "
+              << "separate vs rescanned buffer vs PatternStream (us per connection) ===" << std::endl;
+    std::cout << std::setw(8) << "segment" << std::setw(12) << "separate" << std::setw(12) << "rescan"
+              << std::setw(12) << "stream" << std::setw(10) << "hits" << std::setw(8) << "stream" << std::endl;
+    for (size_t segment : {64, 536, 1460}) {
+        ok = CompareStreaming(database, stream, segment) && ok;
+    }
+    
+    std::cout << "DFA states: " << database.GetStateCount()
+              << ", NFA fallbacks: " << database.GetFallbackCount()
+              << ", memory: " << database.GetMemoryUsage() / 1024 << " KB" << std::endl;
+    
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include "trafficmask.h"
+#include <string>
+#include <vector>
+
+namespace TrafficMask {
+namespace Bench {
+
+// Общие входные данные бенчмарков и проверок из cpp/bench
+
+// Скрывает от компилятора значение указателя, чтобы поиск по неизменным
+// данным не выносился из цикла замера
+template<typename T>
+inline const T* Opaque(const T* pointer) {
+#if defined(__GNUC__)
+    asm volatile("" : "+r"(pointer));
+#endif
+    return pointer;
+}
+
+inline ByteArray FromString(const std::string& text) {
+    return ByteArray(text.begin(), text.end());
+}
+
+// Payload'ы тех же типов, что генерирует TestPacketGenerator в main.cpp
+inline std::vector<ByteArray> BuildPayloadMix() {
+    std::vector<ByteArray> mix;
+    
+    mix.push_back(FromString(
+        "GET /test HTTP/1.1\r\n"
+        "Host: example.com\r\n"
+        "User-Agent: CustomBrowser/1.0\r\n"
+        "Accept: text/html,application/xhtml+xml\r\n"
+        "Accept-Language: en-US,en;q=0.9\r\n"
+        "Accept-Encoding: gzip, deflate\r\n"
+        "Connection: keep-alive\r\n"
+        "Upgrade-Insecure-Requests: 1\r\n\r\n"));
+    
+    ByteArray tls = {0x16, 0x03, 0x01, 0x00, 0x4a, 0x01, 0x00, 0x00, 0x46, 0x03, 0x03};
+    for (uint8_t i = 0; i < 77; ++i) {
+        tls.push_back(static_cast<uint8_t>(0x12 + i * 3));
+    }
+    mix.push_back(tls);
+    
+    mix.push_back({
+        0x12, 0x34, 0x01, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x07, 0x65, 0x78, 0x61, 0x6d, 0x70, 0x6c, 0x65, 0x03, 0x63, 0x6f, 0x6d,
+        0x00, 0x00, 0x01, 0x00, 0x01
+    });
+    
+    ByteArray sni = tls;
+    ByteArray sni_extension = {
+        0x00, 0x00, 0x00, 0x0f, 0x00, 0x0d, 0x00, 0x00, 0x0a, 0x65, 0x78,
+        0x61, 0x6d, 0x70, 0x6c, 0x65, 0x2e, 0x63, 0x6f, 0x6d
+    };
+    sni.insert(sni.end(), sni_extension.begin(), sni_extension.end());
+    mix.push_back(sni);
+    
+    ByteArray ip = {
+        0x45, 0x00, 0x00, 0x3c, 0x12, 0x34, 0x40, 0x00, 0x40, 0x06, 0x00, 0x00,
+        0xc0, 0xa8, 0x01, 0x01, 0x08, 0x08, 0x08, 0x08,
+        0x12, 0x34, 0x00, 0x50, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x50, 0x02, 0x20, 0x00
+    };
+    ip.resize(60, 0x00);
+    mix.push_back(ip);
+    
+    mix.push_back(FromString(
+        "GET /ws HTTP/1.1\r\n"
+        "Host: random-tunnel-id.tunnel.vk-apps.com\r\n"
+        "Upgrade: websocket\r\n"
+        "Connection: Upgrade\r\n"
+        "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+        "Sec-WebSocket-Version: 13\r\n"
+        "Origin: https://vkontakte.ru\r\n"
+        "Referer: https://vk-apps.com\r\n\r\n"));
+    
+    ByteArray encrypted = {0x17, 0x03, 0x03, 0x00, 0x30};
+    for (uint8_t i = 0; i < 48; ++i) {
+        encrypted.push_back(static_cast<uint8_t>(0x12 + i * 7));
+    }
+    mix.push_back(encrypted);
+    
+    mix.push_back(FromString(
+        "POST /api/login HTTP/1.1\r\n"
+        "Host: test.example.com\r\n"
+        "Content-Type: application/json\r\n"
+        "Content-Length: 100\r\n\r\n"
+        "{\"username\": \"user\", \"source_ip\": \"192.168.1.100\", \"server_ip\": \"10.0.0.5\"}"));
+    
+    mix.push_back({
+        0x00, 0x01,
+        0x55, 0x0e, 0x84, 0x00, 0xe2, 0x9b, 0x41, 0xd4,
+        0xa7, 0x16, 0x44, 0x66, 0x55, 0x44, 0x00, 0x01,
+        0x01, 0xbb,
+        0x01, 0x0a, 0x6d, 0x61, 0x69, 0x6c, 0x2e, 0x72, 0x75,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+    });
+    
+    mix.push_back(FromString(
+        "vless://550e8400-e29b-41d4-a716-446655440001@mail.ru:443?"
+        "type=tcp&security=reality&sni=mail.ru&pbk=test_key&"
+        "sid=test_session&spx=test_path#reality_test"));
+    
+    mix.push_back(FromString(
+        "vless://550e8400-e29b-41d4-a716-446655440002@yandex.ru:443?"
+        "type=tcp&security=xtls&flow=xtls-rprx-vision&"
+        "sni=yandex.ru&alpn=h2,http/1.1#vision_test"));
+    
+    return mix;
+}
+
+// Payload'ы размером с MTU без сигнатур: четные - HTTP-подобный текст,
+// нечетные - псевдослучайные байты (как зашифрованный трафик)
+inline std::vector<ByteArray> BuildMtuPayloads(size_t count, size_t size = 1500) {
+    static const char kText[] =
+        "GET /static/img/logo.png HTTP/1.1\r\nHost: cdn.example.org\r\n"
+        "Accept: image/avif,image/webp,*/*\r\nCache-Control: no-cache\r\n";
+    
+    std::vector<ByteArray> payloads;
+    uint32_t seed = 0x9e3779b9;
+    for (size_t p = 0; p < count; ++p) {
+        ByteArray payload(size);
+        for (size_t i = 0; i < payload.size(); ++i) {
+            if (p % 2 == 0) {
+                payload[i] = static_cast<uint8_t>(kText[(i + p) % (sizeof(kText) - 1)]);
+            } else {
+                seed = seed * 1664525 + 1013904223;
+                payload[i] = static_cast<uint8_t>(seed >> 24);
+            }
+        }
+        payloads.push_back(std::move(payload));
+    }
+    return payloads;
+}
+
+} // namespace Bench
+} // namespace TrafficMask
@@ -0,0 +1,127 @@
+#include "random_source.h"
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+using namespace TrafficMask;
+
+// Микробенчмарк случайного заполнения payload: прежний побайтовый
+// std::mt19937 + uniform_int_distribution против потока ChaCha8/12/20
+// (скалярное ядро и AVX2 по восемь блоков) и маскировки каждого третьего
+// байта: цикл с условием против FillStrided (смешивание по маске).
+// Выходы скалярного и AVX2-ядер должны совпадать.
+
+namespace {
+
+constexpr double kTargetSeconds = 0.5;
+constexpr uint32_t kKey[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+
+// Пропускная способность в ГБ/с (байт за наносекунду)
+template<typename Fill>
+double Measure(std::vector<uint8_t>& data, Fill fill) {
+    size_t rounds = 0;
+    std::chrono::duration<double> elapsed(0);
+    auto start = std::chrono::steady_clock::now();
+    while (elapsed.count() < kTargetSeconds) {
+        for (int i = 0; i < 64; ++i) {
+            fill(data.data(), data.size());
+        }
+        rounds += 64;
+        elapsed = std::chrono::steady_clock::now() - start;
+    }
+    return static_cast<double>(data.size()) * static_cast<double>(rounds) / (elapsed.count() * 1e9);
+}
+
+template<int Rounds>
+bool KernelsEqual(size_t blocks) {
+#if defined(TRAFFICMASK_BYTE_SEARCH_X86)
+    if (!ByteSearch::HasAvx2()) {
+        return true;
+    }
+    uint32_t scalar_state[16] = {};
+    uint32_t avx2_state[16] = {};
+    std::vector<uint8_t> scalar(blocks * ChaCha::kBlockSize);
+    std::vector<uint8_t> avx2(blocks * ChaCha::kBlockSize);
+    ChaCha::BlocksScalar<Rounds>(scalar_state, scalar.data(), blocks);
+    ChaCha::BlocksAvx2<Rounds>(avx2_state, avx2.data(), blocks);
+    return scalar == avx2;
+#else
+    (void)blocks;
+    return true;
+#endif
+}
+
+template<int Rounds>
+void CompareKernels(size_t size) {
+    std::vector<uint8_t> data(size);
+    uint32_t state[16] = {};
+    size_t blocks = size / ChaCha::kBlockSize;
+    
+    double scalar = Measure(data, [&](uint8_t* out, size_t) { ChaCha::BlocksScalar<Rounds>(state, out, blocks); });
+    std::cout << "  chacha" << std::setw(2) << std::left << Rounds << std::right << std::setw(8) << size
+              << std::setw(10) << std::fixed << std::setprecision(2) << scalar;
+
+#if defined(TRAFFICMASK_BYTE_SEARCH_X86)
+    if (ByteSearch::HasAvx2()) {
+        double avx2 = Measure(data, [&](uint8_t* out, size_t) { ChaCha::BlocksAvx2<Rounds>(state, out, blocks); });
+        std::cout << std::setw(10) << avx2 << std::setw(9) << avx2 / scalar << "x"
+                  << std::setw(8) << (KernelsEqual<Rounds>(blocks) ? "ok" : "MISMATCH");
+    }
+#endif
+    std::cout << std::endl;
+}
+
+void CompareFill(size_t size) {
+    std::vector<uint8_t> data(size);
+    std::mt19937 gen(12345);
+    RandomSource source(1, kKey, 0);
+    
+    double mt = Measure(data, [&](uint8_t* out, size_t n) {
+        std::uniform_int_distribution<uint8_t> dis(0, 255);
+        for (size_t i = 0; i < n; ++i) {
+            out[i] = dis(gen);
+        }
+    });
+    double fill = Measure(data, [&](uint8_t* out, size_t n) { source.Fill(out, n); });
+    
+    double mt_third = Measure(data, [&](uint8_t* out, size_t n) {
+        std::uniform_int_distribution<uint8_t> dis(0, 255);
+        for (size_t i = 0; i < n; ++i) {
+            if (i % 3 == 0) {
+                out[i] = dis(gen);
+            }
+        }
+    });
+    double strided = Measure(data, [&](uint8_t* out, size_t n) { source.FillStrided(out, n, 3); });
+    
+    std::cout << std::setw(8) << size << std::fixed << std::setprecision(2)
+              << std::setw(10) << mt << std::setw(10) << fill << std::setw(9) << fill / mt << "x"
+              << std::setw(12) << mt_third << std::setw(10) << strided << std::setw(9) << strided / mt_third << "x"
+              << std::endl;
+}
+
+} // namespace
+
+int main() {
+    std::cout << "\n=== ChaCha keystream kernels (GB/s) ===" << std::endl;
+    std::cout << std::setw(16) << "bytes" << std::setw(10) << "scalar" << std::setw(10) << "avx2"
+              << std::setw(10) << "speedup" << std::setw(8) << "output" << std::endl;
+    for (size_t size : {size_t(1536), size_t(65536)}) {
+        CompareKernels<8>(size);
+        CompareKernels<12>(size);
+        CompareKernels<20>(size);
+    }
+    
+    std::cout << "\n=== Payload fill: mt19937 vs RandomSource (GB/s) ===" << std::endl;
+    std::cout << std::setw(8) << "bytes" << std::setw(10) << "mt19937" << std::setw(10) << "Fill"
+              << std::setw(10) << "speedup" << std::setw(12) << "mt19937/3" << std::setw(10) << "Strided"
+              << std::setw(10) << "speedup" << std::endl;
+    for (size_t size : {size_t(64), size_t(1500), size_t(65536)}) {
+        CompareFill(size);
+    }
+    
+    return 0;
+}
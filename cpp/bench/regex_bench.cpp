@@ -0,0 +1,135 @@
+#include "trafficmask.h"
+#include "regex_set.h"
+#include "payload_mix.h"
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <regex>
+#include <string>
+
+using namespace TrafficMask;
+using namespace TrafficMask::Bench;
+
+// Микробенчмарк регулярных выражений сигнатур: цикл std::regex_search
+// (icase, по шаблону за проход) против одного прохода RegexSet.
+// Наборы шаблонов - как у маскировщиков из cpp/signature; данные - пакеты
+// демонстрации (main.cpp), payload'ы размером с MTU и бинарный payload,
+// на котором шаблон IpSidrMasker заставляет std::regex откатываться.
+
+namespace {
+
+constexpr size_t kMtuPayloads = 16;
+constexpr double kTargetSeconds = 0.5;
+
+struct PatternSet {
+    const char* name;
+    std::vector<std::string> patterns;
+};
+
+const std::vector<PatternSet> kPatternSets = {
+    {"http_header", {"User-Agent:.*", "Accept:.*", "Accept-Language:.*", "Accept-Encoding:.*",
+                     "Connection:.*", "Upgrade-Insecure-Requests:.*"}},
+    {"ip_sidr", {"\\x45.*\\x00.*\\x00.*\\x00.*\\x00.*\\x00.*\\x00.*\\x00"}},
+    {"sni", {"\\x16\\x03\\x01.*\\x00\\x00.*\\x03\\x03", "Server Name Indication"}},
+    {"russia_cdn", {"cdn\\.yandex\\.ru", "yastatic\\.net", "rcntr\\.com", "mail\\.ru", "cdn\\.mail\\.ru",
+                    "vk-cdn\\.com", "rambler\\.ru", "cdn\\.rambler\\.ru", "1cbitrix\\.ru",
+                    "cdn\\.1cbitrix\\.ru"}},
+    {"whitelist", {"\\d+\\.\\d+\\.\\d+\\.\\d+"}},
+};
+
+// Много байтов 0x45 и нулей без переводов строки: каждый 0x45 начинает
+// попытку, которую std::regex перебирает с откатами
+ByteArray BuildBacktrackingPayload() {
+    ByteArray payload(1500);
+    for (size_t i = 0; i < payload.size(); ++i) {
+        payload[i] = (i % 3 == 0) ? 0x45 : (i % 17 == 0 ? 0x00 : 0x20);
+    }
+    return payload;
+}
+
+int StdRegexSearch(const std::vector<std::regex>& regexes, const ByteArray& payload) {
+    const char* begin = reinterpret_cast<const char*>(payload.data());
+    for (size_t i = 0; i < regexes.size(); ++i) {
+        if (std::regex_search(begin, begin + payload.size(), regexes[i])) {
+            return static_cast<int>(i);
+        }
+    }
+    return RegexSet::kNoMatch;
+}
+
+// Время одного прохода по payloads в наносекундах на пакет; hits - число совпадений
+template<typename Search>
+double Measure(const std::vector<ByteArray>& payloads, Search search, size_t& hits) {
+    size_t rounds = 0;
+    hits = 0;
+    std::chrono::duration<double> elapsed(0);
+    auto start = std::chrono::steady_clock::now();
+    while (elapsed.count() < kTargetSeconds) {
+        for (const auto& payload : payloads) {
+            hits += search(*Opaque(&payload)) != RegexSet::kNoMatch ? 1 : 0;
+        }
+        ++rounds;
+        elapsed = std::chrono::steady_clock::now() - start;
+    }
+    hits /= rounds;
+    return elapsed.count() * 1e9 / static_cast<double>(rounds * payloads.size());
+}
+
+// Возвращает false, если совпадения разошлись с std::regex
+bool Compare(const PatternSet& set, const char* data_name, const std::vector<ByteArray>& payloads) {
+    std::vector<std::regex> regexes;
+    RegexSet regex_set;
+    for (const auto& pattern : set.patterns) {
+        regexes.emplace_back(pattern, std::regex_constants::icase);
+        regex_set.Add(pattern, true);
+    }
+    regex_set.Build();
+    
+    size_t std_hits = 0;
+    size_t set_hits = 0;
+    double std_ns = Measure(payloads, [&](const ByteArray& payload) {
+        return StdRegexSearch(regexes, payload);
+    }, std_hits);
+    double set_ns = Measure(payloads, [&](const ByteArray& payload) {
+        return regex_set.Search(payload.data(), payload.size());
+    }, set_hits);
+    
+    std::cout << std::setw(12) << set.name << std::setw(12) << data_name
+              << std::setw(14) << std::fixed << std::setprecision(1) << std_ns
+              << std::setw(12) << set_ns
+              << std::setw(10) << std::setprecision(1) << std_ns / set_ns << "x"
+              << std::setw(8) << set_hits << "/" << payloads.size()
+              << std::setw(8) << regex_set.GetStateCount() << std::endl;
+    
+    bool same = std_hits == set_hits;
+    for (const auto& payload : payloads) {
+        bool std_match = StdRegexSearch(regexes, payload) != RegexSet::kNoMatch;
+        same = same && std_match == (regex_set.Search(payload.data(), payload.size()) != RegexSet::kNoMatch);
+    }
+    if (!same) {
+        std::cerr << "Mismatch between std::regex and RegexSet: " << set.name << ", " << data_name << std::endl;
+    }
+    return same;
+}
+
+} // namespace
+
+int main() {
+    std::vector<ByteArray> demo = BuildPayloadMix();
+    std::vector<ByteArray> mtu = BuildMtuPayloads(kMtuPayloads);
+    std::vector<ByteArray> backtracking = {BuildBacktrackingPayload()};
+    
+    std::cout << "\n=== Signature regex: std::regex vs RegexSet (ns per packet) ===" << std::endl;
+    std::cout << std::setw(12) << "patterns" << std::setw(12) << "payloads"
+              << std::setw(14) << "std::regex" << std::setw(12) << "RegexSet"
+              << std::setw(11) << "speedup" << std::setw(10) << "hits" << std::setw(8) << "states" << std::endl;
+    
+    bool ok = true;
+    for (const auto& set : kPatternSets) {
+        ok = Compare(set, "demo", demo) && ok;
+        ok = Compare(set, "mtu 1500", mtu) && ok;
+    }
+    ok = Compare(kPatternSets[1], "backtrack", backtracking) && ok;
+    
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,146 @@
+#include "trafficmask.h"
+#include "replacement_table.h"
+#include "payload_mix.h"
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+using namespace TrafficMask;
+using namespace TrafficMask::Bench;
+
+// Микробенчмарк перезаписи payload по таблицам замен маскировщиков:
+// прежний цикл по таблице (find и замена первого вхождения на строку
+// таблицы), тот же цикл по всем вхождениям и ReplacementTable - поиск всех
+// вхождений и сборка результата за один проход. Результаты не обязаны
+// совпадать: циклы могли заменить короткий образец внутри длинного или
+// внутри уже вставленной замены, поэтому печатается число замен.
+
+namespace {
+
+constexpr double kTargetSeconds = 0.5;
+
+using Entries = std::vector<std::pair<std::string_view, std::string_view>>;
+
+struct RewriteCase {
+    const char* name;
+    Entries entries;  // таблица маскировщика
+    std::string text; // строка с образцами; payload дополняется до размера
+};
+
+const std::vector<RewriteCase> kCases = {
+    {"russia_cdn",
+     {{"cdn.yandex.ru", "yandex.ru"}, {"yastatic.net", "yandex.ru"}, {"rcntr.com", "mail.ru"},
+      {"cdn.mail.ru", "mail.ru"}, {"vk-cdn.com", "vk.com"}, {"cdn.rambler.ru", "rambler.ru"},
+      {"1cbitrix.ru", "1c.ru"}, {"cdn.1cbitrix.ru", "1c.ru"}},
+     "GET /bitrix/js/main.js HTTP/1.1\r\nHost: cdn.1cbitrix.ru\r\n"
+     "Referer: https://yastatic.net/s3/home/\r\nOrigin: https://cdn.mail.ru\r\n"},
+    {"xtls",
+     {{"xtls-rprx-vision", "tls1.2"}, {"xtls-rprx-direct", "tls-direct"}, {"xtls", "tls"},
+      {"XTLS", "TLS"}, {"rprx", "tls"}, {"RPRX", "TLS"}},
+     "vless://550e8400-e29b-41d4-a716-446655440002@yandex.ru:443?"
+     "type=tcp&security=xtls&flow=xtls-rprx-vision&sni=yandex.ru#XTLS"},
+    {"vk_api",
+     {{"/api/vk/", "/api/yandex/"}, {"/method/", "/method/v1/"}, {"/oauth/", "/auth/"},
+      {"/photos/", "/images/"}, {"/audio/", "/music/"}},
+     "GET /api/vk/method/users.get HTTP/1.1\r\nHost: api.vk.com\r\n"
+     "Referer: https://vk.com/photos/album1\r\n"},
+};
+
+// Payload заданного размера: строка с образцами и HTTP-подобное заполнение
+PacketBuffer BuildPayload(const std::string& text, size_t size) {
+    static const char kFiller[] = "Accept-Language: ru-RU,ru;q=0.9,en;q=0.8\r\n";
+    std::string payload = text;
+    while (payload.size() < size) {
+        payload += kFiller;
+    }
+    payload.resize(std::max(size, text.size()));
+    return PacketBuffer(reinterpret_cast<const uint8_t*>(payload.data()), payload.size());
+}
+
+// Прежний цикл маскировщиков: первое вхождение каждой строки таблицы
+size_t ApplyLoop(const Entries& entries, PacketBuffer& data) {
+    size_t replaced = 0;
+    for (const auto& [needle, replacement] : entries) {
+        size_t pos = PacketView(data).Find(needle);
+        if (pos != PacketView::npos) {
+            data.Replace(pos, needle.length(), replacement);
+            ++replaced;
+        }
+    }
+    return replaced;
+}
+
+// Тот же цикл по всем вхождениям каждой строки таблицы
+size_t ApplyLoopAll(const Entries& entries, PacketBuffer& data) {
+    size_t replaced = 0;
+    for (const auto& [needle, replacement] : entries) {
+        size_t pos = PacketView(data).Find(needle);
+        while (pos != PacketView::npos) {
+            data.Replace(pos, needle.length(), replacement);
+            ++replaced;
+            pos = PacketView(data).Find(needle, pos + replacement.length());
+        }
+    }
+    return replaced;
+}
+
+// Время перезаписи одной копии payload в наносекундах; replaced - число замен
+template<typename Rewrite>
+double Measure(const PacketBuffer& payload, Rewrite rewrite, size_t& replaced) {
+    size_t rounds = 0;
+    std::chrono::duration<double> elapsed(0);
+    auto start = std::chrono::steady_clock::now();
+    while (elapsed.count() < kTargetSeconds) {
+        for (int i = 0; i < 64; ++i) {
+            PacketBuffer copy = *Opaque(&payload);
+            replaced = rewrite(copy);
+        }
+        rounds += 64;
+        elapsed = std::chrono::steady_clock::now() - start;
+    }
+    return elapsed.count() * 1e9 / static_cast<double>(rounds);
+}
+
+void Compare(const RewriteCase& test, size_t size) {
+    ReplacementTable table;
+    for (const auto& [needle, replacement] : test.entries) {
+        table.Add(needle, replacement);
+    }
+    
+    PacketBuffer payload = BuildPayload(test.text, size);
+    size_t loop_replaced = 0;
+    size_t all_replaced = 0;
+    size_t table_replaced = 0;
+    double loop_ns = Measure(payload, [&](PacketBuffer& data) { return ApplyLoop(test.entries, data); }, loop_replaced);
+    double all_ns = Measure(payload, [&](PacketBuffer& data) { return ApplyLoopAll(test.entries, data); }, all_replaced);
+    double table_ns = Measure(payload, [&](PacketBuffer& data) { return table.Apply(data); }, table_replaced);
+    
+    std::cout << std::setw(12) << test.name << std::setw(8) << payload.size()
+              << std::setw(12) << std::fixed << std::setprecision(1) << loop_ns
+              << std::setw(12) << all_ns << std::setw(12) << table_ns
+              << std::setw(9) << std::setprecision(2) << all_ns / table_ns << "x"
+              << std::setw(8) << loop_replaced << std::setw(8) << all_replaced
+              << std::setw(8) << table_replaced << std::endl;
+}
+
+} // namespace
+
+int main() {
+    std::cout << "\n=== Replacement tables: find/replace loop vs ReplacementTable (ns per payload) ===" << std::endl;
+    std::cout << std::setw(12) << "table" << std::setw(8) << "bytes"
+              << std::setw(12) << "loop" << std::setw(12) << "loop_all" << std::setw(12) << "table"
+              << std::setw(10) << "vs all" << std::setw(8) << "loop" << std::setw(8) << "all"
+              << std::setw(8) << "table" << std::endl;
+    
+    for (const auto& test : kCases) {
+        Compare(test, 0);
+        Compare(test, 1460);
+    }
+    
+    return 0;
+}
@@ -0,0 +1,227 @@
+#include "trafficmask.h"
+#include "byte_search.h"
+#include "payload_mix.h"
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <regex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace TrafficMask;
+using namespace TrafficMask::Bench;
+
+// Микробенчмарк поиска подстрок внутри процессоров: цикл
+// std::string_view::find против цикла FindBytes по тем же подстрокам и
+// против одного прохода NeedleSet::Match; результаты сверяются. Подстроки - из DetectTrafficType,
+// DetectRealityType и замен маскировщиков; данные - пакеты демонстрации и
+// payload'ы размером с MTU: HTTP-подобный текст и псевдослучайные байты
+// (как зашифрованный трафик) отдельно. Поиск без учета регистра
+// (домены VK Tunnel, пути WebSocket) сравнивается с прежним std::regex icase.
+
+namespace {
+
+constexpr size_t kMtuPayloads = 16;
+constexpr double kTargetSeconds = 0.5;
+
+struct NeedleList {
+    const char* name;
+    std::vector<std::string_view> needles;
+};
+
+const std::vector<NeedleList> kNeedleLists = {
+    {"vk_traffic", {"GET /", "Upgrade: websocket", "/api/", ".js", ".css", ".png", ".jpg",
+                    "vk-cdn.net", "vk-cdn.com", "vk-video.com", "vk-audio.com", "vk-images.com"}},
+    {"reality", {"xtls-rprx-vision", "xtls-rprx-direct", "reality"}},
+    {"vless_proxy", {"@", ":443", ":80", "?type=tcp", "&security=tls", "&path=/"}},
+};
+
+const NeedleList kIgnoreCaseList = {
+    "vk_domains", {".tunnel.vk-apps.com", "vk-apps.com", "vkontakte.ru", "/ws", "/websocket", "/tunnel", "/stream"}
+};
+
+// Бит k установлен, если в данных есть подстрока k
+uint32_t StdFind(const std::vector<std::string_view>& needles, std::string_view text) {
+    uint32_t found = 0;
+    for (size_t k = 0; k < needles.size(); ++k) {
+        if (text.find(needles[k]) != std::string_view::npos) {
+            found |= uint32_t(1) << k;
+        }
+    }
+    return found;
+}
+
+uint32_t KernelFind(const std::vector<std::string_view>& needles, std::string_view text) {
+    uint32_t found = 0;
+    for (size_t k = 0; k < needles.size(); ++k) {
+        if (FindBytes(text, needles[k]) != std::string_view::npos) {
+            found |= uint32_t(1) << k;
+        }
+    }
+    return found;
+}
+
+uint32_t RegexIgnoreCaseFind(const std::vector<std::regex>& regexes, std::string_view text) {
+    uint32_t found = 0;
+    for (size_t k = 0; k < regexes.size(); ++k) {
+        if (std::regex_search(text.begin(), text.end(), regexes[k])) {
+            found |= uint32_t(1) << k;
+        }
+    }
+    return found;
+}
+
+uint32_t KernelIgnoreCaseFind(const std::vector<std::string_view>& needles, std::string_view text) {
+    uint32_t found = 0;
+    for (size_t k = 0; k < needles.size(); ++k) {
+        if (FindBytesIgnoreCase(text, needles[k]) != std::string_view::npos) {
+            found |= uint32_t(1) << k;
+        }
+    }
+    return found;
+}
+
+size_t PopCount(uint32_t mask) {
+    size_t count = 0;
+    for (; mask != 0; mask &= mask - 1) {
+        ++count;
+    }
+    return count;
+}
+
+// Время одного прохода по payloads в наносекундах на пакет;
+// hits - число найденных подстрок за проход
+template<typename Search>
+double Measure(const std::vector<ByteArray>& payloads, Search search, size_t& hits) {
+    size_t rounds = 0;
+    hits = 0;
+    std::chrono::duration<double> elapsed(0);
+    auto start = std::chrono::steady_clock::now();
+    while (elapsed.count() < kTargetSeconds) {
+        for (const auto& payload : payloads) {
+            const ByteArray& data = *Opaque(&payload);
+            hits += PopCount(search(std::string_view(reinterpret_cast<const char*>(data.data()), data.size())));
+        }
+        ++rounds;
+        elapsed = std::chrono::steady_clock::now() - start;
+    }
+    hits /= rounds;
+    return elapsed.count() * 1e9 / static_cast<double>(rounds * payloads.size());
+}
+
+// Возвращает false, если результаты разошлись с std::string_view::find
+bool Compare(const NeedleList& list, const char* data_name, const std::vector<ByteArray>& payloads) {
+    NeedleSet set;
+    for (std::string_view needle : list.needles) {
+        set.Add(needle);
+    }
+    
+    size_t std_hits = 0;
+    size_t kernel_hits = 0;
+    double std_ns = Measure(payloads, [&](std::string_view text) {
+        return StdFind(list.needles, text);
+    }, std_hits);
+    double kernel_ns = Measure(payloads, [&](std::string_view text) {
+        return KernelFind(list.needles, text);
+    }, kernel_hits);
+    size_t set_hits = 0;
+    double set_ns = Measure(payloads, [&](std::string_view text) {
+        return set.Match(text);
+    }, set_hits);
+    
+    std::cout << std::setw(12) << list.name << std::setw(12) << data_name
+              << std::setw(12) << std::fixed << std::setprecision(1) << std_ns
+              << std::setw(12) << kernel_ns << std::setw(8) << std::setprecision(2) << std_ns / kernel_ns << "x"
+              << std::setw(12) << std::setprecision(1) << set_ns << std::setw(8) << std::setprecision(2)
+              << std_ns / set_ns << "x" << std::setw(8) << kernel_hits << std::endl;
+    
+    bool same = std_hits == kernel_hits && std_hits == set_hits;
+    for (const auto& payload : payloads) {
+        std::string_view text(reinterpret_cast<const char*>(payload.data()), payload.size());
+        uint32_t expected = StdFind(list.needles, text);
+        same = same && KernelFind(list.needles, text) == expected && set.Match(text) == expected;
+    }
+    if (!same) {
+        std::cerr << "Mismatch with std::string_view::find: " << list.name << ", " << data_name << std::endl;
+    }
+    return same;
+}
+
+// Поиск без учета регистра: std::regex icase против FindBytesIgnoreCase
+bool CompareIgnoreCase(const NeedleList& list, const char* data_name, const std::vector<ByteArray>& payloads) {
+    std::vector<std::regex> regexes;
+    for (std::string_view needle : list.needles) {
+        std::string escaped;
+        for (char c : needle) {
+            if (c == '.' || c == '?') {
+                escaped += '\\';
+            }
+            escaped += c;
+        }
+        regexes.emplace_back(escaped, std::regex_constants::icase);
+    }
+    
+    size_t regex_hits = 0;
+    size_t kernel_hits = 0;
+    double regex_ns = Measure(payloads, [&](std::string_view text) {
+        return RegexIgnoreCaseFind(regexes, text);
+    }, regex_hits);
+    double kernel_ns = Measure(payloads, [&](std::string_view text) {
+        return KernelIgnoreCaseFind(list.needles, text);
+    }, kernel_hits);
+    
+    std::cout << std::setw(12) << list.name << std::setw(12) << data_name
+              << std::setw(12) << std::fixed << std::setprecision(1) << regex_ns
+              << std::setw(12) << kernel_ns << std::setw(8) << std::setprecision(2) << regex_ns / kernel_ns << "x"
+              << std::setw(8) << kernel_hits << std::endl;
+    
+    bool same = regex_hits == kernel_hits;
+    for (const auto& payload : payloads) {
+        std::string_view text(reinterpret_cast<const char*>(payload.data()), payload.size());
+        same = same && KernelIgnoreCaseFind(list.needles, text) == RegexIgnoreCaseFind(regexes, text);
+    }
+    if (!same) {
+        std::cerr << "Mismatch with std::regex icase: " << list.name << ", " << data_name << std::endl;
+    }
+    return same;
+}
+
+} // namespace
+
+int main() {
+    std::vector<ByteArray> demo = BuildPayloadMix();
+    std::vector<ByteArray> mtu_text;
+    std::vector<ByteArray> mtu_binary;
+    std::vector<ByteArray> mtu = BuildMtuPayloads(kMtuPayloads);
+    for (size_t i = 0; i < mtu.size(); ++i) {
+        (i % 2 == 0 ? mtu_text : mtu_binary).push_back(mtu[i]);
+    }
+    
+    std::cout << "\n=== Substring search: std::string_view::find vs FindBytes vs NeedleSet (ns per packet) ===" << std::endl;
+#if defined(TRAFFICMASK_BYTE_SEARCH_X86)
+    std::cout << "kernel: " << (ByteSearch::HasAvx2() ? "AVX2" : "SSE2") << std::endl;
+#else
+    std::cout << "kernel: scalar" << std::endl;
+#endif
+    std::cout << std::setw(12) << "needles" << std::setw(12) << "payloads"
+              << std::setw(12) << "find" << std::setw(12) << "FindBytes" << std::setw(9) << "speedup"
+              << std::setw(12) << "NeedleSet" << std::setw(9) << "speedup" << std::setw(8) << "hits" << std::endl;
+    
+    bool ok = true;
+    for (const auto& list : kNeedleLists) {
+        ok = Compare(list, "demo", demo) && ok;
+        ok = Compare(list, "mtu text", mtu_text) && ok;
+        ok = Compare(list, "mtu binary", mtu_binary) && ok;
+    }
+    
+    std::cout << "\n=== Case-insensitive search: std::regex icase vs FindBytesIgnoreCase (ns per packet) ===" << std::endl;
+    std::cout << std::setw(12) << "needles" << std::setw(12) << "payloads"
+              << std::setw(12) << "regex" << std::setw(12) << "kernel" << std::setw(9) << "speedup"
+              << std::setw(8) << "hits" << std::endl;
+    ok = CompareIgnoreCase(kIgnoreCaseList, "demo", demo) && ok;
+    ok = CompareIgnoreCase(kIgnoreCaseList, "mtu text", mtu_text) && ok;
+    ok = CompareIgnoreCase(kIgnoreCaseList, "mtu binary", mtu_binary) && ok;
+    
+    return ok ? 0 : 1;
+}
@@ -1,13 +1,51 @@
 #include "trafficmask.h"
+#include "flow_table.h"
 #include <fstream>
 #include <iostream>
 #include <algorithm>
 #include <chrono>
+#include <thread>
 
 namespace TrafficMask {
 
+// Шардов больше, чем ядер, чтобы снизить вероятность коллизий горячих потоков
+static constexpr size_t kShardsPerCore = 4;
+
+// На сколько пакетов вперед предвыбирается состояние потока в пакетном режиме
+static constexpr size_t kBatchPrefetchDistance = 4;
+
+// Шард выровнен по кэш-линии, чтобы блокировки и счетчики соседних шардов
+// не делили одну линию (false sharing)
+struct alignas(64) EngineShard {
+    std::mutex mutex;
+    FlowTable connection_buffer;
+    std::atomic<size_t> processed_packets{0};
+    std::atomic<size_t> masked_packets{0};
+    std::atomic<size_t> bypassed_packets{0};
+};
+
+static size_t DefaultShardCount() {
+    size_t cores = std::thread::hardware_concurrency();
+    if (cores == 0) {
+        cores = 4; // Fallback
+    }
+    return cores * kShardsPerCore;
+}
+
 TrafficMaskEngine::TrafficMaskEngine() 
-    : processed_packets_(0), masked_packets_(0), is_initialized_(false) {
+    : TrafficMaskEngine(DefaultShardCount()) {
+}
+
+TrafficMaskEngine::TrafficMaskEngine(size_t shard_count) 
+    : next_flow_id_(kInvalidFlowId + 1), is_initialized_(false) {
+    if (shard_count == 0) {
+        shard_count = 1;
+    }
+    
+    shards_.reserve(shard_count);
+    for (size_t i = 0; i < shard_count; ++i) {
+        shards_.push_back(std::make_unique<EngineShard>());
+    }
 }
 
 TrafficMaskEngine::~TrafficMaskEngine() {
@@ -26,69 +64,231 @@ bool TrafficMaskEngine::Initialize(const std::string& config_path) {
         return false;
     }
     
-    is_initialized_ = true;
-    std::cout << "TrafficMask engine initialized successfully" << std::endl;
+    // Бюджет памяти соединений делится поровну между шардами
+    size_t shard_budget = config_.flow_memory_budget_bytes / shards_.size();
+    if (config_.flow_memory_budget_bytes != 0 && shard_budget == 0) {
+        shard_budget = 1;
+    }
+    
+    for (auto& shard : shards_) {
+        std::lock_guard<std::mutex> shard_lock(shard->mutex);
+        shard->connection_buffer.Configure(config_, shard_budget);
+        shard->connection_buffer.SetEvictCallback([this](FlowId flow_id) {
+            NotifyConnectionClosed(flow_id);
+        });
+    }
+    
+    is_initialized_.store(true, std::memory_order_release);
+    std::cout << "TrafficMask engine initialized successfully (" 
+              << shards_.size() << " shards)" << std::endl;
     return true;
 }
 
 void TrafficMaskEngine::Shutdown() {
     std::lock_guard<std::mutex> lock(engine_mutex_);
     
-    if (!is_initialized_) {
+    if (!is_initialized_.load()) {
         return;
     }
     
-    signature_processors_.clear();
-    connection_buffer_.clear();
-    is_initialized_ = false;
+    // Останавливаем обработку во всех шардах перед очисткой состояния
+    std::vector<std::unique_lock<std::mutex>> shard_locks = LockAllShards();
+    
+    is_initialized_.store(false, std::memory_order_release);
+    signature_processors_.Clear();
+    for (auto& shard : shards_) {
+        shard->connection_buffer.Clear();
+    }
+    
+    {
+        std::lock_guard<std::mutex> names_lock(flow_names_mutex_);
+        flow_ids_.clear();
+        flow_names_.clear();
+    }
     
     std::cout << "TrafficMask engine shutdown completed" << std::endl;
 }
 
 bool TrafficMaskEngine::ProcessPacket(Packet& packet) {
-    std::lock_guard<std::mutex> lock(engine_mutex_);
-    
-    if (!is_initialized_) {
+    if (!is_initialized_.load(std::memory_order_acquire)) {
         return false;
     }
     
-    processed_packets_++;
+    // Пакеты, пришедшие со строковым идентификатором, интернируются один раз;
+    // дальше поток адресуется только целым flow_id
+    if (packet.flow_id == kInvalidFlowId) {
+        packet.flow_id = InternConnection(packet.connection_id);
+    }
     
-    // Добавляем пакет в буфер соединения для анализа контекста
-    connection_buffer_[packet.connection_id].push_back(packet);
+    // Все пакеты соединения попадают в один шард - порядок внутри потока сохраняется
+    EngineShard& shard = GetShard(packet.flow_id);
+    std::lock_guard<std::mutex> lock(shard.mutex);
     
-    // Ограничиваем размер буфера
-    if (connection_buffer_[packet.connection_id].size() > 100) {
-        connection_buffer_[packet.connection_id].erase(
-            connection_buffer_[packet.connection_id].begin()
-        );
+    // Повторная проверка: Shutdown мог завершиться, пока мы ждали блокировку
+    if (!is_initialized_.load(std::memory_order_relaxed)) {
+        return false;
     }
     
+    shard.processed_packets.fetch_add(1, std::memory_order_relaxed);
+    
+    // Добавляем пакет в кольцо истории соединения (один поиск по хешу, O(1) вставка);
+    // попутно вытесняются простаивающие потоки и потоки сверх бюджета памяти
+    FlowEntry& flow = shard.connection_buffer.Track(packet);
+    
     // Обрабатываем маскировку сигнатур
-    ProcessSignatureMasking(packet);
+    // Класс пакета определяется один раз; процессоры вызываются только для своих классов
+    PacketContext context;
+    context.history = &flow.history;
+    context.protocol = ClassifyPayload(packet.data.data(), packet.data.size());
+    context.stream = &flow.streams[packet.is_incoming ? 1 : 0];
+    packet.context = &context;
+    
+    ProcessSignatureMasking(shard, packet, flow.verdict);
     
+    packet.context = nullptr;
     return true;
 }
 
-void TrafficMaskEngine::RegisterSignatureProcessor(std::shared_ptr<ISignatureProcessor> processor) {
-    std::lock_guard<std::mutex> lock(engine_mutex_);
+size_t TrafficMaskEngine::ProcessBatch(Packet* packets, size_t count) {
+    if (!is_initialized_.load(std::memory_order_acquire) || count == 0) {
+        return 0;
+    }
+    
+    InternBatch(packets, count);
+    
+    // Раскладка переиспользуется между вызовами потока, поэтому в
+    // установившемся режиме пакетный путь не обращается к аллокатору
+    thread_local PacketBatch batch;
+    batch.Assign(packets, count, shards_.size());
+    
+    // Вся пачка видит один снимок процессоров, по его версии проверяются
+    // вердикты потоков. Снимок не блокирует запись в реестр, поэтому его
+    // можно держать, ожидая блокировку шарда
+    ProcessorRegistry::Snapshot processors(signature_processors_);
+    size_t processed = 0;
+    for (size_t s = 0; s < shards_.size(); ++s) {
+        size_t begin = batch.shard_offsets[s];
+        size_t end = batch.shard_offsets[s + 1];
+        if (begin != end) {
+            processed += ProcessShardBatch(*shards_[s], processors, batch, begin, end);
+        }
+    }
     
+    return processed;
+}
+
+FlowId TrafficMaskEngine::InternConnection(const ConnectionId& connection_id) {
+    std::lock_guard<std::mutex> lock(flow_names_mutex_);
+    return InternConnectionLocked(connection_id);
+}
+
+FlowId TrafficMaskEngine::InternConnectionLocked(const ConnectionId& connection_id) {
+    auto it = flow_ids_.find(connection_id);
+    if (it != flow_ids_.end()) {
+        return it->second;
+    }
+    
+    FlowId flow_id = next_flow_id_++;
+    flow_ids_.emplace(connection_id, flow_id);
+    flow_names_.emplace(flow_id, connection_id);
+    return flow_id;
+}
+
+void TrafficMaskEngine::InternBatch(Packet* packets, size_t count) {
+    // Реестр блокируется один раз на пачку и только при наличии новых соединений
+    std::unique_lock<std::mutex> lock(flow_names_mutex_, std::defer_lock);
+    for (size_t i = 0; i < count; ++i) {
+        if (packets[i].flow_id == kInvalidFlowId) {
+            if (!lock.owns_lock()) {
+                lock.lock();
+            }
+            packets[i].flow_id = InternConnectionLocked(packets[i].connection_id);
+        }
+    }
+}
+
+ConnectionId TrafficMaskEngine::GetConnectionName(FlowId flow_id) const {
+    std::lock_guard<std::mutex> lock(flow_names_mutex_);
+    
+    auto it = flow_names_.find(flow_id);
+    if (it != flow_names_.end()) {
+        return it->second;
+    }
+    return "flow#" + std::to_string(flow_id);
+}
+
+size_t TrafficMaskEngine::GetProcessedPackets() const {
+    size_t total = 0;
+    for (const auto& shard : shards_) {
+        total += shard->processed_packets.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+size_t TrafficMaskEngine::GetMaskedPackets() const {
+    size_t total = 0;
+    for (const auto& shard : shards_) {
+        total += shard->masked_packets.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+size_t TrafficMaskEngine::GetBypassedPackets() const {
+    size_t total = 0;
+    for (const auto& shard : shards_) {
+        total += shard->bypassed_packets.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+FlowTableStats TrafficMaskEngine::GetFlowStats() const {
+    FlowTableStats total;
+    for (const auto& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        FlowTableStats stats = shard->connection_buffer.GetStats();
+        total.active_flows += stats.active_flows;
+        total.memory_bytes += stats.memory_bytes;
+        total.idle_evictions += stats.idle_evictions;
+        total.lifetime_evictions += stats.lifetime_evictions;
+        total.memory_evictions += stats.memory_evictions;
+    }
+    return total;
+}
+
+void TrafficMaskEngine::ExpireIdleFlows(size_t now_ms) {
+    if (!is_initialized_.load(std::memory_order_acquire)) {
+        return;
+    }
+    
+    for (auto& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        shard->connection_buffer.Expire(now_ms);
+    }
+    
+    // Снимки процессоров, которые дочитывались во время последней
+    // регистрации, освобождаются здесь, даже если регистраций больше нет
+    signature_processors_.Reclaim();
+}
+
+void TrafficMaskEngine::RegisterSignatureProcessor(std::shared_ptr<ISignatureProcessor> processor) {
+    // Шарды не блокируются: новый снимок процессоров публикуется атомарно,
+    // пакеты в обработке дочитывают предыдущий
     if (processor && processor->IsActive()) {
-        signature_processors_.push_back(processor);
-        std::cout << "Registered signature processor: " << processor->GetSignatureId() << std::endl;
+        SignatureId signature_id = processor->GetSignatureId();
+        ProtocolMask protocols = processor->GetHandledProtocols();
+        PatternSet patterns = processor->GetPatterns();
+        bool defers_edits = processor->DefersPayloadEdits();
+        signature_processors_.Add(std::move(processor), protocols, std::move(patterns), defers_edits);
+        std::cout << "Registered signature processor: " << signature_id << std::endl;
     }
 }
 
 void TrafficMaskEngine::UnregisterSignatureProcessor(const SignatureId& signature_id) {
-    std::lock_guard<std::mutex> lock(engine_mutex_);
-    
-    auto it = std::find_if(signature_processors_.begin(), signature_processors_.end(),
-        [&signature_id](const std::shared_ptr<ISignatureProcessor>& processor) {
-            return processor->GetSignatureId() == signature_id;
-        });
+    bool removed = signature_processors_.RemoveIf([&signature_id](const ISignatureProcessor& processor) {
+        return processor.GetSignatureId() == signature_id;
+    });
     
-    if (it != signature_processors_.end()) {
-        signature_processors_.erase(it);
+    if (removed) {
         std::cout << "Unregistered signature processor: " << signature_id << std::endl;
     }
 }
@@ -102,33 +302,257 @@ bool TrafficMaskEngine::LoadConfiguration(const std::string& config_path) {
     
     // Простая загрузка конфигурации (в реальном проекте используйте JSON/YAML)
     std::string line;
+    std::string section;
     while (std::getline(config_file, line)) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back(); // Конфигурация может быть сохранена с CRLF
+        }
+        
         if (line.empty() || line[0] == '#') {
             continue; // Пропускаем пустые строки и комментарии
         }
         
-        // Здесь можно добавить парсинг конфигурации
+        // Строка без отступа задает текущую секцию верхнего уровня
+        if (line[0] != ' ') {
+            section = line.substr(0, line.find(':'));
+        } else if (section == "cpp_core") {
+            ParseCoreOption(line);
+        }
+        
         std::cout << "Config loaded: " << line << std::endl;
     }
     
     return true;
 }
 
-void TrafficMaskEngine::ProcessSignatureMasking(Packet& packet) {
-    bool was_masked = false;
+void TrafficMaskEngine::ParseCoreOption(const std::string& line) {
+    size_t colon = line.find(':');
+    if (colon == std::string::npos) {
+        return;
+    }
+    
+    std::string key = line.substr(0, colon);
+    key.erase(0, key.find_first_not_of(' '));
+    
+    std::string value = line.substr(colon + 1);
+    value = value.substr(0, value.find('#'));
+    
+    size_t number = 0;
+    try {
+        number = std::stoul(value);
+    } catch (const std::exception&) {
+        return; // Нечисловые параметры ядро не использует
+    }
+    
+    if (key == "history_depth" && number > 0) {
+        config_.history_depth = number;
+    } else if (key == "flow_idle_timeout_sec" && number > 0) {
+        config_.flow_idle_timeout_ms = number * 1000;
+    } else if (key == "flow_max_lifetime_sec" && number > 0) {
+        config_.flow_max_lifetime_ms = number * 1000;
+    } else if (key == "flow_memory_budget_mb") {
+        config_.flow_memory_budget_bytes = number * 1024 * 1024;
+    } else if (key == "flow_verdict_window") {
+        config_.flow_verdict_window = number;
+    }
+}
+
+EngineShard& TrafficMaskEngine::GetShard(FlowId flow_id) {
+    return *shards_[FlowHash(flow_id) % shards_.size()];
+}
+
+std::vector<std::unique_lock<std::mutex>> TrafficMaskEngine::LockAllShards() {
+    // Блокируем шарды всегда в одном порядке, чтобы исключить взаимоблокировку
+    std::vector<std::unique_lock<std::mutex>> locks;
+    locks.reserve(shards_.size());
+    for (auto& shard : shards_) {
+        locks.emplace_back(shard->mutex);
+    }
+    return locks;
+}
+
+void TrafficMaskEngine::NotifyConnectionClosed(FlowId flow_id) {
+    ProcessorRegistry::Snapshot processors(signature_processors_);
+    for (const ProcessorStage& stage : processors) {
+        stage.processor->OnConnectionClosed(flow_id);
+    }
+    
+    // Забываем строковое имя потока; flow_id не переиспользуется,
+    // поэтому устаревший идентификатор не совпадет с новым соединением
+    std::lock_guard<std::mutex> lock(flow_names_mutex_);
+    auto it = flow_names_.find(flow_id);
+    if (it != flow_names_.end()) {
+        flow_ids_.erase(it->second);
+        flow_names_.erase(it);
+    }
+}
+
+void TrafficMaskEngine::ProcessSignatureMasking(EngineShard& shard, Packet& packet, FlowVerdict& verdict) {
+    ProtocolClass protocol = packet.context->protocol;
+    ProcessorRegistry::Snapshot processors(signature_processors_);
+    
+    // После окна детекта поток, который никто не маскировал, обходит процессоры
+    StageMask stages = verdict.Select(processors.Version(), protocol, config_.flow_verdict_window);
+    
+    // Пакет, который общая база не сканирует, разрывает поток байтов
+    // направления: поиск в следующем пакете начнется заново
+    const PatternDatabase* patterns = processors.Patterns();
+    bool scan_patterns = patterns && (stages & processors.PatternStages(protocol)) != 0;
+    if (!scan_patterns) {
+        packet.context->stream->Reset();
+    }
+    
+    if (stages == 0) {
+        shard.bypassed_packets.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
     
-    // Применяем все активные процессоры сигнатур
-    for (auto& processor : signature_processors_) {
-        if (processor && processor->IsActive()) {
-            if (processor->ProcessPacket(packet)) {
-                was_masked = true;
+    // Временные данные процессоров живут в арене потока до конца пакета
+    ScratchArena& arena = ScratchArena::ForCurrentThread();
+    ScratchArena::Scope scratch(arena);
+    
+    // Шаблоны всех процессоров ищутся одним проходом общей базы,
+    // продолжая поиск с места, где остановился предыдущий пакет направления
+    if (scan_patterns) {
+        size_t word_count = patterns->GetWordCount();
+        auto* words = static_cast<uint64_t*>(arena.Allocate(word_count * sizeof(uint64_t), alignof(uint64_t)));
+        patterns->Scan(packet.data.data(), packet.data.size(), words, *packet.context->stream, processors.Version());
+        packet.context->patterns = {words, word_count};
+    }
+    
+    // Применяем активные процессоры сигнатур, которым нужен класс пакета
+    // и которые оставил вердикт потока
+    StageMask masked_by = 0;
+    size_t index = 0;
+    for (const ProcessorStage& stage : processors) {
+        StageMask bit = StageBit(index++);
+        if ((stages & bit) != 0 && (stage.protocols & ProtocolBit(protocol)) != 0 &&
+            stage.processor->IsActive()) {
+            // Процессор без отложенных правок видит собранный пакет
+            if (!stage.defers_edits) {
+                CommitPayloadEdits(packet);
             }
+            if (stage.processor->ProcessPacket(packet)) {
+                masked_by |= bit;
+                
+                // Payload изменен: следующие процессоры проверяют его сами
+                packet.context->patterns = PatternMatches();
+            }
+        }
+    }
+    CommitPayloadEdits(packet);
+    CommitChecksumFixup(packet);
+    
+    verdict.Record(protocol, masked_by, config_.flow_verdict_window);
+    if (masked_by != 0) {
+        shard.masked_packets.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+size_t TrafficMaskEngine::ProcessShardBatch(EngineShard& shard, const ProcessorRegistry::Snapshot& processors,
+                                            PacketBatch& batch, size_t begin, size_t end) {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    
+    if (!is_initialized_.load(std::memory_order_relaxed)) {
+        return 0;
+    }
+    
+    shard.processed_packets.fetch_add(end - begin, std::memory_order_relaxed);
+    FlowTable& flows = shard.connection_buffer;
+    size_t window = config_.flow_verdict_window;
+    batch.Classify(begin, end);
+    
+    // Вердикты запоминаются до конца группы: после процессоров они
+    // обновляются в порядке пакетов
+    thread_local std::vector<FlowVerdict*> verdicts;
+    verdicts.resize(batch.Size());
+    
+    // Вытеснение откладывается до конца группы: история каждого пакета
+    // должна оставаться валидной, пока его обрабатывают процессоры
+    size_t bypassed = 0;
+    flows.Expire(batch.packets[begin]->timestamp);
+    for (size_t i = begin; i < end; ++i) {
+        size_t ahead = i + kBatchPrefetchDistance;
+        if (ahead < end) {
+            flows.Prefetch(batch.flow_ids[ahead]);
+            TRAFFICMASK_PREFETCH(batch.payloads[ahead]);
+        }
+        
+        FlowEntry& flow = flows.TrackInBatch(*batch.packets[i]);
+        batch.contexts[i].history = &flow.history;
+        batch.contexts[i].stream = &flow.streams[batch.directions[i]];
+        batch.packets[i]->context = &batch.contexts[i];
+        batch.stages[i] = flow.verdict.Select(processors.Version(), batch.protocols[i], window);
+        verdicts[i] = &flow.verdict;
+        bypassed += batch.stages[i] == 0;
+        
+        // Обойденный пакет не сканируется и разрывает поток направления;
+        // остальные пропуски сбрасывает ScanPatterns
+        if (batch.stages[i] == 0) {
+            flow.streams[batch.directions[i]].Reset();
         }
     }
     
-    if (was_masked) {
-        masked_packets_++;
+    // Группа, целиком обходящая процессоры, не проходит по ступеням
+    if (bypassed != end - begin) {
+        ProcessSignatureBatch(processors, batch, begin, end);
+    }
+    
+    for (size_t i = begin; i < end; ++i) {
+        if (batch.stages[i] != 0) {
+            verdicts[i]->Record(batch.protocols[i], batch.masked_stages[i], window);
+        }
+        batch.packets[i]->context = nullptr;
+    }
+    flows.FinishBatch(batch.packets[end - 1]->timestamp);
+    
+    size_t masked = batch.CountMasked(begin, end);
+    if (masked != 0) {
+        shard.masked_packets.fetch_add(masked, std::memory_order_relaxed);
+    }
+    if (bypassed != 0) {
+        shard.bypassed_packets.fetch_add(bypassed, std::memory_order_relaxed);
+    }
+    
+    return end - begin;
+}
+
+void TrafficMaskEngine::ProcessSignatureBatch(const ProcessorRegistry::Snapshot& processors,
+                                              PacketBatch& batch, size_t begin, size_t end) {
+    // Процессоры применяются в порядке регистрации, как и в ProcessPacket,
+    // но каждый получает всю группу шарда за один вызов; арена потока
+    // откатывается после каждого прохода. Процессор получает только пакеты
+    // своих классов, оставленные ему вердиктами потоков, и не вызывается,
+    // если таких пакетов в группе нет
+    ScratchArena& arena = ScratchArena::ForCurrentThread();
+    ScratchArena::Scope group_scratch(arena);
+    
+    // Шаблоны всех процессоров ищутся одним проходом общей базы на пакет
+    const PatternDatabase* patterns = processors.Patterns();
+    if (patterns) {
+        size_t words = (end - begin) * patterns->GetWordCount();
+        batch.ScanPatterns(*patterns, processors, begin, end,
+                           static_cast<uint64_t*>(arena.Allocate(words * sizeof(uint64_t), alignof(uint64_t))));
+    }
+    
+    size_t index = 0;
+    for (const ProcessorStage& stage : processors) {
+        size_t stage_index = index++;
+        if (!batch.SelectForStage(begin, end, stage_index, stage.protocols) ||
+            !stage.processor->IsActive()) {
+            continue;
+        }
+        
+        ScratchArena::Scope scratch(arena);
+        if (!stage.defers_edits) {
+            batch.CommitSelectedEdits();
+        }
+        stage.processor->ProcessBatch(batch);
+        batch.RefreshPayloads();
+        batch.CollectMasked(stage_index);
     }
+    batch.CommitEdits(begin, end);
+    batch.CommitChecksumFixups(begin, end);
 }
 
-} // namespace TrafficMask
+} // namespace TrafficMask
\ No newline at end of file
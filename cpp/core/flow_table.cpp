@@ -0,0 +1,190 @@
+#include "flow_table.h"
+
+namespace TrafficMask {
+
+// Приблизительные накладные расходы узла unordered_map
+static constexpr size_t kFlowNodeOverhead = 64;
+
+FlowTable::FlowTable()
+    : lru_head_(nullptr), lru_tail_(nullptr),
+      history_depth_(kDefaultHistoryDepth),
+      idle_timeout_ms_(kDefaultFlowIdleTimeoutMs),
+      max_lifetime_ms_(kDefaultFlowMaxLifetimeMs),
+      memory_budget_bytes_(0), memory_used_(0),
+      idle_evictions_(0), lifetime_evictions_(0), memory_evictions_(0) {
+}
+
+FlowTable::~FlowTable() {
+    flows_.clear();
+}
+
+void FlowTable::Configure(const EngineConfig& config, size_t memory_budget_bytes) {
+    Clear();
+    
+    history_depth_ = config.history_depth;
+    idle_timeout_ms_ = config.flow_idle_timeout_ms;
+    max_lifetime_ms_ = config.flow_max_lifetime_ms;
+    memory_budget_bytes_ = memory_budget_bytes;
+}
+
+FlowEntry& FlowTable::Track(const Packet& packet) {
+    Expire(packet.timestamp);
+    
+    FlowEntry& entry = TrackInBatch(packet);
+    EnforceBudget(&entry);
+    return entry;
+}
+
+FlowEntry& FlowTable::TrackInBatch(const Packet& packet) {
+    size_t now_ms = packet.timestamp;
+    auto result = flows_.try_emplace(packet.flow_id, packet.flow_id, history_depth_, now_ms);
+    FlowEntry& entry = result.first->second;
+    
+    if (result.second) {
+        LruPushFront(entry);
+        ScheduleTimer(entry);
+    } else {
+        entry.last_seen = now_ms;
+        if (lru_head_ != &entry) {
+            LruUnlink(entry);
+            LruPushFront(entry);
+        }
+    }
+    
+    entry.history.Push(packet.data, packet.timestamp, packet.is_incoming);
+    
+    // Память потока растет, только пока кольцо истории заполняется
+    size_t memory = EntryMemory(entry);
+    memory_used_ += memory - entry.memory_bytes;
+    entry.memory_bytes = memory;
+    
+    return entry;
+}
+
+void FlowTable::FinishBatch(size_t now_ms) {
+    Expire(now_ms);
+    EnforceBudget(nullptr);
+}
+
+void FlowTable::Prefetch(FlowId flow_id) const {
+    auto it = flows_.find(flow_id);
+    if (it != flows_.end()) {
+        it->second.history.PrefetchNext();
+    }
+}
+
+void FlowTable::Expire(size_t now_ms) {
+    timers_.Advance(now_ms / kFlowTimerTickMs, [this, now_ms](TimerNode& node) {
+        OnTimer(static_cast<FlowEntry&>(node), now_ms);
+    });
+}
+
+void FlowTable::Clear() {
+    for (auto& flow : flows_) {
+        timers_.Cancel(flow.second);
+    }
+    
+    flows_.clear();
+    lru_head_ = lru_tail_ = nullptr;
+    memory_used_ = 0;
+}
+
+FlowTableStats FlowTable::GetStats() const {
+    FlowTableStats stats;
+    stats.active_flows = flows_.size();
+    stats.memory_bytes = memory_used_;
+    stats.idle_evictions = idle_evictions_;
+    stats.lifetime_evictions = lifetime_evictions_;
+    stats.memory_evictions = memory_evictions_;
+    return stats;
+}
+
+size_t FlowTable::Deadline(const FlowEntry& entry) const {
+    return std::min(entry.last_seen + idle_timeout_ms_, entry.created_at + max_lifetime_ms_);
+}
+
+void FlowTable::ScheduleTimer(FlowEntry& entry) {
+    // Округляем вверх, чтобы таймер не срабатывал раньше срока
+    timers_.Schedule(entry, (Deadline(entry) + kFlowTimerTickMs - 1) / kFlowTimerTickMs);
+}
+
+void FlowTable::OnTimer(FlowEntry& entry, size_t now_ms) {
+    size_t deadline = Deadline(entry);
+    if (now_ms < deadline) {
+        // Поток был активен после постановки таймера - переносим срок
+        ScheduleTimer(entry);
+        return;
+    }
+    
+    bool lifetime_expired = entry.created_at + max_lifetime_ms_ <= deadline;
+    Evict(entry, lifetime_expired ? EvictReason::LIFETIME : EvictReason::IDLE);
+}
+
+void FlowTable::Evict(FlowEntry& entry, EvictReason reason) {
+    switch (reason) {
+        case EvictReason::IDLE:
+            idle_evictions_++;
+            break;
+        case EvictReason::LIFETIME:
+            lifetime_evictions_++;
+            break;
+        case EvictReason::MEMORY:
+            memory_evictions_++;
+            break;
+    }
+    
+    if (evict_callback_) {
+        evict_callback_(entry.key);
+    }
+    
+    timers_.Cancel(entry);
+    LruUnlink(entry);
+    memory_used_ -= entry.memory_bytes;
+    
+    flows_.erase(entry.key);
+}
+
+void FlowTable::EnforceBudget(const FlowEntry* current) {
+    if (memory_budget_bytes_ == 0) {
+        return;
+    }
+    
+    // Вытесняем самые давние потоки; текущий поток не трогаем
+    while (memory_used_ > memory_budget_bytes_ && lru_tail_ && lru_tail_ != current) {
+        Evict(*lru_tail_, EvictReason::MEMORY);
+    }
+}
+
+size_t FlowTable::EntryMemory(const FlowEntry& entry) const {
+    return sizeof(FlowEntry) + kFlowNodeOverhead + entry.history.GetMemoryUsage();
+}
+
+void FlowTable::LruPushFront(FlowEntry& entry) {
+    entry.lru_prev = nullptr;
+    entry.lru_next = lru_head_;
+    if (lru_head_) {
+        lru_head_->lru_prev = &entry;
+    }
+    lru_head_ = &entry;
+    if (!lru_tail_) {
+        lru_tail_ = &entry;
+    }
+}
+
+void FlowTable::LruUnlink(FlowEntry& entry) {
+    if (entry.lru_prev) {
+        entry.lru_prev->lru_next = entry.lru_next;
+    } else {
+        lru_head_ = entry.lru_next;
+    }
+    
+    if (entry.lru_next) {
+        entry.lru_next->lru_prev = entry.lru_prev;
+    } else {
+        lru_tail_ = entry.lru_prev;
+    }
+    
+    entry.lru_prev = entry.lru_next = nullptr;
+}
+
+} // namespace TrafficMask
@@ -0,0 +1,140 @@
+#pragma once
+
+#include "trafficmask.h"
+#include "timer_wheel.h"
+#include <functional>
+
+namespace TrafficMask {
+
+// Разрешение таймеров потоков
+constexpr size_t kFlowTimerTickMs = 100;
+
+// Вердикт потока: какие классы пакетов в нем встречались и какие ступени
+// конвейера его маскировали. Первые window пакетов (окно детекта) и пакеты
+// еще не встречавшихся классов проходят весь конвейер; остальные идут только
+// к ступеням, которые маскировали поток, а если таких нет - обходят
+// процессоры. Вердикт привязан к версии снимка процессоров и начинается
+// заново после регистрации или удаления процессора; window = 0 выключает отбор.
+struct FlowVerdict {
+    uint64_t pipeline_version = 0;
+    size_t packets = 0;             // пакетов в окне детекта (до window)
+    ProtocolMask protocols = 0;     // классы пакетов потока
+    StageMask masking_stages = 0;   // ступени, маскировавшие пакеты потока
+    
+    // Ступени, которым нужен очередной пакет класса protocol; 0 - обход
+    StageMask Select(uint64_t version, ProtocolClass protocol, size_t window) {
+        if (version != pipeline_version) {
+            *this = FlowVerdict();
+            pipeline_version = version;
+        }
+        
+        if (window == 0 || packets < window || (protocols & ProtocolBit(protocol)) == 0) {
+            return kAllStages;
+        }
+        return masking_stages;
+    }
+    
+    // Учитывает пакет, прошедший ступени: masked_by - ступени, которые его замаскировали
+    void Record(ProtocolClass protocol, StageMask masked_by, size_t window) {
+        if (packets < window) {
+            ++packets;
+        }
+        protocols |= ProtocolBit(protocol);
+        masking_stages |= masked_by;
+    }
+};
+
+// Состояние соединения внутри шарда: история, вердикт, потоковое
+// сканирование шаблонов, таймер и позиция в LRU
+struct FlowEntry : TimerNode {
+    FlowEntry(FlowId flow_id, size_t history_depth, size_t now_ms)
+        : key(flow_id), history(history_depth),
+          created_at(now_ms), last_seen(now_ms), memory_bytes(0),
+          lru_prev(nullptr), lru_next(nullptr) {}
+    
+    FlowId key;
+    FlowHistory history;
+    FlowVerdict verdict;
+    PatternStream streams[2];  // по направлениям: [0] - исходящее, [1] - входящее
+    size_t created_at;
+    size_t last_seen;
+    size_t memory_bytes;
+    
+    FlowEntry* lru_prev;
+    FlowEntry* lru_next;
+};
+
+// Таблица соединений шарда с вытеснением по простою, по времени жизни
+// и по бюджету памяти (в порядке LRU).
+// Стоимость на пакет - амортизированная O(1): таймер потока не переставляется
+// на каждом пакете, а при срабатывании сверяется с last_seen и при
+// необходимости переназначается. Полный обход таблицы не выполняется никогда.
+class FlowTable {
+public:
+    using EvictCallback = std::function<void(FlowId)>;
+    
+    FlowTable();
+    ~FlowTable();
+    
+    FlowTable(const FlowTable&) = delete;
+    FlowTable& operator=(const FlowTable&) = delete;
+    
+    void Configure(const EngineConfig& config, size_t memory_budget_bytes);
+    void SetEvictCallback(EvictCallback callback) { evict_callback_ = std::move(callback); }
+    
+    // Учитывает пакет: продвигает таймеры, находит или создает поток,
+    // добавляет пакет в историю и применяет бюджет памяти
+    FlowEntry& Track(const Packet& packet);
+    
+    // Пакетный режим: TrackInBatch не вытесняет потоки, чтобы состояние
+    // всех пакетов пачки пережило вызовы процессоров; вытеснение выполняется
+    // в FinishBatch после обработки пачки
+    FlowEntry& TrackInBatch(const Packet& packet);
+    void FinishBatch(size_t now_ms);
+    
+    // Предвыборка состояния потока, который будет обработан следующим
+    void Prefetch(FlowId flow_id) const;
+    
+    // Вытесняет потоки с истекшими таймерами без входящего пакета
+    void Expire(size_t now_ms);
+    void Clear();
+    
+    FlowTableStats GetStats() const;
+    
+private:
+    enum class EvictReason {
+        IDLE,
+        LIFETIME,
+        MEMORY
+    };
+    
+    std::unordered_map<FlowId, FlowEntry> flows_;
+    TimerWheel timers_;
+    
+    FlowEntry* lru_head_;  // самый свежий поток
+    FlowEntry* lru_tail_;  // самый давний поток
+    
+    size_t history_depth_;
+    size_t idle_timeout_ms_;
+    size_t max_lifetime_ms_;
+    size_t memory_budget_bytes_;  // 0 - без ограничения
+    size_t memory_used_;
+    
+    size_t idle_evictions_;
+    size_t lifetime_evictions_;
+    size_t memory_evictions_;
+    
+    EvictCallback evict_callback_;
+    
+    size_t Deadline(const FlowEntry& entry) const;
+    void ScheduleTimer(FlowEntry& entry);
+    void OnTimer(FlowEntry& entry, size_t now_ms);
+    void Evict(FlowEntry& entry, EvictReason reason);
+    void EnforceBudget(const FlowEntry* current);
+    size_t EntryMemory(const FlowEntry& entry) const;
+    
+    void LruPushFront(FlowEntry& entry);
+    void LruUnlink(FlowEntry& entry);
+};
+
+} // namespace TrafficMask
@@ -270,6 +270,7 @@ void DemonstrateTrafficMasking() {
     std::cout << "\n--- Statistics ---" << std::endl;
     std::cout << "Processed packets: " << engine.GetProcessedPackets() << std::endl;
     std::cout << "Masked packets: " << engine.GetMaskedPackets() << std::endl;
+    std::cout << "Bypassed packets: " << engine.GetBypassedPackets() << std::endl;
     
     // Завершаем работу
     engine.Shutdown();
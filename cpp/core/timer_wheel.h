@@ -0,0 +1,177 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+
+namespace TrafficMask {
+
+// Узел таймера, встраивается в объект-владелец (интрузивный список)
+struct TimerNode {
+    TimerNode* timer_prev = nullptr;
+    TimerNode* timer_next = nullptr;
+    uint64_t expires = 0;  // тик срабатывания
+    bool armed = false;
+};
+
+// Иерархическое колесо таймеров (схема Varghese/Lauck, как в ядре Linux).
+// Постановка и снятие таймера - O(1); продвижение на один тик - O(1)
+// плюс амортизированный каскад таймеров с верхних уровней.
+// Не потокобезопасно: используется под блокировкой шарда.
+class TimerWheel {
+public:
+    static constexpr unsigned kSlotBits = 6;
+    static constexpr size_t kSlots = size_t(1) << kSlotBits;
+    static constexpr size_t kLevels = 4;
+    static constexpr uint64_t kMaxDelta = (uint64_t(1) << (kSlotBits * kLevels)) - 1;
+    
+    TimerWheel() : current_(0), pending_(0) {
+        for (auto& level : wheel_) {
+            for (auto& slot : level) {
+                slot.timer_prev = slot.timer_next = &slot;
+            }
+        }
+    }
+    
+    TimerWheel(const TimerWheel&) = delete;
+    TimerWheel& operator=(const TimerWheel&) = delete;
+    
+    void Schedule(TimerNode& node, uint64_t expires) {
+        if (node.armed) {
+            Cancel(node);
+        }
+        
+        node.expires = expires;
+        node.armed = true;
+        ++pending_;
+        Insert(node);
+    }
+    
+    void Cancel(TimerNode& node) {
+        if (!node.armed) {
+            return;
+        }
+        
+        Unlink(node);
+        node.armed = false;
+        --pending_;
+    }
+    
+    // Продвигает колесо до тика now включительно и вызывает on_expire
+    // для каждого сработавшего таймера. Таймер снимается до вызова, поэтому
+    // обработчик может переназначить его или уничтожить владельца.
+    // Должно вызываться до первой постановки таймера, чтобы задать начало отсчета.
+    template<typename Fn>
+    void Advance(uint64_t now, Fn&& on_expire) {
+        if (pending_ == 0) {
+            // Пустое колесо: перематываем время без обхода слотов
+            if (now >= current_) {
+                current_ = now + 1;
+            }
+            return;
+        }
+        
+        while (current_ <= now) {
+            size_t index = current_ & (kSlots - 1);
+            if (index == 0) {
+                for (size_t level = 1; level < kLevels; ++level) {
+                    if (Cascade(level) != 0) {
+                        break;
+                    }
+                }
+            }
+            ++current_;
+            
+            // Слот забирается целиком: переназначенный обработчиком таймер
+            // не сработает повторно в этом же проходе
+            TimerNode expired;
+            Detach(wheel_[0][index], expired);
+            while (expired.timer_next != &expired) {
+                TimerNode& node = *expired.timer_next;
+                Unlink(node);
+                node.armed = false;
+                --pending_;
+                on_expire(node);
+            }
+            
+            if (pending_ == 0) {
+                current_ = now + 1;
+                break;
+            }
+        }
+    }
+    
+    uint64_t GetCurrentTick() const { return current_; }
+    size_t GetPendingCount() const { return pending_; }
+    
+private:
+    std::array<std::array<TimerNode, kSlots>, kLevels> wheel_;
+    uint64_t current_;
+    size_t pending_;
+    
+    static void Unlink(TimerNode& node) {
+        node.timer_prev->timer_next = node.timer_next;
+        node.timer_next->timer_prev = node.timer_prev;
+        node.timer_prev = node.timer_next = nullptr;
+    }
+    
+    static void Append(TimerNode& head, TimerNode& node) {
+        node.timer_prev = head.timer_prev;
+        node.timer_next = &head;
+        head.timer_prev->timer_next = &node;
+        head.timer_prev = &node;
+    }
+    
+    // Переносит все узлы слота head в пустой список list
+    static void Detach(TimerNode& head, TimerNode& list) {
+        list.timer_prev = list.timer_next = &list;
+        if (head.timer_next == &head) {
+            return;
+        }
+        
+        list.timer_next = head.timer_next;
+        list.timer_prev = head.timer_prev;
+        list.timer_next->timer_prev = &list;
+        list.timer_prev->timer_next = &list;
+        head.timer_prev = head.timer_next = &head;
+    }
+    
+    void Insert(TimerNode& node) {
+        if (node.expires < current_) {
+            // Просроченный таймер срабатывает на ближайшем тике
+            Append(wheel_[0][current_ & (kSlots - 1)], node);
+            return;
+        }
+        
+        uint64_t delta = node.expires - current_;
+        if (delta > kMaxDelta) {
+            node.expires = current_ + kMaxDelta;
+            delta = kMaxDelta;
+        }
+        
+        size_t level = 0;
+        while (level + 1 < kLevels && delta >= (uint64_t(1) << (kSlotBits * (level + 1)))) {
+            ++level;
+        }
+        
+        size_t slot = (node.expires >> (kSlotBits * level)) & (kSlots - 1);
+        Append(wheel_[level][slot], node);
+    }
+    
+    // Переносит таймеры текущего слота уровня level на нижние уровни
+    size_t Cascade(size_t level) {
+        size_t index = (current_ >> (kSlotBits * level)) & (kSlots - 1);
+        TimerNode list;
+        Detach(wheel_[level][index], list);
+        
+        while (list.timer_next != &list) {
+            TimerNode& node = *list.timer_next;
+            Unlink(node);
+            Insert(node);
+        }
+        
+        return index;
+    }
+};
+
+} // namespace TrafficMask
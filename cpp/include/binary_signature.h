@@ -0,0 +1,373 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace TrafficMask {
+
+// Ошибка разбора бинарной сигнатуры
+class BinarySignatureError : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+// Бинарная сигнатура с привязкой к смещениям: заголовок TLS, DNS, IPv4,
+// VLESS проверяется за несколько сравнений вместо поиска regex по всему
+// payload. Сигнатура - элементы через пробел, каждый на своем смещении
+// от начала пакета (или от конца последнего пропущенного поля skipN):
+//   16        байт 0x16
+//   ??        любой байт
+//   +N        N любых байт (N десятичное)
+//   40&F0     байт b, у которого (b & 0xF0) == 0x40
+//   01-03     байт в диапазоне 0x01..0x03
+//   lenN      поле длины N бит (8/16/24/32, big-endian): столько байт
+//             должно идти за полем
+//   totalN    поле полной длины от начала пакета: не меньше уже
+//             прочитанного и не больше размера пакета (как в IPv4)
+//   skipN     поле длины, за которым пропускается столько байт; следующие
+//             элементы отсчитываются от конца пропущенных данных
+// Все перечисленные байты должны присутствовать в пакете.
+// Пример, TLS ClientHello: "16 03 00-03 len16 01 +3 03 00-04".
+// Сигнатура компилируется при загрузке в байткод: соседние точные,
+// маскированные и любые байты сливаются в сравнение до 8 байт одним
+// словом ((слово & маска) == значение), поэтому проверка заголовка -
+// несколько инструкций без цикла по байтам.
+class BinarySignature {
+public:
+    // Компилирует сигнатуру; бросает BinarySignatureError
+    explicit BinarySignature(std::string_view text) {
+        Compiler compiler(*this);
+        size_t pos = 0;
+        while (pos < text.size()) {
+            if (text[pos] == ' ' || text[pos] == '\t') {
+                ++pos;
+                continue;
+            }
+            size_t end = text.find_first_of(" \t", pos);
+            end = end == std::string_view::npos ? text.size() : end;
+            compiler.Token(text.substr(pos, end - pos));
+            pos = end;
+        }
+        compiler.Finish();
+        
+        if (ops_.empty()) {
+            throw BinarySignatureError("empty binary signature");
+        }
+    }
+    
+    bool Matches(const uint8_t* data, size_t size) const {
+        if (size < min_size_) {
+            return false;
+        }
+        
+        size_t cursor = 0;
+        for (const Op& op : ops_) {
+            size_t at = cursor + op.offset;
+            if (at > size || size - at < op.width) {
+                return false;
+            }
+            
+            switch (op.code) {
+                case OpCode::COMPARE:
+                    if ((LoadWord(data + at, size - at, op.width) & op.mask) != op.value) {
+                        return false;
+                    }
+                    break;
+                case OpCode::RANGE:
+                    if (static_cast<uint8_t>(data[at] - op.low) > op.span) {
+                        return false;
+                    }
+                    break;
+                case OpCode::LENGTH:
+                    if (size - at - op.width < ReadLength(data + at, op.width)) {
+                        return false;
+                    }
+                    break;
+                case OpCode::TOTAL_LENGTH: {
+                    uint64_t total = ReadLength(data + at, op.width);
+                    if (total < at + op.width || total > size) {
+                        return false;
+                    }
+                    break;
+                }
+                case OpCode::SKIP: {
+                    uint64_t length = ReadLength(data + at, op.width);
+                    if (length > size - at - op.width) {
+                        return false;
+                    }
+                    cursor = at + op.width + static_cast<size_t>(length);
+                    break;
+                }
+                case OpCode::REQUIRE:
+                    break;
+            }
+        }
+        return true;
+    }
+    
+    // Минимальный размер пакета, при котором сигнатура может совпасть
+    size_t GetMinSize() const { return min_size_; }
+    size_t GetOpCount() const { return ops_.size(); }
+    
+private:
+    enum class OpCode : uint8_t {
+        COMPARE,       // (слово & mask) == value, width байт
+        RANGE,         // low <= байт <= low + span
+        LENGTH,        // за полем помещается указанное в нем число байт
+        TOTAL_LENGTH,  // поле полной длины пакета
+        SKIP,          // поле длины, курсор переходит за данные
+        REQUIRE        // только проверка, что width байт есть в пакете
+    };
+    
+    struct Op {
+        OpCode code;
+        uint8_t width;        // байт, которые читает инструкция
+        uint8_t low = 0;
+        uint8_t span = 0;
+        uint32_t offset = 0;  // от курсора
+        uint64_t mask = 0;
+        uint64_t value = 0;
+        
+        Op(OpCode op_code, size_t op_width) : code(op_code), width(static_cast<uint8_t>(op_width)) {}
+    };
+    
+    std::vector<Op> ops_;
+    size_t min_size_ = 0;
+    
+    // Слово из width байт; маска обнуляет лишнее, поэтому при 8 байтах
+    // в запасе читается целое слово одной загрузкой, а побайтно -
+    // только у самого конца пакета
+    static uint64_t LoadWord(const uint8_t* data, size_t available, size_t width) {
+        uint64_t word = 0;
+        if (available >= sizeof(word)) {
+            std::memcpy(&word, data, sizeof(word));
+        } else {
+            uint8_t bytes[sizeof(word)] = {};
+            for (size_t i = 0; i < width; ++i) {
+                bytes[i] = data[i];
+            }
+            std::memcpy(&word, bytes, sizeof(word));
+        }
+        return word;
+    }
+    
+    static uint64_t ReadLength(const uint8_t* data, size_t width) {
+        uint64_t length = 0;
+        for (size_t i = 0; i < width; ++i) {
+            length = (length << 8) | data[i];
+        }
+        return length;
+    }
+    
+    // Разбор элементов: байты копятся в группу сравнения, пока она
+    // не заполнится или не встретится другой элемент
+    class Compiler {
+    public:
+        explicit Compiler(BinarySignature& signature) : signature_(signature) {}
+        
+        void Token(std::string_view token) {
+            if (token == "??") {
+                AddByte(0, 0);
+            } else if (token[0] == '+') {
+                size_t count = ParseDecimal(token.substr(1), token);
+                for (size_t i = 0; i < count; ++i) {
+                    AddByte(0, 0);
+                }
+            } else if (StartsWith(token, "len")) {
+                AddField(OpCode::LENGTH, token.substr(3), token);
+            } else if (StartsWith(token, "total")) {
+                AddField(OpCode::TOTAL_LENGTH, token.substr(5), token);
+            } else if (StartsWith(token, "skip")) {
+                AddField(OpCode::SKIP, token.substr(4), token);
+            } else if (token.size() == 5 && token[2] == '&') {
+                uint8_t value = ParseHex(token.substr(0, 2), token);
+                uint8_t mask = ParseHex(token.substr(3), token);
+                if ((value & ~mask) != 0) {
+                    Fail("value has bits outside the mask", token);
+                }
+                AddByte(value, mask);
+            } else if (token.size() == 5 && token[2] == '-') {
+                uint8_t low = ParseHex(token.substr(0, 2), token);
+                uint8_t high = ParseHex(token.substr(3), token);
+                if (low > high) {
+                    Fail("empty byte range", token);
+                }
+                FlushGroup();
+                Op op(OpCode::RANGE, 1);
+                op.low = low;
+                op.span = static_cast<uint8_t>(high - low);
+                Emit(op, offset_);
+                ++offset_;
+            } else if (token.size() == 2) {
+                AddByte(ParseHex(token, token), 0xFF);
+            } else {
+                Fail("unknown element", token);
+            }
+        }
+        
+        void Finish() {
+            FlushGroup();
+            // Хвост из любых байт проверяется только по наличию
+            if (offset_ > covered_) {
+                Emit(Op(OpCode::REQUIRE, 0), offset_);
+            }
+        }
+        
+    private:
+        BinarySignature& signature_;
+        size_t offset_ = 0;      // текущая позиция от курсора
+        size_t covered_ = 0;     // до какой позиции проверено наличие байт
+        bool after_skip_ = false;
+        size_t group_start_ = 0;
+        size_t group_size_ = 0;
+        uint8_t group_mask_[8] = {};
+        uint8_t group_value_[8] = {};
+        
+        void AddByte(uint8_t value, uint8_t mask) {
+            if (group_size_ == 0) {
+                if (mask == 0) {
+                    ++offset_;
+                    return;
+                }
+                group_start_ = offset_;
+            }
+            group_mask_[group_size_] = mask;
+            group_value_[group_size_] = value;
+            ++group_size_;
+            ++offset_;
+            if (group_size_ == sizeof(group_mask_)) {
+                FlushGroup();
+            }
+        }
+        
+        void FlushGroup() {
+            // Любые байты в конце группы не сравниваются
+            while (group_size_ > 0 && group_mask_[group_size_ - 1] == 0) {
+                --group_size_;
+            }
+            if (group_size_ == 0) {
+                return;
+            }
+            
+            Op op(OpCode::COMPARE, group_size_);
+            uint8_t mask[8] = {};
+            uint8_t value[8] = {};
+            std::memcpy(mask, group_mask_, group_size_);
+            std::memcpy(value, group_value_, group_size_);
+            std::memcpy(&op.mask, mask, sizeof(op.mask));
+            std::memcpy(&op.value, value, sizeof(op.value));
+            Emit(op, group_start_);
+            group_size_ = 0;
+        }
+        
+        void AddField(OpCode code, std::string_view bits, std::string_view token) {
+            size_t bit_count = ParseDecimal(bits, token);
+            size_t width = bit_count / 8;
+            if (bit_count % 8 != 0 || width == 0 || width > 4) {
+                Fail("length field must be 8, 16, 24 or 32 bits", token);
+            }
+            
+            FlushGroup();
+            Emit(Op(code, width), offset_);
+            if (code == OpCode::SKIP) {
+                // Дальше позиции отсчитываются от конца пропущенных данных
+                offset_ = covered_ = 0;
+                after_skip_ = true;
+            } else {
+                offset_ += width;
+            }
+        }
+        
+        void Emit(Op op, size_t offset) {
+            if (offset > UINT32_MAX) {
+                Fail("offset is too large", "");
+            }
+            op.offset = static_cast<uint32_t>(offset);
+            signature_.ops_.push_back(op);
+            covered_ = std::max(covered_, offset + op.width);
+            if (!after_skip_) {
+                signature_.min_size_ = std::max(signature_.min_size_, covered_);
+            }
+        }
+        
+        static bool StartsWith(std::string_view token, std::string_view prefix) {
+            return token.substr(0, prefix.size()) == prefix;
+        }
+        
+        static uint8_t ParseHex(std::string_view digits, std::string_view token) {
+            if (digits.size() != 2) {
+                Fail("expected two hex digits", token);
+            }
+            unsigned value = 0;
+            for (char c : digits) {
+                unsigned digit;
+                if (c >= '0' && c <= '9') {
+                    digit = c - '0';
+                } else if (c >= 'a' && c <= 'f') {
+                    digit = c - 'a' + 10;
+                } else if (c >= 'A' && c <= 'F') {
+                    digit = c - 'A' + 10;
+                } else {
+                    Fail("expected two hex digits", token);
+                }
+                value = value * 16 + digit;
+            }
+            return static_cast<uint8_t>(value);
+        }
+        
+        static size_t ParseDecimal(std::string_view digits, std::string_view token) {
+            if (digits.empty() || digits.size() > 6) {
+                Fail("expected a decimal number", token);
+            }
+            size_t value = 0;
+            for (char c : digits) {
+                if (c < '0' || c > '9') {
+                    Fail("expected a decimal number", token);
+                }
+                value = value * 10 + static_cast<size_t>(c - '0');
+            }
+            return value;
+        }
+        
+        [[noreturn]] static void Fail(const char* message, std::string_view token) {
+            throw BinarySignatureError(std::string(message) + " in '" + std::string(token) + "'");
+        }
+    };
+};
+
+// Бинарные сигнатуры процессора; пакет совпадает, если совпала любая
+class BinarySignatureSet {
+public:
+    void Add(std::string_view text) {
+        signatures_.emplace_back(text);
+        min_size_ = signatures_.size() == 1 ? signatures_.back().GetMinSize()
+                                            : std::min(min_size_, signatures_.back().GetMinSize());
+    }
+    
+    bool Empty() const { return signatures_.empty(); }
+    size_t Size() const { return signatures_.size(); }
+    
+    bool Matches(const uint8_t* data, size_t size) const {
+        if (signatures_.empty() || size < min_size_) {
+            return false;
+        }
+        for (const BinarySignature& signature : signatures_) {
+            if (signature.Matches(data, size)) {
+                return true;
+            }
+        }
+        return false;
+    }
+    
+private:
+    std::vector<BinarySignature> signatures_;
+    size_t min_size_ = 0;
+};
+
+} // namespace TrafficMask
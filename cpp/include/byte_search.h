@@ -0,0 +1,668 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TRAFFICMASK_BYTE_SEARCH_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+// AVX2-ядра компилируются для отдельной цели и выбираются во время выполнения,
+// поэтому сборка не требует -mavx2 и работает на процессорах без AVX2
+#if defined(TRAFFICMASK_BYTE_SEARCH_X86) && (defined(__GNUC__) || defined(__clang__))
+#define TRAFFICMASK_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TRAFFICMASK_TARGET_AVX2
+#endif
+
+// Редкие длинные ветви выносятся из встраиваемых функций, чтобы короткий
+// путь оставался встроенным в цикл вызывающего
+#if defined(__GNUC__) || defined(__clang__)
+#define TRAFFICMASK_NOINLINE __attribute__((noinline))
+#elif defined(_MSC_VER)
+#define TRAFFICMASK_NOINLINE __declspec(noinline)
+#else
+#define TRAFFICMASK_NOINLINE
+#endif
+
+namespace TrafficMask {
+
+// Поиск подстрок в payload. Участки короче kPairSearchMinSize ищутся
+// ровно как в string_view::find: memchr по первому байту и сравнение. На
+// длинных сначала так же memchr ищет первый байт подстроки: на зашифрованном трафике он встречается редко, и
+// memchr проверяет всего один байт на позицию. Если ложных кандидатов
+// больше, чем в случайных данных (текст, частые '/', 'e', ' '), поиск
+// переходит на пары байтов: позиция - кандидат, если на ней стоит первый
+// байт, а со сдвигом shift - последний (не дальше 63-го). Обе проверки
+// делаются сразу для 64 позиций, блок без кандидатов отбрасывается одной
+// проверкой вектора, кандидаты сравниваются целиком
+namespace ByteSearch {
+
+constexpr size_t kNotFound = std::string_view::npos;
+constexpr size_t kBlockSize = 64;
+
+// На пакетах демонстрации (десятки байт) счет промахов и переход к парам
+// байтов стоили дороже, чем экономили: до этого размера - только memchr
+constexpr size_t kPairSearchMinSize = 256;
+
+// memchr уступает парам байтов, когда ложных кандидатов сверх kExtraMisses
+// больше одного на kMissDistance байт - вчетверо чаще, чем байт встречается
+// в случайных данных: проверка идет после каждого промаха, и порог по
+// среднему срабатывал бы на случайных скоплениях в зашифрованном трафике
+constexpr size_t kMissDistance = 64;
+constexpr size_t kExtraMisses = 4;
+
+// Результат FindByFirstByte: первый байт слишком част для memchr
+constexpr size_t kFrequentFirstByte = kNotFound - 1;
+
+inline unsigned CountTrailingZeros(uint64_t mask) {
+#if defined(_MSC_VER) && !defined(__clang__) && defined(_M_X64)
+    unsigned long index;
+    _BitScanForward64(&index, mask);
+    return static_cast<unsigned>(index);
+#elif defined(_MSC_VER) && !defined(__clang__)
+    unsigned long index;
+    if (_BitScanForward(&index, static_cast<uint32_t>(mask))) {
+        return static_cast<unsigned>(index);
+    }
+    _BitScanForward(&index, static_cast<uint32_t>(mask >> 32));
+    return static_cast<unsigned>(index) + 32;
+#else
+    return static_cast<unsigned>(__builtin_ctzll(mask));
+#endif
+}
+
+// Сдвиг второго проверяемого байта; блок читает kBlockSize + shift байт
+inline size_t ProbeShift(size_t length) {
+    return std::min(length - 1, kBlockSize - 1);
+}
+
+// length >= 1
+inline size_t FindScalar(const uint8_t* data, size_t size, const uint8_t* needle, size_t length, size_t from) {
+    const uint8_t* end = data + size - length + 1;
+    for (const uint8_t* cursor = data + from; cursor < end; ++cursor) {
+        cursor = static_cast<const uint8_t*>(std::memchr(cursor, needle[0], end - cursor));
+        if (!cursor) {
+            return kNotFound;
+        }
+        if (std::memcmp(cursor, needle, length) == 0) {
+            return cursor - data;
+        }
+    }
+    return kNotFound;
+}
+
+// FindScalar, который сдается при частом первом байте, если впереди есть
+// хотя бы блок: возвращает kFrequentFirstByte, а в from - первую
+// непроверенную позицию
+inline size_t FindByFirstByte(const uint8_t* data, size_t size, const uint8_t* needle, size_t length, size_t& from) {
+    const uint8_t* end = data + size - length + 1;
+    const uint8_t* start = data + from;
+    const uint8_t* cursor = start;
+    size_t misses = 0;
+    while (cursor < end) {
+        const uint8_t* hit = static_cast<const uint8_t*>(std::memchr(cursor, needle[0], end - cursor));
+        if (!hit) {
+            return kNotFound;
+        }
+        if (std::memcmp(hit + 1, needle + 1, length - 1) == 0) {
+            return hit - data;
+        }
+        cursor = hit + 1;
+        if (++misses > kExtraMisses && static_cast<size_t>(cursor - start) < (misses - kExtraMisses) * kMissDistance &&
+            static_cast<size_t>(end - cursor) >= kBlockSize + ProbeShift(length)) {
+            from = cursor - data;
+            return kFrequentFirstByte;
+        }
+    }
+    return kNotFound;
+}
+
+// Первый кандидат из mask (бит - позиция от base), совпавший целиком
+inline size_t VerifyCandidates(uint64_t mask, const uint8_t* data, size_t size, size_t base,
+                               const uint8_t* needle, size_t length) {
+    for (; mask != 0; mask &= mask - 1) {
+        size_t pos = base + CountTrailingZeros(mask);
+        if (pos + length > size) {
+            return kNotFound;  // Подстроки длиннее блока: дальше не помещается
+        }
+        if (std::memcmp(data + pos, needle, length) == 0) {
+            return pos;
+        }
+    }
+    return kNotFound;
+}
+
+// Поиск без учета регистра ASCII: байты вне 'A'-'Z' и 'a'-'z' сравниваются
+// точно. В векторных ядрах к данным добавляется бит 0x20 только для тех
+// проверяемых байтов подстроки, которые являются буквами: x | 0x20 == 'a'
+// лишь для 'a' и 'A', поэтому кандидаты так же точны, как без учета регистра,
+// а цена - одно OR на загрузку
+inline uint8_t FoldAscii(uint8_t byte) {
+    return static_cast<uint8_t>(byte - 'A') < 26 ? static_cast<uint8_t>(byte | 0x20) : byte;
+}
+
+// 0x20 для буквы, иначе 0: что добавить к байту данных перед сравнением
+inline uint8_t FoldBit(uint8_t byte) {
+    return static_cast<uint8_t>((byte | 0x20) - 'a') < 26 ? 0x20 : 0x00;
+}
+
+inline bool EqualIgnoreCase(const uint8_t* data, const uint8_t* needle, size_t length) {
+    for (size_t i = 0; i < length; ++i) {
+        if (FoldAscii(data[i]) != FoldAscii(needle[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// length >= 1
+inline size_t FindIgnoreCaseScalar(const uint8_t* data, size_t size, const uint8_t* needle, size_t length, size_t from) {
+    uint8_t first = FoldAscii(needle[0]);
+    for (size_t pos = from; pos + length <= size; ++pos) {
+        if (FoldAscii(data[pos]) == first && EqualIgnoreCase(data + pos + 1, needle + 1, length - 1)) {
+            return pos;
+        }
+    }
+    return kNotFound;
+}
+
+inline size_t VerifyCandidatesIgnoreCase(uint64_t mask, const uint8_t* data, size_t size, size_t base,
+                                         const uint8_t* needle, size_t length) {
+    for (; mask != 0; mask &= mask - 1) {
+        size_t pos = base + CountTrailingZeros(mask);
+        if (pos + length > size) {
+            return kNotFound;
+        }
+        if (EqualIgnoreCase(data + pos, needle, length)) {
+            return pos;
+        }
+    }
+    return kNotFound;
+}
+
+// Множество байтов для векторной проверки по полубайтам: байт b входит,
+// если low[b & 0xf] & high[b >> 4] != 0. Каждый старший полубайт
+// получает свой бит, при числе полубайтов больше 8 биты делятся, и
+// проверка пропускает лишние байты - их отсеивает точное сравнение
+struct ByteClass {
+    std::string bytes;  // различные байты; пусто при all
+    std::array<uint8_t, 16> low{};
+    std::array<uint8_t, 16> high{};
+    size_t high_count = 0;
+    bool all = false;
+    
+    void Add(uint8_t byte) {
+        if (all || bytes.find(static_cast<char>(byte)) != std::string::npos) {
+            return;
+        }
+        bool known_high = false;
+        for (char other : bytes) {
+            known_high = known_high || (static_cast<uint8_t>(other) >> 4) == (byte >> 4);
+        }
+        if (!known_high) {
+            high[byte >> 4] = static_cast<uint8_t>(1u << (high_count++ % 8));
+        }
+        low[byte & 0x0f] |= high[byte >> 4];
+        bytes.push_back(static_cast<char>(byte));
+    }
+    
+    void AddAll() {
+        all = true;
+        bytes.clear();
+        low.fill(0xff);
+        high.fill(0xff);
+    }
+};
+
+#if defined(TRAFFICMASK_BYTE_SEARCH_X86)
+
+inline bool HasAvx2() {
+#if defined(__GNUC__) || defined(__clang__)
+    static const bool supported = __builtin_cpu_supports("avx2");
+#elif defined(_MSC_VER)
+    static const bool supported = [] {
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] < 7) {
+            return false;
+        }
+        __cpuid(info, 1);
+        bool os_saves_ymm = (info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 6) == 6;
+        __cpuidex(info, 7, 0);
+        return os_saves_ymm && (info[1] & (1 << 5)) != 0;
+    }();
+#else
+    static const bool supported = false;
+#endif
+    return supported;
+}
+
+// Кандидаты 64 позиций с block; читает kBlockSize + shift байт
+inline uint64_t CandidatesSse2(const uint8_t* block, size_t shift, __m128i first, __m128i last) {
+    __m128i m[4];
+    for (int i = 0; i < 4; ++i) {
+        __m128i head = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + 16 * i));
+        __m128i tail = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + 16 * i + shift));
+        m[i] = _mm_and_si128(_mm_cmpeq_epi8(head, first), _mm_cmpeq_epi8(tail, last));
+    }
+    __m128i any = _mm_or_si128(_mm_or_si128(m[0], m[1]), _mm_or_si128(m[2], m[3]));
+    if (_mm_movemask_epi8(any) == 0) {
+        return 0;
+    }
+    uint64_t mask = 0;
+    for (int i = 0; i < 4; ++i) {
+        mask |= uint64_t(static_cast<uint32_t>(_mm_movemask_epi8(m[i]))) << (16 * i);
+    }
+    return mask;
+}
+
+TRAFFICMASK_TARGET_AVX2
+inline uint64_t CandidatesAvx2(const uint8_t* block, size_t shift, __m256i first, __m256i last) {
+    __m256i low = _mm256_and_si256(
+        _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(block)), first),
+        _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(block + shift)), last));
+    __m256i high = _mm256_and_si256(
+        _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(block + 32)), first),
+        _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(block + 32 + shift)), last));
+    __m256i any = _mm256_or_si256(low, high);
+    if (_mm256_testz_si256(any, any)) {
+        return 0;
+    }
+    return uint64_t(static_cast<uint32_t>(_mm256_movemask_epi8(low))) |
+           (uint64_t(static_cast<uint32_t>(_mm256_movemask_epi8(high))) << 32);
+}
+
+// 0xff в байтах блока, не входящих в множество ByteClass
+TRAFFICMASK_TARGET_AVX2
+inline __m256i ClassMissesAvx2(__m256i block, __m256i low_table, __m256i high_table) {
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    __m256i low = _mm256_shuffle_epi8(low_table, _mm256_and_si256(block, nibble));
+    __m256i high = _mm256_shuffle_epi8(high_table, _mm256_and_si256(_mm256_srli_epi16(block, 4), nibble));
+    return _mm256_cmpeq_epi8(_mm256_and_si256(low, high), _mm256_setzero_si256());
+}
+
+// Байты блока из множества: бит i - байт i
+TRAFFICMASK_TARGET_AVX2
+inline uint32_t MatchClassAvx2(__m256i block, __m256i low_table, __m256i high_table) {
+    return ~static_cast<uint32_t>(_mm256_movemask_epi8(ClassMissesAvx2(block, low_table, high_table)));
+}
+
+TRAFFICMASK_TARGET_AVX2
+inline __m256i LoadClassTable(const std::array<uint8_t, 16>& table) {
+    return _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(table.data())));
+}
+
+// Поиск парами байтов; length >= 2. Хвост, где блок не помещается
+// в данные (меньше kBlockSize + shift байт), досматривает FindScalar
+inline size_t FindSse2(const uint8_t* data, size_t size, const uint8_t* needle, size_t length, size_t from) {
+    const size_t shift = ProbeShift(length);
+    const __m128i first = _mm_set1_epi8(static_cast<char>(needle[0]));
+    const __m128i last = _mm_set1_epi8(static_cast<char>(needle[shift]));
+    
+    size_t offset = from;
+    for (; offset + kBlockSize + shift <= size; offset += kBlockSize) {
+        uint64_t mask = CandidatesSse2(data + offset, shift, first, last);
+        if (mask != 0) {
+            size_t pos = VerifyCandidates(mask, data, size, offset, needle, length);
+            if (pos != kNotFound) {
+                return pos;
+            }
+        }
+    }
+    return FindScalar(data, size, needle, length, offset);
+}
+
+TRAFFICMASK_TARGET_AVX2
+inline size_t FindAvx2(const uint8_t* data, size_t size, const uint8_t* needle, size_t length, size_t from) {
+    const size_t shift = ProbeShift(length);
+    const __m256i first = _mm256_set1_epi8(static_cast<char>(needle[0]));
+    const __m256i last = _mm256_set1_epi8(static_cast<char>(needle[shift]));
+    
+    size_t offset = from;
+    for (; offset + kBlockSize + shift <= size; offset += kBlockSize) {
+        uint64_t mask = CandidatesAvx2(data + offset, shift, first, last);
+        if (mask != 0) {
+            size_t pos = VerifyCandidates(mask, data, size, offset, needle, length);
+            if (pos != kNotFound) {
+                return pos;
+            }
+        }
+    }
+    return FindScalar(data, size, needle, length, offset);
+}
+
+// Участок от kPairSearchMinSize байт: memchr, пока первый байт редок,
+// затем пары байтов; length >= 2
+TRAFFICMASK_NOINLINE inline size_t FindLong(const uint8_t* data, size_t size, const uint8_t* needle, size_t length, size_t from) {
+    size_t pos = FindByFirstByte(data, size, needle, length, from);
+    if (pos != kFrequentFirstByte) {
+        return pos;
+    }
+    return HasAvx2() ? FindAvx2(data, size, needle, length, from) : FindSse2(data, size, needle, length, from);
+}
+
+// Кандидаты без учета регистра: как CandidatesSse2, но к данным
+// добавляются биты first_fold / last_fold
+inline uint64_t CandidatesIgnoreCaseSse2(const uint8_t* block, size_t shift, __m128i first, __m128i first_fold,
+                                         __m128i last, __m128i last_fold) {
+    __m128i m[4];
+    for (int i = 0; i < 4; ++i) {
+        __m128i head = _mm_or_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(block + 16 * i)), first_fold);
+        __m128i tail = _mm_or_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(block + 16 * i + shift)), last_fold);
+        m[i] = _mm_and_si128(_mm_cmpeq_epi8(head, first), _mm_cmpeq_epi8(tail, last));
+    }
+    __m128i any = _mm_or_si128(_mm_or_si128(m[0], m[1]), _mm_or_si128(m[2], m[3]));
+    if (_mm_movemask_epi8(any) == 0) {
+        return 0;
+    }
+    uint64_t mask = 0;
+    for (int i = 0; i < 4; ++i) {
+        mask |= uint64_t(static_cast<uint32_t>(_mm_movemask_epi8(m[i]))) << (16 * i);
+    }
+    return mask;
+}
+
+TRAFFICMASK_TARGET_AVX2
+inline uint64_t CandidatesIgnoreCaseAvx2(const uint8_t* block, size_t shift, __m256i first, __m256i first_fold,
+                                         __m256i last, __m256i last_fold) {
+    __m256i low = _mm256_and_si256(
+        _mm256_cmpeq_epi8(_mm256_or_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(block)), first_fold), first),
+        _mm256_cmpeq_epi8(_mm256_or_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(block + shift)), last_fold), last));
+    __m256i high = _mm256_and_si256(
+        _mm256_cmpeq_epi8(_mm256_or_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(block + 32)), first_fold), first),
+        _mm256_cmpeq_epi8(_mm256_or_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(block + 32 + shift)), last_fold), last));
+    __m256i any = _mm256_or_si256(low, high);
+    if (_mm256_testz_si256(any, any)) {
+        return 0;
+    }
+    return uint64_t(static_cast<uint32_t>(_mm256_movemask_epi8(low))) |
+           (uint64_t(static_cast<uint32_t>(_mm256_movemask_epi8(high))) << 32);
+}
+
+// length >= 1; хвост досматривает FindIgnoreCaseScalar
+inline size_t FindIgnoreCaseSse2(const uint8_t* data, size_t size, const uint8_t* needle, size_t length, size_t from) {
+    const size_t shift = ProbeShift(length);
+    const __m128i first = _mm_set1_epi8(static_cast<char>(FoldAscii(needle[0])));
+    const __m128i first_fold = _mm_set1_epi8(static_cast<char>(FoldBit(needle[0])));
+    const __m128i last = _mm_set1_epi8(static_cast<char>(FoldAscii(needle[shift])));
+    const __m128i last_fold = _mm_set1_epi8(static_cast<char>(FoldBit(needle[shift])));
+    
+    size_t offset = from;
+    for (; offset + kBlockSize + shift <= size; offset += kBlockSize) {
+        uint64_t mask = CandidatesIgnoreCaseSse2(data + offset, shift, first, first_fold, last, last_fold);
+        if (mask != 0) {
+            size_t pos = VerifyCandidatesIgnoreCase(mask, data, size, offset, needle, length);
+            if (pos != kNotFound) {
+                return pos;
+            }
+        }
+    }
+    return FindIgnoreCaseScalar(data, size, needle, length, offset);
+}
+
+TRAFFICMASK_TARGET_AVX2
+inline size_t FindIgnoreCaseAvx2(const uint8_t* data, size_t size, const uint8_t* needle, size_t length, size_t from) {
+    const size_t shift = ProbeShift(length);
+    const __m256i first = _mm256_set1_epi8(static_cast<char>(FoldAscii(needle[0])));
+    const __m256i first_fold = _mm256_set1_epi8(static_cast<char>(FoldBit(needle[0])));
+    const __m256i last = _mm256_set1_epi8(static_cast<char>(FoldAscii(needle[shift])));
+    const __m256i last_fold = _mm256_set1_epi8(static_cast<char>(FoldBit(needle[shift])));
+    
+    size_t offset = from;
+    for (; offset + kBlockSize + shift <= size; offset += kBlockSize) {
+        uint64_t mask = CandidatesIgnoreCaseAvx2(data + offset, shift, first, first_fold, last, last_fold);
+        if (mask != 0) {
+            size_t pos = VerifyCandidatesIgnoreCase(mask, data, size, offset, needle, length);
+            if (pos != kNotFound) {
+                return pos;
+            }
+        }
+    }
+    return FindIgnoreCaseScalar(data, size, needle, length, offset);
+}
+
+#endif
+
+} // namespace ByteSearch
+
+// Позиция первого вхождения needle в data не раньше from или ByteSearch::kNotFound
+// (совпадает с std::string_view::npos); пустая needle находится в from
+inline size_t FindBytes(const uint8_t* data, size_t size, const uint8_t* needle, size_t length, size_t from = 0) {
+    if (from > size || length > size - from) {
+        return ByteSearch::kNotFound;
+    }
+    if (length == 0) {
+        return from;
+    }
+    if (length == 1) {
+        const void* hit = std::memchr(data + from, needle[0], size - from);
+        return hit ? static_cast<size_t>(static_cast<const uint8_t*>(hit) - data) : ByteSearch::kNotFound;
+    }
+
+#if defined(TRAFFICMASK_BYTE_SEARCH_X86)
+    if (size - from >= ByteSearch::kPairSearchMinSize) {
+        return ByteSearch::FindLong(data, size, needle, length, from);
+    }
+#endif
+    return ByteSearch::FindScalar(data, size, needle, length, from);
+}
+
+inline size_t FindBytes(std::string_view text, std::string_view needle, size_t from = 0) {
+    return FindBytes(reinterpret_cast<const uint8_t*>(text.data()), text.size(),
+                     reinterpret_cast<const uint8_t*>(needle.data()), needle.size(), from);
+}
+
+inline bool ContainsBytes(std::string_view text, std::string_view needle) {
+    return FindBytes(text, needle) != ByteSearch::kNotFound;
+}
+
+// FindBytes без учета регистра ASCII (в любой из строк)
+inline size_t FindBytesIgnoreCase(const uint8_t* data, size_t size, const uint8_t* needle, size_t length,
+                                  size_t from = 0) {
+    if (from > size || length > size - from) {
+        return ByteSearch::kNotFound;
+    }
+    if (length == 0) {
+        return from;
+    }
+
+#if defined(TRAFFICMASK_BYTE_SEARCH_X86)
+    return ByteSearch::HasAvx2() ? ByteSearch::FindIgnoreCaseAvx2(data, size, needle, length, from)
+                                 : ByteSearch::FindIgnoreCaseSse2(data, size, needle, length, from);
+#else
+    return ByteSearch::FindIgnoreCaseScalar(data, size, needle, length, from);
+#endif
+}
+
+inline size_t FindBytesIgnoreCase(std::string_view text, std::string_view needle, size_t from = 0) {
+    return FindBytesIgnoreCase(reinterpret_cast<const uint8_t*>(text.data()), text.size(),
+                               reinterpret_cast<const uint8_t*>(needle.data()), needle.size(), from);
+}
+
+inline bool ContainsBytesIgnoreCase(std::string_view text, std::string_view needle) {
+    return FindBytesIgnoreCase(text, needle) != ByteSearch::kNotFound;
+}
+
+// Набор до 32 подстрок для проверок подряд (find || find || ...): какие из
+// них есть в данных, одним вызовом. С AVX2 данные проходятся один раз
+// блоками по 64 байта: кандидат - позиция, где первый байт входит в первые
+// байты подстрок, а следующий - во вторые (проверка по полубайтам, как в
+// ReplacementTable). В кандидате сравниваются только подстроки с этим
+// первым байтом, еще не найденные. Подстроки из одного байта ищет memchr:
+// в фильтре они пропускали бы любой второй байт. Без AVX2, для одной
+// подстроки и данных короче блока каждая ищется своим FindBytes
+class NeedleSet {
+public:
+    static constexpr size_t kMaxNeedles = 32;
+    
+    NeedleSet() = default;
+    
+    NeedleSet(std::initializer_list<std::string_view> needles) {
+        for (std::string_view needle : needles) {
+            Add(needle);
+        }
+    }
+    
+    // Подстроки сверх kMaxNeedles не добавляются; возвращает false
+    bool Add(std::string_view needle) {
+        if (needles_.size() >= kMaxNeedles) {
+            return false;
+        }
+        uint32_t bit = uint32_t(1) << needles_.size();
+        needles_.emplace_back(needle);
+        all_ |= bit;
+        if (needle.empty()) {
+            empty_ |= bit;  // Пустая подстрока есть в любых данных
+            return true;
+        }
+        if (needle.size() == 1) {
+            single_ |= bit;
+            return true;
+        }
+        by_first_[static_cast<uint8_t>(needle[0])] |= bit;
+        first_.Add(static_cast<uint8_t>(needle[0]));
+        second_.Add(static_cast<uint8_t>(needle[1]));
+        return true;
+    }
+    
+    size_t Size() const { return needles_.size(); }
+    const std::string& Get(size_t index) const { return needles_[index]; }
+    
+    // Есть ли в данных хотя бы одна подстрока
+    bool ContainsAny(std::string_view text) const {
+        return Scan(text, true) != 0;
+    }
+    
+    // Бит k установлен, если в данных есть подстрока k
+    uint32_t Match(std::string_view text) const {
+        return Scan(text, false);
+    }
+    
+private:
+    // Найденные подстроки; any - остановиться на первой
+    uint32_t Scan(std::string_view text, bool any) const {
+        uint32_t found = empty_;
+        if ((any && found != 0) || found == all_) {
+            return found;
+        }
+
+#if defined(TRAFFICMASK_BYTE_SEARCH_X86)
+        if (needles_.size() > 1 && text.size() > ByteSearch::kBlockSize && ByteSearch::HasAvx2()) {
+            for (uint32_t singles = single_; singles != 0; singles &= singles - 1) {
+                size_t k = ByteSearch::CountTrailingZeros(singles);
+                if (std::memchr(text.data(), needles_[k][0], text.size()) != nullptr) {
+                    found |= uint32_t(1) << k;
+                    if (any || found == all_) {
+                        return found;
+                    }
+                }
+            }
+            if ((all_ & ~(single_ | empty_)) == 0) {
+                return found;
+            }
+            return ScanAvx2(reinterpret_cast<const uint8_t*>(text.data()), text.size(), found, any);
+        }
+#endif
+
+        for (size_t k = 0; k < needles_.size(); ++k) {
+            uint32_t bit = uint32_t(1) << k;
+            if ((found & bit) == 0 && FindBytes(text, needles_[k]) != ByteSearch::kNotFound) {
+                found |= bit;
+                if (any) {
+                    break;
+                }
+            }
+        }
+        return found;
+    }
+    
+    // Сравнивает с позиции pos подстроки с первым байтом data[pos], еще не
+    // найденные; true - можно останавливаться
+    bool VerifyAt(const uint8_t* data, size_t size, size_t pos, uint32_t& found, bool any) const {
+        for (uint32_t candidates = by_first_[data[pos]] & ~found; candidates != 0; candidates &= candidates - 1) {
+            size_t k = ByteSearch::CountTrailingZeros(candidates);
+            const std::string& needle = needles_[k];
+            if (needle.size() <= size - pos && std::memcmp(data + pos, needle.data(), needle.size()) == 0) {
+                found |= uint32_t(1) << k;
+                if (any || found == all_) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+#if defined(TRAFFICMASK_BYTE_SEARCH_X86)
+    // Кандидаты 64 позиций с block; читает kBlockSize + 1 байт. Блок без
+    // кандидатов отбрасывается одной проверкой вектора промахов
+    TRAFFICMASK_TARGET_AVX2
+    static uint64_t CandidatesAvx2(const uint8_t* block, __m256i first_low, __m256i first_high,
+                                   __m256i second_low, __m256i second_high) {
+        __m256i misses[2];
+        for (int half = 0; half < 2; ++half) {
+            __m256i head = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block + 32 * half));
+            __m256i tail = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block + 32 * half + 1));
+            misses[half] = _mm256_or_si256(ByteSearch::ClassMissesAvx2(head, first_low, first_high),
+                                           ByteSearch::ClassMissesAvx2(tail, second_low, second_high));
+        }
+        __m256i both = _mm256_and_si256(misses[0], misses[1]);
+        if (_mm256_testc_si256(both, _mm256_set1_epi8(-1))) {
+            return 0;
+        }
+        return ~(uint64_t(static_cast<uint32_t>(_mm256_movemask_epi8(misses[0]))) |
+                 (uint64_t(static_cast<uint32_t>(_mm256_movemask_epi8(misses[1]))) << 32));
+    }
+    
+    TRAFFICMASK_TARGET_AVX2
+    uint32_t ScanAvx2(const uint8_t* data, size_t size, uint32_t found, bool any) const {
+        const __m256i first_low = ByteSearch::LoadClassTable(first_.low);
+        const __m256i first_high = ByteSearch::LoadClassTable(first_.high);
+        const __m256i second_low = ByteSearch::LoadClassTable(second_.low);
+        const __m256i second_high = ByteSearch::LoadClassTable(second_.high);
+        size_t pos = 0;
+        for (; pos + ByteSearch::kBlockSize + 1 <= size; pos += ByteSearch::kBlockSize) {
+            uint64_t mask = CandidatesAvx2(data + pos, first_low, first_high, second_low, second_high);
+            for (; mask != 0; mask &= mask - 1) {
+                if (VerifyAt(data, size, pos + ByteSearch::CountTrailingZeros(mask), found, any)) {
+                    return found;
+                }
+            }
+        }
+        
+        // Хвост - последним блоком внахлест, позиции до pos уже проверены.
+        // В последнем байте подстрока из двух и более байт не начинается
+        if (pos + 1 < size) {
+            size_t last = size - ByteSearch::kBlockSize - 1;
+            uint64_t mask = CandidatesAvx2(data + last, first_low, first_high, second_low, second_high);
+            for (mask &= ~uint64_t(0) << (pos - last); mask != 0; mask &= mask - 1) {
+                if (VerifyAt(data, size, last + ByteSearch::CountTrailingZeros(mask), found, any)) {
+                    break;
+                }
+            }
+        }
+        return found;
+    }
+#endif
+
+    std::vector<std::string> needles_;
+    std::array<uint32_t, 256> by_first_{};  // подстроки каждого первого байта
+    ByteSearch::ByteClass first_;           // первые байты подстрок
+    ByteSearch::ByteClass second_;          // вторые; все, если есть подстрока из одного байта
+    uint32_t all_ = 0;
+    uint32_t empty_ = 0;   // пустые подстроки
+    uint32_t single_ = 0;  // подстроки из одного байта
+};
+
+} // namespace TrafficMask
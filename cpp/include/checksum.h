@@ -0,0 +1,375 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include "byte_search.h"
+#include "packet_buffer.h"
+
+namespace TrafficMask {
+
+// Контрольная сумма Интернета (RFC 1071): ones-complement сумма 16-битных
+// слов в сетевом порядке. Суммы накапливаются в 64 битах и сворачиваются
+// с переносами только в конце
+namespace InternetChecksum {
+
+// С этой длины сумма считается векторно; короткие поля - скалярно
+static constexpr size_t kVectorThreshold = 64;
+
+inline uint16_t Fold(uint64_t sum) {
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return static_cast<uint16_t>(sum);
+}
+
+// Сумма слов с четного смещения; последний нечетный байт - старший
+// байт слова, дополненного нулем
+inline uint64_t SumScalar(const uint8_t* data, size_t size) {
+    uint64_t sum = 0;
+    size_t i = 0;
+    for (; i + 1 < size; i += 2) {
+        sum += (uint32_t(data[i]) << 8) | data[i + 1];
+    }
+    if (i < size) {
+        sum += uint32_t(data[i]) << 8;
+    }
+    return sum;
+}
+
+#if defined(TRAFFICMASK_BYTE_SEARCH_X86)
+
+// Векторные ядра складывают слова в порядке байт машины: сумма
+// ones-complement не зависит от порядка байт (RFC 1071, 2.B), поэтому
+// свернутая сумма переставляется один раз в конце. Каждое 32-битное
+// слово вектора дает две 16-битные половины в отдельные накопители;
+// 32-битные полосы переполнились бы через 2^15 итераций, поэтому они
+// сбрасываются в 64-битную сумму каждые kChunkIterations итераций (в
+// ядре SSE2 полоса получает 4 слова за итерацию - ровно до предела)
+static constexpr size_t kChunkIterations = 1 << 14;
+
+inline uint64_t FinishVector(uint64_t native_sum, const uint8_t* tail, size_t tail_size) {
+    uint16_t folded = Fold(native_sum);
+    return static_cast<uint16_t>((folded >> 8) | (folded << 8)) + SumScalar(tail, tail_size);
+}
+
+// 64 байта за итерацию, четыре загрузки по 16 байт
+inline uint64_t SumSse2(const uint8_t* data, size_t size) {
+    const __m128i low_mask = _mm_set1_epi32(0xffff);
+    uint64_t native_sum = 0;
+    size_t i = 0;
+    while (i + 64 <= size) {
+        __m128i low = _mm_setzero_si128();
+        __m128i high = _mm_setzero_si128();
+        for (size_t n = 0; n < kChunkIterations && i + 64 <= size; ++n, i += 64) {
+            for (size_t k = 0; k < 64; k += 16) {
+                __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + k));
+                low = _mm_add_epi32(low, _mm_and_si128(block, low_mask));
+                high = _mm_add_epi32(high, _mm_srli_epi32(block, 16));
+            }
+        }
+        alignas(16) uint32_t lanes[8];
+        _mm_store_si128(reinterpret_cast<__m128i*>(lanes), low);
+        _mm_store_si128(reinterpret_cast<__m128i*>(lanes + 4), high);
+        for (uint32_t lane : lanes) {
+            native_sum += lane;
+        }
+    }
+    return FinishVector(native_sum, data + i, size - i);
+}
+
+// 64 байта за итерацию, две загрузки по 32 байта
+TRAFFICMASK_TARGET_AVX2
+inline uint64_t SumAvx2(const uint8_t* data, size_t size) {
+    const __m256i low_mask = _mm256_set1_epi32(0xffff);
+    uint64_t native_sum = 0;
+    size_t i = 0;
+    while (i + 64 <= size) {
+        __m256i low = _mm256_setzero_si256();
+        __m256i high = _mm256_setzero_si256();
+        for (size_t n = 0; n < kChunkIterations && i + 64 <= size; ++n, i += 64) {
+            __m256i first = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+            __m256i second = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + 32));
+            low = _mm256_add_epi32(low, _mm256_and_si256(first, low_mask));
+            high = _mm256_add_epi32(high, _mm256_srli_epi32(first, 16));
+            low = _mm256_add_epi32(low, _mm256_and_si256(second, low_mask));
+            high = _mm256_add_epi32(high, _mm256_srli_epi32(second, 16));
+        }
+        alignas(32) uint32_t lanes[16];
+        _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), low);
+        _mm256_store_si256(reinterpret_cast<__m256i*>(lanes + 8), high);
+        for (uint32_t lane : lanes) {
+            native_sum += lane;
+        }
+    }
+    return FinishVector(native_sum, data + i, size - i);
+}
+
+#endif
+
+// Сумма size байт; odd - первый байт стоит на нечетном смещении от
+// начала суммируемых данных и попадает в младший байт слова. Длинные
+// данные суммируются векторно (AVX2, SSE2), иначе скалярно
+inline uint64_t Sum(const uint8_t* data, size_t size, bool odd = false) {
+    uint64_t sum = 0;
+    if (odd && size > 0) {
+        sum = data[0];
+        ++data;
+        --size;
+    }
+#if defined(TRAFFICMASK_BYTE_SEARCH_X86)
+    if (size >= kVectorThreshold) {
+        return sum + (ByteSearch::HasAvx2() ? SumAvx2(data, size) : SumSse2(data, size));
+    }
+#endif
+    return sum + SumScalar(data, size);
+}
+
+inline uint16_t ReadU16(const uint8_t* data, size_t offset) {
+    return static_cast<uint16_t>((data[offset] << 8) | data[offset + 1]);
+}
+
+inline void WriteU16(uint8_t* data, size_t offset, uint16_t value) {
+    data[offset] = static_cast<uint8_t>(value >> 8);
+    data[offset + 1] = static_cast<uint8_t>(value);
+}
+
+} // namespace InternetChecksum
+
+// Изменение суммы от полей, переписанных на месте. Checksum обновляется
+// инкрементально по RFC 1624: HC' = ~(~HC + ~m + m'), где m и m' - старое
+// и новое значение поля, - за O(длина поля), без повторного прохода по
+// данным. Изменения нескольких полей складываются в одно.
+class ChecksumDelta {
+public:
+    // Поле size байт со смещения offset (от начала суммируемых данных)
+    // меняется с old_bytes на new_bytes
+    void Replace(size_t offset, const uint8_t* old_bytes, const uint8_t* new_bytes, size_t size) {
+        bool odd = (offset & 1) != 0;
+        ReplaceSum(InternetChecksum::Fold(InternetChecksum::Sum(old_bytes, size, odd)),
+                   InternetChecksum::Fold(InternetChecksum::Sum(new_bytes, size, odd)));
+    }
+    
+    // Данные с суммой old_sum заменены данными с суммой new_sum
+    void ReplaceSum(uint16_t old_sum, uint16_t new_sum) {
+        sum_ += new_sum + (0xffff ^ old_sum);
+        changed_ = true;
+    }
+    
+    void Add(const ChecksumDelta& other) {
+        sum_ += other.sum_;
+        changed_ = changed_ || other.changed_;
+    }
+    
+    bool Empty() const { return !changed_; }
+    
+    void Clear() {
+        sum_ = 0;
+        changed_ = false;
+    }
+    
+    // Checksum после изменений
+    uint16_t Apply(uint16_t checksum) const {
+        if (!changed_) {
+            return checksum;
+        }
+        return static_cast<uint16_t>(~InternetChecksum::Fold((0xffff ^ checksum) + sum_));
+    }
+    
+private:
+    uint64_t sum_ = 0;
+    bool changed_ = false;
+};
+
+// Переписывает size байт data со смещения offset и учитывает изменение в delta
+inline void RewriteBytes(uint8_t* data, size_t offset, const uint8_t* bytes, size_t size, ChecksumDelta& delta) {
+    delta.Replace(offset, data + offset, bytes, size);
+    std::memcpy(data + offset, bytes, size);
+}
+
+inline void RewriteU16(uint8_t* data, size_t offset, uint16_t value, ChecksumDelta& delta) {
+    uint8_t bytes[2] = {static_cast<uint8_t>(value >> 8), static_cast<uint8_t>(value)};
+    RewriteBytes(data, offset, bytes, sizeof(bytes), delta);
+}
+
+// Расположение checksum TCP/UDP в IPv4 пакете: смещение поля или 0, если
+// его нет в буфере - не TCP/UDP, не первый фрагмент или заголовок L4 обрезан
+inline size_t Ipv4L4ChecksumOffset(const uint8_t* data, size_t size) {
+    if (size < 20 || (data[0] >> 4) != 4) {
+        return 0;
+    }
+    size_t header_length = size_t(data[0] & 0x0F) * 4;
+    if (header_length < 20 || (InternetChecksum::ReadU16(data, 6) & 0x1FFF) != 0) {
+        return 0;
+    }
+    size_t offset = data[9] == 6 ? header_length + 16 : data[9] == 17 ? header_length + 6 : 0;
+    return offset != 0 && offset + 2 <= size ? offset : 0;
+}
+
+// Переписывает size байт IPv4 пакета со смещения offset на месте, сохраняя
+// верными checksum заголовка IP и TCP/UDP. Поле в заголовке IP меняет его
+// checksum, адреса (12-19) входят и в псевдозаголовок L4, поле за
+// заголовком IP меняет checksum L4. Checksum L4 обновляется, только если
+// он есть в буфере; нулевой checksum UDP ("не вычислялся") не трогается.
+// false - не IPv4, поле выходит за пакет, задевает поля checksum или поля,
+// от которых зависит разбор пакета (версия и длина заголовка, общая длина,
+// фрагментация, протокол)
+inline bool RewriteIpv4Bytes(PacketBuffer& packet, size_t offset, const uint8_t* bytes, size_t size) {
+    const uint8_t* data = packet.data();
+    if (packet.size() < 20 || (data[0] >> 4) != 4 || offset > packet.size() || size > packet.size() - offset) {
+        return false;
+    }
+    size_t header_length = size_t(data[0] & 0x0F) * 4;
+    if (header_length < 20 || header_length > packet.size()) {
+        return false;
+    }
+    size_t end = offset + size;
+    size_t l4_checksum = Ipv4L4ChecksumOffset(data, packet.size());
+    if (l4_checksum != 0 && offset < l4_checksum + 2 && end > l4_checksum) {
+        return false;
+    }
+    for (size_t i = offset; i < end && i < 12; ++i) {
+        if (i == 0 || i == 2 || i == 3 || i == 6 || i == 7 || i >= 9) {
+            return false;
+        }
+    }
+    
+    // Поля заголовка IP, псевдозаголовка и данных L4 стоят на смещениях
+    // той же четности от начала своей суммы, что и в пакете
+    ChecksumDelta header;
+    ChecksumDelta l4;
+    size_t header_end = end < header_length ? end : header_length;
+    for (size_t i = offset; i < header_end; ++i) {
+        header.Replace(i, data + i, bytes + (i - offset), 1);
+        if (i >= 12 && i < 20) {
+            l4.Replace(i, data + i, bytes + (i - offset), 1);
+        }
+    }
+    if (end > header_length) {
+        size_t l4_begin = offset > header_length ? offset : header_length;
+        l4.Replace(l4_begin, data + l4_begin, bytes + (l4_begin - offset), end - l4_begin);
+    }
+    
+    uint8_t* out = packet.MutableData();
+    std::memcpy(out + offset, bytes, size);
+    InternetChecksum::WriteU16(out, 10, header.Apply(InternetChecksum::ReadU16(out, 10)));
+    if (l4_checksum != 0 && !l4.Empty()) {
+        uint16_t checksum = InternetChecksum::ReadU16(out, l4_checksum);
+        bool udp = out[9] == 17;
+        if (!udp || checksum != 0) {
+            checksum = l4.Apply(checksum);
+            InternetChecksum::WriteU16(out, l4_checksum, udp && checksum == 0 ? 0xffff : checksum);
+        }
+    }
+    return true;
+}
+
+// Пересчитывает checksum TCP/UDP пакета IPv4 целиком, с псевдозаголовком.
+// Нулевой checksum UDP ("не вычислялся") не трогается
+inline void RecomputeIpv4L4Checksum(PacketBuffer& packet) {
+    const uint8_t* data = packet.data();
+    size_t checksum_offset = Ipv4L4ChecksumOffset(data, packet.size());
+    if (checksum_offset == 0) {
+        return;
+    }
+    bool udp = data[9] == 17;
+    if (udp && InternetChecksum::ReadU16(data, checksum_offset) == 0) {
+        return;
+    }
+    
+    // Сегмент L4 - до общей длины пакета, но не дальше буфера
+    size_t header_length = size_t(data[0] & 0x0F) * 4;
+    size_t total_length = InternetChecksum::ReadU16(data, 2);
+    size_t end = total_length < packet.size() ? total_length : packet.size();
+    if (end < checksum_offset + 2) {
+        return;
+    }
+    
+    uint8_t* out = packet.MutableData();
+    InternetChecksum::WriteU16(out, checksum_offset, 0);
+    uint64_t sum = InternetChecksum::Sum(out + header_length, end - header_length) +
+                   InternetChecksum::SumScalar(out + 12, 8) + out[9] + (end - header_length);
+    uint16_t checksum = static_cast<uint16_t>(~InternetChecksum::Fold(sum));
+    InternetChecksum::WriteU16(out, checksum_offset, udp && checksum == 0 ? 0xffff : checksum);
+}
+
+// Запрос восстановить checksum после того, как процессор перепишет данные
+// целиком, - вместо изменений по полям. Запрос делается до перезаписи;
+// Apply вызывается после нее (движок - после конвейера). Действует первый
+// запрос: сумма, запомненная им, - точка отсчета для всех последующих
+// изменений данных.
+class ChecksumFixup {
+public:
+    // Буфер - пакет IPv4: checksum TCP/UDP пересчитывается целиком
+    void RequestIpv4() {
+        if (mode_ == Mode::NONE) {
+            mode_ = Mode::IPV4;
+        }
+    }
+    
+    // Буфер - сегмент TCP: checksum в заголовке (смещение 16) обновляется
+    // на разность сумм сегмента до и после перезаписи; псевдозаголовок не
+    // меняется, поэтому он не нужен
+    void RequestTcpSegment(const PacketBuffer& data) {
+        if (mode_ == Mode::NONE && data.size() >= kTcpChecksumOffset + 2) {
+            mode_ = Mode::TCP_SEGMENT;
+            old_sum_ = InternetChecksum::Fold(InternetChecksum::Sum(data.data(), data.size()));
+        }
+    }
+    
+    // Буфер - payload L4: разность сумм становится изменением payload
+    // (Packet::payload_checksum). recorded - изменения, учтенные в нем до
+    // запроса; учтенные после него входят в разность сумм
+    void RequestPayload(const PacketBuffer& data, const ChecksumDelta& recorded) {
+        if (mode_ == Mode::NONE) {
+            mode_ = Mode::PAYLOAD;
+            old_sum_ = InternetChecksum::Fold(InternetChecksum::Sum(data.data(), data.size()));
+            recorded_ = recorded;
+        }
+    }
+    
+    bool Pending() const { return mode_ != Mode::NONE; }
+    
+    void Apply(PacketBuffer& data, ChecksumDelta& payload_checksum) {
+        switch (mode_) {
+            case Mode::IPV4:
+                RecomputeIpv4L4Checksum(data);
+                break;
+            case Mode::TCP_SEGMENT:
+                if (data.size() >= kTcpChecksumOffset + 2) {
+                    // Поле checksum одно и то же в обеих суммах и сокращается
+                    ChecksumDelta delta;
+                    delta.ReplaceSum(old_sum_, InternetChecksum::Fold(InternetChecksum::Sum(data.data(), data.size())));
+                    uint8_t* out = data.MutableData();
+                    InternetChecksum::WriteU16(out, kTcpChecksumOffset,
+                                               delta.Apply(InternetChecksum::ReadU16(out, kTcpChecksumOffset)));
+                }
+                break;
+            case Mode::PAYLOAD:
+                payload_checksum = recorded_;
+                payload_checksum.ReplaceSum(old_sum_, InternetChecksum::Fold(InternetChecksum::Sum(data.data(), data.size())));
+                break;
+            case Mode::NONE:
+                break;
+        }
+        Clear();
+    }
+    
+    void Clear() { mode_ = Mode::NONE; }
+    
+private:
+    enum class Mode {
+        NONE,
+        IPV4,
+        TCP_SEGMENT,
+        PAYLOAD
+    };
+    
+    static constexpr size_t kTcpChecksumOffset = 16;
+    
+    Mode mode_ = Mode::NONE;
+    uint16_t old_sum_ = 0;
+    ChecksumDelta recorded_;
+};
+
+} // namespace TrafficMask
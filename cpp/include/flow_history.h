@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include "packet_buffer.h"
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <xmmintrin.h>
+#define TRAFFICMASK_PREFETCH(addr) _mm_prefetch(reinterpret_cast<const char*>(addr), _MM_HINT_T0)
+#elif defined(__GNUC__)
+#define TRAFFICMASK_PREFETCH(addr) __builtin_prefetch(addr)
+#else
+#define TRAFFICMASK_PREFETCH(addr) ((void)(addr))
+#endif
+
+namespace TrafficMask {
+
+// Значение по умолчанию для глубины истории соединения
+constexpr size_t kDefaultHistoryDepth = 100;
+
+// Дескриптор пакета в истории соединения.
+// payload указывает в буфер пакета, на который история держит ссылку,
+// поэтому он остается валидным, пока запись в кольце не перезаписана.
+// Буфер копируется при записи, так что маскировка текущего пакета
+// не меняет содержимое истории.
+struct PacketRecord {
+    const uint8_t* payload = nullptr;
+    uint32_t length = 0;
+    size_t timestamp = 0;
+    bool is_incoming = false;
+};
+
+// Кольцо последних пакетов соединения фиксированной емкости.
+// Добавление - O(1) без сдвига элементов и без копирования payload:
+// запись разделяет буфер с пакетом.
+class FlowHistory {
+public:
+    explicit FlowHistory(size_t capacity)
+        : records_(std::max<size_t>(capacity, 1)), buffers_(records_.size()),
+          head_(0), size_(0), held_bytes_(0) {}
+    
+    FlowHistory(const FlowHistory&) = delete;
+    FlowHistory& operator=(const FlowHistory&) = delete;
+    
+    void Push(const PacketBuffer& payload, size_t timestamp, bool is_incoming) {
+        size_t index = (head_ + size_) % records_.size();
+        if (size_ == records_.size()) {
+            // Кольцо заполнено: перезаписываем самую старую запись
+            index = head_;
+            head_ = (head_ + 1) % records_.size();
+        } else {
+            ++size_;
+        }
+        
+        held_bytes_ -= buffers_[index].capacity();
+        buffers_[index] = payload;
+        held_bytes_ += buffers_[index].capacity();
+        
+        PacketRecord& record = records_[index];
+        record.payload = buffers_[index].data();
+        record.length = static_cast<uint32_t>(buffers_[index].size());
+        record.timestamp = timestamp;
+        record.is_incoming = is_incoming;
+    }
+    
+    size_t Size() const { return size_; }
+    size_t Capacity() const { return records_.size(); }
+    bool Empty() const { return size_ == 0; }
+    
+    // Память, удерживаемая историей: дескрипторы плюс блоки буферов
+    // (блок, разделяемый с пакетом в обработке, учитывается полностью)
+    size_t GetMemoryUsage() const {
+        return records_.capacity() * sizeof(PacketRecord) +
+               buffers_.capacity() * sizeof(PacketBuffer) +
+               held_bytes_;
+    }
+    
+    // i = 0 - самый старый пакет, Size() - 1 - самый новый
+    const PacketRecord& At(size_t i) const {
+        return records_[(head_ + i) % records_.size()];
+    }
+    
+    const PacketRecord& Newest() const { return At(size_ - 1); }
+    
+    // Предвыборка дескриптора и ссылки, которые перезапишет следующий Push
+    void PrefetchNext() const {
+        size_t index = size_ == records_.size() ? head_ : (head_ + size_) % records_.size();
+        TRAFFICMASK_PREFETCH(&records_[index]);
+        TRAFFICMASK_PREFETCH(&buffers_[index]);
+    }
+    
+    // Обход от старых пакетов к новым
+    template<typename Fn>
+    void ForEach(Fn&& fn) const {
+        for (size_t i = 0; i < size_; ++i) {
+            fn(At(i));
+        }
+    }
+    
+private:
+    std::vector<PacketRecord> records_;
+    std::vector<PacketBuffer> buffers_;
+    size_t head_;
+    size_t size_;
+    size_t held_bytes_;
+};
+
+} // namespace TrafficMask
@@ -0,0 +1,178 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include "byte_search.h"
+
+namespace TrafficMask {
+
+enum class HttpHeadStatus {
+    INCOMPLETE,  // пустая строка конца заголовков еще не пришла
+    COMPLETE,
+    INVALID      // не запрос HTTP/1.x или заголовков больше kMaxHeaders
+};
+
+// Строка заголовка: смещения от начала данных
+struct HttpHeaderLine {
+    uint32_t offset;        // начало строки (имя)
+    uint32_t length;        // длина строки вместе с CRLF и строками продолжения
+    uint32_t name_length;
+    uint32_t value_offset;  // значение без пробелов по краям
+    uint32_t value_length;
+};
+
+// Разбор начала запроса HTTP/1.x (строка запроса и заголовки) без
+// выделения памяти: строки ищутся по CRLF векторным FindBytes, для
+// заголовков запоминаются только смещения. Разбор инкрементальный -
+// повторный Parse с дополненными данными (тот же поток, больше байт)
+// продолжает с первой неразобранной строки, поэтому заголовки, уже
+// пришедшие целиком, доступны и при INCOMPLETE.
+class HttpRequestHead {
+public:
+    static constexpr size_t kMaxHeaders = 64;
+    
+    HttpHeadStatus Parse(std::string_view data) {
+        while (status_ == HttpHeadStatus::INCOMPLETE) {
+            size_t line_end = FindBytes(data, "\r\n", parsed_);
+            if (line_end == ByteSearch::kNotFound) {
+                break;
+            }
+            std::string_view line = data.substr(parsed_, line_end - parsed_);
+            size_t next = line_end + 2;
+            
+            if (!request_line_) {
+                status_ = IsRequestLine(line) ? HttpHeadStatus::INCOMPLETE : HttpHeadStatus::INVALID;
+                request_line_ = true;
+            } else if (line.empty()) {
+                status_ = HttpHeadStatus::COMPLETE;
+            } else if (line[0] == ' ' || line[0] == '\t') {
+                // Устаревшее продолжение значения предыдущего заголовка
+                if (count_ == 0) {
+                    status_ = HttpHeadStatus::INVALID;
+                } else {
+                    ExtendHeader(headers_[count_ - 1], line, line_end, next);
+                }
+            } else if (count_ == kMaxHeaders || !AddHeader(line, parsed_, next)) {
+                status_ = HttpHeadStatus::INVALID;
+            }
+            parsed_ = next;
+        }
+        return status_;
+    }
+    
+    void Reset() {
+        status_ = HttpHeadStatus::INCOMPLETE;
+        request_line_ = false;
+        parsed_ = 0;
+        count_ = 0;
+    }
+    
+    HttpHeadStatus Status() const { return status_; }
+    
+    // Размер разобранной части; при COMPLETE - начала запроса вместе с пустой строкой
+    size_t ParsedSize() const { return parsed_; }
+    
+    size_t HeaderCount() const { return count_; }
+    const HttpHeaderLine& Header(size_t index) const { return headers_[index]; }
+    
+    static std::string_view Name(std::string_view data, const HttpHeaderLine& header) {
+        return data.substr(header.offset, header.name_length);
+    }
+    
+    static std::string_view Value(std::string_view data, const HttpHeaderLine& header) {
+        return data.substr(header.value_offset, header.value_length);
+    }
+    
+    // Имя заголовка без учета регистра
+    static bool NameIs(std::string_view data, const HttpHeaderLine& header, std::string_view name) {
+        return header.name_length == name.size() &&
+               ByteSearch::EqualIgnoreCase(reinterpret_cast<const uint8_t*>(data.data()) + header.offset,
+                                           reinterpret_cast<const uint8_t*>(name.data()), name.size());
+    }
+    
+    // Первый заголовок с таким именем или nullptr
+    const HttpHeaderLine* Find(std::string_view data, std::string_view name) const {
+        for (size_t i = 0; i < count_; ++i) {
+            if (NameIs(data, headers_[i], name)) {
+                return &headers_[i];
+            }
+        }
+        return nullptr;
+    }
+    
+private:
+    // METHOD SP target SP HTTP/1.x
+    static bool IsRequestLine(std::string_view line) {
+        size_t method_end = line.find(' ');
+        if (method_end == 0 || method_end == std::string_view::npos) {
+            return false;
+        }
+        for (size_t i = 0; i < method_end; ++i) {
+            if (line[i] < 'A' || line[i] > 'Z') {
+                return false;
+            }
+        }
+        size_t target_end = line.rfind(' ');
+        std::string_view version = line.substr(target_end + 1);
+        return target_end > method_end + 1 && version.size() == 8 &&
+               version.substr(0, 7) == "HTTP/1." && version[7] >= '0' && version[7] <= '9';
+    }
+    
+    static bool IsWhitespace(char c) { return c == ' ' || c == '\t'; }
+    
+    // name ":" OWS value OWS; имя без пробелов
+    bool AddHeader(std::string_view line, size_t offset, size_t next) {
+        size_t colon = line.find(':');
+        if (colon == 0 || colon == std::string_view::npos) {
+            return false;
+        }
+        for (size_t i = 0; i < colon; ++i) {
+            if (IsWhitespace(line[i])) {
+                return false;
+            }
+        }
+        
+        size_t value_begin = colon + 1;
+        size_t value_end = line.size();
+        while (value_begin < value_end && IsWhitespace(line[value_begin])) {
+            ++value_begin;
+        }
+        while (value_end > value_begin && IsWhitespace(line[value_end - 1])) {
+            --value_end;
+        }
+        
+        headers_[count_++] = {static_cast<uint32_t>(offset), static_cast<uint32_t>(next - offset),
+                              static_cast<uint32_t>(colon), static_cast<uint32_t>(offset + value_begin),
+                              static_cast<uint32_t>(value_end - value_begin)};
+        return true;
+    }
+    
+    // Значение продолжается до конца строки продолжения
+    static void ExtendHeader(HttpHeaderLine& header, std::string_view line, size_t line_end, size_t next) {
+        size_t value_end = line.size();
+        while (value_end > 0 && IsWhitespace(line[value_end - 1])) {
+            --value_end;
+        }
+        if (value_end > 0) {
+            if (header.value_length == 0) {
+                size_t value_begin = 0;
+                while (IsWhitespace(line[value_begin])) {
+                    ++value_begin;
+                }
+                header.value_offset = static_cast<uint32_t>(line_end - line.size() + value_begin);
+            }
+            header.value_length = static_cast<uint32_t>(line_end - line.size() + value_end - header.value_offset);
+        }
+        header.length = static_cast<uint32_t>(next - header.offset);
+    }
+    
+    std::array<HttpHeaderLine, kMaxHeaders> headers_;
+    size_t count_ = 0;
+    size_t parsed_ = 0;
+    bool request_line_ = false;
+    HttpHeadStatus status_ = HttpHeadStatus::INCOMPLETE;
+};
+
+} // namespace TrafficMask
@@ -0,0 +1,279 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "byte_search.h"
+
+namespace TrafficMask {
+
+// Поиск набора ключевых слов за один проход (автомат Ахо-Корасик).
+// Автомат собирается в полный DFA: переходы по несовпадению раскрыты на
+// этапе сборки, поэтому на каждый байт приходится ровно одно чтение таблицы.
+// Байты сжаты в классы: все байты, которых нет в ключевых словах, делят
+// один класс, и строка состояния занимает десятки байт вместо 256 переходов.
+// Переходы хранятся уже умноженными на ширину строки, а старший бит
+// отмечает состояния с совпадением - горячий цикл не делает ни умножений,
+// ни обращений к спискам выходов, пока совпадения нет. В корне автомата
+// байты, с которых не начинается ни одно слово, пропускаются блоками по
+// независимой таблице, без цепочки зависимых чтений переходов.
+// Для Contains с несколькими словами автомат уступает одному проходу
+// NeedleSet (фильтр по первым двум байтам): до kMaxNeedleKeywords слов
+// Contains идет через него, Scan - всегда через автомат.
+// Add только запоминает слово: автомат собирается один раз - в Build или
+// перед первым поиском, поэтому набор из n слов строится за один проход,
+// а не n раз. Поиск из нескольких потоков безопасен, Add - нет.
+class KeywordMatcher {
+public:
+    // Состояние автомата; между вызовами Scan его можно сохранять
+    // для поиска в потоке, разбитом на части
+    using State = uint32_t;
+    static constexpr State kStartState = 0;
+    
+    // Больше слов NeedleSet проверяет медленнее автомата (keyword_bench)
+    static constexpr size_t kMaxNeedleKeywords = 6;
+    
+    KeywordMatcher() { Build(); }
+    
+    KeywordMatcher(const KeywordMatcher&) = delete;
+    KeywordMatcher& operator=(const KeywordMatcher&) = delete;
+    
+    // Возвращает номер ключевого слова; автомат пересобирается в Build
+    // или перед первым поиском
+    size_t Add(std::string_view keyword) {
+        keywords_.emplace_back(keyword);
+        stale_.store(true, std::memory_order_release);
+        return keywords_.size() - 1;
+    }
+    
+    void Clear() {
+        keywords_.clear();
+        Build();
+    }
+    
+    void Build() {
+        std::lock_guard<std::mutex> lock(build_mutex_);
+        BuildLocked();
+    }
+    
+    size_t Size() const { return keywords_.size(); }
+    bool Empty() const { return keywords_.empty(); }
+    const std::string& GetKeyword(size_t index) const { return keywords_[index]; }
+    
+    // Есть ли в данных хотя бы одно ключевое слово (как string_view::find)
+    bool Contains(const uint8_t* data, size_t size) const {
+        EnsureBuilt();
+        if (matches_empty_) {
+            return true;
+        }
+        if (use_needles_) {
+            return needles_.ContainsAny(std::string_view(reinterpret_cast<const char*>(data), size));
+        }
+        
+        const State* table = transitions_.data();
+        State state = kStartState;
+        size_t i = 0;
+        while (i < size) {
+            if (state == kStartState) {
+                i = SkipToStart(data, size, i);
+                if (i == size) {
+                    break;
+                }
+            }
+            
+            state = table[state + byte_classes_[data[i++]]];
+            if (state & kMatchFlag) {
+                return true;
+            }
+        }
+        return false;
+    }
+    
+    bool Contains(std::string_view text) const {
+        return Contains(reinterpret_cast<const uint8_t*>(text.data()), text.size());
+    }
+    
+    // Сообщает о каждом вхождении непустого слова: on_match(keyword, end) -
+    // номер слова и позиция сразу за ним. Возвращает состояние для продолжения поиска
+    template<typename Callback>
+    State Scan(const uint8_t* data, size_t size, Callback&& on_match, State state = kStartState) const {
+        EnsureBuilt();
+        const State* table = transitions_.data();
+        size_t i = 0;
+        while (i < size) {
+            if (state == kStartState) {
+                i = SkipToStart(data, size, i);
+                if (i == size) {
+                    break;
+                }
+            }
+            
+            state = table[(state & ~kMatchFlag) + byte_classes_[data[i++]]];
+            if (state & kMatchFlag) {
+                size_t node = (state & ~kMatchFlag) / class_count_;
+                for (uint32_t k = output_offsets_[node]; k < output_offsets_[node + 1]; ++k) {
+                    on_match(size_t(outputs_[k]), i);
+                }
+            }
+        }
+        return state;
+    }
+    
+    size_t GetStateCount() const {
+        EnsureBuilt();
+        return output_offsets_.size() - 1;
+    }
+    size_t GetMemoryUsage() const {
+        EnsureBuilt();
+        return transitions_.size() * sizeof(State) + outputs_.size() * sizeof(uint32_t) +
+               output_offsets_.size() * sizeof(uint32_t) + sizeof(byte_classes_);
+    }
+    
+private:
+    static constexpr State kMatchFlag = State(1) << 31;
+    
+    std::vector<std::string> keywords_;
+    
+    // Собранный автомат: пересобирается лениво из const-методов поиска
+    // под build_mutex_, читается после stale_ == false
+    mutable std::array<State, 256> byte_classes_{};
+    mutable std::array<uint8_t, 256> starts_{};    // 1 - с байта начинается хотя бы одно слово
+    mutable State class_count_ = 1;
+    mutable std::vector<State> transitions_;       // [состояние * class_count_ + класс байта]
+    mutable std::vector<uint32_t> output_offsets_; // выходы состояния s: [offsets[s], offsets[s + 1])
+    mutable std::vector<uint32_t> outputs_;
+    mutable bool matches_empty_ = false;           // пустое слово входит в любые данные
+    mutable NeedleSet needles_;                    // слова для Contains при use_needles_
+    mutable bool use_needles_ = false;
+    mutable std::atomic<bool> stale_{true};        // слова добавлены после сборки
+    mutable std::mutex build_mutex_;
+    
+    void EnsureBuilt() const {
+        if (stale_.load(std::memory_order_acquire)) {
+            std::lock_guard<std::mutex> lock(build_mutex_);
+            if (stale_.load(std::memory_order_relaxed)) {
+                BuildLocked();
+            }
+        }
+    }
+    
+    void BuildLocked() const;
+    
+    // Первая позиция не раньше i, с которой автомат может уйти из корня
+    size_t SkipToStart(const uint8_t* data, size_t size, size_t i) const {
+        const uint8_t* starts = starts_.data();
+        while (i + 4 <= size &&
+               (starts[data[i]] | starts[data[i + 1]] | starts[data[i + 2]] | starts[data[i + 3]]) == 0) {
+            i += 4;
+        }
+        while (i < size && starts[data[i]] == 0) {
+            ++i;
+        }
+        return i;
+    }
+};
+
+inline void KeywordMatcher::BuildLocked() const {
+    // Классы байтов: 0 - байты вне ключевых слов, остальные по одному на байт
+    byte_classes_.fill(0);
+    starts_.fill(0);
+    class_count_ = 1;
+    for (const auto& keyword : keywords_) {
+        if (!keyword.empty()) {
+            starts_[static_cast<unsigned char>(keyword[0])] = 1;
+        }
+        for (unsigned char byte : keyword) {
+            if (byte_classes_[byte] == 0) {
+                byte_classes_[byte] = class_count_++;
+            }
+        }
+    }
+    
+    // Бор по классам байтов; -1 - перехода нет
+    std::vector<std::vector<int32_t>> trie(1, std::vector<int32_t>(class_count_, -1));
+    std::vector<std::vector<uint32_t>> node_outputs(1);
+    matches_empty_ = false;
+    for (size_t k = 0; k < keywords_.size(); ++k) {
+        if (keywords_[k].empty()) {
+            matches_empty_ = true;
+            continue;
+        }
+        
+        size_t node = 0;
+        for (unsigned char byte : keywords_[k]) {
+            State cls = byte_classes_[byte];
+            if (trie[node][cls] < 0) {
+                trie[node][cls] = static_cast<int32_t>(trie.size());
+                trie.emplace_back(class_count_, -1);
+                node_outputs.emplace_back();
+            }
+            node = static_cast<size_t>(trie[node][cls]);
+        }
+        node_outputs[node].push_back(static_cast<uint32_t>(k));
+    }
+    
+    // Обход в ширину: суффиксные ссылки, раскрытие переходов и
+    // наследование выходов от суффиксного состояния
+    std::vector<size_t> fail(trie.size(), 0);
+    std::vector<size_t> queue;
+    queue.reserve(trie.size());
+    for (State cls = 0; cls < class_count_; ++cls) {
+        if (trie[0][cls] < 0) {
+            trie[0][cls] = 0;
+        } else {
+            queue.push_back(static_cast<size_t>(trie[0][cls]));
+        }
+    }
+    
+    for (size_t head = 0; head < queue.size(); ++head) {
+        size_t node = queue[head];
+        const std::vector<uint32_t>& inherited = node_outputs[fail[node]];
+        node_outputs[node].insert(node_outputs[node].end(), inherited.begin(), inherited.end());
+        
+        for (State cls = 0; cls < class_count_; ++cls) {
+            int32_t next = trie[node][cls];
+            if (next < 0) {
+                trie[node][cls] = trie[fail[node]][cls];
+            } else {
+                fail[next] = static_cast<size_t>(trie[fail[node]][cls]);
+                queue.push_back(static_cast<size_t>(next));
+            }
+        }
+    }
+    
+    // Плоская таблица с предумноженными переходами и флагом совпадения
+    transitions_.assign(trie.size() * class_count_, 0);
+    for (size_t node = 0; node < trie.size(); ++node) {
+        for (State cls = 0; cls < class_count_; ++cls) {
+            size_t next = static_cast<size_t>(trie[node][cls]);
+            State target = static_cast<State>(next * class_count_);
+            if (!node_outputs[next].empty()) {
+                target |= kMatchFlag;
+            }
+            transitions_[node * class_count_ + cls] = target;
+        }
+    }
+    
+    output_offsets_.assign(1, 0);
+    outputs_.clear();
+    for (const auto& node_output : node_outputs) {
+        outputs_.insert(outputs_.end(), node_output.begin(), node_output.end());
+        output_offsets_.push_back(static_cast<uint32_t>(outputs_.size()));
+    }
+    
+    use_needles_ = keywords_.size() <= kMaxNeedleKeywords;
+    needles_ = NeedleSet();
+    if (use_needles_) {
+        for (const auto& keyword : keywords_) {
+            needles_.Add(keyword);
+        }
+    }
+    stale_.store(false, std::memory_order_release);
+}
+
+} // namespace TrafficMask
@@ -0,0 +1,495 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace TrafficMask {
+
+// Резерв перед и после payload: перезапись заголовков и дописывание
+// данных в пределах резерва не требуют перевыделения буфера
+constexpr size_t kPacketHeadroom = 64;
+constexpr size_t kPacketTailroom = 64;
+
+// Заголовок блока буфера; данные пакета лежат сразу за ним
+struct alignas(16) BufferBlock {
+    std::atomic<uint32_t> refs;
+    uint32_t size_class;  // индекс класса пула или kOversizeClass
+    size_t capacity;      // байт данных за заголовком
+    
+    uint8_t* Bytes() { return reinterpret_cast<uint8_t*>(this + 1); }
+};
+
+// Пул блоков пакетных буферов с классами размеров.
+// Блоки выделяются слэбами и возвращаются в список свободных своего класса,
+// поэтому в установившемся режиме буферы не обращаются к аллокатору.
+// Каждый поток держит небольшой кэш свободных блоков и обменивается с общим
+// списком порциями по kCacheBatch, так что блокировка берется редко.
+// Блоки больше старшего класса выделяются и освобождаются напрямую.
+class PacketBufferPool {
+public:
+    static constexpr uint32_t kOversizeClass = UINT32_MAX;
+    static constexpr size_t kClassCount = 4;
+    static constexpr size_t kBlocksPerSlab = 32;
+    static constexpr size_t kCacheBatch = 16;
+    
+    // Пул живет до конца процесса: буферы могут освобождаться
+    // из статических объектов после выхода из main
+    static PacketBufferPool& Instance() {
+        static PacketBufferPool* pool = new PacketBufferPool();
+        return *pool;
+    }
+    
+    BufferBlock* Allocate(size_t capacity) {
+        uint32_t size_class = ClassFor(capacity);
+        BufferBlock* block = nullptr;
+        
+        if (size_class == kOversizeClass) {
+            void* memory = ::operator new(sizeof(BufferBlock) + capacity);
+            block = new (memory) BufferBlock();
+            block->capacity = capacity;
+        } else {
+            ThreadCache* cache = LocalCache();
+            if (cache) {
+                std::vector<BufferBlock*>& blocks = cache->blocks[size_class];
+                if (blocks.empty()) {
+                    Refill(size_class, blocks);
+                }
+                block = blocks.back();
+                blocks.pop_back();
+            } else {
+                std::vector<BufferBlock*> single;
+                Refill(size_class, single, 1);
+                block = single.back();
+            }
+        }
+        
+        block->refs.store(1, std::memory_order_relaxed);
+        block->size_class = size_class;
+        return block;
+    }
+    
+    void Release(BufferBlock* block) {
+        if (block->size_class == kOversizeClass) {
+            block->~BufferBlock();
+            ::operator delete(block);
+            return;
+        }
+        
+        ThreadCache* cache = LocalCache();
+        if (!cache) {
+            SizeClass& cls = classes_[block->size_class];
+            std::lock_guard<std::mutex> lock(cls.mutex);
+            cls.free_blocks.push_back(block);
+            return;
+        }
+        
+        std::vector<BufferBlock*>& blocks = cache->blocks[block->size_class];
+        blocks.push_back(block);
+        if (blocks.size() >= 2 * kCacheBatch) {
+            Flush(block->size_class, blocks, kCacheBatch);
+        }
+    }
+    
+    size_t GetAllocatedBytes() const {
+        size_t total = 0;
+        for (const auto& cls : classes_) {
+            std::lock_guard<std::mutex> lock(cls.mutex);
+            total += cls.slabs.size() * kBlocksPerSlab * (sizeof(BufferBlock) + cls.capacity);
+        }
+        return total;
+    }
+    
+private:
+    struct SizeClass {
+        size_t capacity = 0;
+        mutable std::mutex mutex;
+        std::vector<BufferBlock*> free_blocks;
+        std::vector<std::unique_ptr<uint8_t[]>> slabs;
+    };
+    
+    SizeClass classes_[kClassCount];
+    
+    // Кэш потока; при завершении потока блоки возвращаются в общие списки
+    struct ThreadCache {
+        std::vector<BufferBlock*> blocks[kClassCount];
+        
+        ~ThreadCache() {
+            CacheAlive() = false;
+            for (uint32_t i = 0; i < kClassCount; ++i) {
+                Instance().Flush(i, blocks[i], blocks[i].size());
+            }
+        }
+    };
+    
+    static bool& CacheAlive() {
+        thread_local bool alive = true;
+        return alive;
+    }
+    
+    // nullptr - кэш потока уже разрушен (освобождение из деструкторов
+    // статических объектов); тогда блоки идут напрямую в общий список
+    static ThreadCache* LocalCache() {
+        if (!CacheAlive()) {
+            return nullptr;
+        }
+        thread_local ThreadCache cache;
+        return &cache;
+    }
+    
+    void Refill(uint32_t size_class, std::vector<BufferBlock*>& blocks, size_t count = kCacheBatch) {
+        SizeClass& cls = classes_[size_class];
+        std::lock_guard<std::mutex> lock(cls.mutex);
+        while (count-- > 0) {
+            if (cls.free_blocks.empty()) {
+                AllocateSlab(cls, size_class);
+            }
+            blocks.push_back(cls.free_blocks.back());
+            cls.free_blocks.pop_back();
+        }
+    }
+    
+    void Flush(uint32_t size_class, std::vector<BufferBlock*>& blocks, size_t count) {
+        SizeClass& cls = classes_[size_class];
+        std::lock_guard<std::mutex> lock(cls.mutex);
+        while (count-- > 0 && !blocks.empty()) {
+            cls.free_blocks.push_back(blocks.back());
+            blocks.pop_back();
+        }
+    }
+    
+    PacketBufferPool() {
+        // Короткие пакеты, MTU Ethernet, jumbo-кадры, максимальный IP-пакет
+        const size_t capacities[kClassCount] = {
+            256,
+            1500 + kPacketHeadroom + kPacketTailroom,
+            9000 + kPacketHeadroom + kPacketTailroom,
+            65535 + kPacketHeadroom + kPacketTailroom
+        };
+        for (size_t i = 0; i < kClassCount; ++i) {
+            classes_[i].capacity = capacities[i];
+        }
+    }
+    
+    uint32_t ClassFor(size_t capacity) const {
+        for (uint32_t i = 0; i < kClassCount; ++i) {
+            if (capacity <= classes_[i].capacity) {
+                return i;
+            }
+        }
+        return kOversizeClass;
+    }
+    
+    void AllocateSlab(SizeClass& cls, uint32_t size_class) {
+        size_t stride = sizeof(BufferBlock) + cls.capacity;
+        stride = (stride + alignof(BufferBlock) - 1) & ~(alignof(BufferBlock) - 1);
+        
+        // Запас на выравнивание первого блока
+        cls.slabs.push_back(std::make_unique<uint8_t[]>(stride * kBlocksPerSlab + alignof(BufferBlock)));
+        uintptr_t base = reinterpret_cast<uintptr_t>(cls.slabs.back().get());
+        base = (base + alignof(BufferBlock) - 1) & ~(uintptr_t(alignof(BufferBlock)) - 1);
+        
+        cls.free_blocks.reserve(cls.free_blocks.size() + kBlocksPerSlab);
+        for (size_t i = 0; i < kBlocksPerSlab; ++i) {
+            BufferBlock* block = new (reinterpret_cast<void*>(base + i * stride)) BufferBlock();
+            block->capacity = cls.capacity;
+            block->size_class = size_class;
+            cls.free_blocks.push_back(block);
+        }
+    }
+};
+
+// Payload пакета: ссылка на блок пула со счетчиком ссылок и копированием
+// при записи. Копирование PacketBuffer не копирует данные; первая запись
+// в разделяемый буфер отделяет собственную копию. Чтение через operator[],
+// data() и begin()/end() никогда не копирует, запись - через MutableData()
+// или operator[] неконстантного буфера.
+class PacketBuffer {
+public:
+    // Ссылка на байт для записи: чтение идет без копирования,
+    // присваивание отделяет буфер, если он разделяемый
+    class ByteRef {
+    public:
+        ByteRef(PacketBuffer& buffer, size_t index) : buffer_(buffer), index_(index) {}
+        
+        operator uint8_t() const { return buffer_.data()[index_]; }
+        
+        ByteRef& operator=(uint8_t value) {
+            buffer_.MutableData()[index_] = value;
+            return *this;
+        }
+        ByteRef& operator=(const ByteRef& other) { return *this = static_cast<uint8_t>(other); }
+        ByteRef& operator^=(uint8_t value) { return *this = static_cast<uint8_t>(*this ^ value); }
+        ByteRef& operator|=(uint8_t value) { return *this = static_cast<uint8_t>(*this | value); }
+        ByteRef& operator&=(uint8_t value) { return *this = static_cast<uint8_t>(*this & value); }
+        ByteRef& operator+=(uint8_t value) { return *this = static_cast<uint8_t>(*this + value); }
+        
+    private:
+        PacketBuffer& buffer_;
+        size_t index_;
+    };
+    
+    PacketBuffer() noexcept : block_(nullptr), offset_(0), size_(0) {}
+    
+    PacketBuffer(const uint8_t* data, size_t size,
+                 size_t headroom = kPacketHeadroom, size_t tailroom = kPacketTailroom)
+        : block_(nullptr), offset_(0), size_(0) {
+        Allocate(size, headroom, tailroom);
+        if (size > 0) {
+            std::memcpy(block_->Bytes() + offset_, data, size);
+        }
+    }
+    
+    // Точка приема пакета: единственное копирование payload
+    PacketBuffer(const std::vector<uint8_t>& data)
+        : PacketBuffer(data.data(), data.size()) {}
+    
+    PacketBuffer(const PacketBuffer& other) noexcept
+        : block_(other.block_), offset_(other.offset_), size_(other.size_) {
+        if (block_) {
+            block_->refs.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    
+    PacketBuffer(PacketBuffer&& other) noexcept
+        : block_(other.block_), offset_(other.offset_), size_(other.size_) {
+        other.block_ = nullptr;
+        other.offset_ = other.size_ = 0;
+    }
+    
+    PacketBuffer& operator=(const PacketBuffer& other) noexcept {
+        if (this != &other) {
+            PacketBuffer copy(other);
+            Swap(copy);
+        }
+        return *this;
+    }
+    
+    PacketBuffer& operator=(PacketBuffer&& other) noexcept {
+        if (this != &other) {
+            Reset();
+            Swap(other);
+        }
+        return *this;
+    }
+    
+    ~PacketBuffer() { Reset(); }
+    
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    size_t capacity() const { return block_ ? block_->capacity : 0; }
+    size_t Headroom() const { return offset_; }
+    size_t Tailroom() const { return block_ ? block_->capacity - offset_ - size_ : 0; }
+    bool IsShared() const { return block_ && block_->refs.load(std::memory_order_acquire) > 1; }
+    
+    const uint8_t* data() const { return block_ ? block_->Bytes() + offset_ : nullptr; }
+    const uint8_t* begin() const { return data(); }
+    const uint8_t* end() const { return data() + size_; }
+    
+    uint8_t operator[](size_t index) const { return data()[index]; }
+    ByteRef operator[](size_t index) { return ByteRef(*this, index); }
+    
+    // Доступ на запись; разделяемый буфер предварительно копируется
+    uint8_t* MutableData() {
+        if (IsShared()) {
+            Reallocate(size_, kPacketHeadroom, kPacketTailroom, true);
+        }
+        return block_ ? block_->Bytes() + offset_ : nullptr;
+    }
+    
+    // Заменяет содержимое; старые данные не копируются, даже если буфер разделяемый
+    template<typename Iterator>
+    void assign(Iterator first, Iterator last) {
+        uint8_t* out = Overwrite(static_cast<size_t>(std::distance(first, last)));
+        for (; first != last; ++first) {
+            *out++ = static_cast<uint8_t>(*first);
+        }
+    }
+    
+    // Готовит size байт под запись целиком и возвращает их начало;
+    // прежние данные не копируются и не обнуляются
+    uint8_t* Overwrite(size_t size) {
+        if (IsShared() || !block_ || size > block_->capacity - offset_) {
+            Reallocate(size, kPacketHeadroom, kPacketTailroom, false);
+        }
+        size_ = static_cast<uint32_t>(size);
+        return block_->Bytes() + offset_;
+    }
+    
+    // Изменение размера в пределах tailroom выполняется на месте;
+    // новые байты заполняются нулями. Границы данных хранятся в самом
+    // PacketBuffer, поэтому уменьшение не затрагивает других владельцев блока.
+    void resize(size_t size) {
+        if (size > size_) {
+            Append(size - size_);
+        } else {
+            size_ = static_cast<uint32_t>(size);
+        }
+    }
+    
+    // Расширение в начало за счет headroom; возвращает начало новых байт
+    uint8_t* Prepend(size_t count) {
+        if (IsShared() || !block_ || count > offset_) {
+            Reallocate(size_, count + kPacketHeadroom, kPacketTailroom, true);
+        }
+        offset_ -= static_cast<uint32_t>(count);
+        size_ += static_cast<uint32_t>(count);
+        std::memset(block_->Bytes() + offset_, 0, count);
+        return block_->Bytes() + offset_;
+    }
+    
+    // Расширение в конец за счет tailroom; возвращает начало новых байт
+    uint8_t* Append(size_t count) {
+        if (IsShared() || !block_ || count > Tailroom()) {
+            Reallocate(size_, kPacketHeadroom, count + kPacketTailroom, true);
+        }
+        uint8_t* tail = block_->Bytes() + offset_ + size_;
+        std::memset(tail, 0, count);
+        size_ += static_cast<uint32_t>(count);
+        return tail;
+    }
+    
+    // Отбрасывание байт с краев без копирования данных
+    void TrimFront(size_t count) {
+        count = count < size_ ? count : size_;
+        offset_ += static_cast<uint32_t>(count);
+        size_ -= static_cast<uint32_t>(count);
+    }
+    
+    void TrimBack(size_t count) {
+        size_ -= static_cast<uint32_t>(count < size_ ? count : size_);
+    }
+    
+    // Заменяет count байт с позиции pos на replacement_size байт replacement
+    // (replacement не должен указывать внутрь буфера). Замена той же длины
+    // пишет поверх; при другой длине сдвигается меньшая из частей по краям
+    // замены - голова в headroom или хвост в tailroom. Новый блок берется,
+    // только если буфер разделяемый или резерва не хватает, и тогда данные
+    // копируются в него один раз, уже с заменой.
+    void Replace(size_t pos, size_t count, const uint8_t* replacement, size_t replacement_size) {
+        pos = pos < size_ ? pos : size_;
+        count = count < size_ - pos ? count : size_ - pos;
+        size_t tail = size_ - pos - count;
+        
+        if (replacement_size != count && block_ && !IsShared()) {
+            uint8_t* base = block_->Bytes() + offset_;
+            if (replacement_size < count) {
+                size_t shrink = count - replacement_size;
+                if (pos < tail) {
+                    std::memmove(base + shrink, base, pos);
+                    offset_ += static_cast<uint32_t>(shrink);
+                } else {
+                    std::memmove(base + pos + replacement_size, base + pos + count, tail);
+                }
+                size_ -= static_cast<uint32_t>(shrink);
+            } else {
+                size_t grow = replacement_size - count;
+                bool head_fits = grow <= offset_;
+                bool tail_fits = grow <= Tailroom();
+                if (head_fits && (pos < tail || !tail_fits)) {
+                    std::memmove(base - grow, base, pos);
+                    offset_ -= static_cast<uint32_t>(grow);
+                } else if (tail_fits) {
+                    std::memmove(base + pos + replacement_size, base + pos + count, tail);
+                } else {
+                    Rebuild(pos, count, replacement_size);
+                }
+                size_ = static_cast<uint32_t>(pos + replacement_size + tail);
+            }
+        } else if (replacement_size != count || IsShared()) {
+            Rebuild(pos, count, replacement_size);
+            size_ = static_cast<uint32_t>(pos + replacement_size + tail);
+        }
+        
+        if (replacement_size > 0) {
+            std::memcpy(block_->Bytes() + offset_ + pos, replacement, replacement_size);
+        }
+    }
+    
+    void Replace(size_t pos, size_t count, std::string_view replacement) {
+        Replace(pos, count, reinterpret_cast<const uint8_t*>(replacement.data()), replacement.size());
+    }
+    
+    void clear() { size_ = 0; }
+    
+    std::vector<uint8_t> ToByteArray() const { return std::vector<uint8_t>(begin(), end()); }
+    
+    void Swap(PacketBuffer& other) noexcept {
+        std::swap(block_, other.block_);
+        std::swap(offset_, other.offset_);
+        std::swap(size_, other.size_);
+    }
+    
+private:
+    BufferBlock* block_;
+    uint32_t offset_;  // начало данных в блоке (= текущий headroom)
+    uint32_t size_;
+    
+    void Allocate(size_t size, size_t headroom, size_t tailroom) {
+        block_ = PacketBufferPool::Instance().Allocate(headroom + size + tailroom);
+        // Класс пула может дать больше запрошенного - излишек уходит в tailroom
+        offset_ = static_cast<uint32_t>(headroom);
+        size_ = static_cast<uint32_t>(size);
+    }
+    
+    // Переносит данные в новый блок с заданным резервом;
+    // keep_data = false - содержимое не нужно (перезапись целиком)
+    void Reallocate(size_t size, size_t headroom, size_t tailroom, bool keep_data) {
+        BufferBlock* old_block = block_;
+        const uint8_t* old_data = data();
+        size_t old_size = size_;
+        
+        Allocate(size, headroom, tailroom);
+        if (keep_data && old_size > 0) {
+            std::memcpy(block_->Bytes() + offset_, old_data, old_size);
+        }
+        
+        if (old_block) {
+            ReleaseBlock(old_block);
+        }
+    }
+    
+    // Переносит данные в новый блок, оставляя на месте count байт с pos
+    // промежуток в replacement_size байт; size_ выставляет вызывающий
+    void Rebuild(size_t pos, size_t count, size_t replacement_size) {
+        BufferBlock* old_block = block_;
+        const uint8_t* old_data = data();
+        size_t tail = size_ - pos - count;
+        
+        Allocate(pos + replacement_size + tail, kPacketHeadroom, kPacketTailroom);
+        uint8_t* out = block_->Bytes() + offset_;
+        if (pos > 0) {
+            std::memcpy(out, old_data, pos);
+        }
+        if (tail > 0) {
+            std::memcpy(out + pos + replacement_size, old_data + pos + count, tail);
+        }
+        
+        if (old_block) {
+            ReleaseBlock(old_block);
+        }
+    }
+    
+    void Reset() {
+        if (block_) {
+            ReleaseBlock(block_);
+            block_ = nullptr;
+        }
+        offset_ = size_ = 0;
+    }
+    
+    static void ReleaseBlock(BufferBlock* block) {
+        if (block->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            PacketBufferPool::Instance().Release(block);
+        }
+    }
+};
+
+} // namespace TrafficMask
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include "packet_buffer.h"
+#include "byte_search.h"
+
+namespace TrafficMask {
+
+// Вид на payload пакета только для чтения: указатель и длина без
+// владения и без копирования. Детекторы смотрят на пакет через вид,
+// а перезапись идет методами PacketBuffer (Replace и др.) прямо в буфере.
+// Любое изменение размера буфера делает ранее взятые виды недействительными,
+// поэтому после Replace вид берется заново.
+class PacketView {
+public:
+    static constexpr size_t npos = std::string_view::npos;
+    
+    PacketView() noexcept : data_(nullptr), size_(0) {}
+    PacketView(const uint8_t* data, size_t size) noexcept : data_(data), size_(size) {}
+    PacketView(const PacketBuffer& buffer) noexcept : data_(buffer.data()), size_(buffer.size()) {}
+    
+    const uint8_t* data() const { return data_; }
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    const uint8_t* begin() const { return data_; }
+    const uint8_t* end() const { return data_ + size_; }
+    
+    uint8_t operator[](size_t index) const { return data_[index]; }
+    
+    // Payload как текст (для regex и сравнения строк)
+    std::string_view Text() const {
+        return std::string_view(reinterpret_cast<const char*>(data_), size_);
+    }
+    
+    // Часть вида; границы обрезаются по размеру
+    PacketView Subview(size_t pos, size_t count = npos) const {
+        pos = pos < size_ ? pos : size_;
+        count = count < size_ - pos ? count : size_ - pos;
+        return PacketView(data_ + pos, count);
+    }
+    
+    size_t Find(std::string_view needle, size_t from = 0) const {
+        return FindBytes(Text(), needle, from);
+    }
+    
+    bool Contains(std::string_view needle) const { return Find(needle) != npos; }
+    
+    bool StartsWith(std::string_view prefix) const {
+        return Text().substr(0, prefix.size()) == prefix;
+    }
+    
+private:
+    const uint8_t* data_;
+    size_t size_;
+};
+
+} // namespace TrafficMask
@@ -0,0 +1,235 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "regex_set.h"
+
+namespace TrafficMask {
+
+// Номер шаблона в реестре процесса; одинаковые шаблоны разных
+// процессоров получают один номер
+using PatternId = uint32_t;
+
+enum class PatternKind : uint8_t {
+    KEYWORD,  // подстрока с учетом регистра
+    REGEX     // регулярное выражение без учета регистра
+};
+
+// Набор шаблонов процессора: бит на номер в реестре
+class PatternSet {
+public:
+    void Add(PatternId id) {
+        size_t word = id >> 6;
+        if (words_.size() <= word) {
+            words_.resize(word + 1, 0);
+        }
+        words_[word] |= uint64_t(1) << (id & 63);
+    }
+    
+    bool Contains(PatternId id) const {
+        size_t word = id >> 6;
+        return word < words_.size() && ((words_[word] >> (id & 63)) & 1) != 0;
+    }
+    
+    void Merge(const PatternSet& other) {
+        if (words_.size() < other.words_.size()) {
+            words_.resize(other.words_.size(), 0);
+        }
+        for (size_t i = 0; i < other.words_.size(); ++i) {
+            words_[i] |= other.words_[i];
+        }
+    }
+    
+    bool Empty() const {
+        return std::all_of(words_.begin(), words_.end(), [](uint64_t word) { return word == 0; });
+    }
+    
+    void Clear() { words_.clear(); }
+    
+    const std::vector<uint64_t>& Words() const { return words_; }
+    
+    template<typename Callback>
+    void ForEach(Callback&& callback) const {
+        for (size_t word = 0; word < words_.size(); ++word) {
+            for (unsigned bit = 0; bit < 64; ++bit) {
+                if ((words_[word] >> bit) & 1) {
+                    callback(static_cast<PatternId>(word * 64 + bit));
+                }
+            }
+        }
+    }
+    
+private:
+    std::vector<uint64_t> words_;
+};
+
+// Шаблоны, найденные в пакете: бит на номер в реестре. Память принадлежит
+// движку и живет, пока процессоры обрабатывают пакет; пустой вид означает,
+// что пакет не сканировался
+struct PatternMatches {
+    const uint64_t* words = nullptr;
+    size_t word_count = 0;
+    
+    bool IsValid() const { return words != nullptr; }
+    
+    bool Contains(PatternId id) const {
+        size_t word = id >> 6;
+        return word < word_count && ((words[word] >> (id & 63)) & 1) != 0;
+    }
+    
+    // Найден ли хотя бы один шаблон набора
+    bool Intersects(const PatternSet& set) const {
+        const std::vector<uint64_t>& set_words = set.Words();
+        size_t count = std::min(word_count, set_words.size());
+        for (size_t i = 0; i < count; ++i) {
+            if ((words[i] & set_words[i]) != 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+// Потоковое сканирование одного направления соединения: состояние автомата
+// общей базы после последнего просканированного пакета. Сигнатура,
+// разрезанная между TCP-сегментами, находится в пакете с ее последним
+// байтом, а байты прежних пакетов не сканируются повторно. База
+// пересобирается вместе со снимком процессоров, поэтому состояние привязано
+// к версии снимка; пакет направления, не прошедший сканирование, разрывает
+// поток, и вызывающий сбрасывает состояние через Reset
+struct PatternStream {
+    uint64_t pipeline_version = 0;
+    RegexSet::StreamState state = RegexSet::kStreamStart;
+    
+    void Reset() { *this = PatternStream(); }
+};
+
+// Реестр шаблонов процесса: (вид, текст) -> номер. Номера не освобождаются,
+// поэтому наборы процессоров остаются верными при любой пересборке базы
+class PatternRegistry {
+public:
+    struct Entry {
+        PatternKind kind;
+        std::string text;
+    };
+    
+    // Общий реестр процесса; намеренно не разрушается, как и домен эпох
+    static PatternRegistry& Instance() {
+        static PatternRegistry* registry = new PatternRegistry();
+        return *registry;
+    }
+    
+    PatternId Intern(PatternKind kind, std::string_view text) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto key = std::make_pair(kind, std::string(text));
+        auto it = ids_.find(key);
+        if (it != ids_.end()) {
+            return it->second;
+        }
+        
+        PatternId id = static_cast<PatternId>(entries_.size());
+        entries_.push_back({kind, key.second});
+        ids_.emplace(std::move(key), id);
+        return id;
+    }
+    
+    Entry Get(PatternId id) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return entries_[id];
+    }
+    
+    size_t Size() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return entries_.size();
+    }
+    
+private:
+    mutable std::mutex mutex_;
+    std::map<std::pair<PatternKind, std::string>, PatternId> ids_;
+    std::vector<Entry> entries_;
+    
+    PatternRegistry() = default;
+};
+
+// Общая база шаблонов конвейера: шаблоны и ключевые слова всех процессоров
+// без повторов, собранные в один ленивый DFA (слова - как точные литералы).
+// Пакет сканируется один раз, и каждый процессор проверяет свои шаблоны
+// по битовому результату вместо собственного прохода по payload.
+// Собирается на медленном пути при публикации снимка процессоров
+class PatternDatabase {
+public:
+    // Кеш DFA общей базы больше, чем у одного процессора: в нем
+    // шаблоны всех процессоров сразу
+    static constexpr size_t kCacheBytes = 4 * RegexSet::kDefaultCacheBytes;
+    
+    explicit PatternDatabase(const PatternSet& patterns) : regexes_(kCacheBytes) {
+        PatternRegistry& registry = PatternRegistry::Instance();
+        patterns.ForEach([&](PatternId id) {
+            PatternRegistry::Entry entry = registry.Get(id);
+            if (entry.kind == PatternKind::REGEX) {
+                regexes_.Add(entry.text, true);
+            } else {
+                regexes_.Add(RegexSet::EscapeLiteral(entry.text), false);
+            }
+            ids_.push_back(id);
+            word_count_ = std::max<size_t>(word_count_, id / 64 + 1);
+        });
+        regexes_.Build();
+    }
+    
+    PatternDatabase(const PatternDatabase&) = delete;
+    PatternDatabase& operator=(const PatternDatabase&) = delete;
+    
+    size_t Size() const { return ids_.size(); }
+    bool Empty() const { return ids_.empty(); }
+    
+    // Слов в результате сканирования
+    size_t GetWordCount() const { return word_count_; }
+    
+    // Заполняет words (GetWordCount() слов) найденными в данных шаблонами
+    void Scan(const uint8_t* data, size_t size, uint64_t* words) const {
+        std::fill(words, words + word_count_, 0);
+        regexes_.SearchAll(data, size, MatchRecorder{this, words});
+    }
+    
+    // Потоковый вариант: поиск продолжается с состояния stream, и в words
+    // попадают шаблоны, совпадения которых заканчиваются в этом пакете.
+    // version - версия снимка процессоров, которому принадлежит база
+    void Scan(const uint8_t* data, size_t size, uint64_t* words, PatternStream& stream, uint64_t version) const {
+        if (stream.pipeline_version != version) {
+            stream.pipeline_version = version;
+            stream.state = RegexSet::kStreamStart;
+        }
+        std::fill(words, words + word_count_, 0);
+        stream.state = regexes_.SearchAll(data, size, MatchRecorder{this, words}, stream.state);
+    }
+    
+    size_t GetMemoryUsage() const { return regexes_.GetMemoryUsage() + ids_.size() * sizeof(PatternId); }
+    size_t GetStateCount() const { return regexes_.GetStateCount(); }
+    size_t GetFallbackCount() const { return regexes_.GetFallbackCount(); }
+    
+private:
+    RegexSet regexes_;
+    std::vector<PatternId> ids_;  // номер в реестре по номеру шаблона в regexes_
+    size_t word_count_ = 0;
+    
+    // Отмечает найденный шаблон в битах реестра
+    struct MatchRecorder {
+        const PatternDatabase* database;
+        uint64_t* words;
+        
+        void operator()(uint32_t pattern) const {
+            PatternId id = database->ids_[pattern];
+            words[id >> 6] |= uint64_t(1) << (id & 63);
+        }
+    };
+};
+
+} // namespace TrafficMask
@@ -0,0 +1,208 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include "packet_buffer.h"
+
+namespace TrafficMask {
+
+// Правка payload: remove байт с позиции offset исходных данных
+// заменяются байтами insert (пустой insert - удаление, remove = 0 - вставка)
+struct PayloadEdit {
+    uint32_t offset;
+    uint32_t remove;
+    std::string_view insert;
+};
+
+// Участок собранного payload: кусок исходных данных или вставка.
+// Последовательность участков - готовый список для writev/sendmsg
+// (поля переносятся в iovec один к одному)
+struct PayloadSegment {
+    const uint8_t* data;
+    size_t size;
+};
+
+// Список правок к одному payload с применением за один проход. Позиции
+// задаются относительно исходных данных, поэтому правки можно добавлять в
+// любом порядке, не пересчитывая смещения после каждой, и правки разных
+// процессоров сливаются в один список. Емкость фиксирована, память не
+// выделяется; insert должен жить до Apply и не указывать в сам буфер.
+// Короткие вставки, которым негде жить (поля длины), копируются в сам
+// список через Store, поэтому список с такими правками не копируется.
+class PayloadEdits {
+public:
+    static constexpr size_t kMaxEdits = 32;
+    
+    // Байт для вставок, скопированных в список
+    static constexpr size_t kStoreSize = 32;
+    
+    // Участков в Gather не больше: куски между правками и вставки
+    static constexpr size_t kMaxSegments = 2 * kMaxEdits + 1;
+    
+    // false - список заполнен или правка пересекается с уже добавленной
+    // (удаляемые участки общие или вставка внутри удаляемого)
+    bool Add(size_t offset, size_t remove, std::string_view insert) {
+        if (count_ == kMaxEdits) {
+            return false;
+        }
+        
+        size_t index = Slot(offset, remove);
+        if (index == kNoSlot) {
+            return false;
+        }
+        for (size_t i = count_; i > index; --i) {
+            edits_[i] = edits_[i - 1];
+        }
+        edits_[index] = {static_cast<uint32_t>(offset), static_cast<uint32_t>(remove), insert};
+        ++count_;
+        return true;
+    }
+    
+    // Правка с участком [offset, offset + remove) не пересекается с уже
+    // добавленными - для групп правок, которые добавляются все или ни одной
+    bool Fits(size_t offset, size_t remove) const {
+        return Slot(offset, remove) != kNoSlot;
+    }
+    
+    // Сколько еще правок и байт Store помещается в список
+    size_t Available() const { return kMaxEdits - count_; }
+    size_t StoreAvailable() const { return kStoreSize - stored_; }
+    
+    // Копирует size байт в список и возвращает вставку на них (живет до
+    // Clear); пустая - места не хватило
+    std::string_view Store(const uint8_t* bytes, size_t size) {
+        if (size > StoreAvailable()) {
+            return {};
+        }
+        char* out = store_.data() + stored_;
+        std::memcpy(out, bytes, size);
+        stored_ += size;
+        return std::string_view(out, size);
+    }
+    
+    size_t Size() const { return count_; }
+    bool Empty() const { return count_ == 0; }
+    const PayloadEdit& operator[](size_t index) const { return edits_[index]; }
+    void Clear() {
+        count_ = 0;
+        stored_ = 0;
+    }
+    
+    // Размер данных после правок; false - правки пересекаются
+    // или выходят за size байт
+    bool OutputSize(size_t size, size_t& output_size) const {
+        size_t end = 0;
+        output_size = size;
+        for (size_t i = 0; i < count_; ++i) {
+            const PayloadEdit& edit = edits_[i];
+            if (edit.offset < end || edit.offset > size || edit.remove > size - edit.offset) {
+                return false;
+            }
+            end = edit.offset + edit.remove;
+            output_size = output_size - edit.remove + edit.insert.size();
+        }
+        return true;
+    }
+    
+    // Применяет правки; false - правки некорректны, данные не изменены.
+    // Если ни одна правка не сдвигает данные вперед (замены не длиннее
+    // удаляемого), неразделяемый буфер сжимается на месте, иначе
+    // результат собирается в новый буфер точного размера.
+    bool Apply(PacketBuffer& data) const {
+        size_t output_size = 0;
+        if (!OutputSize(data.size(), output_size)) {
+            return false;
+        }
+        if (count_ == 0) {
+            return true;
+        }
+        
+        bool in_place = !data.IsShared();
+        ptrdiff_t shift = 0;
+        for (size_t i = 0; i < count_ && in_place; ++i) {
+            shift += static_cast<ptrdiff_t>(edits_[i].insert.size()) - static_cast<ptrdiff_t>(edits_[i].remove);
+            in_place = shift <= 0;
+        }
+        
+        if (in_place) {
+            // Запись не обгоняет чтение: участки сдвигаются только назад
+            uint8_t* bytes = data.MutableData();
+            uint8_t* out = bytes;
+            size_t pos = 0;
+            for (size_t i = 0; i < count_; ++i) {
+                const PayloadEdit& edit = edits_[i];
+                std::memmove(out, bytes + pos, edit.offset - pos);
+                out += edit.offset - pos;
+                std::memcpy(out, edit.insert.data(), edit.insert.size());
+                out += edit.insert.size();
+                pos = edit.offset + edit.remove;
+            }
+            std::memmove(out, bytes + pos, data.size() - pos);
+            data.resize(output_size);
+            return true;
+        }
+        
+        PayloadSegment segments[kMaxSegments];
+        size_t count = Gather(data.data(), data.size(), segments);
+        PacketBuffer output;
+        uint8_t* out = output.Overwrite(output_size);
+        for (size_t i = 0; i < count; ++i) {
+            std::memcpy(out, segments[i].data, segments[i].size);
+            out += segments[i].size;
+        }
+        data.Swap(output);
+        return true;
+    }
+    
+    // Собранный payload без копирования: участки исходных данных между
+    // правками и вставки по порядку, пустые пропускаются. segments - не
+    // меньше kMaxSegments элементов; возвращает их число. Правки должны
+    // быть корректны для size байт (OutputSize)
+    size_t Gather(const uint8_t* data, size_t size, PayloadSegment* segments) const {
+        size_t count = 0;
+        size_t pos = 0;
+        for (size_t i = 0; i < count_; ++i) {
+            const PayloadEdit& edit = edits_[i];
+            if (edit.offset > pos) {
+                segments[count++] = {data + pos, edit.offset - pos};
+            }
+            if (!edit.insert.empty()) {
+                segments[count++] = {reinterpret_cast<const uint8_t*>(edit.insert.data()), edit.insert.size()};
+            }
+            pos = edit.offset + edit.remove;
+        }
+        if (size > pos) {
+            segments[count++] = {data + pos, size - pos};
+        }
+        return count;
+    }
+    
+private:
+    static constexpr size_t kNoSlot = ~size_t(0);
+    
+    // Место новой правки в списке, упорядоченном по позиции (при равной -
+    // в порядке добавления); kNoSlot - правка пересекается с соседней
+    size_t Slot(size_t offset, size_t remove) const {
+        size_t index = count_;
+        while (index > 0 && edits_[index - 1].offset > offset) {
+            --index;
+        }
+        if (index > 0 && edits_[index - 1].offset + edits_[index - 1].remove > offset) {
+            return kNoSlot;
+        }
+        if (index < count_ && offset + remove > edits_[index].offset) {
+            return kNoSlot;
+        }
+        return index;
+    }
+    
+    std::array<PayloadEdit, kMaxEdits> edits_;
+    size_t count_ = 0;
+    std::array<char, kStoreSize> store_;
+    size_t stored_ = 0;
+};
+
+} // namespace TrafficMask
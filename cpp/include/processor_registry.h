@@ -0,0 +1,294 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "protocol_classifier.h"
+#include "pattern_database.h"
+
+namespace TrafficMask {
+
+class ISignatureProcessor;
+
+// Эпохи для отложенного освобождения данных, которые читаются без блокировок.
+// Читатель на время чтения публикует в своей записи текущую эпоху; писатель
+// после замены указателя продвигает эпоху и освобождает старые данные, когда
+// ни один активный читатель не вошел раньше этой эпохи.
+// Записи потоков не удаляются: после завершения потока запись переиспользуется.
+class EpochDomain {
+public:
+    struct ThreadRecord {
+        std::atomic<uint64_t> epoch{0};  // 0 - поток вне чтения
+        std::atomic<bool> in_use{false};
+        size_t depth = 0;                // вложенные Enter одного потока
+        ThreadRecord* next = nullptr;
+    };
+    
+    // Общий домен процесса; намеренно не разрушается, как и пул буферов
+    static EpochDomain& Instance() {
+        static EpochDomain* domain = new EpochDomain();
+        return *domain;
+    }
+    
+    void Enter() {
+        ThreadRecord& record = CurrentRecord();
+        if (record.depth++ == 0) {
+            record.epoch.store(global_epoch_.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+        }
+    }
+    
+    void Exit() {
+        ThreadRecord& record = CurrentRecord();
+        if (--record.depth == 0) {
+            record.epoch.store(0, std::memory_order_release);
+        }
+    }
+    
+    // Вызывается писателем после публикации нового указателя;
+    // возвращает эпоху, с которой старые данные недостижимы для новых читателей
+    uint64_t Advance() {
+        return global_epoch_.fetch_add(1, std::memory_order_seq_cst) + 1;
+    }
+    
+    // Данные, снятые в эпоху retire_epoch, можно освободить
+    bool IsQuiescent(uint64_t retire_epoch) const {
+        for (ThreadRecord* record = records_.load(std::memory_order_acquire); record; record = record->next) {
+            uint64_t epoch = record->epoch.load(std::memory_order_seq_cst);
+            if (epoch != 0 && epoch < retire_epoch) {
+                return false;
+            }
+        }
+        return true;
+    }
+    
+private:
+    std::atomic<uint64_t> global_epoch_{1};
+    std::atomic<ThreadRecord*> records_{nullptr};
+    
+    EpochDomain() = default;
+    
+    // Освобождает запись при завершении потока
+    struct RecordHolder {
+        ThreadRecord* record = nullptr;
+        ~RecordHolder() {
+            if (record) {
+                record->in_use.store(false, std::memory_order_release);
+            }
+        }
+    };
+    
+    ThreadRecord& CurrentRecord() {
+        thread_local RecordHolder holder;
+        if (!holder.record) {
+            holder.record = AcquireRecord();
+        }
+        return *holder.record;
+    }
+    
+    ThreadRecord* AcquireRecord() {
+        for (ThreadRecord* record = records_.load(std::memory_order_acquire); record; record = record->next) {
+            bool expected = false;
+            if (!record->in_use.load(std::memory_order_relaxed) &&
+                record->in_use.compare_exchange_strong(expected, true, std::memory_order_acq_rel)) {
+                return record;
+            }
+        }
+        
+        ThreadRecord* record = new ThreadRecord();
+        record->in_use.store(true, std::memory_order_relaxed);
+        ThreadRecord* head = records_.load(std::memory_order_relaxed);
+        do {
+            record->next = head;
+        } while (!records_.compare_exchange_weak(head, record, std::memory_order_acq_rel));
+        return record;
+    }
+};
+
+// Ступень конвейера: процессор, классы пакетов, которые ему нужны,
+// и его шаблоны в общей базе; defers_edits - процессор откладывает правки
+// длины payload (ISignatureProcessor::DefersPayloadEdits)
+struct ProcessorStage {
+    ISignatureProcessor* processor;
+    ProtocolMask protocols;
+    PatternSet patterns;
+    bool defers_edits;
+};
+
+// Набор ступеней конвейера по индексам в снимке; ступени с индексом 63
+// и дальше делят старший бит и выбираются только вместе
+using StageMask = uint64_t;
+
+constexpr StageMask kAllStages = ~StageMask(0);
+
+constexpr StageMask StageBit(size_t index) {
+    return StageMask(1) << (index < 63 ? index : 63);
+}
+
+// Неизменяемый снимок конвейера процессоров. shared_ptr удерживают
+// процессоры, пока снимок жив; читатели обходят сырые указатели
+struct ProcessorPipeline {
+    uint64_t version = 0;
+    std::vector<std::shared_ptr<ISignatureProcessor>> owners;
+    std::vector<ProcessorStage> stages;
+    
+    // Шаблоны всех ступеней, собранные для одного прохода по пакету,
+    // и ступени с шаблонами по классам пакетов
+    std::shared_ptr<const PatternDatabase> patterns;
+    std::array<StageMask, static_cast<size_t>(ProtocolClass::COUNT)> pattern_stages{};
+};
+
+// Реестр процессоров сигнатур в стиле RCU.
+// Изменение собирает новый снимок и публикует его атомарной заменой указателя;
+// пакеты в обработке дочитывают свой снимок, который освобождается по эпохам.
+// Путь данных не берет блокировок и не трогает счетчики ссылок shared_ptr.
+class ProcessorRegistry {
+public:
+    // Снимок для чтения на время обработки пакета или пачки
+    class Snapshot {
+    public:
+        explicit Snapshot(const ProcessorRegistry& registry) {
+            EpochDomain::Instance().Enter();
+            pipeline_ = registry.current_.load(std::memory_order_seq_cst);
+        }
+        
+        ~Snapshot() { EpochDomain::Instance().Exit(); }
+        
+        Snapshot(const Snapshot&) = delete;
+        Snapshot& operator=(const Snapshot&) = delete;
+        
+        uint64_t Version() const { return pipeline_->version; }
+        size_t Size() const { return pipeline_->stages.size(); }
+        
+        // Общая база шаблонов; nullptr, если у ступеней нет шаблонов
+        const PatternDatabase* Patterns() const { return pipeline_->patterns.get(); }
+        
+        // Ступени с шаблонами среди тех, что обрабатывают класс protocol
+        StageMask PatternStages(ProtocolClass protocol) const {
+            return pipeline_->pattern_stages[static_cast<size_t>(protocol)];
+        }
+        const ProcessorStage* begin() const { return pipeline_->stages.data(); }
+        const ProcessorStage* end() const { return begin() + Size(); }
+        
+    private:
+        const ProcessorPipeline* pipeline_;
+    };
+    
+    ProcessorRegistry() : current_(new ProcessorPipeline()) {}
+    
+    ~ProcessorRegistry() {
+        // Читателей к этому моменту нет - освобождаем все сразу
+        delete current_.load(std::memory_order_relaxed);
+        for (auto& retired : retired_) {
+            delete retired.pipeline;
+        }
+    }
+    
+    ProcessorRegistry(const ProcessorRegistry&) = delete;
+    ProcessorRegistry& operator=(const ProcessorRegistry&) = delete;
+    
+    void Add(std::shared_ptr<ISignatureProcessor> processor, ProtocolMask protocols, PatternSet patterns = {},
+             bool defers_edits = false) {
+        std::lock_guard<std::mutex> lock(writer_mutex_);
+        auto next = CopyCurrent();
+        next->stages.push_back({processor.get(), protocols, std::move(patterns), defers_edits});
+        next->owners.push_back(std::move(processor));
+        Publish(std::move(next));
+    }
+    
+    // Удаляет первый процессор, для которого predicate вернул true
+    template<typename Predicate>
+    bool RemoveIf(Predicate predicate) {
+        std::lock_guard<std::mutex> lock(writer_mutex_);
+        auto next = CopyCurrent();
+        for (size_t i = 0; i < next->owners.size(); ++i) {
+            if (predicate(*next->owners[i])) {
+                next->owners.erase(next->owners.begin() + i);
+                next->stages.erase(next->stages.begin() + i);
+                Publish(std::move(next));
+                return true;
+            }
+        }
+        return false;
+    }
+    
+    void Clear() {
+        std::lock_guard<std::mutex> lock(writer_mutex_);
+        Publish(std::make_unique<ProcessorPipeline>());
+    }
+    
+    // Освобождает снимки, которые больше никто не читает
+    void Reclaim() {
+        std::lock_guard<std::mutex> lock(writer_mutex_);
+        ReclaimLocked();
+    }
+    
+    uint64_t GetVersion() const {
+        Snapshot snapshot(*this);
+        return snapshot.Version();
+    }
+    
+private:
+    struct RetiredPipeline {
+        uint64_t epoch;
+        const ProcessorPipeline* pipeline;
+    };
+    
+    std::atomic<const ProcessorPipeline*> current_;
+    std::mutex writer_mutex_;
+    std::vector<RetiredPipeline> retired_;
+    
+    std::unique_ptr<ProcessorPipeline> CopyCurrent() const {
+        return std::make_unique<ProcessorPipeline>(*current_.load(std::memory_order_relaxed));
+    }
+    
+    void Publish(std::unique_ptr<ProcessorPipeline> next) {
+        next->version = current_.load(std::memory_order_relaxed)->version + 1;
+        BuildPatterns(*next);
+        const ProcessorPipeline* previous = current_.exchange(next.release(), std::memory_order_seq_cst);
+        retired_.push_back({EpochDomain::Instance().Advance(), previous});
+        ReclaimLocked();
+    }
+    
+    // Пересобирает общую базу шаблонов снимка; шаблон нескольких
+    // процессоров попадает в нее один раз
+    static void BuildPatterns(ProcessorPipeline& pipeline) {
+        PatternSet all;
+        pipeline.pattern_stages.fill(0);
+        for (size_t index = 0; index < pipeline.stages.size(); ++index) {
+            const ProcessorStage& stage = pipeline.stages[index];
+            if (stage.patterns.Empty()) {
+                continue;
+            }
+            all.Merge(stage.patterns);
+            for (size_t protocol = 0; protocol < pipeline.pattern_stages.size(); ++protocol) {
+                if (stage.protocols & ProtocolBit(static_cast<ProtocolClass>(protocol))) {
+                    pipeline.pattern_stages[protocol] |= StageBit(index);
+                }
+            }
+        }
+        
+        pipeline.patterns.reset();
+        if (!all.Empty()) {
+            pipeline.patterns = std::make_shared<const PatternDatabase>(all);
+        }
+    }
+    
+    void ReclaimLocked() {
+        EpochDomain& domain = EpochDomain::Instance();
+        size_t kept = 0;
+        for (auto& retired : retired_) {
+            if (domain.IsQuiescent(retired.epoch)) {
+                delete retired.pipeline;
+            } else {
+                retired_[kept++] = retired;
+            }
+        }
+        retired_.resize(kept);
+    }
+};
+
+} // namespace TrafficMask
@@ -0,0 +1,217 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include "byte_search.h"
+
+namespace TrafficMask {
+
+// Класс содержимого пакета, определяемый один раз до вызова процессоров
+enum class ProtocolClass : uint8_t {
+    UNKNOWN = 0,
+    TLS_HANDSHAKE,         // TLS record 0x16 (ClientHello/ServerHello и т.д.)
+    TLS_APPLICATION_DATA,  // TLS record 0x17
+    TLS_OTHER,             // TLS ChangeCipherSpec / Alert
+    HTTP_REQUEST,
+    HTTP_RESPONSE,
+    WEBSOCKET_UPGRADE,     // HTTP-запрос с Upgrade: websocket
+    WEBSOCKET_FRAME,
+    DNS,
+    IPV4,                  // сырой IPv4-пакет с заголовком
+    VLESS,                 // бинарный заголовок VLESS
+    PROXY_URI,             // текстовые ссылки vless:// vmess:// trojan://
+    COUNT
+};
+
+// Набор классов, которые обрабатывает процессор
+using ProtocolMask = uint32_t;
+
+constexpr ProtocolMask ProtocolBit(ProtocolClass protocol) {
+    return ProtocolMask(1) << static_cast<unsigned>(protocol);
+}
+
+constexpr ProtocolMask kAllProtocols = (ProtocolMask(1) << static_cast<unsigned>(ProtocolClass::COUNT)) - 1;
+
+constexpr ProtocolMask kHttpProtocols = ProtocolBit(ProtocolClass::HTTP_REQUEST) |
+                                        ProtocolBit(ProtocolClass::HTTP_RESPONSE) |
+                                        ProtocolBit(ProtocolClass::WEBSOCKET_UPGRADE);
+
+constexpr ProtocolMask kTlsProtocols = ProtocolBit(ProtocolClass::TLS_HANDSHAKE) |
+                                       ProtocolBit(ProtocolClass::TLS_APPLICATION_DATA) |
+                                       ProtocolBit(ProtocolClass::TLS_OTHER);
+
+// Классы, внутри которых прокси-трафик узнается по тексту: ссылки
+// vless:// и имена режимов (reality, xtls-rprx-vision) встречаются и в
+// теле HTTP, и в записях TLS, и в кадрах WebSocket, а не только в начале
+// payload. Не входят DNS и сырой IPv4 - их разбирают свои процессоры
+constexpr ProtocolMask kProxyTextProtocols = kHttpProtocols | kTlsProtocols |
+                                             ProtocolBit(ProtocolClass::WEBSOCKET_FRAME) |
+                                             ProtocolBit(ProtocolClass::PROXY_URI) |
+                                             ProtocolBit(ProtocolClass::UNKNOWN);
+
+inline const char* ProtocolClassName(ProtocolClass protocol) {
+    switch (protocol) {
+        case ProtocolClass::TLS_HANDSHAKE: return "tls_handshake";
+        case ProtocolClass::TLS_APPLICATION_DATA: return "tls_application_data";
+        case ProtocolClass::TLS_OTHER: return "tls_other";
+        case ProtocolClass::HTTP_REQUEST: return "http_request";
+        case ProtocolClass::HTTP_RESPONSE: return "http_response";
+        case ProtocolClass::WEBSOCKET_UPGRADE: return "websocket_upgrade";
+        case ProtocolClass::WEBSOCKET_FRAME: return "websocket_frame";
+        case ProtocolClass::DNS: return "dns";
+        case ProtocolClass::IPV4: return "ipv4";
+        case ProtocolClass::VLESS: return "vless";
+        case ProtocolClass::PROXY_URI: return "proxy_uri";
+        default: return "unknown";
+    }
+}
+
+namespace Classifier {
+
+// Сколько байт HTTP-заголовка просматривается в поисках Upgrade
+constexpr size_t kHttpUpgradeScanBytes = 1024;
+
+inline bool StartsWith(const uint8_t* data, size_t size, const char* prefix) {
+    size_t length = std::strlen(prefix);
+    return size >= length && std::memcmp(data, prefix, length) == 0;
+}
+
+// Поиск ASCII-строки без учета регистра; needle задается в нижнем регистре.
+// Векторный поиск FindBytesIgnoreCase вместо сравнения с каждой позиции
+inline bool ContainsLowercase(const uint8_t* data, size_t size, const char* needle) {
+    return FindBytesIgnoreCase(data, size, reinterpret_cast<const uint8_t*>(needle), std::strlen(needle)) !=
+           ByteSearch::kNotFound;
+}
+
+inline bool IsHttpRequest(const uint8_t* data, size_t size) {
+    static const char* const kMethods[] = {
+        "GET ", "POST ", "PUT ", "HEAD ", "DELETE ", "OPTIONS ", "PATCH ", "CONNECT "
+    };
+    for (const char* method : kMethods) {
+        if (StartsWith(data, size, method)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Заголовок TLS record: тип 20-23, версия 3.x
+inline bool IsTlsRecord(const uint8_t* data, size_t size) {
+    return size >= 5 && data[0] >= 0x14 && data[0] <= 0x17 && data[1] == 0x03 && data[2] <= 0x04;
+}
+
+// IPv4: версия 4, корректная длина заголовка, полная длина не больше буфера
+inline bool IsIpv4Packet(const uint8_t* data, size_t size) {
+    if (size < 20 || (data[0] >> 4) != 4) {
+        return false;
+    }
+    
+    size_t header_length = (data[0] & 0x0F) * 4;
+    size_t total_length = (size_t(data[2]) << 8) | data[3];
+    return header_length >= 20 && header_length <= total_length && total_length <= size;
+}
+
+// DNS: заголовок 12 байт, стандартный opcode, 1-4 вопроса и корректное
+// имя из меток, за которым помещаются QTYPE и QCLASS
+inline bool IsDnsMessage(const uint8_t* data, size_t size) {
+    if (size < 17) {
+        return false;
+    }
+    
+    uint8_t opcode = (data[2] >> 3) & 0x0F;
+    size_t questions = (size_t(data[4]) << 8) | data[5];
+    if (opcode > 2 || questions == 0 || questions > 4) {
+        return false;
+    }
+    
+    size_t offset = 12;
+    while (offset < size && data[offset] != 0) {
+        uint8_t label = data[offset];
+        if (label > 63) {
+            return false;
+        }
+        offset += label + 1;
+    }
+    
+    return offset + 5 <= size;
+}
+
+// Бинарный заголовок VLESS: версия 0, команда TCP/UDP/MUX, затем UUID
+inline bool IsVlessHeader(const uint8_t* data, size_t size) {
+    return size >= 20 && data[0] == 0x00 && data[1] >= 0x01 && data[1] <= 0x03;
+}
+
+// Кадр WebSocket: нулевые RSV, известный opcode и заголовок в пределах буфера
+inline bool IsWebSocketFrame(const uint8_t* data, size_t size) {
+    if (size < 2 || (data[0] & 0x70) != 0) {
+        return false;
+    }
+    
+    uint8_t opcode = data[0] & 0x0F;
+    bool known_opcode = opcode <= 0x02 || (opcode >= 0x08 && opcode <= 0x0A);
+    if (!known_opcode || (data[0] & 0x80) == 0) {
+        return false;
+    }
+    
+    uint8_t length = data[1] & 0x7F;
+    size_t header = 2 + (length == 126 ? 2 : length == 127 ? 8 : 0) + ((data[1] & 0x80) ? 4 : 0);
+    return header <= size;
+}
+
+} // namespace Classifier
+
+// Классификация по первым байтам и длинам: каждая проверка читает
+// не больше нескольких байт, кроме поиска Upgrade в начале HTTP-заголовка
+inline ProtocolClass ClassifyPayload(const uint8_t* data, size_t size) {
+    using namespace Classifier;
+    
+    if (size == 0) {
+        return ProtocolClass::UNKNOWN;
+    }
+    
+    if (IsTlsRecord(data, size)) {
+        switch (data[0]) {
+            case 0x16: return ProtocolClass::TLS_HANDSHAKE;
+            case 0x17: return ProtocolClass::TLS_APPLICATION_DATA;
+            default: return ProtocolClass::TLS_OTHER;
+        }
+    }
+    
+    if (IsHttpRequest(data, size)) {
+        size_t scan = size < kHttpUpgradeScanBytes ? size : kHttpUpgradeScanBytes;
+        if (ContainsLowercase(data, scan, "upgrade: websocket")) {
+            return ProtocolClass::WEBSOCKET_UPGRADE;
+        }
+        return ProtocolClass::HTTP_REQUEST;
+    }
+    
+    if (StartsWith(data, size, "HTTP/1.")) {
+        return ProtocolClass::HTTP_RESPONSE;
+    }
+    
+    if (StartsWith(data, size, "vless://") || StartsWith(data, size, "vmess://") ||
+        StartsWith(data, size, "trojan://")) {
+        return ProtocolClass::PROXY_URI;
+    }
+    
+    if (IsIpv4Packet(data, size)) {
+        return ProtocolClass::IPV4;
+    }
+    
+    if (IsDnsMessage(data, size)) {
+        return ProtocolClass::DNS;
+    }
+    
+    if (IsVlessHeader(data, size)) {
+        return ProtocolClass::VLESS;
+    }
+    
+    if (IsWebSocketFrame(data, size)) {
+        return ProtocolClass::WEBSOCKET_FRAME;
+    }
+    
+    return ProtocolClass::UNKNOWN;
+}
+
+} // namespace TrafficMask
@@ -0,0 +1,1048 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "scratch_arena.h"
+
+namespace TrafficMask {
+
+// Ошибка разбора регулярного выражения
+class RegexSyntaxError : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+// Множество байтов (битовая маска на 256 значений)
+struct ByteSet {
+    std::array<uint64_t, 4> bits{};
+    
+    void Add(uint8_t byte) { bits[byte >> 6] |= uint64_t(1) << (byte & 63); }
+    bool Contains(uint8_t byte) const { return ((bits[byte >> 6] >> (byte & 63)) & 1) != 0; }
+    
+    void AddRange(uint8_t first, uint8_t last) {
+        for (unsigned byte = first; byte <= last; ++byte) {
+            Add(static_cast<uint8_t>(byte));
+        }
+    }
+    
+    void Merge(const ByteSet& other) {
+        for (size_t i = 0; i < bits.size(); ++i) {
+            bits[i] |= other.bits[i];
+        }
+    }
+    
+    void Invert() {
+        for (auto& word : bits) {
+            word = ~word;
+        }
+    }
+    
+    // Дополняет ASCII-буквы парой другого регистра
+    void FoldCase() {
+        for (unsigned byte = 'A'; byte <= 'Z'; ++byte) {
+            if (Contains(static_cast<uint8_t>(byte)) || Contains(static_cast<uint8_t>(byte | 0x20))) {
+                Add(static_cast<uint8_t>(byte));
+                Add(static_cast<uint8_t>(byte | 0x20));
+            }
+        }
+    }
+};
+
+// Набор регулярных выражений, проверяемый за один проход по данным.
+// Шаблоны (подмножество синтаксиса ECMAScript, как у std::regex: литералы,
+// \xHH, \d \w \s, классы [...], ., |, группы, * + ? {n,m}) компилируются
+// в общую программу NFA Томпсона. Поиск идет по DFA, состояния которого
+// строятся лениво при первом переходе и кешируются в таблице фиксированного
+// размера; когда бюджет памяти исчерпан, остаток данных проверяется
+// симуляцией NFA. Оба режима линейны по длине данных и не откатываются назад.
+// Переходы начального состояния строятся сразу: байты, на которых автомат
+// остается в начале, пропускаются блоками без цепочки зависимых чтений.
+// Поиск безопасен из нескольких потоков: готовые переходы читаются без
+// блокировок, новые состояния добавляются под мьютексом. Заполненный кеш
+// не сбрасывается (на его номера ссылаются потоковые состояния): после
+// этого новые переходы не строятся, и мьютекс больше не берется.
+class RegexSet {
+public:
+    static constexpr int kNoMatch = -1;
+    static constexpr size_t kDefaultCacheBytes = 64 * 1024;
+    
+    // Состояние потокового поиска - номер состояния DFA. Начальное
+    // состояние строится первым, поэтому его номер всегда 0
+    using StreamState = int32_t;
+    static constexpr StreamState kStreamStart = 0;
+    
+    explicit RegexSet(size_t cache_bytes = kDefaultCacheBytes) : cache_bytes_(cache_bytes) { Build(); }
+    
+    RegexSet(const RegexSet&) = delete;
+    RegexSet& operator=(const RegexSet&) = delete;
+    
+    // Разбирает шаблон и возвращает его номер; бросает RegexSyntaxError.
+    // Автомат пересобирается в Build
+    size_t Add(std::string_view pattern, bool ignore_case);
+    
+    // Шаблон, совпадающий ровно с literal (каждый байт - через \xHH)
+    static std::string EscapeLiteral(std::string_view literal) {
+        static const char kHex[] = "0123456789abcdef";
+        std::string pattern;
+        pattern.reserve(literal.size() * 4);
+        for (unsigned char byte : literal) {
+            pattern += "\\x";
+            pattern += kHex[byte >> 4];
+            pattern += kHex[byte & 15];
+        }
+        return pattern;
+    }
+    
+    void Build();
+    
+    size_t Size() const { return pattern_count_; }
+    bool Empty() const { return pattern_count_ == 0; }
+    
+    // Номер шаблона, совпадение с которым заканчивается раньше всех
+    // (при равенстве - меньший номер), или kNoMatch
+    int Search(const uint8_t* data, size_t size) const;
+    
+    int Search(std::string_view text) const {
+        return Search(reinterpret_cast<const uint8_t*>(text.data()), text.size());
+    }
+    
+    // Вызывает on_match(pattern) для каждого шаблона, который встречается
+    // в данных; номер может повторяться. В отличие от Search, проход не
+    // останавливается на первом совпадении
+    template<typename Callback>
+    void SearchAll(const uint8_t* data, size_t size, Callback&& on_match) const {
+        SearchAll(data, size, on_match, kStreamStart);
+    }
+    
+    // Потоковый поиск: data - очередная часть потока, state - значение,
+    // которое вернул вызов для предыдущей части (kStreamStart в начале).
+    // Совпадение, разрезанное между частями, сообщается в той части, где
+    // оно заканчивается; прежние части не пересканируются. Кеш DFA не
+    // очищается, поэтому состояние остается верным, пока набор не пересобран.
+    // Если кеш заполнен и поиск ушел в симуляцию NFA, ее состояние не
+    // сохраняется: возвращается kStreamStart
+    template<typename Callback>
+    StreamState SearchAll(const uint8_t* data, size_t size, Callback&& on_match, StreamState state) const;
+    
+    size_t GetStateCount() const {
+        std::lock_guard<std::mutex> lock(cache_mutex_);
+        return state_count_;
+    }
+    size_t GetStateLimit() const { return max_states_; }
+    size_t GetFallbackCount() const { return fallbacks_.load(std::memory_order_relaxed); }
+    // Таблица переходов, состояния с их векторами и узлами индекса, программа
+    size_t GetMemoryUsage() const {
+        std::lock_guard<std::mutex> lock(cache_mutex_);
+        return TableBytes() + state_heap_bytes_ +
+               program_.size() * sizeof(Instruction) + sets_.size() * sizeof(ByteSet);
+    }
+    
+private:
+    struct Instruction {
+        enum class Op : uint8_t {
+            BYTES,   // байт из sets_[x], переход к следующей инструкции
+            SPLIT,   // ветвление на x и y
+            JUMP,    // переход на x
+            MATCH    // совпадение шаблона x
+        };
+        Op op;
+        uint32_t x;
+        uint32_t y;
+    };
+    
+    struct Node {
+        enum class Kind : uint8_t {
+            EMPTY,
+            BYTES,
+            CONCAT,
+            ALTERNATE,
+            REPEAT
+        };
+        Kind kind;
+        uint32_t set = 0;
+        uint32_t min = 0;
+        uint32_t max = 0;
+        std::vector<uint32_t> children;
+    };
+    
+    class Parser;
+    
+    // Множество инструкций с O(1) очисткой; память выделяет вызывающий
+    struct SparseSet {
+        uint32_t* dense;
+        uint32_t* sparse;
+        uint32_t size = 0;
+        
+        bool Contains(uint32_t pc) const { return sparse[pc] < size && dense[sparse[pc]] == pc; }
+        void Insert(uint32_t pc) {
+            sparse[pc] = size;
+            dense[size++] = pc;
+        }
+    };
+    
+    struct DfaState {
+        std::vector<uint32_t> pcs;      // инструкции BYTES и MATCH по возрастанию
+        std::vector<uint32_t> matches;  // номера совпавших шаблонов по возрастанию
+        int match = kNoMatch;           // первый из matches
+    };
+    
+    static constexpr uint32_t kUnbounded = ~uint32_t(0);
+    static constexpr size_t kMaxProgramSize = 1 << 16;
+    static constexpr size_t kMinStates = 8;
+    
+    // Приблизительные накладные расходы узла std::map и блока кучи
+    static constexpr size_t kIndexNodeOverhead = 4 * sizeof(void*);
+    static constexpr size_t kHeapBlockOverhead = 2 * sizeof(void*);
+    
+    // Переход хранит номер состояния, умноженный на class_count_;
+    // флаг отмечает состояние с совпадением, -1 - переход еще не построен
+    static constexpr int32_t kAcceptFlag = int32_t(1) << 30;
+    static constexpr int32_t kUnknown = -1;
+    
+    size_t cache_bytes_;
+    size_t pattern_count_ = 0;
+    std::vector<Instruction> program_;
+    std::vector<ByteSet> sets_;
+    std::vector<uint32_t> starts_;
+    
+    std::array<uint32_t, 256> byte_classes_{};
+    std::vector<uint8_t> class_bytes_;  // представитель каждого класса
+    uint32_t class_count_ = 1;
+    
+    size_t max_states_ = 0;
+    std::unique_ptr<std::atomic<int32_t>[]> transitions_;
+    std::unique_ptr<DfaState[]> states_;
+    int32_t start_ = 0;
+    std::array<uint8_t, 256> start_loops_{};  // 1 - байт оставляет автомат в начальном состоянии
+    
+    // Построение состояний (только под cache_mutex_)
+    mutable std::mutex cache_mutex_;
+    mutable size_t state_count_ = 0;
+    mutable size_t state_heap_bytes_ = 0;  // куча построенных состояний, см. StateHeapBytes
+    mutable std::atomic<bool> cache_full_{false};
+    mutable std::map<std::vector<uint32_t>, uint32_t> state_index_;
+    mutable std::vector<uint32_t> build_dense_;
+    mutable std::vector<uint32_t> build_sparse_;
+    mutable std::vector<uint32_t> build_stack_;
+    mutable std::atomic<size_t> fallbacks_{0};
+    
+    void Emit(const std::vector<Node>& nodes, uint32_t index);
+    uint32_t Append(Instruction instruction);
+    void ComputeByteClasses();
+    
+    void AddClosure(uint32_t pc, SparseSet& set, uint32_t* stack) const;
+    void Step(const uint32_t* pcs, size_t count, uint8_t byte, SparseSet& next, uint32_t* stack) const;
+    int MatchOf(const uint32_t* pcs, size_t count) const;
+    
+    template<typename Callback>
+    void ForEachMatch(const uint32_t* pcs, size_t count, Callback&& on_match) const {
+        for (size_t i = 0; i < count; ++i) {
+            if (program_[pcs[i]].op == Instruction::Op::MATCH) {
+                on_match(program_[pcs[i]].x);
+            }
+        }
+    }
+    
+    // Память, выделяемая под все max_states_ состояний заранее
+    size_t TableBytes() const {
+        return max_states_ * (class_count_ * sizeof(std::atomic<int32_t>) + sizeof(DfaState));
+    }
+    
+    // Куча одного состояния: pcs хранятся дважды (в DfaState и ключом
+    // state_index_), matches и узел индекса
+    static size_t StateHeapBytes(size_t pc_count, size_t match_count) {
+        size_t bytes = 2 * (pc_count * sizeof(uint32_t) + kHeapBlockOverhead) + kIndexNodeOverhead +
+                       sizeof(std::vector<uint32_t>) + sizeof(uint32_t);
+        if (match_count > 0) {
+            bytes += match_count * sizeof(uint32_t) + kHeapBlockOverhead;
+        }
+        return bytes;
+    }
+    
+    int32_t AddState(SparseSet& set) const;
+    int32_t ComputeTransition(int32_t state, uint32_t byte_class) const;
+    
+    // Симуляция NFA с состояния state. На каждой позиции с совпадением
+    // вызывается on_match(pcs, count, first) - множество инструкций и
+    // меньший совпавший номер; true останавливает поиск
+    template<typename Callback>
+    void SearchNfa(const DfaState& state, const uint8_t* data, size_t size, Callback&& on_match) const;
+    
+    // Первая позиция не раньше i, на которой автомат покидает начальное состояние
+    size_t SkipStartLoops(const uint8_t* data, size_t size, size_t i) const {
+        const uint8_t* loops = start_loops_.data();
+        while (i + 4 <= size && (loops[data[i]] & loops[data[i + 1]] & loops[data[i + 2]] & loops[data[i + 3]]) != 0) {
+            i += 4;
+        }
+        while (i < size && loops[data[i]] != 0) {
+            ++i;
+        }
+        return i;
+    }
+};
+
+// Рекурсивный спуск по шаблону; строит дерево узлов и множества байтов
+class RegexSet::Parser {
+public:
+    Parser(std::string_view pattern, bool ignore_case, std::vector<ByteSet>& sets)
+        : pattern_(pattern), ignore_case_(ignore_case), sets_(sets), pos_(0) {}
+    
+    std::vector<Node> nodes;
+    
+    uint32_t Parse() {
+        uint32_t root = ParseAlternation(0);
+        if (pos_ != pattern_.size()) {
+            Fail("unmatched ')'");
+        }
+        return root;
+    }
+    
+private:
+    static constexpr size_t kMaxNesting = 64;
+    static constexpr uint32_t kMaxRepeat = 1000;
+    
+    std::string_view pattern_;
+    bool ignore_case_;
+    std::vector<ByteSet>& sets_;
+    size_t pos_;
+    
+    [[noreturn]] void Fail(const char* message) const {
+        throw RegexSyntaxError(std::string(message) + " at offset " + std::to_string(pos_));
+    }
+    
+    bool AtEnd() const { return pos_ >= pattern_.size(); }
+    char Peek() const { return pattern_[pos_]; }
+    
+    uint32_t AddNode(Node node) {
+        nodes.push_back(std::move(node));
+        return static_cast<uint32_t>(nodes.size() - 1);
+    }
+    
+    uint32_t AddBytes(ByteSet set) {
+        if (ignore_case_) {
+            set.FoldCase();
+        }
+        sets_.push_back(set);
+        
+        Node node;
+        node.kind = Node::Kind::BYTES;
+        node.set = static_cast<uint32_t>(sets_.size() - 1);
+        return AddNode(std::move(node));
+    }
+    
+    uint32_t ParseAlternation(size_t depth) {
+        if (depth > kMaxNesting) {
+            Fail("nesting too deep");
+        }
+        
+        Node node;
+        node.kind = Node::Kind::ALTERNATE;
+        node.children.push_back(ParseConcat(depth));
+        while (!AtEnd() && Peek() == '|') {
+            ++pos_;
+            node.children.push_back(ParseConcat(depth));
+        }
+        
+        if (node.children.size() == 1) {
+            return node.children[0];
+        }
+        return AddNode(std::move(node));
+    }
+    
+    uint32_t ParseConcat(size_t depth) {
+        Node node;
+        node.kind = Node::Kind::CONCAT;
+        while (!AtEnd() && Peek() != '|' && Peek() != ')') {
+            node.children.push_back(ParseRepeat(depth));
+        }
+        
+        if (node.children.empty()) {
+            node.kind = Node::Kind::EMPTY;
+        }
+        return AddNode(std::move(node));
+    }
+    
+    uint32_t ParseRepeat(size_t depth) {
+        uint32_t atom = ParseAtom(depth);
+        if (AtEnd()) {
+            return atom;
+        }
+        
+        uint32_t min = 0;
+        uint32_t max = kUnbounded;
+        switch (Peek()) {
+            case '*':
+                ++pos_;
+                break;
+            case '+':
+                ++pos_;
+                min = 1;
+                break;
+            case '?':
+                ++pos_;
+                max = 1;
+                break;
+            case '{':
+                ParseBraces(min, max);
+                break;
+            default:
+                return atom;
+        }
+        
+        // Ленивые квантификаторы не меняют факт совпадения
+        if (!AtEnd() && Peek() == '?') {
+            ++pos_;
+        }
+        if (!AtEnd() && (Peek() == '*' || Peek() == '+' || Peek() == '?' || Peek() == '{')) {
+            Fail("nothing to repeat");
+        }
+        
+        Node node;
+        node.kind = Node::Kind::REPEAT;
+        node.min = min;
+        node.max = max;
+        node.children.push_back(atom);
+        return AddNode(std::move(node));
+    }
+    
+    uint32_t ParseNumber() {
+        uint32_t value = 0;
+        size_t start = pos_;
+        while (!AtEnd() && Peek() >= '0' && Peek() <= '9') {
+            value = value * 10 + static_cast<uint32_t>(Peek() - '0');
+            if (value > kMaxRepeat) {
+                Fail("repeat count too large");
+            }
+            ++pos_;
+        }
+        if (pos_ == start) {
+            Fail("invalid repeat count");
+        }
+        return value;
+    }
+    
+    void ParseBraces(uint32_t& min, uint32_t& max) {
+        ++pos_;
+        min = ParseNumber();
+        max = min;
+        if (!AtEnd() && Peek() == ',') {
+            ++pos_;
+            max = (!AtEnd() && Peek() == '}') ? kUnbounded : ParseNumber();
+        }
+        if (AtEnd() || Peek() != '}' || max < min) {
+            Fail("invalid repeat braces");
+        }
+        ++pos_;
+    }
+    
+    uint32_t ParseAtom(size_t depth) {
+        char c = Peek();
+        ++pos_;
+        
+        ByteSet set;
+        switch (c) {
+            case '(': {
+                if (!AtEnd() && Peek() == '?') {
+                    if (pos_ + 1 < pattern_.size() && pattern_[pos_ + 1] == ':') {
+                        pos_ += 2;
+                    } else {
+                        Fail("unsupported group");
+                    }
+                }
+                uint32_t inner = ParseAlternation(depth + 1);
+                if (AtEnd() || Peek() != ')') {
+                    Fail("missing ')'");
+                }
+                ++pos_;
+                return inner;
+            }
+            case '[':
+                return AddBytes(ParseClass());
+            case '.':
+                // Как в ECMAScript: любой байт, кроме концов строк
+                set.Invert();
+                set.bits[0] &= ~((uint64_t(1) << '\n') | (uint64_t(1) << '\r'));
+                return AddBytes(set);
+            case '\\':
+                return AddBytes(ParseEscape(false));
+            case '^':
+            case '$':
+                Fail("anchors are not supported");
+            case '*':
+            case '+':
+            case '?':
+            case '{':
+                Fail("nothing to repeat");
+            default:
+                set.Add(static_cast<uint8_t>(c));
+                return AddBytes(set);
+        }
+    }
+    
+    int HexDigit(char c) const {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    }
+    
+    // Escape-последовательность после '\'; в классе \b означает backspace
+    ByteSet ParseEscape(bool in_class) {
+        if (AtEnd()) {
+            Fail("trailing backslash");
+        }
+        
+        char c = Peek();
+        ++pos_;
+        
+        ByteSet set;
+        switch (c) {
+            case 'd':
+            case 'D':
+                set.AddRange('0', '9');
+                break;
+            case 'w':
+            case 'W':
+                set.AddRange('a', 'z');
+                set.AddRange('A', 'Z');
+                set.AddRange('0', '9');
+                set.Add('_');
+                break;
+            case 's':
+            case 'S':
+                set.AddRange('\t', '\r');
+                set.Add(' ');
+                break;
+            case 'x': {
+                int high = pos_ < pattern_.size() ? HexDigit(pattern_[pos_]) : -1;
+                int low = pos_ + 1 < pattern_.size() ? HexDigit(pattern_[pos_ + 1]) : -1;
+                if (high < 0 || low < 0) {
+                    Fail("invalid \\x escape");
+                }
+                pos_ += 2;
+                set.Add(static_cast<uint8_t>(high * 16 + low));
+                return set;
+            }
+            case 'n': set.Add('\n'); return set;
+            case 'r': set.Add('\r'); return set;
+            case 't': set.Add('\t'); return set;
+            case 'f': set.Add('\f'); return set;
+            case 'v': set.Add('\v'); return set;
+            case '0': set.Add(0); return set;
+            case 'b':
+                if (in_class) {
+                    set.Add('\b');
+                    return set;
+                }
+                Fail("word boundaries are not supported");
+            case 'B':
+                Fail("word boundaries are not supported");
+            default:
+                if (c >= '1' && c <= '9') {
+                    Fail("backreferences are not supported");
+                }
+                set.Add(static_cast<uint8_t>(c));
+                return set;
+        }
+        
+        // \D \W \S - дополнения
+        if (c == 'D' || c == 'W' || c == 'S') {
+            set.Invert();
+        }
+        return set;
+    }
+    
+    ByteSet ParseClass() {
+        ByteSet set;
+        bool negate = !AtEnd() && Peek() == '^';
+        if (negate) {
+            ++pos_;
+        }
+        
+        while (true) {
+            if (AtEnd()) {
+                Fail("missing ']'");
+            }
+            if (Peek() == ']') {
+                ++pos_;
+                break;
+            }
+            
+            bool single = false;
+            uint8_t first = 0;
+            ByteSet item = ParseClassAtom(single, first);
+            
+            // Диапазон a-z; '-' в конце класса - литерал
+            if (single && pos_ + 1 < pattern_.size() && Peek() == '-' && pattern_[pos_ + 1] != ']') {
+                ++pos_;
+                bool single_last = false;
+                uint8_t last = 0;
+                ParseClassAtom(single_last, last);
+                if (!single_last || last < first) {
+                    Fail("invalid class range");
+                }
+                item.AddRange(first, last);
+            }
+            set.Merge(item);
+        }
+        
+        // Регистр раскрывается до инверсии: [^a] без учета регистра не содержит и A
+        if (ignore_case_) {
+            set.FoldCase();
+        }
+        if (negate) {
+            set.Invert();
+        }
+        return set;
+    }
+    
+    ByteSet ParseClassAtom(bool& single, uint8_t& byte) {
+        ByteSet set;
+        if (Peek() == '\\') {
+            ++pos_;
+            char escape = AtEnd() ? 'x' : Peek();
+            set = ParseEscape(true);
+            single = std::strchr("dDwWsS", escape) == nullptr;
+        } else {
+            set.Add(static_cast<uint8_t>(Peek()));
+            ++pos_;
+            single = true;
+        }
+        
+        if (single) {
+            for (unsigned b = 0; b < 256; ++b) {
+                if (set.Contains(static_cast<uint8_t>(b))) {
+                    byte = static_cast<uint8_t>(b);
+                    break;
+                }
+            }
+        }
+        return set;
+    }
+};
+
+inline size_t RegexSet::Add(std::string_view pattern, bool ignore_case) {
+    // Дерево строится целиком до изменения программы: при ошибке разбора
+    // набор остается прежним
+    size_t sets_before = sets_.size();
+    size_t program_before = program_.size();
+    Parser parser(pattern, ignore_case, sets_);
+    try {
+        uint32_t root = parser.Parse();
+        
+        uint32_t start = static_cast<uint32_t>(program_.size());
+        Emit(parser.nodes, root);
+        Append({Instruction::Op::MATCH, static_cast<uint32_t>(pattern_count_), 0});
+        starts_.push_back(start);
+    } catch (...) {
+        sets_.resize(sets_before);
+        program_.resize(program_before);
+        throw;
+    }
+    return pattern_count_++;
+}
+
+inline uint32_t RegexSet::Append(Instruction instruction) {
+    if (program_.size() >= kMaxProgramSize) {
+        throw RegexSyntaxError("pattern is too large");
+    }
+    program_.push_back(instruction);
+    return static_cast<uint32_t>(program_.size() - 1);
+}
+
+inline void RegexSet::Emit(const std::vector<Node>& nodes, uint32_t index) {
+    const Node& node = nodes[index];
+    switch (node.kind) {
+        case Node::Kind::EMPTY:
+            break;
+        case Node::Kind::BYTES:
+            Append({Instruction::Op::BYTES, node.set, 0});
+            break;
+        case Node::Kind::CONCAT:
+            for (uint32_t child : node.children) {
+                Emit(nodes, child);
+            }
+            break;
+        case Node::Kind::ALTERNATE: {
+            std::vector<uint32_t> jumps;
+            for (size_t i = 0; i < node.children.size(); ++i) {
+                if (i + 1 == node.children.size()) {
+                    Emit(nodes, node.children[i]);
+                    break;
+                }
+                uint32_t split = Append({Instruction::Op::SPLIT, 0, 0});
+                program_[split].x = split + 1;
+                Emit(nodes, node.children[i]);
+                jumps.push_back(Append({Instruction::Op::JUMP, 0, 0}));
+                program_[split].y = static_cast<uint32_t>(program_.size());
+            }
+            for (uint32_t jump : jumps) {
+                program_[jump].x = static_cast<uint32_t>(program_.size());
+            }
+            break;
+        }
+        case Node::Kind::REPEAT: {
+            uint32_t child = node.children[0];
+            for (uint32_t i = 0; i < node.min; ++i) {
+                Emit(nodes, child);
+            }
+            
+            if (node.max == kUnbounded) {
+                uint32_t split = Append({Instruction::Op::SPLIT, 0, 0});
+                program_[split].x = split + 1;
+                Emit(nodes, child);
+                Append({Instruction::Op::JUMP, split, 0});
+                program_[split].y = static_cast<uint32_t>(program_.size());
+            } else {
+                std::vector<uint32_t> splits;
+                for (uint32_t i = node.min; i < node.max; ++i) {
+                    uint32_t split = Append({Instruction::Op::SPLIT, 0, 0});
+                    program_[split].x = split + 1;
+                    splits.push_back(split);
+                    Emit(nodes, child);
+                }
+                for (uint32_t split : splits) {
+                    program_[split].y = static_cast<uint32_t>(program_.size());
+                }
+            }
+            break;
+        }
+    }
+}
+
+inline void RegexSet::ComputeByteClasses() {
+    // Граница класса - байт, на котором меняется принадлежность хотя бы одному множеству
+    std::array<bool, 256> boundary{};
+    for (const auto& set : sets_) {
+        for (unsigned byte = 1; byte < 256; ++byte) {
+            if (set.Contains(static_cast<uint8_t>(byte)) != set.Contains(static_cast<uint8_t>(byte - 1))) {
+                boundary[byte] = true;
+            }
+        }
+    }
+    
+    class_bytes_.assign(1, 0);
+    uint32_t current = 0;
+    for (unsigned byte = 0; byte < 256; ++byte) {
+        if (boundary[byte]) {
+            ++current;
+            class_bytes_.push_back(static_cast<uint8_t>(byte));
+        }
+        byte_classes_[byte] = current;
+    }
+    class_count_ = current + 1;
+}
+
+inline void RegexSet::Build() {
+    ComputeByteClasses();
+    
+    {
+        std::lock_guard<std::mutex> lock(cache_mutex_);
+        build_dense_.assign(program_.size() + 1, 0);
+        build_sparse_.assign(program_.size() + 1, 0);
+        build_stack_.assign(program_.size() + 1, 0);
+        SparseSet start{build_dense_.data(), build_sparse_.data()};
+        for (uint32_t pc : starts_) {
+            AddClosure(pc, start, build_stack_.data());
+        }
+        
+        // Бюджет памяти определяет предел числа состояний DFA. Поиск без
+        // привязки к началу добавляет начальные инструкции на каждом шаге,
+        // поэтому ключ любого состояния не короче ключа начального - по нему
+        // оценивается куча состояния. Точная куча учитывается в AddState
+        size_t start_pcs = 0;
+        for (uint32_t i = 0; i < start.size; ++i) {
+            Instruction::Op op = program_[start.dense[i]].op;
+            start_pcs += op == Instruction::Op::BYTES || op == Instruction::Op::MATCH ? 1 : 0;
+        }
+        size_t state_bytes = class_count_ * sizeof(std::atomic<int32_t>) + sizeof(DfaState) + StateHeapBytes(start_pcs, 0);
+        max_states_ = std::max(kMinStates, cache_bytes_ / state_bytes);
+        max_states_ = std::min<size_t>(max_states_, (size_t(kAcceptFlag) - 1) / class_count_);
+        
+        transitions_.reset(new std::atomic<int32_t>[max_states_ * class_count_]);
+        for (size_t i = 0; i < max_states_ * class_count_; ++i) {
+            transitions_[i].store(kUnknown, std::memory_order_relaxed);
+        }
+        states_.reset(new DfaState[max_states_]);
+        state_count_ = 0;
+        state_heap_bytes_ = 0;
+        cache_full_.store(false, std::memory_order_relaxed);
+        state_index_.clear();
+        start_ = AddState(start);
+    }
+    
+    start_loops_.fill(0);
+    if (start_ & kAcceptFlag) {
+        return;
+    }
+    for (uint32_t byte_class = 0; byte_class < class_count_; ++byte_class) {
+        ComputeTransition(start_, byte_class);
+    }
+    for (unsigned byte = 0; byte < 256; ++byte) {
+        int32_t next = transitions_[start_ + byte_classes_[byte]].load(std::memory_order_relaxed);
+        start_loops_[byte] = next == start_ ? 1 : 0;
+    }
+}
+
+inline void RegexSet::AddClosure(uint32_t pc, SparseSet& set, uint32_t* stack) const {
+    if (set.Contains(pc)) {
+        return;
+    }
+    
+    size_t top = 0;
+    set.Insert(pc);
+    stack[top++] = pc;
+    while (top > 0) {
+        const Instruction& instruction = program_[stack[--top]];
+        uint32_t targets[2] = {instruction.x, instruction.y};
+        size_t target_count = instruction.op == Instruction::Op::SPLIT ? 2 :
+                              instruction.op == Instruction::Op::JUMP ? 1 : 0;
+        for (size_t i = 0; i < target_count; ++i) {
+            if (!set.Contains(targets[i])) {
+                set.Insert(targets[i]);
+                stack[top++] = targets[i];
+            }
+        }
+    }
+}
+
+inline void RegexSet::Step(const uint32_t* pcs, size_t count, uint8_t byte,
+                           SparseSet& next, uint32_t* stack) const {
+    next.size = 0;
+    for (size_t i = 0; i < count; ++i) {
+        const Instruction& instruction = program_[pcs[i]];
+        if (instruction.op == Instruction::Op::BYTES && sets_[instruction.x].Contains(byte)) {
+            AddClosure(pcs[i] + 1, next, stack);
+        }
+    }
+    
+    // Поиск без привязки к началу: любой шаблон может начаться с каждого байта
+    for (uint32_t pc : starts_) {
+        AddClosure(pc, next, stack);
+    }
+}
+
+inline int RegexSet::MatchOf(const uint32_t* pcs, size_t count) const {
+    int match = kNoMatch;
+    for (size_t i = 0; i < count; ++i) {
+        const Instruction& instruction = program_[pcs[i]];
+        if (instruction.op == Instruction::Op::MATCH &&
+            (match == kNoMatch || int(instruction.x) < match)) {
+            match = static_cast<int>(instruction.x);
+        }
+    }
+    return match;
+}
+
+inline int32_t RegexSet::AddState(SparseSet& set) const {
+    // Ключ состояния - только инструкции, влияющие на переходы и совпадения
+    std::vector<uint32_t> pcs;
+    for (uint32_t i = 0; i < set.size; ++i) {
+        Instruction::Op op = program_[set.dense[i]].op;
+        if (op == Instruction::Op::BYTES || op == Instruction::Op::MATCH) {
+            pcs.push_back(set.dense[i]);
+        }
+    }
+    std::sort(pcs.begin(), pcs.end());
+    
+    auto it = state_index_.find(pcs);
+    uint32_t index;
+    if (it != state_index_.end()) {
+        index = it->second;
+    } else {
+        // Предел - число строк таблицы или бюджет вместе с кучей состояний
+        std::vector<uint32_t> matches;
+        ForEachMatch(pcs.data(), pcs.size(), [&matches](uint32_t pattern) {
+            matches.push_back(pattern);
+        });
+        size_t heap_bytes = StateHeapBytes(pcs.size(), matches.size());
+        if (state_count_ == max_states_ ||
+            (state_count_ >= kMinStates && TableBytes() + state_heap_bytes_ + heap_bytes > cache_bytes_)) {
+            cache_full_.store(true, std::memory_order_relaxed);
+            return kUnknown;
+        }
+        index = static_cast<uint32_t>(state_count_++);
+        state_heap_bytes_ += heap_bytes;
+        DfaState& state = states_[index];
+        std::sort(matches.begin(), matches.end());
+        state.matches = std::move(matches);
+        state.match = state.matches.empty() ? kNoMatch : static_cast<int>(state.matches[0]);
+        state.pcs = pcs;
+        state_index_.emplace(std::move(pcs), index);
+    }
+    
+    int32_t value = static_cast<int32_t>(index * class_count_);
+    return states_[index].match != kNoMatch ? (value | kAcceptFlag) : value;
+}
+
+inline int32_t RegexSet::ComputeTransition(int32_t state, uint32_t byte_class) const {
+    // Кеш заполнен: без мьютекса сразу в симуляцию NFA, иначе потоки
+    // общего набора выстраивались бы в очередь на каждом новом переходе
+    if (cache_full_.load(std::memory_order_relaxed)) {
+        fallbacks_.fetch_add(1, std::memory_order_relaxed);
+        return kUnknown;
+    }
+    
+    std::lock_guard<std::mutex> lock(cache_mutex_);
+    
+    std::atomic<int32_t>& slot = transitions_[state + byte_class];
+    int32_t next = slot.load(std::memory_order_relaxed);
+    if (next != kUnknown) {
+        return next;  // Переход построил другой поток
+    }
+    
+    const DfaState& current = states_[state / class_count_];
+    SparseSet set{build_dense_.data(), build_sparse_.data()};
+    Step(current.pcs.data(), current.pcs.size(), class_bytes_[byte_class], set, build_stack_.data());
+    
+    next = AddState(set);
+    if (next == kUnknown) {
+        fallbacks_.fetch_add(1, std::memory_order_relaxed);
+        return kUnknown;
+    }
+    
+    // Публикация после заполнения состояния: читатель видит его целиком
+    slot.store(next, std::memory_order_release);
+    return next;
+}
+
+template<typename Callback>
+void RegexSet::SearchNfa(const DfaState& state, const uint8_t* data, size_t size, Callback&& on_match) const {
+    // Кеш DFA заполнен - остаток проверяется симуляцией NFA на памяти арены
+    ScratchArena& arena = ScratchArena::ForCurrentThread();
+    ScratchArena::Scope scratch(arena);
+    
+    size_t program_size = program_.size() + 1;
+    auto allocate = [&arena, program_size]() {
+        auto* memory = static_cast<uint32_t*>(arena.Allocate(program_size * sizeof(uint32_t), alignof(uint32_t)));
+        std::memset(memory, 0, program_size * sizeof(uint32_t));
+        return memory;
+    };
+    
+    SparseSet current{allocate(), allocate()};
+    SparseSet next{allocate(), allocate()};
+    uint32_t* stack = allocate();
+    
+    for (uint32_t pc : state.pcs) {
+        current.Insert(pc);
+    }
+    
+    for (size_t i = 0; i < size; ++i) {
+        Step(current.dense, current.size, data[i], next, stack);
+        int match = MatchOf(next.dense, next.size);
+        if (match != kNoMatch && on_match(next.dense, next.size, match)) {
+            return;
+        }
+        std::swap(current, next);
+    }
+}
+
+inline int RegexSet::Search(const uint8_t* data, size_t size) const {
+    int32_t state = start_;
+    if (state & kAcceptFlag) {
+        return states_[(state & ~kAcceptFlag) / class_count_].match;
+    }
+    if (pattern_count_ == 0) {
+        return kNoMatch;
+    }
+    
+    const std::atomic<int32_t>* table = transitions_.get();
+    for (size_t i = 0; i < size; ++i) {
+        if (state == start_) {
+            i = SkipStartLoops(data, size, i);
+            if (i == size) {
+                break;
+            }
+        }
+        
+        uint32_t byte_class = byte_classes_[data[i]];
+        int32_t next = table[state + byte_class].load(std::memory_order_acquire);
+        if (next == kUnknown) {
+            next = ComputeTransition(state, byte_class);
+            if (next == kUnknown) {
+                int match = kNoMatch;
+                SearchNfa(states_[state / class_count_], data + i, size - i,
+                          [&match](const uint32_t*, size_t, int first) {
+                              match = first;
+                              return true;
+                          });
+                return match;
+            }
+        }
+        
+        if (next & kAcceptFlag) {
+            return states_[(next & ~kAcceptFlag) / class_count_].match;
+        }
+        state = next;
+    }
+    return kNoMatch;
+}
+
+template<typename Callback>
+RegexSet::StreamState RegexSet::SearchAll(const uint8_t* data, size_t size, Callback&& on_match,
+                                          StreamState state) const {
+    if (pattern_count_ == 0) {
+        return kStreamStart;
+    }
+    
+    // Состояние хранится без флага совпадения: поиск продолжается после него.
+    // Чужое состояние (от другого набора) не должно выводить за таблицу
+    int32_t start = start_ & ~kAcceptFlag;
+    if (state < 0 || static_cast<size_t>(state) >= max_states_ * class_count_ || state % class_count_ != 0) {
+        state = start;
+    }
+    int32_t reported = kUnknown;
+    if (start_ & kAcceptFlag) {
+        for (uint32_t pattern : states_[start / class_count_].matches) {
+            on_match(pattern);
+        }
+    }
+    
+    const std::atomic<int32_t>* table = transitions_.get();
+    for (size_t i = 0; i < size; ++i) {
+        if (state == start) {
+            i = SkipStartLoops(data, size, i);
+            if (i == size) {
+                break;
+            }
+        }
+        
+        uint32_t byte_class = byte_classes_[data[i]];
+        int32_t next = table[state + byte_class].load(std::memory_order_acquire);
+        if (next == kUnknown) {
+            next = ComputeTransition(state, byte_class);
+            if (next == kUnknown) {
+                SearchNfa(states_[state / class_count_], data + i, size - i,
+                          [this, &on_match](const uint32_t* pcs, size_t count, int) {
+                              ForEachMatch(pcs, count, on_match);
+                              return false;
+                          });
+                return kStreamStart;
+            }
+        }
+        
+        // Хвосты вида .* держат автомат в одном принимающем состоянии:
+        // о его совпадениях сообщается один раз подряд
+        if ((next & kAcceptFlag) && next != reported) {
+            reported = next;
+            for (uint32_t pattern : states_[(next & ~kAcceptFlag) / class_count_].matches) {
+                on_match(pattern);
+            }
+        }
+        state = next & ~kAcceptFlag;
+    }
+    return state;
+}
+
+} // namespace TrafficMask
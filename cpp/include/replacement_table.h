@@ -0,0 +1,344 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "byte_search.h"
+#include "packet_buffer.h"
+#include "payload_edits.h"
+#include "scratch_arena.h"
+
+namespace TrafficMask {
+
+// Таблица замен подстрок (образец -> замена), применяемая к payload за
+// один проход слева направо вместо find/replace и пересборки буфера на
+// каждую строку таблицы. Образцы сгруппированы по первому байту, внутри
+// группы - от длинного к короткому: в каждой позиции берется самое
+// длинное совпадение ("xtls-rprx-vision" раньше "xtls"), и поиск
+// продолжается за ним. Вставленный текст повторно не сканируется, поэтому
+// порядок строк таблицы не важен. Позиции-кандидаты отбираются векторно
+// по блокам, совпадение проверяется сравнением первых 8 байт словом. Если
+// все замены той же длины, что и образцы, payload переписывается на месте,
+// иначе результат собирается одним проходом в новый буфер точного размера.
+class ReplacementTable {
+public:
+    using Entry = std::pair<std::string_view, std::string_view>;
+    
+    // Первых байтов, сравниваемых векторно; при большем их числе
+    // кандидаты отбираются по таблице групп
+    static constexpr size_t kMaxVectorFirstBytes = 8;
+    
+    ReplacementTable() = default;
+    
+    ReplacementTable(std::initializer_list<Entry> entries) {
+        for (const Entry& entry : entries) {
+            Add(entry.first, entry.second);
+        }
+    }
+    
+    // Пустой и повторный образцы не добавляются: при повторе
+    // действует первая замена
+    void Add(std::string_view needle, std::string_view replacement) {
+        if (needle.empty() || std::find(needles_.begin(), needles_.end(), needle) != needles_.end()) {
+            return;
+        }
+        needles_.emplace_back(needle);
+        replacements_.emplace_back(replacement);
+        same_size_ = same_size_ && needle.size() == replacement.size();
+        first_.Add(static_cast<uint8_t>(needle[0]));
+        if (needle.size() > 1) {
+            second_.Add(static_cast<uint8_t>(needle[1]));
+        } else {
+            second_.AddAll();
+        }
+        
+        // Группы по первому байту, в группе - от длинного образца к
+        // короткому, при равной длине - в порядке добавления
+        order_.push_back(static_cast<uint32_t>(needles_.size() - 1));
+        std::stable_sort(order_.begin(), order_.end(), [this](uint32_t a, uint32_t b) {
+            uint8_t first_a = static_cast<uint8_t>(needles_[a][0]);
+            uint8_t first_b = static_cast<uint8_t>(needles_[b][0]);
+            if (first_a != first_b) {
+                return first_a < first_b;
+            }
+            return needles_[a].size() > needles_[b].size();
+        });
+        groups_.fill(Group{});
+        prefixes_.clear();
+        for (uint32_t i = 0; i < order_.size(); ++i) {
+            const std::string& sorted = needles_[order_[i]];
+            Group& group = groups_[static_cast<uint8_t>(sorted[0])];
+            if (group.begin == group.end) {
+                group.begin = i;
+            }
+            group.end = i + 1;
+            
+            Prefix prefix;
+            std::memcpy(&prefix.bits, sorted.data(), std::min(sorted.size(), sizeof(uint64_t)));
+            prefix.mask = sorted.size() >= sizeof(uint64_t) ? ~uint64_t(0) : (uint64_t(1) << (8 * sorted.size())) - 1;
+            prefixes_.push_back(prefix);
+        }
+    }
+    
+    size_t Size() const { return needles_.size(); }
+    bool Empty() const { return needles_.empty(); }
+    
+    // Есть ли в данных хотя бы один образец
+    bool ContainsAny(std::string_view text) const {
+        const uint8_t* data = reinterpret_cast<const uint8_t*>(text.data());
+        bool found = false;
+        Scan(data, text.size(), [&](size_t pos) {
+            found = MatchAt(data, text.size(), pos) != kNoEntry;
+            return found ? text.size() : pos + 1;
+        });
+        return found;
+    }
+    
+    // Применяет замены ко всем выбранным вхождениям; возвращает их число
+    size_t Apply(PacketBuffer& data) const {
+        return Apply(data, [](const PacketBuffer&) {});
+    }
+    
+    // То же; before_write(data) вызывается один раз перед первой записью,
+    // только если есть что заменить (например, запрос восстановить checksum)
+    template<typename BeforeWrite>
+    size_t Apply(PacketBuffer& data, BeforeWrite&& before_write) const {
+        if (needles_.empty() || data.empty()) {
+            return 0;
+        }
+        
+        // Выбранные вхождения в порядке позиций; список живет в арене
+        // потока только до конца вызова
+        ScratchArena::Scope scratch(ScratchArena::ForCurrentThread());
+        ScratchVector<Match> matches;
+        const uint8_t* in = data.data();
+        size_t size = data.size();
+        size_t output_size = size;
+        Scan(in, size, [&](size_t pos) {
+            uint32_t entry = MatchAt(in, size, pos);
+            if (entry == kNoEntry) {
+                return pos + 1;
+            }
+            matches.push_back({static_cast<uint32_t>(pos), entry});
+            output_size = output_size - needles_[entry].size() + replacements_[entry].size();
+            return pos + needles_[entry].size();
+        });
+        if (matches.empty()) {
+            return 0;
+        }
+        before_write(static_cast<const PacketBuffer&>(data));
+        
+        if (same_size_) {
+            uint8_t* out = data.MutableData();
+            for (const Match& match : matches) {
+                const std::string& replacement = replacements_[match.entry];
+                std::memcpy(out + match.start, replacement.data(), replacement.size());
+            }
+            return matches.size();
+        }
+        
+        // Неизменные участки и замены копируются в новый буфер по порядку
+        PacketBuffer output;
+        uint8_t* out = output.Overwrite(output_size);
+        size_t pos = 0;
+        for (const Match& match : matches) {
+            const std::string& replacement = replacements_[match.entry];
+            std::memcpy(out, in + pos, match.start - pos);
+            out += match.start - pos;
+            std::memcpy(out, replacement.data(), replacement.size());
+            out += replacement.size();
+            pos = match.start + needles_[match.entry].size();
+        }
+        std::memcpy(out, in + pos, size - pos);
+        data.Swap(output);
+        return matches.size();
+    }
+    
+    // Те же вхождения, что выбрал бы Apply, но замены добавляются в edits
+    // (вставки указывают в таблицу - она должна жить до применения правок).
+    // Вхождение, участок которого уже правится, пропускается; возвращает
+    // число добавленных правок
+    size_t Collect(std::string_view text, PayloadEdits& edits) const {
+        if (needles_.empty() || text.empty()) {
+            return 0;
+        }
+        
+        const uint8_t* in = reinterpret_cast<const uint8_t*>(text.data());
+        size_t added = 0;
+        Scan(in, text.size(), [&](size_t pos) {
+            uint32_t entry = MatchAt(in, text.size(), pos);
+            if (entry == kNoEntry) {
+                return pos + 1;
+            }
+            if (edits.Add(pos, needles_[entry].size(), replacements_[entry])) {
+                ++added;
+            }
+            return pos + needles_[entry].size();
+        });
+        return added;
+    }
+    
+private:
+    static constexpr uint32_t kNoEntry = UINT32_MAX;
+    
+    struct Match {
+        uint32_t start;
+        uint32_t entry;
+    };
+    
+    // Образцы с одним первым байтом: order_[begin, end)
+    struct Group {
+        uint32_t begin = 0;
+        uint32_t end = 0;
+    };
+    
+    // Первые 8 байт образца order_[i] и маска его длины: кандидат
+    // отсеивается одним сравнением слова, memcmp - только для остатка
+    struct Prefix {
+        uint64_t bits = 0;
+        uint64_t mask = 0;
+    };
+    
+    // Самый длинный образец, совпавший с позиции pos, или kNoEntry
+    uint32_t MatchAt(const uint8_t* data, size_t size, size_t pos) const {
+        const Group& group = groups_[data[pos]];
+        if (size - pos >= sizeof(uint64_t)) {
+            uint64_t window;
+            std::memcpy(&window, data + pos, sizeof(window));
+            for (uint32_t i = group.begin; i < group.end; ++i) {
+                if ((window & prefixes_[i].mask) != prefixes_[i].bits) {
+                    continue;
+                }
+                const std::string& needle = needles_[order_[i]];
+                if (needle.size() <= sizeof(uint64_t) ||
+                    (needle.size() <= size - pos &&
+                     std::memcmp(data + pos + sizeof(uint64_t), needle.data() + sizeof(uint64_t),
+                                 needle.size() - sizeof(uint64_t)) == 0)) {
+                    return order_[i];
+                }
+            }
+            return kNoEntry;
+        }
+        
+        // Конец данных: слово целиком не читается
+        for (uint32_t i = group.begin; i < group.end; ++i) {
+            const std::string& needle = needles_[order_[i]];
+            if (needle.size() <= size - pos && std::memcmp(data + pos, needle.data(), needle.size()) == 0) {
+                return order_[i];
+            }
+        }
+        return kNoEntry;
+    }
+    
+    // Передает on_candidate позиции не раньше предыдущего результата
+    // on_candidate, с байта которых начинается хоть один образец; результат
+    // не меньше size останавливает проход
+    template<typename Callback>
+    void Scan(const uint8_t* data, size_t size, Callback&& on_candidate) const {
+        size_t next = 0;
+        size_t from = 0;
+
+#if defined(TRAFFICMASK_BYTE_SEARCH_X86)
+        if (ByteSearch::HasAvx2()) {
+            from = ScanAvx2(data, size, next, on_candidate);
+        } else if (first_.bytes.size() <= kMaxVectorFirstBytes) {
+            from = ScanSse2(data, size, next, on_candidate);
+        }
+#endif
+
+        for (from = std::max(from, next); from < size; from = std::max(from + 1, next)) {
+            const Group& group = groups_[data[from]];
+            if (group.begin != group.end) {
+                next = on_candidate(from);
+            }
+        }
+    }
+    
+    // Кандидаты блока: бит i маски - позиция base + i; false - проход остановлен
+    template<typename Callback>
+    static bool VisitCandidates(uint32_t mask, size_t base, size_t size, size_t& next, Callback& on_candidate) {
+        while (mask != 0) {
+            size_t pos = base + ByteSearch::CountTrailingZeros(mask);
+            mask &= mask - 1;
+            if (pos >= next) {
+                next = on_candidate(pos);
+                if (next >= size) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+#if defined(TRAFFICMASK_BYTE_SEARCH_X86)
+    // Блоки по 32 байта: кандидат - позиция, где первый байт входит в
+    // first_, а следующий - в second_ (на тексте один первый байт встречается
+    // часто, пара - редко). Возвращает первую позицию, не покрытую блоками,
+    // или size после остановки
+    template<typename Callback>
+    TRAFFICMASK_TARGET_AVX2 size_t ScanAvx2(const uint8_t* data, size_t size, size_t& next, Callback& on_candidate) const {
+        const __m256i first_low = ByteSearch::LoadClassTable(first_.low);
+        const __m256i first_high = ByteSearch::LoadClassTable(first_.high);
+        const __m256i second_low = ByteSearch::LoadClassTable(second_.low);
+        const __m256i second_high = ByteSearch::LoadClassTable(second_.high);
+        size_t from = 0;
+        for (; from + 33 <= size; from += 32) {
+            if (from + 32 <= next) {
+                continue;
+            }
+            __m256i head = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + from));
+            __m256i tail = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + from + 1));
+            uint32_t mask = ByteSearch::MatchClassAvx2(head, first_low, first_high) & ByteSearch::MatchClassAvx2(tail, second_low, second_high);
+            if (!VisitCandidates(mask, from, size, next, on_candidate)) {
+                return size;
+            }
+        }
+        return from;
+    }
+    
+    // Без AVX2 - блоки по 16 байт, сравнение с каждым первым байтом;
+    // недостающие до kMaxVectorFirstBytes дублируют первый, чтобы число
+    // сравнений было постоянным
+    template<typename Callback>
+    size_t ScanSse2(const uint8_t* data, size_t size, size_t& next, Callback& on_candidate) const {
+        __m128i firsts[kMaxVectorFirstBytes];
+        for (size_t i = 0; i < kMaxVectorFirstBytes; ++i) {
+            firsts[i] = _mm_set1_epi8(first_.bytes[i < first_.bytes.size() ? i : 0]);
+        }
+        size_t from = 0;
+        for (; from + 16 <= size; from += 16) {
+            if (from + 16 <= next) {
+                continue;
+            }
+            __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + from));
+            __m128i hits = _mm_cmpeq_epi8(block, firsts[0]);
+            for (size_t i = 1; i < kMaxVectorFirstBytes; ++i) {
+                hits = _mm_or_si128(hits, _mm_cmpeq_epi8(block, firsts[i]));
+            }
+            uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(hits));
+            if (!VisitCandidates(mask, from, size, next, on_candidate)) {
+                return size;
+            }
+        }
+        return from;
+    }
+#endif
+
+    std::vector<std::string> needles_;
+    std::vector<std::string> replacements_;
+    std::vector<uint32_t> order_;      // номера образцов, сгруппированные по первому байту
+    std::vector<Prefix> prefixes_;     // префиксы образцов в порядке order_
+    std::array<Group, 256> groups_{};  // группа образцов каждого первого байта
+    ByteSearch::ByteClass first_;                  // первые байты образцов
+    ByteSearch::ByteClass second_;                 // вторые байты; все, если есть образец из одного байта
+    bool same_size_ = true;
+};
+
+} // namespace TrafficMask
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace TrafficMask {
+
+// Bump-арена для временных данных процессоров (копии payload для замен,
+// промежуточные строки и векторы). Выделение - сдвиг указателя, освобождения
+// по отдельности нет: память возвращается откатом к метке (Scope) или Reset.
+// Чанки сохраняются между пакетами, поэтому в установившемся режиме арена
+// не обращается к аллокатору. Одна арена на рабочий поток, не потокобезопасна.
+class ScratchArena {
+public:
+    static constexpr size_t kDefaultChunkSize = 64 * 1024;
+    
+    struct Marker {
+        size_t chunk;
+        size_t offset;
+    };
+    
+    // Откатывает арену к состоянию на момент создания
+    class Scope {
+    public:
+        explicit Scope(ScratchArena& arena) : arena_(arena), marker_(arena.Mark()) {}
+        ~Scope() { arena_.Rewind(marker_); }
+        
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+        
+    private:
+        ScratchArena& arena_;
+        Marker marker_;
+    };
+    
+    explicit ScratchArena(size_t chunk_size = kDefaultChunkSize)
+        : chunk_size_(chunk_size), current_(0), offset_(0) {}
+    
+    ScratchArena(const ScratchArena&) = delete;
+    ScratchArena& operator=(const ScratchArena&) = delete;
+    
+    // Арена текущего рабочего потока; движок откатывает ее после
+    // каждого пакета или группы пакетов
+    static ScratchArena& ForCurrentThread() {
+        thread_local ScratchArena arena;
+        return arena;
+    }
+    
+    void* Allocate(size_t size, size_t alignment = alignof(std::max_align_t)) {
+        while (current_ < chunks_.size()) {
+            Chunk& chunk = chunks_[current_];
+            uintptr_t base = reinterpret_cast<uintptr_t>(chunk.memory.get());
+            uintptr_t aligned = (base + offset_ + alignment - 1) & ~(uintptr_t(alignment) - 1);
+            if (aligned + size <= base + chunk.size) {
+                offset_ = aligned + size - base;
+                return reinterpret_cast<void*>(aligned);
+            }
+            
+            // Следующий чанк уже выделен на предыдущих пакетах
+            ++current_;
+            offset_ = 0;
+        }
+        
+        // Запрос больше стандартного чанка получает собственный чанк
+        size_t chunk_size = std::max(chunk_size_, size + alignment);
+        chunks_.push_back({std::make_unique<uint8_t[]>(chunk_size), chunk_size});
+        current_ = chunks_.size() - 1;
+        offset_ = 0;
+        return Allocate(size, alignment);
+    }
+    
+    Marker Mark() const { return {current_, offset_}; }
+    
+    void Rewind(const Marker& marker) {
+        current_ = marker.chunk;
+        offset_ = marker.offset;
+    }
+    
+    void Reset() { Rewind({0, 0}); }
+    
+    size_t GetCapacity() const {
+        size_t total = 0;
+        for (const auto& chunk : chunks_) {
+            total += chunk.size;
+        }
+        return total;
+    }
+    
+private:
+    struct Chunk {
+        std::unique_ptr<uint8_t[]> memory;
+        size_t size;
+    };
+    
+    size_t chunk_size_;
+    std::vector<Chunk> chunks_;
+    size_t current_;  // чанк, из которого идет выделение
+    size_t offset_;   // занято байт в текущем чанке
+};
+
+// STL-аллокатор поверх арены. По умолчанию берет арену текущего потока,
+// поэтому ScratchString/ScratchVector заменяют std::string/std::vector
+// без передачи аллокатора явно. deallocate ничего не делает.
+template<typename T>
+class ScratchAllocator {
+public:
+    using value_type = T;
+    
+    ScratchAllocator() noexcept : arena_(&ScratchArena::ForCurrentThread()) {}
+    explicit ScratchAllocator(ScratchArena& arena) noexcept : arena_(&arena) {}
+    
+    template<typename U>
+    ScratchAllocator(const ScratchAllocator<U>& other) noexcept : arena_(other.GetArena()) {}
+    
+    T* allocate(size_t count) {
+        return static_cast<T*>(arena_->Allocate(count * sizeof(T), alignof(T)));
+    }
+    
+    void deallocate(T*, size_t) noexcept {}
+    
+    ScratchArena* GetArena() const noexcept { return arena_; }
+    
+    template<typename U>
+    bool operator==(const ScratchAllocator<U>& other) const noexcept { return arena_ == other.GetArena(); }
+    template<typename U>
+    bool operator!=(const ScratchAllocator<U>& other) const noexcept { return arena_ != other.GetArena(); }
+    
+private:
+    ScratchArena* arena_;
+};
+
+using ScratchString = std::basic_string<char, std::char_traits<char>, ScratchAllocator<char>>;
+
+template<typename T>
+using ScratchVector = std::vector<T, ScratchAllocator<T>>;
+
+} // namespace TrafficMask
@@ -0,0 +1,189 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <iterator>
+#include "packet_buffer.h"
+#include "payload_edits.h"
+
+namespace TrafficMask {
+
+// Расположение имени сервера (SNI, host_name) в TLS ClientHello и всех
+// полей длины, которые его охватывают: при замене имени другой длины
+// каждое из них меняется на ту же разницу
+struct TlsServerName {
+    size_t record_length;      // длина записи TLS (2 байта)
+    size_t handshake_length;   // длина сообщения handshake (3 байта)
+    size_t extensions_length;  // длина блока расширений (2 байта)
+    size_t extension_length;   // длина расширения server_name (2 байта)
+    size_t list_length;        // длина ServerNameList (2 байта)
+    size_t name_length;        // длина HostName (2 байта)
+    size_t name;               // начало HostName
+    size_t size;               // длина HostName
+};
+
+namespace TlsClientHello {
+
+inline size_t ReadU16(const uint8_t* data, size_t offset) {
+    return (size_t(data[offset]) << 8) | data[offset + 1];
+}
+
+inline size_t ReadU24(const uint8_t* data, size_t offset) {
+    return (size_t(data[offset]) << 16) | (size_t(data[offset + 1]) << 8) | data[offset + 2];
+}
+
+inline void WriteU16(uint8_t* data, size_t offset, size_t value) {
+    data[offset] = static_cast<uint8_t>(value >> 8);
+    data[offset + 1] = static_cast<uint8_t>(value);
+}
+
+inline void WriteU24(uint8_t* data, size_t offset, size_t value) {
+    data[offset] = static_cast<uint8_t>(value >> 16);
+    data[offset + 1] = static_cast<uint8_t>(value >> 8);
+    data[offset + 2] = static_cast<uint8_t>(value);
+}
+
+} // namespace TlsClientHello
+
+// Находит host_name в ClientHello, целиком лежащем в data (одна запись
+// handshake). Поля переменной длины проходятся по их длинам, и каждая
+// длина сверяется с границей охватывающего поля; false - не ClientHello,
+// запись обрезана или в ней нет имени сервера
+inline bool FindTlsServerName(const uint8_t* data, size_t size, TlsServerName& server_name) {
+    using TlsClientHello::ReadU16;
+    using TlsClientHello::ReadU24;
+    
+    // Запись: тип 0x16, версия, длина; сообщение: тип 0x01, длина
+    if (size < 9 || data[0] != 0x16 || data[1] != 0x03 || data[5] != 0x01) {
+        return false;
+    }
+    size_t record_end = 5 + ReadU16(data, 3);
+    size_t hello_end = 9 + ReadU24(data, 6);
+    if (record_end > size || hello_end > record_end) {
+        return false;
+    }
+    
+    // Версия и random, затем session_id, cipher_suites, compression_methods
+    size_t pos = 9 + 2 + 32;
+    if (pos + 1 > hello_end) {
+        return false;
+    }
+    pos += 1 + data[pos];
+    if (pos + 2 > hello_end) {
+        return false;
+    }
+    pos += 2 + ReadU16(data, pos);
+    if (pos + 1 > hello_end) {
+        return false;
+    }
+    pos += 1 + data[pos];
+    if (pos + 2 > hello_end) {
+        return false;
+    }
+    
+    size_t extensions_length = pos;
+    size_t extensions_end = pos + 2 + ReadU16(data, pos);
+    if (extensions_end > hello_end) {
+        return false;
+    }
+    
+    for (pos += 2; pos + 4 <= extensions_end;) {
+        size_t type = ReadU16(data, pos);
+        size_t extension_end = pos + 4 + ReadU16(data, pos + 2);
+        if (extension_end > extensions_end) {
+            return false;
+        }
+        if (type != 0x0000) {
+            pos = extension_end;
+            continue;
+        }
+        
+        // server_name: длина списка, затем записи (тип, длина, имя);
+        // нужна запись host_name (тип 0)
+        size_t list = pos + 4;
+        if (list + 2 > extension_end || list + 2 + ReadU16(data, list) != extension_end) {
+            return false;
+        }
+        for (size_t entry = list + 2; entry + 3 <= extension_end;) {
+            size_t entry_end = entry + 3 + ReadU16(data, entry + 1);
+            if (entry_end > extension_end) {
+                return false;
+            }
+            if (data[entry] == 0x00) {
+                server_name = {3, 6, extensions_length, pos + 2, list, entry + 1, entry + 3, entry_end - entry - 3};
+                return true;
+            }
+            entry = entry_end;
+        }
+        return false;
+    }
+    return false;
+}
+
+// Заменяет host_name на name другой длины. Правка имени и новые значения
+// всех полей длины, которые его охватывают, добавляются в edits
+// (относительно текущих данных): сами данные не меняются, и процессоры,
+// которые правят пакет после, видят прежние длины, согласованные с
+// прежним именем. Правки добавляются все или ни одной; false - список
+// заполнен или один из участков уже правится
+inline bool ReplaceTlsServerName(const PacketBuffer& data, const TlsServerName& server_name, std::string_view name,
+                                 PayloadEdits& edits) {
+    using TlsClientHello::ReadU16;
+    using TlsClientHello::ReadU24;
+    using TlsClientHello::WriteU16;
+    using TlsClientHello::WriteU24;
+    
+    // Длины полей ограничены 16 битами: имя не длиннее того, что
+    // помещается в самое короткое из охватывающих полей
+    const uint8_t* bytes = data.data();
+    size_t record = ReadU16(bytes, server_name.record_length);
+    if (name.empty() || name.size() > 0xffff - (record - server_name.size)) {
+        return false;
+    }
+    
+    // Все поля длины охватывают имя и меняются на одну разницу;
+    // длина самого имени - его размер
+    struct LengthField {
+        size_t offset;
+        size_t size;
+    };
+    const LengthField fields[] = {
+        {server_name.record_length, 2},
+        {server_name.handshake_length, 3},
+        {server_name.extensions_length, 2},
+        {server_name.extension_length, 2},
+        {server_name.list_length, 2},
+        {server_name.name_length, 2}
+    };
+    constexpr size_t kFieldBytes = 2 + 3 + 2 + 2 + 2 + 2;
+    
+    if (edits.Available() < std::size(fields) + 1 || edits.StoreAvailable() < kFieldBytes ||
+        !edits.Fits(server_name.name, server_name.size)) {
+        return false;
+    }
+    for (const LengthField& field : fields) {
+        if (!edits.Fits(field.offset, field.size)) {
+            return false;
+        }
+    }
+    
+    auto adjust = [&](size_t length) { return length - server_name.size + name.size(); };
+    uint8_t values[kFieldBytes];
+    size_t pos = 0;
+    for (const LengthField& field : fields) {
+        if (field.offset == server_name.name_length) {
+            WriteU16(values, pos, name.size());
+        } else if (field.size == 3) {
+            WriteU24(values, pos, adjust(ReadU24(bytes, field.offset)));
+        } else {
+            WriteU16(values, pos, adjust(ReadU16(bytes, field.offset)));
+        }
+        edits.Add(field.offset, field.size, edits.Store(values + pos, field.size));
+        pos += field.size;
+    }
+    edits.Add(server_name.name, server_name.size, name);
+    return true;
+}
+
+} // namespace TrafficMask
@@ -6,7 +6,17 @@
 #include <unordered_map>
 #include <functional>
 #include <mutex>
+#include <atomic>
 #include <random>
+#include "packet_buffer.h"
+#include "checksum.h"
+#include "packet_view.h"
+#include "payload_edits.h"
+#include "flow_history.h"
+#include "scratch_arena.h"
+#include "random_source.h"
+#include "processor_registry.h"
+#include "protocol_classifier.h"
 
 namespace TrafficMask {
 
@@ -15,16 +25,285 @@ using ByteArray = std::vector<uint8_t>;
 using SignatureId = std::string;
 using ConnectionId = std::string;
 
-// Структура для представления пакета данных
+// Компактный идентификатор потока для горячего пути. Строковый ConnectionId
+// интернируется один раз при первом появлении потока и дальше нужен только
+// для логов и API; идентификаторы не переиспользуются.
+using FlowId = uint64_t;
+constexpr FlowId kInvalidFlowId = 0;
+
+// Контекст обработки пакета; заполняется движком на время вызова процессоров
+struct PacketContext {
+    // Последние пакеты соединения (включая текущий до маскировки)
+    const FlowHistory* history = nullptr;
+    
+    // Класс содержимого, определенный до вызова процессоров
+    ProtocolClass protocol = ProtocolClass::UNKNOWN;
+    
+    // Шаблоны общей базы, найденные в payload одним проходом для всех
+    // процессоров. Пусто, если пакет не сканировался или его уже изменил
+    // предыдущий процессор - тогда процессор проверяет payload сам
+    PatternMatches patterns;
+    
+    // Состояние потокового сканирования направления соединения: шаблон,
+    // разрезанный между пакетами, находится в пакете с его концом.
+    // nullptr - пакет сканируется отдельно от соседних
+    PatternStream* stream = nullptr;
+    
+    // Отложенные правки длины payload от процессоров с
+    // DefersPayloadEdits(), относительно payload до этих правок. Правки
+    // процессоров подряд сливаются, и движок собирает пакет один раз -
+    // перед первым процессором без отложенных правок и после конвейера
+    PayloadEdits edits;
+    
+    // Запрос процессора, переписавшего данные целиком, восстановить
+    // checksum; движок выполняет его после конвейера и правок
+    ChecksumFixup checksum_fixup;
+    
+    // Исходное состояние без копирования всего контекста: почти весь его
+    // размер - встроенная емкость edits, которую достаточно опустошить
+    void Reset() {
+        history = nullptr;
+        protocol = ProtocolClass::UNKNOWN;
+        patterns = PatternMatches();
+        stream = nullptr;
+        edits.Clear();
+        checksum_fixup = ChecksumFixup();
+    }
+};
+
+// Структура для представления пакета данных.
+// Payload хранится в PacketBuffer: копирование пакета (очереди, история
+// соединения) не копирует данные, пока ни один процессор их не изменил.
 struct Packet {
-    ByteArray data;
+    PacketBuffer data;
     size_t timestamp;
-    ConnectionId connection_id;
+    ConnectionId connection_id;  // заполняется только на пути API; см. flow_id
+    FlowId flow_id;              // kInvalidFlowId - движок интернирует connection_id
     bool is_incoming;
+    PacketContext* context;      // nullptr вне движка
+    
+    // Изменение суммы payload от полей, переписанных процессорами на месте.
+    // Payload - данные L4 без заголовка (четность смещений та же, что в
+    // сегменте), поэтому владелец заголовка TCP/UDP обновляет его checksum
+    // за O(1): checksum = payload_checksum.Apply(checksum)
+    ChecksumDelta payload_checksum;
+    
+    Packet() : timestamp(0), flow_id(kInvalidFlowId), is_incoming(false), context(nullptr) {}
+    Packet(PacketBuffer d, size_t ts, const ConnectionId& cid, bool incoming)
+        : data(std::move(d)), timestamp(ts), connection_id(cid), flow_id(kInvalidFlowId),
+          is_incoming(incoming), context(nullptr) {}
+    Packet(PacketBuffer d, size_t ts, FlowId flow, bool incoming)
+        : data(std::move(d)), timestamp(ts), flow_id(flow), is_incoming(incoming), context(nullptr) {}
+};
+
+// Применяет отложенные правки пакета (PacketContext::edits) одним проходом
+// и очищает список. Правки меняют длину, поэтому checksum восстанавливается
+// по сумме payload до и после: запрос делается до применения, выполняет
+// его CommitChecksumFixup
+inline void CommitPayloadEdits(Packet& packet) {
+    if (packet.context && !packet.context->edits.Empty()) {
+        packet.context->checksum_fixup.RequestPayload(packet.data, packet.payload_checksum);
+        packet.context->edits.Apply(packet.data);
+        packet.context->edits.Clear();
+    }
+}
+
+// Выполняет запрос восстановить checksum (PacketContext::checksum_fixup)
+inline void CommitChecksumFixup(Packet& packet) {
+    if (packet.context && packet.context->checksum_fixup.Pending()) {
+        packet.context->checksum_fixup.Apply(packet.data, packet.payload_checksum);
+    }
+}
+
+// Перемешивание flow_id (финализатор splitmix64): последовательные
+// идентификаторы равномерно распределяются по шардам
+inline uint64_t FlowHash(FlowId flow_id) {
+    uint64_t hash = flow_id;
+    hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebULL;
+    return hash ^ (hash >> 31);
+}
+
+// Пачка пакетов в раскладке structure-of-arrays.
+// Метаданные горячего пути лежат плотными массивами рядом с указателями на
+// payload, поэтому проход по пачке не трогает сами объекты Packet.
+// Пакеты упорядочены по шардам, внутри шарда - в исходном порядке,
+// так что пакеты одного потока обрабатываются строго друг за другом.
+struct PacketBatch {
+    std::vector<Packet*> packets;
+    std::vector<const uint8_t*> payloads;
+    std::vector<uint32_t> lengths;
+    std::vector<FlowId> flow_ids;
+    std::vector<uint64_t> flow_hashes;
+    std::vector<uint8_t> directions;      // 1 - входящий
+    std::vector<uint8_t> masked;          // 1 - пакет замаскирован текущим процессором
+    std::vector<ProtocolClass> protocols; // заполняется Classify
+    std::vector<StageMask> stages;        // ступени, которым нужен пакет (вердикт потока)
+    std::vector<uint32_t> selected;       // пакеты текущего процессора по порядку
+    std::vector<StageMask> masked_stages; // ступени, замаскировавшие пакет
+    std::vector<PacketContext> contexts;
+    std::vector<uint32_t> shard_offsets;  // пакеты шарда s: [shard_offsets[s], shard_offsets[s + 1])
+    
+    size_t Size() const { return packets.size(); }
+    
+    // Раскладывает пакеты по шардам устойчивой сортировкой подсчетом.
+    // Память массивов переиспользуется между вызовами.
+    void Assign(Packet* input, size_t count, size_t shard_count) {
+        input_shards_.resize(count);
+        shard_offsets.assign(shard_count + 1, 0);
+        for (size_t i = 0; i < count; ++i) {
+            input_shards_[i] = static_cast<uint32_t>(FlowHash(input[i].flow_id) % shard_count);
+            ++shard_offsets[input_shards_[i] + 1];
+        }
+        for (size_t s = 0; s < shard_count; ++s) {
+            shard_offsets[s + 1] += shard_offsets[s];
+        }
+        
+        packets.resize(count);
+        payloads.resize(count);
+        lengths.resize(count);
+        flow_ids.resize(count);
+        flow_hashes.resize(count);
+        directions.resize(count);
+        masked.assign(count, 0);
+        protocols.resize(count);
+        stages.assign(count, kAllStages);
+        selected.reserve(count);
+        masked_stages.assign(count, 0);
+        contexts.resize(count);
+        
+        // Позиции заполнения берутся из начал шардов; после прохода
+        // shard_offsets[s] указывает на конец шарда s, и массив сдвигается на одну позицию
+        for (size_t i = 0; i < count; ++i) {
+            size_t slot = shard_offsets[input_shards_[i]]++;
+            Packet& packet = input[i];
+            packets[slot] = &packet;
+            payloads[slot] = packet.data.data();
+            lengths[slot] = static_cast<uint32_t>(packet.data.size());
+            flow_ids[slot] = packet.flow_id;
+            flow_hashes[slot] = FlowHash(packet.flow_id);
+            directions[slot] = packet.is_incoming ? 1 : 0;
+            contexts[slot].Reset();
+        }
+        for (size_t s = shard_count; s > 0; --s) {
+            shard_offsets[s] = shard_offsets[s - 1];
+        }
+        shard_offsets[0] = 0;
+    }
+    
+    // Классифицирует пакеты [begin, end) до вызова процессоров
+    void Classify(size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            protocols[i] = ClassifyPayload(payloads[i], lengths[i]);
+            contexts[i].protocol = protocols[i];
+        }
+    }
+    
+    // Собирает в selected пакеты [begin, end), которые нужны ступени stage
+    // с классами handled. Остальные проходы ступени идут только по этому
+    // списку: процессору обычно нужны один-два класса из смеси. Возвращает
+    // false, если таких пакетов нет и процессор можно не вызывать
+    bool SelectForStage(size_t begin, size_t end, size_t stage, ProtocolMask handled) {
+        StageMask bit = StageBit(stage);
+        selected.clear();
+        for (size_t i = begin; i < end; ++i) {
+            if ((stages[i] & bit) != 0 && (handled & ProtocolBit(protocols[i])) != 0) {
+                selected.push_back(static_cast<uint32_t>(i));
+            }
+        }
+        return !selected.empty();
+    }
+    
+    // Сканирует общей базой пакеты [begin, end), которым нужна хотя бы
+    // одна ступень с шаблонами; words - память вызывающего на
+    // (end - begin) * patterns.GetWordCount() слов. Пакеты одного потока
+    // идут по порядку, поэтому потоковое состояние продолжается от пакета
+    // к пакету; пропущенный пакет разрывает поток своего направления
+    void ScanPatterns(const PatternDatabase& patterns, const ProcessorRegistry::Snapshot& processors,
+                      size_t begin, size_t end, uint64_t* words) {
+        size_t word_count = patterns.GetWordCount();
+        for (size_t i = begin; i < end; ++i) {
+            PatternStream* stream = contexts[i].stream;
+            if ((stages[i] & processors.PatternStages(protocols[i])) == 0) {
+                if (stream) {
+                    stream->Reset();
+                }
+                continue;
+            }
+            uint64_t* packet_words = words + (i - begin) * word_count;
+            if (stream) {
+                patterns.Scan(payloads[i], lengths[i], packet_words, *stream, processors.Version());
+            } else {
+                patterns.Scan(payloads[i], lengths[i], packet_words);
+            }
+            contexts[i].patterns = {packet_words, word_count};
+        }
+    }
+    
+    // Переносит отметки процессора ступени stage из masked в masked_stages.
+    // Результат сканирования измененного пакета больше не верен
+    void CollectMasked(size_t stage) {
+        StageMask bit = StageBit(stage);
+        for (uint32_t i : selected) {
+            if (masked[i]) {
+                masked_stages[i] |= bit;
+                masked[i] = 0;
+                contexts[i].patterns = PatternMatches();
+            }
+        }
+    }
     
-    Packet() : timestamp(0), is_incoming(false) {}
-    Packet(const ByteArray& d, size_t ts, const ConnectionId& cid, bool incoming)
-        : data(d), timestamp(ts), connection_id(cid), is_incoming(incoming) {}
+    // Число пакетов [begin, end), замаскированных хотя бы одним процессором
+    size_t CountMasked(size_t begin, size_t end) const {
+        size_t count = 0;
+        for (size_t i = begin; i < end; ++i) {
+            count += masked_stages[i] != 0;
+        }
+        return count;
+    }
+    
+    // Применяет отложенные правки пакетов [begin, end) и обновляет их payload
+    void CommitEdits(size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            CommitEdits(i);
+        }
+    }
+    
+    // То же для пакетов selected - перед процессором без отложенных правок
+    void CommitSelectedEdits() {
+        for (uint32_t i : selected) {
+            CommitEdits(i);
+        }
+    }
+    
+    // Восстанавливает checksum пакетов [begin, end), которые об этом просили
+    void CommitChecksumFixups(size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            if (contexts[i].checksum_fixup.Pending()) {
+                CommitChecksumFixup(*packets[i]);
+            }
+        }
+    }
+    
+    // Обновляет payloads/lengths пакетов selected после процессора,
+    // который мог изменить их размер
+    void RefreshPayloads() {
+        for (uint32_t i : selected) {
+            payloads[i] = packets[i]->data.data();
+            lengths[i] = static_cast<uint32_t>(packets[i]->data.size());
+        }
+    }
+    
+private:
+    std::vector<uint32_t> input_shards_;
+    
+    void CommitEdits(size_t i) {
+        if (!contexts[i].edits.Empty()) {
+            CommitPayloadEdits(*packets[i]);
+            payloads[i] = packets[i]->data.data();
+            lengths[i] = static_cast<uint32_t>(packets[i]->data.size());
+        }
+    }
 };
 
 // Интерфейс для обработки сигнатур
@@ -34,6 +313,38 @@ public:
     virtual bool ProcessPacket(Packet& packet) = 0;
     virtual SignatureId GetSignatureId() const = 0;
     virtual bool IsActive() const = 0;
+    
+    // Вызывается, когда движок вытесняет соединение; процессоры с
+    // собственным состоянием потоков должны освободить его здесь
+    virtual void OnConnectionClosed(FlowId /*flow_id*/) {}
+    
+    // Классы пакетов, которые нужны процессору; движок не вызывает его
+    // для остальных. Читается один раз при регистрации
+    virtual ProtocolMask GetHandledProtocols() const { return kAllProtocols; }
+    
+    // Шаблоны процессора в реестре (PatternRegistry). Движок собирает
+    // шаблоны всех процессоров в общую базу, сканирует ею пакет один раз и
+    // передает результат в PacketContext::patterns. Читается при регистрации
+    virtual PatternSet GetPatterns() const { return PatternSet(); }
+    
+    // true - процессор меняет длину payload только правками в
+    // PacketContext::edits, а на месте переписывает байты без сдвига.
+    // Тогда движок не собирает пакет перед его вызовом, и правки соседних
+    // таких процессоров применяются вместе. Читается при регистрации
+    virtual bool DefersPayloadEdits() const { return false; }
+    
+    // Пакетная обработка пакетов batch.selected (индексы по порядку пачки);
+    // результат отмечается в batch.masked. Список отбирает вызывающий по
+    // классу и вердикту потока. По умолчанию - цикл по ProcessPacket.
+    // Процессоры могут переопределить метод, чтобы работать по
+    // SoA-массивам и предвыбирать данные следующих пакетов.
+    virtual void ProcessBatch(PacketBatch& batch) {
+        for (uint32_t i : batch.selected) {
+            if (ProcessPacket(*batch.packets[i])) {
+                batch.masked[i] = 1;
+            }
+        }
+    }
 };
 
 // Интерфейс для обработки трафика
@@ -45,10 +356,44 @@ public:
     virtual void RegisterSignatureProcessor(std::shared_ptr<ISignatureProcessor> processor) = 0;
 };
 
+// Значения по умолчанию для вытеснения соединений
+constexpr size_t kDefaultFlowIdleTimeoutMs = 120 * 1000;
+constexpr size_t kDefaultFlowMaxLifetimeMs = 3600 * 1000;
+constexpr size_t kDefaultFlowMemoryBudgetBytes = size_t(256) * 1024 * 1024;
+
+// Пакетов в начале потока, которые проходят весь конвейер процессоров
+// до того, как вердикт потока начнет отбирать процессоры
+constexpr size_t kDefaultFlowVerdictWindow = 8;
+
+// Параметры ядра из секции cpp_core конфигурации
+struct EngineConfig {
+    size_t history_depth = kDefaultHistoryDepth;                   // пакетов в истории соединения
+    size_t flow_idle_timeout_ms = kDefaultFlowIdleTimeoutMs;       // вытеснение по простою
+    size_t flow_max_lifetime_ms = kDefaultFlowMaxLifetimeMs;       // абсолютное время жизни
+    size_t flow_memory_budget_bytes = kDefaultFlowMemoryBudgetBytes; // 0 - без ограничения
+    size_t flow_verdict_window = kDefaultFlowVerdictWindow;        // 0 - вердикты потоков выключены
+};
+
+// Статистика таблицы соединений
+struct FlowTableStats {
+    size_t active_flows = 0;
+    size_t memory_bytes = 0;
+    size_t idle_evictions = 0;
+    size_t lifetime_evictions = 0;
+    size_t memory_evictions = 0;
+};
+
+// Шард движка: собственная блокировка, состояние соединений и счетчики
+struct EngineShard;
+struct FlowVerdict;
+
 // Основной движок системы
+// Соединения распределяются по шардам по хешу flow_id, поэтому пакеты
+// разных потоков маскируются параллельно, а пакеты одного потока - строго по порядку
 class TrafficMaskEngine {
 public:
     TrafficMaskEngine();
+    explicit TrafficMaskEngine(size_t shard_count);
     ~TrafficMaskEngine();
     
     // Инициализация и управление
@@ -58,26 +403,60 @@ public:
     // Обработка пакетов
     bool ProcessPacket(Packet& packet);
     
+    // Пакетная обработка: одна блокировка шарда и один вызов каждого
+    // процессора на группу пакетов шарда. Возвращает число обработанных пакетов.
+    size_t ProcessBatch(Packet* packets, size_t count);
+    size_t ProcessBatch(std::vector<Packet>& packets) { return ProcessBatch(packets.data(), packets.size()); }
+    
+    // Интернирование соединений: FlowId выдается один раз на поток и
+    // передается в Packet::flow_id, строковая форма остается для логов и API
+    FlowId InternConnection(const ConnectionId& connection_id);
+    ConnectionId GetConnectionName(FlowId flow_id) const;
+    
     // Управление сигнатурами
     void RegisterSignatureProcessor(std::shared_ptr<ISignatureProcessor> processor);
     void UnregisterSignatureProcessor(const SignatureId& signature_id);
     
+    // Вытеснение простаивающих соединений по часам вызывающего (мс),
+    // для шардов, в которые давно не приходили пакеты; заодно освобождает
+    // устаревшие снимки процессоров
+    void ExpireIdleFlows(size_t now_ms);
+    
     // Статистика
-    size_t GetProcessedPackets() const { return processed_packets_; }
-    size_t GetMaskedPackets() const { return masked_packets_; }
+    size_t GetProcessedPackets() const;
+    size_t GetMaskedPackets() const;
+    size_t GetBypassedPackets() const;  // пакеты, обошедшие процессоры по вердикту потока
+    FlowTableStats GetFlowStats() const;
+    size_t GetShardCount() const { return shards_.size(); }
+    const EngineConfig& GetConfig() const { return config_; }
     
 private:
-    std::vector<std::shared_ptr<ISignatureProcessor>> signature_processors_;
-    std::unordered_map<ConnectionId, std::vector<Packet>> connection_buffer_;
+    // Снимок процессоров читается шардами без блокировок (см. ProcessorRegistry)
+    ProcessorRegistry signature_processors_;
+    std::vector<std::unique_ptr<EngineShard>> shards_;
+    EngineConfig config_;
     
-    size_t processed_packets_;
-    size_t masked_packets_;
+    // Реестр интернированных соединений (только медленный путь)
+    mutable std::mutex flow_names_mutex_;
+    std::unordered_map<ConnectionId, FlowId> flow_ids_;
+    std::unordered_map<FlowId, ConnectionId> flow_names_;
+    FlowId next_flow_id_;
     
-    bool is_initialized_;
+    std::atomic<bool> is_initialized_;
     std::mutex engine_mutex_;
     
     bool LoadConfiguration(const std::string& config_path);
-    void ProcessSignatureMasking(Packet& packet);
+    void ParseCoreOption(const std::string& line);
+    FlowId InternConnectionLocked(const ConnectionId& connection_id);
+    void InternBatch(Packet* packets, size_t count);
+    EngineShard& GetShard(FlowId flow_id);
+    std::vector<std::unique_lock<std::mutex>> LockAllShards();
+    void ProcessSignatureMasking(EngineShard& shard, Packet& packet, FlowVerdict& verdict);
+    size_t ProcessShardBatch(EngineShard& shard, const ProcessorRegistry::Snapshot& processors,
+                             PacketBatch& batch, size_t begin, size_t end);
+    void ProcessSignatureBatch(const ProcessorRegistry::Snapshot& processors,
+                               PacketBatch& batch, size_t begin, size_t end);
+    void NotifyConnectionClosed(FlowId flow_id);
 };
 
 } // namespace TrafficMask
@@ -3,8 +3,8 @@
 #include "trafficmask.h"
 #include <unordered_map>
 #include <vector>
-#include <random>
 #include <algorithm>
+#include <mutex>
 
 namespace TrafficMask {
 
@@ -13,41 +13,43 @@ class EncryptedTrafficMasker : public BaseSignatureProcessor {
 public:
     EncryptedTrafficMasker() : BaseSignatureProcessor("encrypted_traffic_masker") {
         // Паттерны для зашифрованного трафика
-        AddPattern("\\x17\\x03\\x03");        // TLS application data
-        AddPattern("\\x17\\x03\\x01");        // TLS application data TLS 1.0
-        AddPattern("\\x17\\x03\\x02");        // TLS application data TLS 1.1
-        AddPattern("\\x17\\x03\\x03");        // TLS application data TLS 1.2
-        AddPattern("\\x17\\x03\\x04");        // TLS application data TLS 1.3
+        AddBinarySignature("17 03 01-04 +2");  // TLS application data, TLS 1.0-1.3
         AddKeyword("TLS");
         AddKeyword("encrypted");
         AddKeyword("SSL");
     }
     
+    ProtocolMask GetHandledProtocols() const override {
+        return kTlsProtocols;
+    }
+    
     bool ProcessPacket(Packet& packet) override {
-        if (!IsActive() || !CheckSignature(packet.data)) {
+        if (!IsActive() || !CheckSignature(packet)) {
             return false;
         }
         
-        return MaskEncryptedTraffic(packet.data);
+        return MaskEncryptedTraffic(packet);
     }
     
 private:
-    bool MaskEncryptedTraffic(ByteArray& data) {
+    bool MaskEncryptedTraffic(Packet& packet) {
+        const PacketBuffer& data = packet.data;
         if (data.size() < 5) return false;
         
         // Определяем тип зашифрованного трафика
         uint8_t content_type = data[0];
         
         if (content_type == 0x17) {  // Application Data
-            return MaskTlsApplicationData(data);
+            return MaskTlsApplicationData(packet);
         } else if (content_type >= 0x16 && content_type <= 0x18) {
-            return MaskGenericEncryptedData(data);
+            return MaskGenericEncryptedData(packet);
         }
         
         return false;
     }
     
-    bool MaskTlsApplicationData(ByteArray& data) {
+    bool MaskTlsApplicationData(Packet& packet) {
+        const PacketBuffer& data = packet.data;
         if (data.size() < 5) return false;
         
         // TLS заголовок: [content_type][version][length]
@@ -60,45 +62,36 @@ private:
         
         // Маскируем зашифрованные данные (но сохраняем заголовки)
         if (data.size() > 5) {
-            MaskEncryptedPayload(data, 5, length);
+            MaskEncryptedPayload(packet, 5, length);
             return true;
         }
         
         return false;
     }
     
-    bool MaskGenericEncryptedData(ByteArray& data) {
+    bool MaskGenericEncryptedData(Packet& packet) {
         // Для других типов зашифрованного трафика
-        if (data.size() < 4) return false;
+        if (packet.data.size() < 4) return false;
         
         // Простая маскировка случайными байтами
-        MaskRandomBytes(data);
+        MaskRandomBytes(packet);
         return true;
     }
     
-    void MaskEncryptedPayload(ByteArray& data, size_t offset, size_t length) {
-        if (offset + length > data.size()) {
-            length = data.size() - offset;
-        }
+    // Зашифрованные данные переписываются целиком: checksum
+    // восстанавливается по сумме payload до и после
+    void MaskEncryptedPayload(Packet& packet, size_t offset, size_t length) {
+        if (offset >= packet.data.size()) return;
+        length = std::min(length, packet.data.size() - offset);
         
         // Случайная маскировка зашифрованных данных
-        static std::random_device rd;
-        static std::mt19937 gen(rd());
-        std::uniform_int_distribution<uint8_t> dis(0, 255);
-        
-        for (size_t i = offset; i < offset + length && i < data.size(); ++i) {
-            data[i] = dis(gen);
-        }
+        FillPayloadRandom(packet, offset, length);
     }
     
-    void MaskRandomBytes(ByteArray& data) {
-        static std::random_device rd;
-        static std::mt19937 gen(rd());
-        std::uniform_int_distribution<uint8_t> dis(0, 255);
-        
+    void MaskRandomBytes(Packet& packet) {
         // Маскируем случайными байтами, но сохраняем первые 4 байта
-        for (size_t i = 4; i < data.size(); ++i) {
-            data[i] = dis(gen);
+        if (packet.data.size() > 4) {
+            FillPayloadRandom(packet, 4, packet.data.size() - 4);
         }
     }
 };
@@ -109,21 +102,30 @@ public:
     TcpStreamMasker() : BaseSignatureProcessor("tcp_stream_masker") {
         AddKeyword("TCP");
         AddKeyword("stream");
-        AddPattern("\\x50\\x00\\x00\\x00");  // TCP header patterns
+        AddBinarySignature("+12 50-FF +7");  // заголовок TCP: data offset >= 5
     }
     
     bool ProcessPacket(Packet& packet) override {
-        if (!IsActive() || !CheckSignature(packet.data)) {
+        if (!IsActive() || !CheckSignature(packet)) {
             return false;
         }
         
-        return MaskTcpStream(packet.data, packet.connection_id);
+        return MaskTcpStream(packet);
+    }
+    
+    // Движок вытеснил соединение - состояние потока больше не нужно
+    void OnConnectionClosed(FlowId flow_id) override {
+        std::lock_guard<std::mutex> lock(streams_mutex_);
+        tcp_streams_.erase(flow_id);
     }
     
 private:
-    std::unordered_map<ConnectionId, std::vector<uint8_t>> tcp_streams_;
+    std::mutex streams_mutex_;
+    std::unordered_map<FlowId, std::vector<uint8_t>> tcp_streams_;
     
-    bool MaskTcpStream(ByteArray& data, const ConnectionId& conn_id) {
+    bool MaskTcpStream(Packet& packet) {
+        const PacketBuffer& data = packet.data;
+        
         // Анализируем TCP заголовок
         if (data.size() < 20) return false;
         
@@ -140,24 +142,23 @@ private:
         
         // Маскируем TCP payload
         if (data.size() > header_length) {
-            MaskTcpPayload(data, header_length);
+            MaskTcpPayload(packet, header_length);
             return true;
         }
         
         return false;
     }
     
-    void MaskTcpPayload(ByteArray& data, size_t header_length) {
-        if (header_length >= data.size()) return;
+    // Payload за заголовком TCP переписывается целиком: checksum в
+    // заголовке обновляется по сумме сегмента до и после
+    void MaskTcpPayload(Packet& packet, size_t header_length) {
+        if (header_length >= packet.data.size()) return;
         
         // Маскируем payload случайными байтами
-        static std::random_device rd;
-        static std::mt19937 gen(rd());
-        std::uniform_int_distribution<uint8_t> dis(0, 255);
-        
-        for (size_t i = header_length; i < data.size(); ++i) {
-            data[i] = dis(gen);
-        }
+        ChecksumFixup local;
+        PendingChecksumFixup(packet, local).RequestTcpSegment(packet.data);
+        RandomSource::ForCurrentThread().Fill(packet.data.MutableData() + header_length, packet.data.size() - header_length);
+        ApplyLocalChecksumFixup(packet, local);
     }
 };
 
@@ -167,19 +168,24 @@ public:
     UdpPacketMasker() : BaseSignatureProcessor("udp_packet_masker") {
         AddKeyword("UDP");
         AddKeyword("packet");
-        AddPattern("\\x45\\x00");  // IPv4 UDP patterns
+        AddBinarySignature("45 ?? total16 +5 11 +18");  // IPv4 + заголовок UDP
+    }
+    
+    ProtocolMask GetHandledProtocols() const override {
+        return ProtocolBit(ProtocolClass::IPV4);
     }
     
     bool ProcessPacket(Packet& packet) override {
-        if (!IsActive() || !CheckSignature(packet.data)) {
+        if (!IsActive() || !CheckSignature(packet)) {
             return false;
         }
         
-        return MaskUdpPacket(packet.data);
+        return MaskUdpPacket(packet);
     }
     
 private:
-    bool MaskUdpPacket(ByteArray& data) {
+    bool MaskUdpPacket(Packet& packet) {
+        const PacketBuffer& data = packet.data;
         if (data.size() < 28) return false; // IP(20) + UDP(8) минимум
         
         // Определяем позицию UDP заголовка (после IP заголовка)
@@ -194,24 +200,23 @@ private:
         // Маскируем UDP payload
         size_t udp_header_start = ip_header_length + 8;
         if (udp_header_start < data.size()) {
-            MaskUdpPayload(data, udp_header_start);
+            MaskUdpPayload(packet, udp_header_start);
             return true;
         }
         
         return false;
     }
     
-    void MaskUdpPayload(ByteArray& data, size_t offset) {
-        if (offset >= data.size()) return;
+    // Payload UDP переписывается целиком: checksum UDP пересчитывается
+    // по пакету IPv4
+    void MaskUdpPayload(Packet& packet, size_t offset) {
+        if (offset >= packet.data.size()) return;
         
         // Маскируем UDP payload случайными байтами
-        static std::random_device rd;
-        static std::mt19937 gen(rd());
-        std::uniform_int_distribution<uint8_t> dis(0, 255);
-        
-        for (size_t i = offset; i < data.size(); ++i) {
-            data[i] = dis(gen);
-        }
+        ChecksumFixup local;
+        PendingChecksumFixup(packet, local).RequestIpv4();
+        RandomSource::ForCurrentThread().Fill(packet.data.MutableData() + offset, packet.data.size() - offset);
+        ApplyLocalChecksumFixup(packet, local);
     }
 };
 
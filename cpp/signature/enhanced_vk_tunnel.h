@@ -1,10 +1,12 @@
 #pragma once
 
 #include "trafficmask.h"
+#include "byte_search.h"
+#include "replacement_table.h"
 #include <regex>
 #include <vector>
-#include <random>
-#include <unordered_map>
+#include <string_view>
+#include <iterator>
 
 namespace TrafficMask {
 
@@ -30,14 +32,36 @@ public:
         AddKeyword("wss://");
     }
     
+    ProtocolMask GetHandledProtocols() const override {
+        return kHttpProtocols |
+               ProtocolBit(ProtocolClass::WEBSOCKET_FRAME) |
+               ProtocolBit(ProtocolClass::UNKNOWN);
+    }
+    
+    // Замены доменов и путей - правки в общем списке; WebSocket данные и
+    // прочий трафик переписываются на месте без изменения длины
+    bool DefersPayloadEdits() const override { return true; }
+    
     bool ProcessPacket(Packet& packet) override {
-        if (!IsActive() || !CheckSignature(packet.data)) {
+        if (!IsActive() || !CheckSignature(packet)) {
             return false;
         }
         
         // Определяем тип VK трафика и применяем соответствующую маскировку
         TrafficType traffic_type = DetectTrafficType(packet.data);
-        return ApplyTrafficMasking(packet.data, traffic_type);
+        
+        // WebSocket данные и прочий трафик переписываются случайными
+        // байтами: checksum восстанавливается по сумме payload до и после
+        ChecksumFixup local_fixup;
+        if (traffic_type == TrafficType::WEBSOCKET_DATA || traffic_type == TrafficType::UNKNOWN) {
+            PendingChecksumFixup(packet, local_fixup).RequestPayload(packet.data, packet.payload_checksum);
+        }
+        
+        PayloadEdits local;
+        bool masked = ApplyTrafficMasking(packet.data, traffic_type, PendingEdits(packet, local));
+        ApplyLocalEdits(packet, local);
+        ApplyLocalChecksumFixup(packet, local_fixup);
+        return masked;
     }
     
 private:
@@ -51,7 +75,8 @@ private:
         UNKNOWN
     };
     
-    std::unordered_map<std::string, std::string> cdn_replacements_ = {
+    // Домены VK CDN и их замены; таблица же ищет CDN запросы
+    ReplacementTable cdn_replacements_ = {
         {"vk-cdn.net", "yandex.ru"},
         {"vk-cdn.com", "cloud.yandex.ru"},
         {"vk-video.com", "video.yandex.ru"},
@@ -59,171 +84,121 @@ private:
         {"vk-images.com", "images.yandex.net"}
     };
     
-    TrafficType DetectTrafficType(const ByteArray& data) {
-        std::string content(data.begin(), data.end());
+    TrafficType DetectTrafficType(const PacketBuffer& data) {
+        PacketView content(data);
+        
+        static const NeedleSet static_assets = {".js", ".css", ".png", ".jpg"};
         
-        if (content.find("GET /") != std::string::npos) {
-            if (content.find("Upgrade: websocket") != std::string::npos) {
+        if (content.Contains("GET /")) {
+            if (content.Contains("Upgrade: websocket")) {
                 return TrafficType::WEBSOCKET_UPGRADE;
-            } else if (content.find(".js") != std::string::npos || 
-                      content.find(".css") != std::string::npos ||
-                      content.find(".png") != std::string::npos ||
-                      content.find(".jpg") != std::string::npos) {
+            } else if (static_assets.ContainsAny(content.Text())) {
                 return TrafficType::STATIC_ASSETS;
-            } else if (content.find("/api/") != std::string::npos) {
+            } else if (content.Contains("/api/")) {
                 return TrafficType::API_REQUEST;
             } else {
                 return TrafficType::HTTP_REQUEST;
             }
         }
         
-        if (content.find("\x81") != std::string::npos || // WebSocket frame
-            content.find("\x82") != std::string::npos) {
+        if (content.Contains("\x81") || // WebSocket frame
+            content.Contains("\x82")) {
             return TrafficType::WEBSOCKET_DATA;
         }
         
         // Проверяем CDN запросы
-        for (const auto& [cdn_domain, _] : cdn_replacements_) {
-            if (content.find(cdn_domain) != std::string::npos) {
-                return TrafficType::CDN_REQUEST;
-            }
+        if (cdn_replacements_.ContainsAny(content.Text())) {
+            return TrafficType::CDN_REQUEST;
         }
         
         return TrafficType::UNKNOWN;
     }
     
-    bool ApplyTrafficMasking(ByteArray& data, TrafficType type) {
+    bool ApplyTrafficMasking(PacketBuffer& data, TrafficType type, PayloadEdits& edits) {
+        std::string_view text = PacketView(data).Text();
         switch (type) {
             case TrafficType::HTTP_REQUEST:
-                return MaskHttpRequest(data);
+                return MaskHttpRequest(text, edits);
             case TrafficType::WEBSOCKET_UPGRADE:
-                return MaskWebSocketUpgrade(data);
+                return MaskWebSocketUpgrade(text, edits);
             case TrafficType::WEBSOCKET_DATA:
                 return MaskWebSocketData(data);
             case TrafficType::CDN_REQUEST:
-                return MaskCdnRequest(data);
+                return MaskCdnRequest(text, edits);
             case TrafficType::API_REQUEST:
-                return MaskApiRequest(data);
+                return MaskApiRequest(text, edits);
             case TrafficType::STATIC_ASSETS:
-                return MaskStaticAssets(data);
+                return MaskStaticAssets(text, edits);
             default:
                 return MaskGenericVkTraffic(data);
         }
     }
     
-    bool MaskHttpRequest(ByteArray& data) {
-        std::string content(data.begin(), data.end());
+    bool MaskHttpRequest(std::string_view text, PayloadEdits& edits) {
         bool modified = false;
         
-        // Заменяем VK домены на популярные российские домены
-        std::vector<std::regex> vk_patterns = {
-            std::regex(R"([a-zA-Z0-9-]+\.tunnel\.vk-apps\.com)", std::regex_constants::icase),
-            std::regex(R"(vk-apps\.com)", std::regex_constants::icase),
-            std::regex(R"(vkontakte\.ru)", std::regex_constants::icase)
+        // Заменяем VK домены на популярные российские домены;
+        // домены ищутся без учета регистра, поддомен туннеля - вместе с доменом
+        static constexpr std::pair<std::string_view, bool> vk_domains[] = {
+            {".tunnel.vk-apps.com", true},
+            {"vk-apps.com", false},
+            {"vkontakte.ru", false}
         };
         
-        std::vector<std::string> replacement_domains = {
+        static constexpr const char* replacement_domains[] = {
             "mail.ru",
             "ok.ru", 
             "rambler.ru",
             "rutracker.org"
         };
         
-        for (const auto& pattern : vk_patterns) {
-            static std::random_device rd;
-            static std::mt19937 gen(rd());
-            std::uniform_int_distribution<> dis(0, replacement_domains.size() - 1);
-            std::string replacement = replacement_domains[dis(gen)];
+        for (const auto& [domain, with_subdomain] : vk_domains) {
+            const char* replacement = replacement_domains[RandomSource::ForCurrentThread().Bounded(std::size(replacement_domains))];
             
-            std::string new_content = std::regex_replace(content, pattern, replacement);
-            if (new_content != content) {
-                content = new_content;
+            if (CollectIgnoreCase(text, domain, replacement, edits, with_subdomain) > 0) {
                 modified = true;
             }
         }
         
-        if (modified) {
-            data.assign(content.begin(), content.end());
-            return true;
-        }
-        
-        return false;
+        return modified;
     }
     
-    bool MaskWebSocketUpgrade(ByteArray& data) {
-        std::string content(data.begin(), data.end());
+    bool MaskWebSocketUpgrade(std::string_view text, PayloadEdits& edits) {
         bool modified = false;
         
-        // Заменяем WebSocket пути
-        std::string ws_pattern = R"(/ws|/websocket|/tunnel|/stream)";
-        std::vector<std::string> ws_replacements = {"/im", "/chat", "/api", "/service"};
+        // Заменяем WebSocket пути без учета регистра; пути не перекрываются,
+        // поэтому правки по очереди совпадают с прежним regex-выбором
+        static constexpr std::string_view ws_paths[] = {"/ws", "/websocket", "/tunnel", "/stream"};
+        static constexpr const char* ws_replacements[] = {"/im", "/chat", "/api", "/service"};
         
-        static std::random_device rd;
-        static std::mt19937 gen(rd());
-        std::uniform_int_distribution<> dis(0, ws_replacements.size() - 1);
-        
-        try {
-            std::regex ws_regex(ws_pattern, std::regex_constants::icase);
-            std::string replacement = ws_replacements[dis(gen)];
-            
-            std::string new_content = std::regex_replace(content, ws_regex, replacement);
-            if (new_content != content) {
-                content = new_content;
+        const char* replacement = ws_replacements[RandomSource::ForCurrentThread().Bounded(std::size(ws_replacements))];
+        for (std::string_view path : ws_paths) {
+            if (CollectIgnoreCase(text, path, replacement, edits) > 0) {
                 modified = true;
             }
-        } catch (const std::regex_error& e) {
-            // Игнорируем ошибки regex
         }
         
-        if (modified) {
-            data.assign(content.begin(), content.end());
-            return true;
-        }
-        
-        return false;
+        return modified;
     }
     
-    bool MaskWebSocketData(ByteArray& data) {
-        // Маскируем WebSocket данные случайными байтами
-        static std::random_device rd;
-        static std::mt19937 gen(rd());
-        std::uniform_int_distribution<uint8_t> dis(0, 255);
-        
-        // Сохраняем WebSocket заголовок (первые 6 байт)
-        for (size_t i = 6; i < data.size(); ++i) {
-            data[i] = dis(gen);
+    bool MaskWebSocketData(PacketBuffer& data) {
+        // Маскируем WebSocket данные случайными байтами,
+        // сохраняя WebSocket заголовок (первые 6 байт)
+        if (data.size() > 6) {
+            RandomSource::ForCurrentThread().Fill(data.MutableData() + 6, data.size() - 6);
         }
         
         return true;
     }
     
-    bool MaskCdnRequest(ByteArray& data) {
-        std::string content(data.begin(), data.end());
-        bool modified = false;
-        
+    bool MaskCdnRequest(std::string_view text, PayloadEdits& edits) {
         // Заменяем VK CDN домены на Яндекс CDN домены
-        for (const auto& [vk_cdn, yandex_cdn] : cdn_replacements_) {
-            size_t pos = content.find(vk_cdn);
-            if (posit != std::string::npos) {
-                content.replace(pos, vk_cdn.length(), yandex_cdn);
-                modified = true;
-            }
-        }
-        
-        if (modified) {
-            data.assign(content.begin(), content.end());
-            return true;
-        }
-        
-        return false;
+        return cdn_replacements_.Collect(text, edits) > 0;
     }
     
-    bool MaskApiRequest(ByteArray& data) {
-        std::string content(data.begin(), data.end());
-        bool modified = false;
-        
+    bool MaskApiRequest(std::string_view text, PayloadEdits& edits) {
         // Заменяем VK API пути на Яндекс API пути
-        std::vector<std::pair<std::string, std::string>> api_replacements = {
+        static const ReplacementTable api_replacements = {
             {"/api/vk/", "/api/yandex/"},
             {"/method/", "/method/v1/"},
             {"/oauth/", "/auth/"},
@@ -231,28 +206,12 @@ private:
             {"/audio/", "/music/"}
         };
         
-        for (const auto& [vk_api, yandex_api] : api_replacements) {
-            size_t pos = content.find(vk_api);
-            if (pos != std::string::npos) {
-                content.replace(pos, vk_api.length(), yandex_api);
-                modified = true;
-            }
-        }
-        
-        if (modified) {
-            data.assign(content.begin(), content.end());
-            return true;
-        }
-        
-        return false;
+        return api_replacements.Collect(text, edits) > 0;
     }
     
-    bool MaskStaticAssets(ByteArray& data) {
-        std::string content(data.begin(), data.end());
-        bool modified = false;
-        
+    bool MaskStaticAssets(std::string_view text, PayloadEdits& edits) {
         // Заменяем пути к статическим ресурсам
-        std::vector<std::pair<std::string, std::string>> asset_replacements = {
+        static const ReplacementTable asset_replacements = {
             {"/static/", "/assets/"},
             {"/images/", "/img/"},
             {"/styles/", "/css/"},
@@ -260,33 +219,19 @@ private:
             {"/fonts/", "/f/"}
         };
         
-        for (const auto& [vk_path, replacement_path] : asset_replacements) {
-            size_t pos = content.find(vk_path);
-            if (pos != std::string::npos) {
-                content.replace(pos, vk_path.length(), replacement_path);
-                modified = true;
-            }
-        }
-        
-        if (modified) {
-            data.assign(content.begin(), content.end());
-            return true;
-        }
-        
-        return false;
+        return asset_replacements.Collect(text, edits) > 0;
     }
     
-    bool MaskGenericVkTraffic(ByteArray& data) {
+    bool MaskGenericVkTraffic(PacketBuffer& data) {
         // Общая маскировка для неизвестного VK трафика
-        static std::random_device rd;
-        static std::mt19937 gen(rd());
-        std::uniform_int_distribution<uint8_t> dis(0, 255);
+        RandomSource& random = RandomSource::ForCurrentThread();
+        uint8_t* bytes = data.MutableData();
         
         // Маскируем часть данных, сохраняя начало
         size_t mask_start = std::min(data.size() / 4, size_t(10));
         for (size_t i = mask_start; i < data.size(); ++i) {
-            if (rand() % 3 == 0) {  // Маскируем каждый третий байт
-                data[i] = dis(gen);
+            if (random.Bounded(3) == 0) {  // Маскируем каждый третий байт
+                random.Fill(bytes + i, 1);
             }
         }
         
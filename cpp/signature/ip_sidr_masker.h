@@ -11,13 +11,17 @@ class IpSidrMasker : public BaseSignatureProcessor {
 public:
     IpSidrMasker() : BaseSignatureProcessor("ip_sidr_masker") {
         // Добавляем паттерны для IP пакетов
-        AddPattern("\\x45.*\\x00.*\\x00.*\\x00.*\\x00.*\\x00.*\\x00.*\\x00");
+        AddBinarySignature("45-4F ?? total16 +16");  // заголовок IPv4
         AddKeyword("IP");
         AddKeyword("packet");
     }
     
+    ProtocolMask GetHandledProtocols() const override {
+        return ProtocolBit(ProtocolClass::IPV4);
+    }
+    
     bool ProcessPacket(Packet& packet) override {
-        if (!IsActive() || !CheckSignature(packet.data)) {
+        if (!IsActive() || !CheckSignature(packet)) {
             return false;
         }
         
@@ -25,7 +29,7 @@ public:
     }
     
 private:
-    bool MaskIpSidr(ByteArray& data) {
+    bool MaskIpSidr(PacketBuffer& data) {
         if (data.size() < 20) return false; // Минимальный размер IP заголовка
         
         // Проверяем версию IP (4-й бит первого байта)
@@ -35,7 +39,7 @@ private:
         return MaskSourceIp(data);
     }
     
-    bool MaskSourceIp(ByteArray& data) {
+    bool MaskSourceIp(PacketBuffer& data) {
         if (data.size() < 20) return false;
         
         // Source IP находится в байтах 12-15
@@ -45,16 +49,13 @@ private:
         // Генерируем маскированный IP из пула популярных IP
         uint32_t masked_ip = GenerateMaskedIp(original_ip);
         
-        // Заменяем source IP
-        data[12] = (masked_ip >> 24) & 0xFF;
-        data[13] = (masked_ip >> 16) & 0xFF;
-        data[14] = (masked_ip >> 8) & 0xFF;
-        data[15] = masked_ip & 0xFF;
-        
-        // Пересчитываем checksum
-        RecalculateChecksum(data);
-        
-        return true;
+        // Заменяем source IP; checksum заголовка IP и TCP/UDP (адрес входит
+        // в псевдозаголовок) обновляются инкрементально
+        const uint8_t masked_bytes[4] = {
+            static_cast<uint8_t>(masked_ip >> 24), static_cast<uint8_t>(masked_ip >> 16),
+            static_cast<uint8_t>(masked_ip >> 8), static_cast<uint8_t>(masked_ip)
+        };
+        return RewriteIpv4Bytes(data, 12, masked_bytes, sizeof(masked_bytes));
     }
     
     uint32_t GenerateMaskedIp(uint32_t original_ip) {
@@ -74,34 +75,6 @@ private:
         size_t index = original_ip % mask_ips.size();
         return mask_ips[index];
     }
-    
-    void RecalculateChecksum(ByteArray& data) {
-        if (data.size() < 20) return;
-        
-        // Обнуляем checksum
-        data[10] = 0;
-        data[11] = 0;
-        
-        // Вычисляем новый checksum
-        uint32_t checksum = 0;
-        size_t header_length = (data[0] & 0x0F) * 4;
-        
-        for (size_t i = 0; i < header_length; i += 2) {
-            if (i != 10) { // Пропускаем поле checksum
-                checksum += (data[i] << 8) | data[i + 1];
-            }
-        }
-        
-        // Добавляем переносы
-        while (checksum >> 16) {
-            checksum = (checksum & 0xFFFF) + (checksum >> 16);
-        }
-        
-        // Инвертируем и записываем
-        checksum = ~checksum;
-        data[10] = (checksum >> 8) & 0xFF;
-        data[11] = checksum & 0xFF;
-    }
 };
 
 } // namespace TrafficMask
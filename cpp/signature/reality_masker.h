@@ -1,10 +1,11 @@
 #pragma once
 
 #include "trafficmask.h"
+#include "replacement_table.h"
 #include <unordered_map>
 #include <vector>
-#include <random>
 #include <array>
+#include <string_view>
 
 namespace TrafficMask {
 
@@ -17,19 +18,23 @@ public:
         AddPattern("REALITY");
         AddPattern("xtls-rprx-vision");
         AddPattern("xtls-rprx-direct");
-        AddPattern("\\x17\\x03\\x03.*\\x00\\x00\\x00\\x00");
+        AddBinarySignature("17 03 03 +2");  // TLS 1.2 application data, как у REALITY
         AddKeyword("reality");
         AddKeyword("xtls");
         AddKeyword("vision");
         AddKeyword("direct");
     }
     
+    ProtocolMask GetHandledProtocols() const override {
+        return kProxyTextProtocols;
+    }
+    
     bool ProcessPacket(Packet& packet) override {
-        if (!IsActive() || !CheckSignature(packet.data)) {
+        if (!IsActive() || !CheckSignature(packet)) {
             return false;
         }
         
-        return ProcessRealityTraffic(packet.data);
+        return ProcessRealityTraffic(packet);
     }
     
 private:
@@ -52,20 +57,20 @@ private:
         "avito.ru"
     };
     
-    bool ProcessRealityTraffic(ByteArray& data) {
-        RealityType reality_type = DetectRealityType(data);
+    bool ProcessRealityTraffic(Packet& packet) {
+        RealityType reality_type = DetectRealityType(packet.data);
         
         switch (reality_type) {
             case RealityType::REALITY_TLS:
-                return MaskRealityTls(data);
+                return MaskRealityTls(packet);
             case RealityType::REALITY_VISION:
-                return MaskRealityVision(data);
+                return MaskRealityVision(packet);
             case RealityType::REALITY_DIRECT:
-                return MaskRealityDirect(data);
+                return MaskRealityDirect(packet.data, packet.payload_checksum);
             case RealityType::REALITY_PROXY:
-                return MaskRealityProxy(data);
+                return MaskRealityProxy(packet);
             default:
-                return MaskGenericReality(data);
+                return MaskGenericReality(packet);
         }
     }
     
@@ -77,7 +82,7 @@ private:
         UNKNOWN
     };
     
-    RealityType DetectRealityType(const ByteArray& data) {
+    RealityType DetectRealityType(const PacketBuffer& data) {
         if (data.size() < 5) return RealityType::UNKNOWN;
         
         // Проверяем REALITY TLS паттерн
@@ -86,71 +91,56 @@ private:
         }
         
         // Проверяем на Vision паттерны
-        std::string content(data.begin(), data.end());
-        if (content.find("xtls-rprx-vision") != std::string::npos) {
+        PacketView content(data);
+        if (content.Contains("xtls-rprx-vision")) {
             return RealityType::REALITY_VISION;
         }
         
-        if (content.find("xtls-rprx-direct") != std::string::npos) {
+        if (content.Contains("xtls-rprx-direct")) {
             return RealityType::REALITY_DIRECT;
         }
         
-        if (content.find("reality") != std::string::npos) {
+        if (content.Contains("reality")) {
             return RealityType::REALITY_PROXY;
         }
         
         return RealityType::UNKNOWN;
     }
     
-    bool MaskRealityTls(ByteArray& data) {
+    bool MaskRealityTls(Packet& packet) {
         // Маскируем REALITY TLS как обычный TLS handshake
+        const PacketBuffer& data = packet.data;
         if (data.size() < 5) return false;
         
         // Сохраняем TLS заголовок, но маскируем payload
         uint16_t tls_length = (data[3] << 8) | data[4];
         
         if (data.size() > 5) {
-            MaskTlsPayload(data, 5, tls_length);
+            MaskTlsPayload(packet, 5, tls_length);
         }
         
         return true;
     }
     
-    bool MaskRealityVision(ByteArray& data) {
+    bool MaskRealityVision(Packet& packet) {
         // Маскируем Vision как стандартный TLS поток
-        std::string content(data.begin(), data.end());
-        bool modified = false;
-        
         // Заменяем Vision паттерны на стандартные TLS
-        std::vector<std::pair<std::string, std::string>> vision_replacements = {
+        static const ReplacementTable vision_replacements = {
             {"xtls-rprx-vision", "tls1.2"},
             {"xtls-rprx-direct", "tls-direct"},
             {"reality", "tls"},
             {"REALITY", "TLS"}
         };
         
-        for (const auto& [vision_pattern, tls_replacement] : vision_replacements) {
-            size_t pos = content.find(vision_pattern);
-            if (pos != std::string::npos) {
-                content.replace(pos, vision_pattern.length(), tls_replacement);
-                modified = true;
-            }
-        }
-        
-        if (modified) {
-            data.assign(content.begin(), content.end());
-            return true;
-        }
-        
-        return false;
+        return ApplyReplacements(packet, vision_replacements) > 0;
     }
     
-    bool MaskRealityDirect(ByteArray& data) {
+    bool MaskRealityDirect(PacketBuffer& data, ChecksumDelta& checksum) {
         // Маскируем Direct как обычный HTTPS соединение
         if (data.size() < 10) return false;
         
         // Создаем поддельный HTTPS заголовок
-        ByteArray fake_https = {
+        static constexpr uint8_t fake_https[] = {
             0x16, 0x03, 0x03, 0x00, 0x4a,  // TLS Handshake
             0x01, 0x00, 0x00, 0x46, 0x03,  // ClientHello
             0x03, 0x12, 0x34, 0x56, 0x78,  // Random
@@ -171,21 +161,16 @@ private:
         };
         
         // Заменяем начало данных на поддельный HTTPS
-        size_t replace_size = std::min(fake_https.size(), data.size());
-        for (size_t i = 0; i < replace_size; ++i) {
-            data[i] = fake_https[i];
-        }
+        size_t replace_size = std::min(sizeof(fake_https), data.size());
+        RewriteBytes(data.MutableData(), 0, fake_https, replace_size, checksum);
         
         return true;
     }
     
-    bool MaskRealityProxy(ByteArray& data) {
+    bool MaskRealityProxy(Packet& packet) {
         // Маскируем REALITY прокси как российские сервисы
-        std::string content(data.begin(), data.end());
-        bool modified = false;
-        
         // Заменяем REALITY прокси на российские домены
-        std::vector<std::pair<std::string, std::string>> proxy_replacements = {
+        static const ReplacementTable proxy_replacements = {
             {"reality://", "https://"},
             {"REALITY://", "HTTPS://"},
             {"xtls-rprx-vision", "tls1.2"},
@@ -194,51 +179,25 @@ private:
             {"@REALITY", "@yandex.ru"}
         };
         
-        for (const auto& [reality_pattern, russia_replacement] : proxy_replacements) {
-            size_t pos = content.find(reality_pattern);
-            if (pos != std::string::npos) {
-                content.replace(pos, reality_pattern.length(), russia_replacement);
-                modified = true;
-            }
-        }
-        
-        if (modified) {
-            data.assign(content.begin(), content.end());
-            return true;
-        }
-        
-        return false;
+        return ApplyReplacements(packet, proxy_replacements) > 0;
     }
     
-    bool MaskGenericReality(ByteArray& data) {
-        // Общая маскировка REALITY трафика
-        static std::random_device rd;
-        static std::mt19937 gen(rd());
-        std::uniform_int_distribution<uint8_t> dis(0, 255);
-        
-        // Маскируем случайными байтами, сохраняя первые 5 байт
-        for (size_t i = 5; i < data.size(); ++i) {
-            if (i % 4 == 0) {  // Маскируем каждый четвертый байт
-                data[i] = dis(gen);
-            }
+    bool MaskGenericReality(Packet& packet) {
+        // Общая маскировка REALITY трафика: случайный каждый четвертый
+        // байт (позиции 8, 12, 16...), первые 5 байт сохраняются
+        if (packet.data.size() > 8) {
+            FillPayloadRandom(packet, 8, packet.data.size() - 8, 4);
         }
         
         return true;
     }
     
-    void MaskTlsPayload(ByteArray& data, size_t offset, size_t length) {
-        if (offset + length > data.size()) {
-            length = data.size() - offset;
-        }
-        
-        static std::random_device rd;
-        static std::mt19937 gen(rd());
-        std::uniform_int_distribution<uint8_t> dis(0, 255);
+    void MaskTlsPayload(Packet& packet, size_t offset, size_t length) {
+        if (offset >= packet.data.size()) return;
+        length = std::min(length, packet.data.size() - offset);
         
         // Маскируем TLS payload случайными байтами
-        for (size_t i = offset; i < offset + length && i < data.size(); ++i) {
-            data[i] = dis(gen);
-        }
+        FillPayloadRandom(packet, offset, length);
     }
 };
 
@@ -257,21 +216,22 @@ public:
         AddKeyword("direct");
     }
     
+    ProtocolMask GetHandledProtocols() const override {
+        return kProxyTextProtocols;
+    }
+    
     bool ProcessPacket(Packet& packet) override {
-        if (!IsActive() || !CheckSignature(packet.data)) {
+        if (!IsActive() || !CheckSignature(packet)) {
             return false;
         }
         
-        return MaskXtlsTraffic(packet.data);
+        return MaskXtlsTraffic(packet);
     }
     
 private:
-    bool MaskXtlsTraffic(ByteArray& data) {
-        std::string content(data.begin(), data.end());
-        bool modified = false;
-        
+    bool MaskXtlsTraffic(Packet& packet) {
         // Заменяем XTLS паттерны на стандартные TLS
-        std::vector<std::pair<std::string, std::string>> xtls_replacements = {
+        static const ReplacementTable xtls_replacements = {
             {"xtls-rprx-vision", "tls1.2"},
             {"xtls-rprx-direct", "tls-direct"},
             {"xtls", "tls"},
@@ -280,20 +240,7 @@ private:
             {"RPRX", "TLS"}
         };
         
-        for (const auto& [xtls_pattern, tls_replacement] : xtls_replacements) {
-            size_t pos = content.find(xtls_pattern);
-            if (pos != std::string::npos) {
-                content.replace(pos, xtls_pattern.length(), tls_replacement);
-                modified = true;
-            }
-        }
-        
-        if (modified) {
-            data.assign(content.begin(), content.end());
-            return true;
-        }
-        
-        return false;
+        return ApplyReplacements(packet, xtls_replacements) > 0;
     }
 };
 
@@ -1,9 +1,11 @@
 #pragma once
 
 #include "trafficmask.h"
+#include "replacement_table.h"
 #include <regex>
 #include <vector>
-#include <random>
+#include <string_view>
+#include <iterator>
 
 namespace TrafficMask {
 
@@ -20,24 +22,36 @@ public:
         AddKeyword("vkontakte");
     }
     
+    ProtocolMask GetHandledProtocols() const override {
+        return kHttpProtocols |
+               ProtocolBit(ProtocolClass::UNKNOWN);
+    }
+    
+    bool DefersPayloadEdits() const override { return true; }
+    
     bool ProcessPacket(Packet& packet) override {
-        if (!IsActive() || !CheckSignature(packet.data)) {
+        if (!IsActive() || !CheckSignature(packet)) {
             return false;
         }
         
-        return MaskVkTunnel(packet.data);
+        PayloadEdits local;
+        bool masked = MaskVkTunnel(PacketView(packet.data).Text(), PendingEdits(packet, local));
+        ApplyLocalEdits(packet, local);
+        return masked;
     }
     
 private:
-    bool MaskVkTunnel(ByteArray& data) {
-        // Заменяем VK Tunnel домены на популярные российские домены
-        std::vector<std::string> vk_tunnel_patterns = {
-            R"([a-zA-Z0-9-]+\.tunnel\.vk-apps\.com)",
-            R"(vk-apps\.com)",
-            R"(vkontakte\.ru)"
+    bool MaskVkTunnel(std::string_view text, PayloadEdits& edits) {
+        // Заменяем VK Tunnel домены на популярные российские домены;
+        // домены ищутся без учета регистра, поддомен туннеля - вместе с доменом.
+        // Домен внутри уже замененного поддомена туннеля не правится повторно
+        static constexpr std::pair<std::string_view, bool> vk_tunnel_domains[] = {
+            {".tunnel.vk-apps.com", true},
+            {"vk-apps.com", false},
+            {"vkontakte.ru", false}
         };
         
-        std::vector<std::string> replacement_domains = {
+        static constexpr const char* replacement_domains[] = {
             "vk.com",
             "mail.ru", 
             "yandex.ru",
@@ -45,36 +59,18 @@ private:
             "rutracker.org"
         };
         
-        std::string content(data.begin(), data.end());
         bool modified = false;
         
-        for (const auto& pattern : vk_tunnel_patterns) {
-            try {
-                std::regex vk_regex(pattern, std::regex_constants::icase);
-                
-                // Выбираем случайный домен для замены
-                static std::random_device rd;
-                static std::mt19937 gen(rd());
-                std::uniform_int_distribution<> dis(0, replacement_domains.size() - 1);
-                std::string replacement = replacement_domains[dis(gen)];
-                
-                std::string new_content = std::regex_replace(content, vk_regex, replacement);
-                if (new_content != content) {
-                    content = new_content;
-                    modified = true;
-                }
-            } catch (const std::regex_error& e) {
-                // Игнорируем ошибки regex
+        for (const auto& [domain, with_subdomain] : vk_tunnel_domains) {
+            // Выбираем случайный домен для замены
+            const char* replacement = replacement_domains[RandomSource::ForCurrentThread().Bounded(std::size(replacement_domains))];
+            
+            if (CollectIgnoreCase(text, domain, replacement, edits, with_subdomain) > 0) {
+                modified = true;
             }
         }
         
-        if (modified) {
-            // Обновляем данные пакета
-            data.assign(content.begin(), content.end());
-            return true;
-        }
-        
-        return false;
+        return modified;
     }
 };
 
@@ -95,28 +91,28 @@ public:
         AddPattern("cdn\\.1cbitrix\\.ru");
     }
     
+    ProtocolMask GetHandledProtocols() const override {
+        return kHttpProtocols |
+               ProtocolBit(ProtocolClass::UNKNOWN);
+    }
+    
+    bool DefersPayloadEdits() const override { return true; }
+    
     bool ProcessPacket(Packet& packet) override {
-        if (!IsActive() || !CheckSignature(packet.data)) {
+        if (!IsActive() || !CheckSignature(packet)) {
             return false;
         }
         
-        return MaskRussiaCdn(packet.data);
+        PayloadEdits local;
+        bool masked = MaskRussiaCdn(PacketView(packet.data).Text(), PendingEdits(packet, local));
+        ApplyLocalEdits(packet, local);
+        return masked;
     }
     
 private:
-    bool MaskRussiaCdn(ByteArray& data) {
-        std::vector<std::string> cdn_replacements = {
-            "vk.com",
-            "mail.ru",
-            "yandex.ru",
-            "ok.ru"
-        };
-        
-        std::string content(data.begin(), data.end());
-        bool modified = false;
-        
+    bool MaskRussiaCdn(std::string_view text, PayloadEdits& edits) {
         // Заменяем CDN домены на основные домены компаний
-        std::string replacements[][2] = {
+        static const ReplacementTable replacements = {
             {"cdn.yandex.ru", "yandex.ru"},
             {"yastatic.net", "yandex.ru"},
             {"rcntr.com", "mail.ru"},
@@ -127,20 +123,7 @@ private:
             {"cdn.1cbitrix.ru", "1c.ru"}
         };
         
-        for (const auto& replacement : replacements) {
-            size_t pos = content.find(replacement[0]);
-            if (pos != std::string::npos) {
-                content.replace(pos, replacement[0].length(), replacement[1]);
-                modified = true;
-            }
-        }
-        
-        if (modified) {
-            data.assign(content.begin(), content.end());
-            return true;
-        }
-        
-        return false;
+        return replacements.Collect(text, edits) > 0;
     }
 };
 
@@ -160,21 +143,23 @@ public:
         AddKeyword("apiyandex");
     }
     
+    ProtocolMask GetHandledProtocols() const override {
+        return kHttpProtocols |
+               ProtocolBit(ProtocolClass::UNKNOWN);
+    }
+    
     bool ProcessPacket(Packet& packet) override {
-        if (!IsActive() || !CheckSignature(packet.data)) {
+        if (!IsActive() || !CheckSignature(packet)) {
             return false;
         }
         
-        return MaskRussiaApi(packet.data);
+        return MaskRussiaApi(packet);
     }
     
 private:
-    bool MaskRussiaApi(ByteArray& data) {
-        std::string content(data.begin(), data.end());
-        bool modified = false;
-        
+    bool MaskRussiaApi(Packet& packet) {
         // Маскируем API пути, чтобы они выглядели как обычные веб-запросы
-        std::string api_replacements[][2] = {
+        static const ReplacementTable api_replacements = {
             {"/api/vk/", "/vk/"},
             {"/api/mail/", "/mail/"},
             {"/api/yandex/", "/yandex/"},
@@ -186,20 +171,7 @@ private:
             {"apiyandex", "yandex"}
         };
         
-        for (const auto& replacement : api_replacements) {
-            size_t pos = content.find(replacement[0]);
-            if (pos != std::string::npos) {
-                content.replace(pos, replacement[0].length(), replacement[1]);
-                modified = true;
-            }
-        }
-        
-        if (modified) {
-            data.assign(content.begin(), content.end());
-            return true;
-        }
-        
-        return false;
+        return ApplyReplacements(packet, api_replacements) > 0;
     }
 };
 
@@ -1,8 +1,19 @@
 #pragma once
 
 #include "trafficmask.h"
+#include "keyword_matcher.h"
+#include "regex_set.h"
+#include "binary_signature.h"
+#include "replacement_table.h"
+#include "http_request_head.h"
+#include "payload_edits.h"
+#include "tls_client_hello.h"
 #include <regex>
 #include <set>
+#include <deque>
+#include <algorithm>
+#include <string_view>
+#include <iterator>
 
 namespace TrafficMask {
 
@@ -11,8 +22,10 @@ class BaseSignatureProcessor : public ISignatureProcessor {
 protected:
     SignatureId signature_id_;
     bool is_active_;
-    std::vector<std::regex> patterns_;
-    std::set<std::string> keywords_;
+    RegexSet patterns_;        // все шаблоны процессора - один автомат
+    KeywordMatcher keywords_;  // все ключевые слова ищутся за один проход
+    PatternSet pattern_ids_;   // те же шаблоны и слова в общем реестре
+    BinarySignatureSet binary_signatures_;  // заголовки по смещениям, без поиска
     
 public:
     BaseSignatureProcessor(const SignatureId& id) 
@@ -25,39 +38,184 @@ public:
     
     void SetActive(bool active) { is_active_ = active; }
     
+    PatternSet GetPatterns() const override { return pattern_ids_; }
+    
     // Добавление паттернов для поиска
     void AddPattern(const std::string& pattern) {
         try {
-            patterns_.emplace_back(pattern, std::regex_constants::icase);
-        } catch (const std::regex_error& e) {
+            patterns_.Add(pattern, true);
+            patterns_.Build();
+            pattern_ids_.Add(PatternRegistry::Instance().Intern(PatternKind::REGEX, pattern));
+        } catch (const RegexSyntaxError& e) {
             std::cerr << "Invalid regex pattern: " << pattern << " - " << e.what() << std::endl;
         }
     }
     
     void AddKeyword(const std::string& keyword) {
-        keywords_.insert(keyword);
+        keywords_.Add(keyword);
+        pattern_ids_.Add(PatternRegistry::Instance().Intern(PatternKind::KEYWORD, keyword));
     }
     
-protected:
-    // Проверка содержимого пакета на соответствие сигнатурам
-    bool CheckSignature(const ByteArray& data) const {
-        std::string content(data.begin(), data.end());
+    // Бинарная сигнатура заголовка (синтаксис - в binary_signature.h);
+    // проверяется по смещениям от начала payload, а не поиском
+    void AddBinarySignature(const std::string& signature) {
+        try {
+            binary_signatures_.Add(signature);
+        } catch (const BinarySignatureError& e) {
+            std::cerr << "Invalid binary signature: " << signature << " - " << e.what() << std::endl;
+        }
+    }
+    
+    // Активность проверяется один раз на пачку; payload следующего
+    // пакета предвыбирается, пока сканируется текущий
+    void ProcessBatch(PacketBatch& batch) override {
+        if (!is_active_) {
+            return;
+        }
         
-        // Проверка по ключевым словам
-        for (const auto& keyword : keywords_) {
-            if (content.find(keyword) != std::string::npos) {
-                return true;
+        const std::vector<uint32_t>& selected = batch.selected;
+        for (size_t k = 0; k < selected.size(); ++k) {
+            if (k + 1 < selected.size()) {
+                TRAFFICMASK_PREFETCH(batch.payloads[selected[k + 1]]);
+            }
+            size_t i = selected[k];
+            if (ProcessPacket(*batch.packets[i])) {
+                batch.masked[i] = 1;
             }
         }
+    }
+    
+protected:
+    // Замены всех вхождений needle без учета регистра ASCII добавляются в
+    // edits, поиск векторный, без regex. with_subdomain захватывает и метку
+    // хоста слева ([a-zA-Z0-9-]+), как шаблон "[a-zA-Z0-9-]+\\.tunnel...":
+    // вхождение без такой метки пропускается, как и вхождение в участке,
+    // который уже правится. replacement должен жить до применения правок.
+    // Возвращает число добавленных правок
+    static size_t CollectIgnoreCase(std::string_view text, std::string_view needle, std::string_view replacement,
+                                    PayloadEdits& edits, bool with_subdomain = false) {
+        if (needle.empty()) {
+            return 0;
+        }
         
-        // Проверка по регулярным выражениям
-        for (const auto& pattern : patterns_) {
-            if (std::regex_search(content, pattern)) {
-                return true;
+        size_t added = 0;
+        size_t from = 0;
+        while (true) {
+            size_t pos = FindBytesIgnoreCase(text, needle, from);
+            if (pos == PacketView::npos) {
+                break;
+            }
+            
+            size_t start = pos;
+            if (with_subdomain) {
+                while (start > from && IsHostLabelByte(static_cast<uint8_t>(text[start - 1]))) {
+                    --start;
+                }
+                if (start == pos) {
+                    from = pos + 1;
+                    continue;
+                }
             }
+            
+            if (edits.Add(start, pos + needle.size() - start, replacement)) {
+                ++added;
+            }
+            from = pos + needle.size();
         }
         
-        return false;
+        return added;
+    }
+    
+    // Список для правок длины payload процессора с DefersPayloadEdits():
+    // в движке - общий PacketContext::edits, который движок применяет сам,
+    // вне движка - local, применяемый ApplyLocalEdits
+    static PayloadEdits& PendingEdits(Packet& packet, PayloadEdits& local) {
+        return packet.context ? packet.context->edits : local;
+    }
+    
+    // Вне движка правки применяются сразу, и checksum восстанавливается по
+    // сумме payload до и после них (в движке - CommitPayloadEdits)
+    static void ApplyLocalEdits(Packet& packet, PayloadEdits& local) {
+        if (!packet.context && !local.Empty()) {
+            ChecksumFixup fixup;
+            fixup.RequestPayload(packet.data, packet.payload_checksum);
+            local.Apply(packet.data);
+            fixup.Apply(packet.data, packet.payload_checksum);
+        }
+    }
+    
+    // Запрос восстановить checksum для процессора, переписывающего данные
+    // целиком; делается до перезаписи. В движке - общий
+    // PacketContext::checksum_fixup, выполняемый после конвейера, вне
+    // движка - local, выполняемый ApplyLocalChecksumFixup
+    static ChecksumFixup& PendingChecksumFixup(Packet& packet, ChecksumFixup& local) {
+        return packet.context ? packet.context->checksum_fixup : local;
+    }
+    
+    static void ApplyLocalChecksumFixup(Packet& packet, ChecksumFixup& local) {
+        if (!packet.context) {
+            local.Apply(packet.data, packet.payload_checksum);
+        }
+    }
+    
+    // Применяет таблицу замен к payload сразу; замены меняют длину, поэтому
+    // checksum восстанавливается по сумме payload до и после. Запрос - только
+    // если таблица нашла что заменить. Возвращает число замен
+    static size_t ApplyReplacements(Packet& packet, const ReplacementTable& table) {
+        ChecksumFixup local;
+        size_t replaced = table.Apply(packet.data, [&](const PacketBuffer& data) {
+            PendingChecksumFixup(packet, local).RequestPayload(data, packet.payload_checksum);
+        });
+        ApplyLocalChecksumFixup(packet, local);
+        return replaced;
+    }
+    
+    // Заполняет size байт payload со смещения offset потоком ключей
+    // RandomSource (stride > 1 - только каждый stride-й байт), checksum
+    // восстанавливается по сумме payload до и после. Запрос делается здесь,
+    // на ветке, которая действительно пишет: пакеты, которые процессор
+    // оставляет как есть, не суммируются
+    static void FillPayloadRandom(Packet& packet, size_t offset, size_t size, size_t stride = 1) {
+        ChecksumFixup local;
+        PendingChecksumFixup(packet, local).RequestPayload(packet.data, packet.payload_checksum);
+        uint8_t* data = packet.data.MutableData() + offset;
+        if (stride == 1) {
+            RandomSource::ForCurrentThread().Fill(data, size);
+        } else {
+            RandomSource::ForCurrentThread().FillStrided(data, size, stride);
+        }
+        ApplyLocalChecksumFixup(packet, local);
+    }
+    
+    static bool IsHostLabelByte(uint8_t c) {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '-';
+    }
+    
+    // Проверка пакета на соответствие сигнатурам: по результату общей
+    // базы, если движок уже просканировал пакет, иначе по payload.
+    // Бинарные сигнатуры в базу не входят - их проверка и так O(1)
+    bool CheckSignature(const Packet& packet) const {
+        if (packet.context && packet.context->patterns.IsValid()) {
+            return binary_signatures_.Matches(packet.data.data(), packet.data.size()) ||
+                   packet.context->patterns.Intersects(pattern_ids_);
+        }
+        return CheckSignature(packet.data);
+    }
+    
+    // Проверка содержимого пакета на соответствие сигнатурам
+    bool CheckSignature(const PacketBuffer& data) const {
+        // Проверка заголовка по бинарным сигнатурам
+        if (binary_signatures_.Matches(data.data(), data.size())) {
+            return true;
+        }
+        
+        // Проверка по ключевым словам
+        if (keywords_.Contains(data.data(), data.size())) {
+            return true;
+        }
+        
+        // Проверка по регулярным выражениям: один проход за все шаблоны
+        return patterns_.Search(data.data(), data.size()) != RegexSet::kNoMatch;
     }
 };
 
@@ -74,31 +232,47 @@ public:
         AddPattern("Upgrade-Insecure-Requests:.*");
     }
     
+    ProtocolMask GetHandledProtocols() const override {
+        return kHttpProtocols;
+    }
+    
+    bool DefersPayloadEdits() const override { return true; }
+    
     bool ProcessPacket(Packet& packet) override {
-        if (!IsActive() || !CheckSignature(packet.data)) {
+        if (!IsActive() || !CheckSignature(packet)) {
             return false;
         }
         
         // Маскируем HTTP заголовки
-        MaskHttpHeaders(packet.data);
+        PayloadEdits local;
+        MaskHttpHeaders(packet.data, PendingEdits(packet, local));
+        ApplyLocalEdits(packet, local);
         return true;
     }
     
 private:
-    void MaskHttpHeaders(ByteArray& data) {
-        std::string content(data.begin(), data.end());
-        
-        // Заменяем User-Agent на стандартный
-        std::regex user_agent_regex("User-Agent:.*?\\r\\n");
-        content = std::regex_replace(content, user_agent_regex, 
-            "User-Agent: Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36\\r\\n");
-        
-        // Удаляем специфичные заголовки
-        std::regex upgrade_regex("Upgrade-Insecure-Requests:.*?\\r\\n");
-        content = std::regex_replace(content, upgrade_regex, "");
+    void MaskHttpHeaders(const PacketBuffer& data, PayloadEdits& edits) {
+        static constexpr std::string_view standard_user_agent =
+            "Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36";
+        
+        // Заголовки ищутся разбором начала запроса; для сегмента без конца
+        // заголовков правятся строки, пришедшие целиком
+        std::string_view text = PacketView(data).Text();
+        HttpRequestHead head;
+        if (head.Parse(text) == HttpHeadStatus::INVALID) {
+            return;
+        }
         
-        // Обновляем данные пакета
-        data.assign(content.begin(), content.end());
+        // Заменяем User-Agent на стандартный, удаляем специфичные заголовки;
+        // правки применяются одним проходом вместе с правками соседних процессоров
+        for (size_t i = 0; i < head.HeaderCount(); ++i) {
+            const HttpHeaderLine& header = head.Header(i);
+            if (HttpRequestHead::NameIs(text, header, "User-Agent")) {
+                edits.Add(header.value_offset, header.value_length, standard_user_agent);
+            } else if (HttpRequestHead::NameIs(text, header, "Upgrade-Insecure-Requests")) {
+                edits.Add(header.offset, header.length, {});
+            }
+        }
     }
 };
 
@@ -113,25 +287,29 @@ public:
         AddKeyword("handshake");
     }
     
+    ProtocolMask GetHandledProtocols() const override {
+        return ProtocolBit(ProtocolClass::TLS_HANDSHAKE);
+    }
+    
     bool ProcessPacket(Packet& packet) override {
-        if (!IsActive() || !CheckSignature(packet.data)) {
+        if (!IsActive() || !CheckSignature(packet)) {
             return false;
         }
         
         // Маскируем TLS fingerprint
-        MaskTlsFingerprint(packet.data);
+        MaskTlsFingerprint(packet.data, packet.payload_checksum);
         return true;
     }
     
 private:
-    void MaskTlsFingerprint(ByteArray& data) {
+    void MaskTlsFingerprint(PacketBuffer& data, ChecksumDelta& checksum) {
         // Простая маскировка TLS данных
         // В реальном проекте здесь будет более сложная логика
         
-        for (size_t i = 0; i < data.size() && i < 50; ++i) {
-            if (i % 4 == 0) {
-                data[i] = (data[i] ^ 0xAA) & 0xFF;
-            }
+        uint8_t* bytes = data.MutableData();
+        for (size_t i = 0; i < data.size() && i < 50; i += 4) {
+            uint8_t masked = bytes[i] ^ 0xAA;
+            RewriteBytes(bytes, i, &masked, 1, checksum);
         }
     }
 };
@@ -140,32 +318,36 @@ private:
 class DnsQueryMasker : public BaseSignatureProcessor {
 public:
     DnsQueryMasker() : BaseSignatureProcessor("dns_query_masker") {
-        AddPattern("\\x00\\x01.*\\x00\\x01"); // DNS query pattern
+        AddBinarySignature("+2 00&F8 ?? 00 01-04 00 00 +4 01-3F");  // стандартный DNS-запрос
         AddKeyword("query");
         AddKeyword("dns");
     }
     
+    ProtocolMask GetHandledProtocols() const override {
+        return ProtocolBit(ProtocolClass::DNS);
+    }
+    
     bool ProcessPacket(Packet& packet) override {
-        if (!IsActive() || !CheckSignature(packet.data)) {
+        if (!IsActive() || !CheckSignature(packet)) {
             return false;
         }
         
         // Маскируем DNS запросы
-        MaskDnsQuery(packet.data);
+        MaskDnsQuery(packet.data, packet.payload_checksum);
         return true;
     }
     
 private:
-    void MaskDnsQuery(ByteArray& data) {
-        // Простая маскировка DNS данных
+    void MaskDnsQuery(PacketBuffer& data, ChecksumDelta& checksum) {
+        // Простая маскировка DNS данных; checksum UDP обновляется по полям
         if (data.size() > 12) {
+            uint8_t* out = data.MutableData();
+            
             // Маскируем ID запроса
-            data[0] = 0x12;
-            data[1] = 0x34;
+            RewriteU16(out, 0, 0x1234, checksum);
             
             // Маскируем флаги
-            data[2] = 0x01;
-            data[3] = 0x00;
+            RewriteU16(out, 2, 0x0100, checksum);
         }
     }
 };
@@ -175,41 +357,43 @@ class SniMasker : public BaseSignatureProcessor {
 public:
     SniMasker() : BaseSignatureProcessor("sni_masker") {
         // Добавляем паттерны для TLS ClientHello
-        AddPattern("\\x16\\x03\\x01.*\\x00\\x00.*\\x03\\x03");
+        AddBinarySignature("16 03 00-03 +2 01 +3 03 00-03");  // TLS ClientHello
         AddPattern("Server Name Indication");
         AddKeyword("SNI");
         AddKeyword("server_name");
     }
     
+    ProtocolMask GetHandledProtocols() const override {
+        return ProtocolBit(ProtocolClass::TLS_HANDSHAKE);
+    }
+    
+    bool DefersPayloadEdits() const override { return true; }
+    
     bool ProcessPacket(Packet& packet) override {
-        if (!IsActive() || !CheckSignature(packet.data)) {
+        if (!IsActive() || !CheckSignature(packet)) {
             return false;
         }
         
-        return MaskSniExtension(packet.data);
+        PayloadEdits local;
+        bool masked = MaskSniExtension(packet.data, PendingEdits(packet, local));
+        ApplyLocalEdits(packet, local);
+        return masked;
     }
     
 private:
-    bool MaskSniExtension(ByteArray& data) {
-        // Поиск TLS ClientHello
-        if (data.size() < 5 || data[0] != 0x16) {
-            return false; // Не TLS handshake
-        }
-        
-        // Поиск SNI extension (0x00 0x00)
-        for (size_t i = 5; i < data.size() - 2; ++i) {
-            if (data[i] == 0x00 && data[i+1] == 0x00) {
-                // Найдена SNI extension
-                return ReplaceSniWithMask(data, i);
-            }
+    bool MaskSniExtension(const PacketBuffer& data, PayloadEdits& edits) {
+        // Имя сервера ищется разбором ClientHello по длинам полей
+        TlsServerName server_name;
+        if (!FindTlsServerName(data.data(), data.size(), server_name)) {
+            return false;
         }
         
-        return false;
+        return ReplaceSniWithMask(data, server_name, edits);
     }
     
-    bool ReplaceSniWithMask(ByteArray& data, size_t sni_offset) {
+    bool ReplaceSniWithMask(const PacketBuffer& data, const TlsServerName& server_name, PayloadEdits& edits) {
         // Заменяем SNI на российские домены для маскировки
-        std::vector<std::string> mask_domains = {
+        static constexpr std::string_view mask_domains[] = {
             "vk.com",
             "vk.ru", 
             "mail.ru",
@@ -228,32 +412,11 @@ private:
         };
         
         // Выбираем случайный домен для маскировки
-        static std::random_device rd;
-        static std::mt19937 gen(rd());
-        std::uniform_int_distribution<> dis(0, mask_domains.size() - 1);
-        std::string mask_domain = mask_domains[dis(gen)];
-        
-        // Заменяем SNI
-        return ReplaceSniString(data, sni_offset, mask_domain);
-    }
-    
-    bool ReplaceSniString(ByteArray& data, size_t offset, const std::string& new_domain) {
-        if (offset + 2 >= data.size()) return false;
+        std::string_view mask_domain = mask_domains[RandomSource::ForCurrentThread().Bounded(std::size(mask_domains))];
         
-        // Получаем длину текущего SNI
-        size_t sni_length = (data[offset + 2] << 8) | data[offset + 3];
-        
-        if (offset + 4 + sni_length > data.size()) return false;
-        
-        // Заменяем домен
-        if (new_domain.length() <= sni_length) {
-            std::copy(new_domain.begin(), new_domain.end(), data.begin() + offset + 4);
-            // Заполняем оставшееся место нулями
-            std::fill(data.begin() + offset + 4 + new_domain.length(), 
-                     data.begin() + offset + 4 + sni_length, 0);
-        }
-        
-        return true;
+        // Заменяем SNI целиком при любой длине домена: поля длины,
+        // охватывающие имя, пересчитываются
+        return ReplaceTlsServerName(data, server_name, mask_domain, edits);
     }
 };
 
@@ -262,13 +425,17 @@ class IpSidrMasker : public BaseSignatureProcessor {
 public:
     IpSidrMasker() : BaseSignatureProcessor("ip_sidr_masker") {
         // Добавляем паттерны для IP пакетов
-        AddPattern("\\x45.*\\x00.*\\x00.*\\x00.*\\x00.*\\x00.*\\x00.*\\x00");
+        AddBinarySignature("45-4F ?? total16 +16");  // заголовок IPv4
         AddKeyword("IP");
         AddKeyword("packet");
     }
     
+    ProtocolMask GetHandledProtocols() const override {
+        return ProtocolBit(ProtocolClass::IPV4);
+    }
+    
     bool ProcessPacket(Packet& packet) override {
-        if (!IsActive() || !CheckSignature(packet.data)) {
+        if (!IsActive() || !CheckSignature(packet)) {
             return false;
         }
         
@@ -276,7 +443,7 @@ public:
     }
     
 private:
-    bool MaskIpSidr(ByteArray& data) {
+    bool MaskIpSidr(PacketBuffer& data) {
         if (data.size() < 20) return false; // Минимальный размер IP заголовка
         
         // Проверяем версию IP (4-й бит первого байта)
@@ -286,7 +453,7 @@ private:
         return MaskSourceIp(data);
     }
     
-    bool MaskSourceIp(ByteArray& data) {
+    bool MaskSourceIp(PacketBuffer& data) {
         if (data.size() < 20) return false;
         
         // Source IP находится в байтах 12-15
@@ -296,16 +463,13 @@ private:
         // Генерируем маскированный IP из пула популярных IP
         uint32_t masked_ip = GenerateMaskedIp(original_ip);
         
-        // Заменяем source IP
-        data[12] = (masked_ip >> 24) & 0xFF;
-        data[13] = (masked_ip >> 16) & 0xFF;
-        data[14] = (masked_ip >> 8) & 0xFF;
-        data[15] = masked_ip & 0xFF;
-        
-        // Пересчитываем checksum
-        RecalculateChecksum(data);
-        
-        return true;
+        // Заменяем source IP; checksum заголовка IP и TCP/UDP (адрес входит
+        // в псевдозаголовок) обновляются инкрементально
+        const uint8_t masked_bytes[4] = {
+            static_cast<uint8_t>(masked_ip >> 24), static_cast<uint8_t>(masked_ip >> 16),
+            static_cast<uint8_t>(masked_ip >> 8), static_cast<uint8_t>(masked_ip)
+        };
+        return RewriteIpv4Bytes(data, 12, masked_bytes, sizeof(masked_bytes));
     }
     
     uint32_t GenerateMaskedIp(uint32_t original_ip) {
@@ -341,34 +505,6 @@ private:
         size_t index = original_ip % mask_ips.size();
         return mask_ips[index];
     }
-    
-    void RecalculateChecksum(ByteArray& data) {
-        if (data.size() < 20) return;
-        
-        // Обнуляем checksum
-        data[10] = 0;
-        data[11] = 0;
-        
-        // Вычисляем новый checksum
-        uint32_t checksum = 0;
-        size_t header_length = (data[0] & 0x0F) * 4;
-        
-        for (size_t i = 0; i < header_length; i += 2) {
-            if (i != 10) { // Пропускаем поле checksum
-                checksum += (data[i] << 8) | data[i + 1];
-            }
-        }
-        
-        // Добавляем переносы
-        while (checksum >> 16) {
-            checksum = (checksum & 0xFFFF) + (checksum >> 16);
-        }
-        
-        // Инвертируем и записываем
-        checksum = ~checksum;
-        data[10] = (checksum >> 8) & 0xFF;
-        data[11] = checksum & 0xFF;
-    }
 };
 
 // Российские маскировщики (аналогично VK Tunnel)
@@ -387,23 +523,36 @@ public:
         AddKeyword("vkontakte");
     }
     
+    ProtocolMask GetHandledProtocols() const override {
+        return kHttpProtocols |
+               ProtocolBit(ProtocolClass::UNKNOWN);
+    }
+    
+    bool DefersPayloadEdits() const override { return true; }
+    
     bool ProcessPacket(Packet& packet) override {
-        if (!IsActive() || !CheckSignature(packet.data)) {
+        if (!IsActive() || !CheckSignature(packet)) {
             return false;
         }
         
-        return MaskVkTunnel(packet.data);
+        PayloadEdits local;
+        bool masked = MaskVkTunnel(PacketView(packet.data).Text(), PendingEdits(packet, local));
+        ApplyLocalEdits(packet, local);
+        return masked;
     }
     
 private:
-    bool MaskVkTunnel(ByteArray& data) {
-        std::vector<std::string> vk_tunnel_patterns = {
-            R"([a-zA-Z0-9-]+\.tunnel\.vk-apps\.com)",
-            R"(vk-apps\.com)",
-            R"(vkontakte\.ru)"
+    bool MaskVkTunnel(std::string_view text, PayloadEdits& edits) {
+        // Заменяем VK Tunnel домены на популярные российские домены;
+        // домены ищутся без учета регистра, поддомен туннеля - вместе с доменом.
+        // Домен внутри уже замененного поддомена туннеля не правится повторно
+        static constexpr std::pair<std::string_view, bool> vk_tunnel_domains[] = {
+            {".tunnel.vk-apps.com", true},
+            {"vk-apps.com", false},
+            {"vkontakte.ru", false}
         };
         
-        std::vector<std::string> replacement_domains = {
+        static constexpr const char* replacement_domains[] = {
             "vk.com",
             "mail.ru", 
             "yandex.ru",
@@ -411,35 +560,18 @@ private:
             "rutracker.org"
         };
         
-        std::string content(data.begin(), data.end());
         bool modified = false;
         
-        for (const auto& pattern : vk_tunnel_patterns) {
-            try {
-                std::regex vk_regex(pattern, std::regex_constants::icase);
-                
-                // Выбираем случайный домен для замены
-                static std::random_device rd;
-                static std::mt19937 gen(rd());
-                std::uniform_int_distribution<> dis(0, replacement_domains.size() - 1);
-                std::string replacement = replacement_domains[dis(gen)];
-                
-                std::string new_content = std::regex_replace(content, vk_regex, replacement);
-                if (new_content != content) {
-                    content = new_content;
-                    modified = true;
-                }
-            } catch (const std::regex_error& e) {
-                // Игнорируем ошибки regex
+        for (const auto& [domain, with_subdomain] : vk_tunnel_domains) {
+            // Выбираем случайный домен для замены
+            const char* replacement = replacement_domains[RandomSource::ForCurrentThread().Bounded(std::size(replacement_domains))];
+            
+            if (CollectIgnoreCase(text, domain, replacement, edits, with_subdomain) > 0) {
+                modified = true;
             }
         }
         
-        if (modified) {
-            data.assign(content.begin(), content.end());
-            return true;
-        }
-        
-        return false;
+        return modified;
     }
 };
 
@@ -453,36 +585,39 @@ class EncryptedTrafficMasker : public BaseSignatureProcessor {
 public:
     EncryptedTrafficMasker() : BaseSignatureProcessor("encrypted_traffic_masker") {
         // Паттерны для зашифрованного трафика
-        AddPattern("\\x17\\x03\\x03");        // TLS application data
-        AddPattern("\\x17\\x03\\x01");        // TLS application data TLS 1.0
-        AddPattern("\\x17\\x03\\x02");        // TLS application data TLS 1.1
-        AddPattern("\\x17\\x03\\x04");        // TLS application data TLS 1.3
+        AddBinarySignature("17 03 01-04 +2");  // TLS application data, TLS 1.0-1.3
         AddKeyword("TLS");
         AddKeyword("encrypted");
         AddKeyword("SSL");
     }
     
+    ProtocolMask GetHandledProtocols() const override {
+        return ProtocolBit(ProtocolClass::TLS_APPLICATION_DATA);
+    }
+    
     bool ProcessPacket(Packet& packet) override {
-        if (!IsActive() || !CheckSignature(packet.data)) {
+        if (!IsActive() || !CheckSignature(packet)) {
             return false;
         }
         
-        return MaskEncryptedTraffic(packet.data);
+        return MaskEncryptedTraffic(packet);
     }
     
 private:
-    bool MaskEncryptedTraffic(ByteArray& data) {
+    bool MaskEncryptedTraffic(Packet& packet) {
+        const PacketBuffer& data = packet.data;
         if (data.size() < 5) return false;
         
         uint8_t content_type = data[0];
         if (content_type == 0x17) {  // Application Data
-            return MaskTlsApplicationData(data);
+            return MaskTlsApplicationData(packet);
         }
         
         return false;
     }
     
-    bool MaskTlsApplicationData(ByteArray& data) {
+    bool MaskTlsApplicationData(Packet& packet) {
+        const PacketBuffer& data = packet.data;
         if (data.size() < 5) return false;
         
         uint16_t version = (data[1] << 8) | data[2];
@@ -491,25 +626,20 @@ private:
         if (version < 0x0301 || version > 0x0304) return false;
         
         if (data.size() > 5) {
-            MaskEncryptedPayload(data, 5, length);
+            MaskEncryptedPayload(packet, 5, length);
             return true;
         }
         
         return false;
     }
     
-    void MaskEncryptedPayload(ByteArray& data, size_t offset, size_t length) {
-        if (offset + length > data.size()) {
-            length = data.size() - offset;
-        }
-        
-        static std::random_device rd;
-        static std::mt19937 gen(rd());
-        std::uniform_int_distribution<uint8_t> dis(0, 255);
+    // Зашифрованные данные переписываются целиком: checksum
+    // восстанавливается по сумме payload до и после
+    void MaskEncryptedPayload(Packet& packet, size_t offset, size_t length) {
+        if (offset >= packet.data.size()) return;
+        length = std::min(length, packet.data.size() - offset);
         
-        for (size_t i = offset; i < offset + length && i < data.size(); ++i) {
-            data[i] = dis(gen);
-        }
+        FillPayloadRandom(packet, offset, length);
     }
 };
 
@@ -525,20 +655,31 @@ public:
         InitializeRussiaWhitelist();
     }
     
+    ProtocolMask GetHandledProtocols() const override {
+        return kHttpProtocols |
+               ProtocolBit(ProtocolClass::UNKNOWN);
+    }
+    
+    // Замены IP меняют длину - правки в общем списке
+    bool DefersPayloadEdits() const override { return true; }
+    
     bool ProcessPacket(Packet& packet) override {
         if (!IsActive()) return false;
         
-        return ApplyWhitelistMasking(packet.data);
+        PayloadEdits local;
+        bool masked = ApplyWhitelistMasking(PacketView(packet.data).Text(), PendingEdits(packet, local));
+        ApplyLocalEdits(packet, local);
+        return masked;
     }
     
     void AddToWhitelist(const std::string& ip) {
         std::lock_guard<std::mutex> lock(whitelist_mutex_);
-        whitelist_ips_.insert(ip);
+        AddToWhitelistLocked(ip);
     }
     
-    bool IsIpWhitelisted(const std::string& ip) const {
+    bool IsIpWhitelisted(std::string_view ip) const {
         std::lock_guard<std::mutex> lock(whitelist_mutex_);
-        return whitelist_ips_.find(ip) != whitelist_ips_.end();
+        return IsIpWhitelistedLocked(ip);
     }
     
     size_t GetWhitelistSize() const {
@@ -548,10 +689,15 @@ public:
     
 private:
     mutable std::mutex whitelist_mutex_;
-    std::unordered_set<std::string> whitelist_ips_;
+    
+    // Адреса только добавляются: строки в deque не перемещаются, поэтому
+    // замены в отложенных правках указывают прямо на них. Поиск - по
+    // упорядоченным string_view, без временных строк
+    std::deque<std::string> whitelist_ips_;
+    std::vector<std::string_view> sorted_ips_;
     
     void InitializeRussiaWhitelist() {
-        std::vector<std::string> russia_ips = {
+        static constexpr const char* russia_ips[] = {
             // Яндекс DNS
             "77.88.8.8", "77.88.8.9", "77.88.8.10", "77.88.8.11",
             
@@ -568,51 +714,93 @@ private:
             "87.250.250.242", "87.250.250.243", "87.250.250.244", "87.250.250.245"
         };
         
-        for (const auto& ip : russia_ips) {
-            whitelist_ips_.insert(ip);
+        for (const char* ip : russia_ips) {
+            AddToWhitelistLocked(ip);
         }
     }
     
-    bool ApplyWhitelistMasking(ByteArray& data) {
-        std::string content(data.begin(), data.end());
-        std::string original_content = content;
+    void AddToWhitelistLocked(std::string_view ip) {
+        auto it = std::lower_bound(sorted_ips_.begin(), sorted_ips_.end(), ip);
+        if (it == sorted_ips_.end() || *it != ip) {
+            whitelist_ips_.emplace_back(ip);
+            sorted_ips_.insert(it, whitelist_ips_.back());
+        }
+    }
+    
+    bool IsIpWhitelistedLocked(std::string_view ip) const {
+        return std::binary_search(sorted_ips_.begin(), sorted_ips_.end(), ip);
+    }
+    
+    // Неразрешенные IP заменяются случайными из белого списка правками в
+    // edits; разрешенные остаются как есть. Адреса ищутся одним проходом
+    // без regex, как прежний шаблон
+    // \b((25[0-5]|2[0-4][0-9]|[01]?[0-9][0-9]?)\.){3}(25[0-5]|...)\b
+    bool ApplyWhitelistMasking(std::string_view text, PayloadEdits& edits) {
+        std::lock_guard<std::mutex> lock(whitelist_mutex_);
+        bool masked = false;
         
-        // Простой regex для поиска IP адресов
-        std::regex ip_pattern(R"(\b(?:(?:25[0-5]|2[0-4][0-9]|[01]?[0-9][0-9]?)\.){3}(?:25[0-5]|2[0-4][0-9]|[01]?[0-9][0-9]?)\b)");
+        for (size_t pos = 0; pos < text.size();) {
+            size_t end = MatchIpv4(text, pos);
+            if (end == std::string_view::npos) {
+                ++pos;
+                continue;
+            }
+            
+            std::string_view ip = text.substr(pos, end - pos);
+            if (!IsIpWhitelistedLocked(ip)) {
+                std::string_view masked_ip = GenerateMaskedIpFromWhitelistLocked();
+                if (edits.Add(pos, ip.size(), masked_ip)) {
+                    masked = true;
+                }
+            }
+            pos = end;
+        }
         
-        std::sregex_iterator begin(content.begin(), content.end(), ip_pattern);
-        std::sregex_iterator end;
+        return masked;
+    }
+    
+    // Конец адреса IPv4, начинающегося с pos, или npos: четыре октета по
+    // 1-3 цифры со значением не больше 255 через точку, слева и справа -
+    // граница слова (как \b: символ не из [A-Za-z0-9_] или край данных)
+    static size_t MatchIpv4(std::string_view text, size_t pos) {
+        if (text[pos] < '0' || text[pos] > '9' || (pos > 0 && IsWordByte(static_cast<uint8_t>(text[pos - 1])))) {
+            return std::string_view::npos;
+        }
         
-        for (auto it = begin; it != end; ++it) {
-            std::string ip = it->str();
-            if (!IsIpWhitelisted(ip)) {
-                std::string masked_ip = GenerateMaskedIpFromWhitelist();
-                size_t pos = content.find(ip);
-                if (pos != std::string::npos) {
-                    content.replace(pos, ip.length(), masked_ip);
+        for (int octet = 0; octet < 4; ++octet) {
+            if (octet > 0) {
+                if (pos >= text.size() || text[pos] != '.') {
+                    return std::string_view::npos;
                 }
+                ++pos;
+            }
+            
+            size_t digits = 0;
+            unsigned value = 0;
+            while (pos + digits < text.size() && digits < 4 && text[pos + digits] >= '0' && text[pos + digits] <= '9') {
+                value = value * 10 + unsigned(text[pos + digits] - '0');
+                ++digits;
+            }
+            if (digits == 0 || digits > 3 || value > 255) {
+                return std::string_view::npos;
             }
+            pos += digits;
         }
         
-        if (original_content != content) {
-            data.assign(content.begin(), content.end());
-            return true;
+        if (pos < text.size() && IsWordByte(static_cast<uint8_t>(text[pos]))) {
+            return std::string_view::npos;
         }
-        
-        return false;
+        return pos;
     }
     
-    std::string GenerateMaskedIpFromWhitelist() const {
-        std::lock_guard<std::mutex> lock(whitelist_mutex_);
+    static bool IsWordByte(uint8_t c) {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+    }
+    
+    std::string_view GenerateMaskedIpFromWhitelistLocked() const {
         if (whitelist_ips_.empty()) return "77.88.8.8";
         
-        static std::random_device rd;
-        static std::mt19937 gen(rd());
-        std::uniform_int_distribution<> dis(0, whitelist_ips_.size() - 1);
-        
-        auto it = whitelist_ips_.begin();
-        std::advance(it, dis(gen));
-        return *it;
+        return whitelist_ips_[RandomSource::ForCurrentThread().Bounded(whitelist_ips_.size())];
     }
 };
 
@@ -622,20 +810,23 @@ public:
     VlessMasker() : BaseSignatureProcessor("vless_masker") {
         // VLESS специфичные паттерны
         AddPattern("vless://");
-        AddPattern("\\x00\\x00\\x00\\x00");  // VLESS UUID pattern
-        AddPattern("\\x01\\x00\\x00\\x00");  // VLESS command pattern
+        AddBinarySignature("00 01-03 +18");  // заголовок VLESS: версия 0, команда TCP/UDP/MUX
         AddKeyword("vless");
         AddKeyword("xtls");
         AddKeyword("reality");
         AddKeyword("vision");
     }
     
+    ProtocolMask GetHandledProtocols() const override {
+        return ProtocolBit(ProtocolClass::VLESS) | kProxyTextProtocols;
+    }
+    
     bool ProcessPacket(Packet& packet) override {
-        if (!IsActive() || !CheckSignature(packet.data)) {
+        if (!IsActive() || !CheckSignature(packet)) {
             return false;
         }
         
-        return ProcessVlessTraffic(packet.data);
+        return ProcessVlessTraffic(packet);
     }
     
 private:
@@ -657,21 +848,21 @@ private:
         "550e8400-e29b-41d4-a716-446655440008"   // Gismeteo UUID
     };
     
-    bool ProcessVlessTraffic(ByteArray& data) {
+    bool ProcessVlessTraffic(Packet& packet) {
         // Определяем тип VLESS трафика
-        VlessType vless_type = DetectVlessType(data);
+        VlessType vless_type = DetectVlessType(packet.data);
         
         switch (vless_type) {
             case VlessType::VLESS_PROTOCOL:
-                return MaskVlessProtocol(data);
+                return MaskVlessProtocol(packet.data, packet.payload_checksum);
             case VlessType::VLESS_XTLS:
-                return MaskVlessXtls(data);
+                return MaskVlessXtls(packet);
             case VlessType::VLESS_REALITY:
-                return MaskVlessReality(data);
+                return MaskVlessReality(packet);
             case VlessType::VLESS_VISION:
-                return MaskVlessVision(data);
+                return MaskVlessVision(packet.data, packet.payload_checksum);
             default:
-                return MaskGenericVless(data);
+                return MaskGenericVless(packet);
         }
     }
     
@@ -683,7 +874,7 @@ private:
         UNKNOWN
     };
     
-    VlessType DetectVlessType(const ByteArray& data) {
+    VlessType DetectVlessType(const PacketBuffer& data) {
         if (data.size() < 4) return VlessType::UNKNOWN;
         
         // Проверяем VLESS заголовок
@@ -702,83 +893,70 @@ private:
         }
         
         // Проверяем на REALITY паттерны
-        std::string content(data.begin(), data.end());
-        if (content.find("reality") != std::string::npos) {
+        PacketView content(data);
+        if (content.Contains("reality")) {
             return VlessType::VLESS_REALITY;
         }
         
         // Проверяем на Vision паттерны
-        if (content.find("vision") != std::string::npos) {
+        if (content.Contains("vision")) {
             return VlessType::VLESS_VISION;
         }
         
         return VlessType::UNKNOWN;
     }
     
-    bool MaskVlessProtocol(ByteArray& data) {
+    bool MaskVlessProtocol(PacketBuffer& data, ChecksumDelta& checksum) {
         if (data.size() < 20) return false;
         
-        // Маскируем UUID (байты 1-16)
-        MaskVlessUuid(data, 1);
+        // Маскируем UUID (байты 1-16); изменения полей учитываются в
+        // checksum payload
+        MaskVlessUuid(data, 1, checksum);
         
         // Маскируем команду и порт
         if (data.size() > 17) {
-            data[17] = VLESS_COMMAND_TCP;  // Принудительно TCP
+            RewriteBytes(data.MutableData(), 17, &VLESS_COMMAND_TCP, 1, checksum);  // Принудительно TCP
         }
         
         return true;
     }
     
-    bool MaskVlessXtls(ByteArray& data) {
+    bool MaskVlessXtls(Packet& packet) {
         // Маскируем XTLS поток как обычный HTTPS
-        std::string content(data.begin(), data.end());
-        bool modified = false;
-        
         // Заменяем XTLS паттерны на HTTPS
-        std::vector<std::pair<std::string, std::string>> xtls_replacements = {
+        static const ReplacementTable xtls_replacements = {
             {"xtls", "https"},
             {"XTLS", "HTTPS"},
             {"xtls-rprx-vision", "https-tls"},
             {"xtls-rprx-direct", "https-direct"}
         };
         
-        for (const auto& [xtls_pattern, https_replacement] : xtls_replacements) {
-            size_t pos = content.find(xtls_pattern);
-            if (pos != std::string::npos) {
-                content.replace(pos, xtls_pattern.length(), https_replacement);
-                modified = true;
-            }
-        }
-        
-        if (modified) {
-            data.assign(content.begin(), content.end());
-            return true;
-        }
-        
-        return false;
+        return ApplyReplacements(packet, xtls_replacements) > 0;
     }
     
-    bool MaskVlessReality(ByteArray& data) {
+    bool MaskVlessReality(Packet& packet) {
         // Маскируем REALITY как обычный TLS handshake
-        if (data.size() < 5) return false;
+        if (packet.data.size() < 5) return false;
         
         // Заменяем REALITY заголовок на стандартный TLS
-        data[0] = 0x16;  // TLS Handshake
-        data[1] = 0x03;  // TLS version major
-        data[2] = 0x03;  // TLS version minor (1.2)
+        static constexpr uint8_t tls_header[] = {
+            0x16,        // TLS Handshake
+            0x03, 0x03   // TLS version 1.2
+        };
+        RewriteBytes(packet.data.MutableData(), 0, tls_header, sizeof(tls_header), packet.payload_checksum);
         
         // Маскируем остальные данные как TLS payload
-        MaskTlsPayload(data, 5);
+        MaskTlsPayload(packet, 5);
         
         return true;
     }
     
-    bool MaskVlessVision(ByteArray& data) {
+    bool MaskVlessVision(PacketBuffer& data, ChecksumDelta& checksum) {
         // Маскируем Vision как стандартный TLS поток
         if (data.size() < 10) return false;
         
         // Создаем поддельный TLS ClientHello
-        ByteArray fake_tls = {
+        static constexpr uint8_t fake_tls[] = {
             0x16, 0x03, 0x03, 0x00, 0x4a,  // TLS Handshake header
             0x01, 0x00, 0x00, 0x46, 0x03,  // ClientHello
             0x03, 0x12, 0x34, 0x56, 0x78,  // Random
@@ -799,52 +977,38 @@ private:
         };
         
         // Заменяем начало данных на поддельный TLS
-        size_t replace_size = std::min(fake_tls.size(), data.size());
-        for (size_t i = 0; i < replace_size; ++i) {
-            data[i] = fake_tls[i];
-        }
+        size_t replace_size = std::min(sizeof(fake_tls), data.size());
+        RewriteBytes(data.MutableData(), 0, fake_tls, replace_size, checksum);
         
         return true;
     }
     
-    bool MaskGenericVless(ByteArray& data) {
-        // Общая маскировка VLESS трафика
-        static std::random_device rd;
-        static std::mt19937 gen(rd());
-        std::uniform_int_distribution<uint8_t> dis(0, 255);
-        
-        // Маскируем случайными байтами, сохраняя первые 4 байта
-        for (size_t i = 4; i < data.size(); ++i) {
-            if (i % 3 == 0) {  // Маскируем каждый третий байт
-                data[i] = dis(gen);
-            }
+    bool MaskGenericVless(Packet& packet) {
+        // Общая маскировка VLESS трафика: случайный каждый третий байт
+        // (позиции 6, 9, 12...), первые 4 байта сохраняются
+        if (packet.data.size() > 6) {
+            FillPayloadRandom(packet, 6, packet.data.size() - 6, 3);
         }
         
         return true;
     }
     
-    void MaskVlessUuid(ByteArray& data, size_t offset) {
+    void MaskVlessUuid(PacketBuffer& data, size_t offset, ChecksumDelta& checksum) {
         if (offset + 16 > data.size()) return;
         
         // Выбираем случайный российский UUID
-        static std::random_device rd;
-        static std::mt19937 gen(rd());
-        std::uniform_int_distribution<> dis(0, russia_uuids_.size() - 1);
-        
-        std::string selected_uuid = russia_uuids_[dis(gen)];
+        const std::string& selected_uuid = russia_uuids_[RandomSource::ForCurrentThread().Bounded(russia_uuids_.size())];
         
         // Конвертируем UUID в байты (упрощенная версия)
-        std::vector<uint8_t> uuid_bytes = ConvertUuidToBytes(selected_uuid);
+        std::array<uint8_t, 16> uuid_bytes = ConvertUuidToBytes(selected_uuid);
         
         // Заменяем UUID в данных
-        for (size_t i = 0; i < 16 && offset + i < data.size(); ++i) {
-            data[offset + i] = uuid_bytes[i];
-        }
+        RewriteBytes(data.MutableData(), offset, uuid_bytes.data(), uuid_bytes.size(), checksum);
     }
     
-    std::vector<uint8_t> ConvertUuidToBytes(const std::string& uuid) {
+    std::array<uint8_t, 16> ConvertUuidToBytes(const std::string& uuid) {
         // Упрощенная конвертация UUID в байты
-        std::vector<uint8_t> bytes(16);
+        std::array<uint8_t, 16> bytes;
         
         // Генерируем детерминированные байты на основе UUID
         std::hash<std::string> hasher;
@@ -857,17 +1021,11 @@ private:
         return bytes;
     }
     
-    void MaskTlsPayload(ByteArray& data, size_t offset) {
-        if (offset >= data.size()) return;
-        
-        static std::random_device rd;
-        static std::mt19937 gen(rd());
-        std::uniform_int_distribution<uint8_t> dis(0, 255);
+    void MaskTlsPayload(Packet& packet, size_t offset) {
+        if (offset >= packet.data.size()) return;
         
         // Маскируем TLS payload случайными байтами
-        for (size_t i = offset; i < data.size(); ++i) {
-            data[i] = dis(gen);
-        }
+        FillPayloadRandom(packet, offset, packet.data.size() - offset);
     }
 };
 
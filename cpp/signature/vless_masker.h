@@ -1,10 +1,12 @@
 #pragma once
 
 #include "trafficmask.h"
+#include "byte_search.h"
+#include "replacement_table.h"
 #include <unordered_map>
 #include <vector>
-#include <random>
 #include <array>
+#include <string_view>
 
 namespace TrafficMask {
 
@@ -14,20 +16,23 @@ public:
     VlessMasker() : BaseSignatureProcessor("vless_masker") {
         // VLESS специфичные паттерны
         AddPattern("vless://");
-        AddPattern("\\x00\\x00\\x00\\x00");  // VLESS UUID pattern
-        AddPattern("\\x01\\x00\\x00\\x00");  // VLESS command pattern
+        AddBinarySignature("00 01-03 +18");  // заголовок VLESS: версия 0, команда TCP/UDP/MUX
         AddKeyword("vless");
         AddKeyword("xtls");
         AddKeyword("reality");
         AddKeyword("vision");
     }
     
+    ProtocolMask GetHandledProtocols() const override {
+        return ProtocolBit(ProtocolClass::VLESS) | kProxyTextProtocols;
+    }
+    
     bool ProcessPacket(Packet& packet) override {
-        if (!IsActive() || !CheckSignature(packet.data)) {
+        if (!IsActive() || !CheckSignature(packet)) {
             return false;
         }
         
-        return ProcessVlessTraffic(packet.data);
+        return ProcessVlessTraffic(packet);
     }
     
 private:
@@ -49,21 +54,21 @@ private:
         "550e8400-e29b-41d4-a716-446655440008"   // Gismeteo UUID
     };
     
-    bool ProcessVlessTraffic(ByteArray& data) {
+    bool ProcessVlessTraffic(Packet& packet) {
         // Определяем тип VLESS трафика
-        VlessType vless_type = DetectVlessType(data);
+        VlessType vless_type = DetectVlessType(packet.data);
         
         switch (vless_type) {
             case VlessType::VLESS_PROTOCOL:
-                return MaskVlessProtocol(data);
+                return MaskVlessProtocol(packet.data, packet.payload_checksum);
             case VlessType::VLESS_XTLS:
-                return MaskVlessXtls(data);
+                return MaskVlessXtls(packet);
             case VlessType::VLESS_REALITY:
-                return MaskVlessReality(data);
+                return MaskVlessReality(packet);
             case VlessType::VLESS_VISION:
-                return MaskVlessVision(data);
+                return MaskVlessVision(packet.data, packet.payload_checksum);
             default:
-                return MaskGenericVless(data);
+                return MaskGenericVless(packet);
         }
     }
     
@@ -75,7 +80,7 @@ private:
         UNKNOWN
     };
     
-    VlessType DetectVlessType(const ByteArray& data) {
+    VlessType DetectVlessType(const PacketBuffer& data) {
         if (data.size() < 4) return VlessType::UNKNOWN;
         
         // Проверяем VLESS заголовок
@@ -106,84 +111,67 @@ private:
         return VlessType::UNKNOWN;
     }
     
-    bool ContainsRealityPattern(const ByteArray& data) {
-        std::string content(data.begin(), data.end());
-        return content.find("reality") != std::string::npos ||
-               content.find("REALITY") != std::string::npos ||
-               content.find("xtls-rprx-vision") != std::string::npos;
+    bool ContainsRealityPattern(const PacketBuffer& data) {
+        static const NeedleSet patterns = {"reality", "REALITY", "xtls-rprx-vision"};
+        return patterns.ContainsAny(PacketView(data).Text());
     }
     
-    bool ContainsVisionPattern(const ByteArray& data) {
-        std::string content(data.begin(), data.end());
-        return content.find("vision") != std::string::npos ||
-               content.find("VISION") != std::string::npos ||
-               content.find("xtls-rprx-vision") != std::string::npos;
+    bool ContainsVisionPattern(const PacketBuffer& data) {
+        static const NeedleSet patterns = {"vision", "VISION", "xtls-rprx-vision"};
+        return patterns.ContainsAny(PacketView(data).Text());
     }
     
-    bool MaskVlessProtocol(ByteArray& data) {
+    bool MaskVlessProtocol(PacketBuffer& data, ChecksumDelta& checksum) {
         if (data.size() < 20) return false;
         
-        // Маскируем UUID (байты 1-16)
-        MaskVlessUuid(data, 1);
+        // Маскируем UUID (байты 1-16); изменения полей учитываются в
+        // checksum payload
+        MaskVlessUuid(data, 1, checksum);
         
         // Маскируем команду и порт
         if (data.size() > 17) {
-            data[17] = VLESS_COMMAND_TCP;  // Принудительно TCP
+            RewriteBytes(data.MutableData(), 17, &VLESS_COMMAND_TCP, 1, checksum);  // Принудительно TCP
         }
         
         return true;
     }
     
-    bool MaskVlessXtls(ByteArray& data) {
+    bool MaskVlessXtls(Packet& packet) {
         // Маскируем XTLS поток как обычный HTTPS
-        std::string content(data.begin(), data.end());
-        bool modified = false;
-        
         // Заменяем XTLS паттерны на HTTPS
-        std::vector<std::pair<std::string, std::string>> xtls_replacements = {
+        static const ReplacementTable xtls_replacements = {
             {"xtls", "https"},
             {"XTLS", "HTTPS"},
             {"xtls-rprx-vision", "https-tls"},
             {"xtls-rprx-direct", "https-direct"}
         };
         
-        for (const auto& [xtls_pattern, https_replacement] : xtls_replacements) {
-            size_t pos = content.find(xtls_pattern);
-            if (pos != std::string::npos) {
-                content.replace(pos, xtls_pattern.length(), https_replacement);
-                modified = true;
-            }
-        }
-        
-        if (modified) {
-            data.assign(content.begin(), content.end());
-            return true;
-        }
-        
-        return false;
+        return ApplyReplacements(packet, xtls_replacements) > 0;
     }
     
-    bool MaskVlessReality(ByteArray& data) {
+    bool MaskVlessReality(Packet& packet) {
         // Маскируем REALITY как обычный TLS handshake
-        if (data.size() < 5) return false;
+        if (packet.data.size() < 5) return false;
         
         // Заменяем REALITY заголовок на стандартный TLS
-        data[0] = 0x16;  // TLS Handshake
-        data[1] = 0x03;  // TLS version major
-        data[2] = 0x03;  // TLS version minor (1.2)
+        static constexpr uint8_t tls_header[] = {
+            0x16,        // TLS Handshake
+            0x03, 0x03   // TLS version 1.2
+        };
+        RewriteBytes(packet.data.MutableData(), 0, tls_header, sizeof(tls_header), packet.payload_checksum);
         
         // Маскируем остальные данные как TLS payload
-        MaskTlsPayload(data, 5);
+        MaskTlsPayload(packet, 5);
         
         return true;
     }
     
-    bool MaskVlessVision(ByteArray& data) {
+    bool MaskVlessVision(PacketBuffer& data, ChecksumDelta& checksum) {
         // Маскируем Vision как стандартный TLS поток
         if (data.size() < 10) return false;
         
         // Создаем поддельный TLS ClientHello
-        ByteArray fake_tls = {
+        static constexpr uint8_t fake_tls[] = {
             0x16, 0x03, 0x03, 0x00, 0x4a,  // TLS Handshake header
             0x01, 0x00, 0x00, 0x46, 0x03,  // ClientHello
             0x03, 0x12, 0x34, 0x56, 0x78,  // Random
@@ -204,52 +192,38 @@ private:
         };
         
         // Заменяем начало данных на поддельный TLS
-        size_t replace_size = std::min(fake_tls.size(), data.size());
-        for (size_t i = 0; i < replace_size; ++i) {
-            data[i] = fake_tls[i];
-        }
+        size_t replace_size = std::min(sizeof(fake_tls), data.size());
+        RewriteBytes(data.MutableData(), 0, fake_tls, replace_size, checksum);
         
         return true;
     }
     
-    bool MaskGenericVless(ByteArray& data) {
-        // Общая маскировка VLESS трафика
-        static std::random_device rd;
-        static std::mt19937 gen(rd());
-        std::uniform_int_distribution<uint8_t> dis(0, 255);
-        
-        // Маскируем случайными байтами, сохраняя первые 4 байта
-        for (size_t i = 4; i < data.size(); ++i) {
-            if (i % 3 == 0) {  // Маскируем каждый третий байт
-                data[i] = dis(gen);
-            }
+    bool MaskGenericVless(Packet& packet) {
+        // Общая маскировка VLESS трафика: случайный каждый третий байт
+        // (позиции 6, 9, 12...), первые 4 байта сохраняются
+        if (packet.data.size() > 6) {
+            FillPayloadRandom(packet, 6, packet.data.size() - 6, 3);
         }
         
         return true;
     }
     
-    void MaskVlessUuid(ByteArray& data, size_t offset) {
+    void MaskVlessUuid(PacketBuffer& data, size_t offset, ChecksumDelta& checksum) {
         if (offset + 16 > data.size()) return;
         
         // Выбираем случайный российский UUID
-        static std::random_device rd;
-        static std::mt19937 gen(rd());
-        std::uniform_int_distribution<> dis(0, russia_uuids_.size() - 1);
-        
-        std::string selected_uuid = russia_uuids_[dis(gen)];
+        const std::string& selected_uuid = russia_uuids_[RandomSource::ForCurrentThread().Bounded(russia_uuids_.size())];
         
         // Конвертируем UUID в байты (упрощенная версия)
-        std::vector<uint8_t> uuid_bytes = ConvertUuidToBytes(selected_uuid);
+        std::array<uint8_t, 16> uuid_bytes = ConvertUuidToBytes(selected_uuid);
         
         // Заменяем UUID в данных
-        for (size_t i = 0; i < 16 && offset + i < data.size(); ++i) {
-            data[offset + i] = uuid_bytes[i];
-        }
+        RewriteBytes(data.MutableData(), offset, uuid_bytes.data(), uuid_bytes.size(), checksum);
     }
     
-    std::vector<uint8_t> ConvertUuidToBytes(const std::string& uuid) {
+    std::array<uint8_t, 16> ConvertUuidToBytes(const std::string& uuid) {
         // Упрощенная конвертация UUID в байты
-        std::vector<uint8_t> bytes(16);
+        std::array<uint8_t, 16> bytes;
         
         // Генерируем детерминированные байты на основе UUID
         std::hash<std::string> hasher;
@@ -262,17 +236,11 @@ private:
         return bytes;
     }
     
-    void MaskTlsPayload(ByteArray& data, size_t offset) {
-        if (offset >= data.size()) return;
-        
-        static std::random_device rd;
-        static std::mt19937 gen(rd());
-        std::uniform_int_distribution<uint8_t> dis(0, 255);
+    void MaskTlsPayload(Packet& packet, size_t offset) {
+        if (offset >= packet.data.size()) return;
         
         // Маскируем TLS payload случайными байтами
-        for (size_t i = offset; i < data.size(); ++i) {
-            data[i] = dis(gen);
-        }
+        FillPayloadRandom(packet, offset, packet.data.size() - offset);
     }
 };
 
@@ -281,27 +249,28 @@ class VlessProxyMasker : public BaseSignatureProcessor {
 public:
     VlessProxyMasker() : BaseSignatureProcessor("vless_proxy_masker") {
         AddPattern("vless://.*@.*:.*");
-        AddPattern("\\x00\\x00\\x00\\x00.*\\x01\\x00\\x00\\x00");
+        AddBinarySignature("00 01-03 +18");  // заголовок VLESS
         AddKeyword("proxy");
         AddKeyword("socks");
         AddKeyword("http");
     }
     
+    ProtocolMask GetHandledProtocols() const override {
+        return kProxyTextProtocols;
+    }
+    
     bool ProcessPacket(Packet& packet) override {
-        if (!IsActive() || !CheckSignature(packet.data)) {
+        if (!IsActive() || !CheckSignature(packet)) {
             return false;
         }
         
-        return MaskVlessProxy(packet.data);
+        return MaskVlessProxy(packet);
     }
     
 private:
-    bool MaskVlessProxy(ByteArray& data) {
-        std::string content(data.begin(), data.end());
-        bool modified = false;
-        
+    bool MaskVlessProxy(Packet& packet) {
         // Заменяем VLESS прокси на российские сервисы
-        std::vector<std::pair<std::::string, std::string>> proxy_replacements = {
+        static const ReplacementTable proxy_replacements = {
             {"vless://", "https://"},
             {"@", "@mail.ru:"},
             {":443", ":443"},
@@ -311,20 +280,7 @@ private:
             {"&path=/", "&path=/api/"}
         };
         
-        for (const auto& [vless_pattern, russia_replacement] : proxy_replacements) {
-            size_t pos = content.find(vless_pattern);
-            if (pos != std::string::npos) {
-                content.replace(pos, vless_pattern.length(), russia_replacement);
-                modified = true;
-            }
-        }
-        
-        if (modified) {
-            data.assign(content.begin(), content.end());
-            return true;
-        }
-        
-        return false;
+        return ApplyReplacements(packet, proxy_replacements) > 0;
     }
 };
 
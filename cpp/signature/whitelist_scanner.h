@@ -81,6 +81,11 @@ public:
         AddPattern("\\d+\\.\\d+\\.\\d+\\.\\d+");
     }
     
+    ProtocolMask GetHandledProtocols() const override {
+        return kHttpProtocols |
+               ProtocolBit(ProtocolClass::UNKNOWN);
+    }
+    
     bool ProcessPacket(Packet& packet) override {
         if (!IsActive()) return false;
         
@@ -123,29 +128,33 @@ private:
     
     bool ApplyWhitelistMasking(Packet& packet) {
         // Извлекаем IP адреса из пакета
-        std::vector<std::string> ips = ExtractIpsFromPacket(packet.data);
+        ScratchVector<std::string> ips = ExtractIpsFromPacket(packet.data);
         
+        // Замены меняют длину: checksum восстанавливается по сумме payload
+        // до первой замены и после последней
+        ChecksumFixup local;
         bool masked = false;
         for (const std::string& ip : ips) {
             if (!scanner_->IsIpWhitelisted(ip)) {
-                if (MaskIpInPacket(packet.data, ip)) {
+                if (MaskIpInPacket(packet, ip, local)) {
                     masked = true;
                 }
             }
         }
+        ApplyLocalChecksumFixup(packet, local);
         
         return masked;
     }
     
-    std::vector<std::string> ExtractIpsFromPacket(const ByteArray& data) {
-        std::vector<std::string> ips;
-        std::string content(data.begin(), data.end());
+    ScratchVector<std::string> ExtractIpsFromPacket(const PacketBuffer& data) {
+        ScratchVector<std::string> ips;
+        std::string_view content = PacketView(data).Text();
         
         // Простой regex для поиска IP адресов
-        std::regex ip_pattern(R"(\b(?:(?:25[0-5]|2[0-4][0-9]|[01]?[0-9][0-9]?)\.){3}(?:25[0-5]|2[0-4][0-9]|[01]?[0-9][0-9]?)\b)");
+        static const std::regex ip_pattern(R"(\b(?:(?:25[0-5]|2[0-4][0-9]|[01]?[0-9][0-9]?)\.){3}(?:25[0-5]|2[0-4][0-9]|[01]?[0-9][0-9]?)\b)");
         
-        std::sregex_iterator begin(content.begin(), content.end(), ip_pattern);
-        std::sregex_iterator end;
+        std::cregex_iterator begin(content.data(), content.data() + content.size(), ip_pattern);
+        std::cregex_iterator end;
         
         for (auto it = begin; it != end; ++it) {
             ips.push_back(it->str());
@@ -154,18 +163,15 @@ private:
         return ips;
     }
     
-    bool MaskIpInPacket(ByteArray& data, const std::string& ip) {
-        std::string content(data.begin(), data.end());
-        std::string original_content = content;
-        
+    bool MaskIpInPacket(Packet& packet, const std::string& ip, ChecksumFixup& local) {
         // Заменяем неразрешенный IP на случайный из белого списка
         std::string masked_ip = GenerateMaskedIpFromWhitelist();
         
-        size_t pos = content.find(ip);
-        if (pos != std::string::npos) {
-            content.replace(pos, ip.length(), masked_ip);
-            data.assign(content.begin(), content.end());
-            return original_content != content;
+        size_t pos = PacketView(packet.data).Find(ip);
+        if (pos != PacketView::npos) {
+            PendingChecksumFixup(packet, local).RequestPayload(packet.data, packet.payload_checksum);
+            packet.data.Replace(pos, ip.length(), masked_ip);
+            return masked_ip != ip;
         }
         
         return false;
@@ -180,11 +186,7 @@ private:
             "31.31.31.31"  // VK
         };
         
-        static std::random_device rd;
-        static std::mt19937 gen(rd());
-        std::uniform_int_distribution<> dis(0, fallback_ips.size() - 1);
-        
-        return fallback_ips[dis(gen)];
+        return fallback_ips[RandomSource::ForCurrentThread().Bounded(fallback_ips.size())];
     }
 };
 
@@ -40,10 +40,47 @@ bool TrafficProcessor::ProcessOutgoing(Packet& packet) {
     return true;
 }
 
+size_t TrafficProcessor::ProcessBatch(Packet* packets, size_t count) {
+    if (!IsRunning()) {
+        return 0;
+    }
+    
+    size_t incoming = 0;
+    {
+        std::lock_guard<std::mutex> lock(incoming_mutex_);
+        for (size_t i = 0; i < count; ++i) {
+            if (packets[i].is_incoming) {
+                incoming_queue_.push(packets[i]);
+                ++incoming;
+            }
+        }
+    }
+    
+    if (incoming != count) {
+        std::lock_guard<std::mutex> lock(outgoing_mutex_);
+        for (size_t i = 0; i < count; ++i) {
+            if (!packets[i].is_incoming) {
+                outgoing_queue_.push(packets[i]);
+            }
+        }
+    }
+    
+    if (incoming != 0) {
+        incoming_cv_.notify_all();
+    }
+    if (incoming != count) {
+        outgoing_cv_.notify_all();
+    }
+    
+    return count;
+}
+
 void TrafficProcessor::RegisterSignatureProcessor(std::shared_ptr<ISignatureProcessor> processor) {
     if (processor && processor->IsActive()) {
-        signature_processors_.push_back(processor);
-        std::cout << "Registered signature processor: " << processor->GetSignatureId() << std::endl;
+        SignatureId signature_id = processor->GetSignatureId();
+        ProtocolMask protocols = processor->GetHandledProtocols();
+        signature_processors_.Add(std::move(processor), protocols);
+        std::cout << "Registered signature processor: " << signature_id << std::endl;
     }
 }
 
@@ -91,64 +128,71 @@ void TrafficProcessor::Stop() {
 }
 
 void TrafficProcessor::WorkerThread() {
+    // Буферы пачки живут все время работы потока и переиспользуются
+    std::vector<Packet> packets;
+    PacketBatch batch;
+    packets.reserve(kWorkerBatchSize);
+    
     while (is_running_.load()) {
-        Packet packet;
-        bool has_packet = false;
-        
-        // Проверяем входящие пакеты
-        {
-            std::unique_lock<std::mutex> lock(incoming_mutex_);
-            if (incoming_cv_.wait_for(lock, std::chrono::milliseconds(100), 
-                [this] { return !incoming_queue_.empty() || !is_running_.load(); })) {
-                
-                if (!incoming_queue_.empty()) {
-                    packet = incoming_queue_.front();
-                    incoming_queue_.pop();
-                    has_packet = true;
-                }
-            }
-        }
+        packets.clear();
         
-        // Если нет входящих, проверяем исходящие
-        if (!has_packet) {
-            std::unique_lock<std::mutex> lock(outgoing_mutex_);
-            if (outgoing_cv_.wait_for(lock, std::chrono::milliseconds(100), 
-                [this] { return !outgoing_queue_.empty() || !is_running_.load(); })) {
-                
-                if (!outgoing_queue_.empty()) {
-                    packet = outgoing_queue_.front();
-                    outgoing_queue_.pop();
-                    has_packet = true;
-                }
-            }
+        // Проверяем входящие пакеты, если нет - исходящие
+        if (!DequeueBatch(incoming_queue_, incoming_mutex_, incoming_cv_, packets)) {
+            DequeueBatch(outgoing_queue_, outgoing_mutex_, outgoing_cv_, packets);
         }
         
-        // Обрабатываем пакет
-        if (has_packet) {
-            ProcessPacketInternal(packet);
+        // Обрабатываем пачку
+        if (!packets.empty()) {
+            ProcessBatchInternal(packets, batch);
         }
     }
 }
 
-bool TrafficProcessor::ProcessPacketInternal(Packet& packet) {
-    processed_count_.fetch_add(1);
+bool TrafficProcessor::DequeueBatch(std::queue<Packet>& queue, std::mutex& mutex,
+                                    std::condition_variable& cv, std::vector<Packet>& packets) {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (!cv.wait_for(lock, std::chrono::milliseconds(100), 
+        [this, &queue] { return !queue.empty() || !is_running_.load(); })) {
+        return false;
+    }
     
-    bool was_masked = false;
+    while (!queue.empty() && packets.size() < kWorkerBatchSize) {
+        packets.push_back(std::move(queue.front()));
+        queue.pop();
+    }
     
-    // Применяем все активные процессоры сигнатур
-    for (auto& processor : signature_processors_) {
-        if (processor && processor->IsActive()) {
-            if (processor->ProcessPacket(packet)) {
-                was_masked = true;
-            }
+    return !packets.empty();
+}
+
+void TrafficProcessor::ProcessBatchInternal(std::vector<Packet>& packets, PacketBatch& batch) {
+    processed_count_.fetch_add(packets.size());
+    
+    // Очередь не разделена на шарды - вся пачка идет одной группой
+    batch.Assign(packets.data(), packets.size(), 1);
+    batch.Classify(0, batch.Size());
+    
+    // Применяем все активные процессоры сигнатур; временные данные
+    // процессора освобождаются откатом арены рабочего потока.
+    // Состояния потоков здесь нет, поэтому пакеты отбираются только по классу
+    ScratchArena& arena = ScratchArena::ForCurrentThread();
+    ProcessorRegistry::Snapshot processors(signature_processors_);
+    size_t index = 0;
+    for (const ProcessorStage& stage : processors) {
+        size_t stage_index = index++;
+        if (batch.SelectForStage(0, batch.Size(), stage_index, stage.protocols) &&
+            stage.processor->IsActive()) {
+            ScratchArena::Scope scratch(arena);
+            stage.processor->ProcessBatch(batch);
+            batch.RefreshPayloads();
+            batch.CollectMasked(stage_index);
         }
     }
     
-    if (was_masked) {
-        masked_count_.fetch_add(1);
-    }
+    size_t masked = batch.CountMasked(0, batch.Size());
     
-    return true;
+    if (masked != 0) {
+        masked_count_.fetch_add(masked);
+    }
 }
 
 } // namespace TrafficMask
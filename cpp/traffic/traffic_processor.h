@@ -16,6 +16,11 @@ public:
     bool ProcessOutgoing(Packet& packet) override;
     void RegisterSignatureProcessor(std::shared_ptr<ISignatureProcessor> processor) override;
     
+    // Постановка пачки в очереди одной блокировкой на направление;
+    // рабочие потоки забирают пакеты пачками до kWorkerBatchSize
+    size_t ProcessBatch(Packet* packets, size_t count);
+    size_t ProcessBatch(std::vector<Packet>& packets) { return ProcessBatch(packets.data(), packets.size()); }
+    
     // Управление процессором
     void Start();
     void Stop();
@@ -26,7 +31,10 @@ public:
     size_t GetMaskedCount() const { return masked_count_.load(); }
     
 private:
-    std::vector<std::shared_ptr<ISignatureProcessor>> signature_processors_;
+    static constexpr size_t kWorkerBatchSize = 32;
+    
+    // Регистрация возможна при работающих рабочих потоках (см. ProcessorRegistry)
+    ProcessorRegistry signature_processors_;
     std::queue<Packet> incoming_queue_;
     std::queue<Packet> outgoing_queue_;
     
@@ -42,7 +50,9 @@ private:
     std::vector<std::thread> worker_threads_;
     
     void WorkerThread();
-    bool ProcessPacketInternal(Packet& packet);
+    bool DequeueBatch(std::queue<Packet>& queue, std::mutex& mutex,
+                      std::condition_variable& cv, std::vector<Packet>& packets);
+    void ProcessBatchInternal(std::vector<Packet>& packets, PacketBatch& batch);
 };
 
 } // namespace TrafficMask